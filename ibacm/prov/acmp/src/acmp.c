@@ -38,6 +38,7 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <infiniband/acm.h>
@@ -48,7 +49,6 @@
 #include <infiniband/umad_sa_mcm.h>
 #include <ifaddrs.h>
 #include <dlfcn.h>
-#include <search.h>
 #include <netdb.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -60,6 +60,8 @@
 #include <ccan/list.h>
 #include "acm_util.h"
 #include "acm_mad.h"
+#include "acmp_dest_map.h"
+#include "acm_route_cache.h"
 
 #define IB_LID_MCAST_START 0xc000
 
@@ -90,7 +92,8 @@ enum acmp_loopback_prot {
 
 enum acmp_route_preload {
 	ACMP_ROUTE_PRELOAD_NONE,
-	ACMP_ROUTE_PRELOAD_OSM_FULL_V1
+	ACMP_ROUTE_PRELOAD_OSM_FULL_V1,
+	ACMP_ROUTE_PRELOAD_ROUTE_CACHE
 };
 
 enum acmp_addr_preload {
@@ -99,27 +102,30 @@ enum acmp_addr_preload {
 };
 
 /*
- * Nested locking order: dest -> ep, dest -> port
+ * Nested locking order: dest -> ep, dest -> port.  The locks of the dest map
+ * are taken last.
  */
 struct acmp_ep;
 
+/*
+ * The name of a dest is only formatted when it is logged, see
+ * acmp_dest_name(), to keep the entries of large caches small.
+ */
 struct acmp_dest {
-	uint8_t                address[ACM_MAX_ADDRESS]; /* keep first */
-	char                   name[ACM_MAX_ADDRESS];
+	struct acmp_dest_node  node; /* address and addr_type */
 	struct ibv_ah          *ah;
+	struct acmp_ep         *ep;
 	struct ibv_ah_attr     av;
 	struct ibv_path_record path;
 	union ibv_gid          mgid;
 	__be64                 req_id;
 	struct list_head       req_queue;
-	uint32_t               remote_qpn;
 	pthread_mutex_t        lock;
-	enum acmp_state        state;
-	atomic_t               refcnt;
 	uint64_t	       addr_timeout;
 	uint64_t	       route_timeout;
-	uint8_t                addr_type;
-	struct acmp_ep         *ep;
+	uint32_t               remote_qpn;
+	enum acmp_state        state;
+	atomic_t               refcnt;
 };
 
 struct acmp_device;
@@ -134,6 +140,7 @@ struct acmp_port {
 	enum ibv_mtu        mtu;
 	enum ibv_rate       rate;
 	int                 subnet_timeout;
+	uint8_t             packet_lifetime;
 	uint16_t            default_pkey_ix;
 	uint16_t            lid;
 	uint16_t            lid_mask;
@@ -178,7 +185,7 @@ struct acmp_ep {
 	uint8_t               *recv_bufs;
 	struct list_node      entry;
 	char		      id_string[IBV_SYSFS_NAME_MAX + 11];
-	void                  *dest_map[ACM_ADDRESS_RESERVED - 1];
+	struct acmp_dest_map  dest_map;
 	struct acmp_dest      mc_dest[MAX_EP_MC];
 	int                   mc_cnt;
 	uint16_t              pkey_index;
@@ -287,20 +294,53 @@ static uint8_t min_rate = IBV_RATE_10_GBPS;
 static enum acmp_route_preload route_preload;
 static enum acmp_addr_preload addr_preload;
 
+/*
+ * Mapped route cache file, see acm_route_cache.h.  Dests are filled from the
+ * cache when they are created, instead of allocating all of them at startup.
+ * The file is checked at most once a second, and mapped again once it has
+ * been replaced.  Lookups hold a reference, so the previous mapping stays
+ * valid until they are done.
+ */
+struct acmp_route_cache {
+	void                               *base;
+	size_t                             size;
+	const struct acm_route_cache_port  *ports;
+	const struct acm_route_cache_lid   *lids;
+	const struct acm_route_cache_lid   *guids;
+	const struct acm_route_cache_route *routes;
+	uint32_t                           num_ports;
+	uint32_t                           num_lids;
+	uint32_t                           num_routes;
+	dev_t                              dev;
+	ino_t                              ino;
+	struct timespec                    mtime;
+	atomic_t                           refcnt;
+};
+
+static struct acmp_route_cache *route_cache;
+static pthread_mutex_t route_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t route_cache_checked;
+
 static int acmp_initialized = 0;
 
-static int acmp_compare_dest(const void *dest1, const void *dest2)
+static __thread char dest_name[ACM_MAX_ADDRESS];
+
+/* Formats the name of dest if messages of this level are logged */
+static const char *acmp_dest_name(int level, const struct acmp_dest *dest)
 {
-	return memcmp(dest1, dest2, ACM_MAX_ADDRESS);
+	dest_name[0] = '\0';
+	acm_format_name(level, dest_name, sizeof dest_name,
+			dest->node.addr_type, dest->node.address,
+			ACM_MAX_ADDRESS);
+	return dest_name;
 }
 
 static void
 acmp_set_dest_addr(struct acmp_dest *dest, uint8_t addr_type,
 		   const uint8_t *addr, size_t size)
 {
-	memcpy(dest->address, addr, size);
-	dest->addr_type = addr_type;
-	acm_format_name(0, dest->name, sizeof dest->name, addr_type, addr, size);
+	memcpy(dest->node.address, addr, size);
+	dest->node.addr_type = addr_type;
 }
 
 static void
@@ -328,21 +368,29 @@ acmp_alloc_dest(uint8_t addr_type, const uint8_t *addr)
 	}
 
 	acmp_init_dest(dest, addr_type, addr, ACM_MAX_ADDRESS);
-	acm_log(1, "%s\n", dest->name);
+	acmp_dest_node_init(&dest->node, addr_type, addr);
+	acm_log(1, "%s\n", acmp_dest_name(1, dest));
 	return dest;
 }
 
-/* Caller must hold ep lock. */
+static void acmp_get_dest_node(struct acmp_dest_node *node)
+{
+	struct acmp_dest *dest = container_of(node, struct acmp_dest, node);
+
+	(void) atomic_inc(&dest->refcnt);
+}
+
 static struct acmp_dest *
 acmp_get_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 {
-	struct acmp_dest *dest, **tdest;
+	struct acmp_dest_node *node;
+	struct acmp_dest *dest;
 
-	tdest = tfind(addr, &ep->dest_map[addr_type - 1], acmp_compare_dest);
-	if (tdest) {
-		dest = *tdest;
-		(void) atomic_inc(&dest->refcnt);
-		acm_log(2, "%s\n", dest->name);
+	node = acmp_dest_map_find(&ep->dest_map, addr_type, addr,
+				  acmp_get_dest_node);
+	if (node) {
+		dest = container_of(node, struct acmp_dest, node);
+		acm_log(2, "%s\n", acmp_dest_name(2, dest));
 	} else {
 		dest = NULL;
 		acm_format_name(2, log_data, sizeof log_data,
@@ -355,34 +403,257 @@ acmp_get_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 static void
 acmp_put_dest(struct acmp_dest *dest)
 {
-	acm_log(2, "%s\n", dest->name);
+	acm_log(2, "%s\n", acmp_dest_name(2, dest));
 	if (atomic_dec(&dest->refcnt) == 0) {
 		free(dest);
 	}
 }
 
-/* Caller must hold ep lock. */
+/* Drops the reference of the map, unless another thread removed dest */
 static void
 acmp_remove_dest(struct acmp_ep *ep, struct acmp_dest *dest)
 {
-	acm_log(2, "%s\n", dest->name);
-	if (!tdelete(dest->address, &ep->dest_map[dest->addr_type - 1],
-		     acmp_compare_dest))
-		acm_log(0, "ERROR: %s not found!!\n", dest->name);
+	acm_log(2, "%s\n", acmp_dest_name(2, dest));
+	if (acmp_dest_map_remove(&ep->dest_map, &dest->node))
+		acmp_put_dest(dest);
+}
 
-	acmp_put_dest(dest);
+static void acmp_put_route_cache(struct acmp_route_cache *cache)
+{
+	if (atomic_dec(&cache->refcnt) == 0) {
+		munmap(cache->base, cache->size);
+		free(cache);
+	}
+}
+
+static bool acmp_route_cache_valid(struct acmp_route_cache *cache)
+{
+	const struct acm_route_cache_hdr *hdr = cache->base;
+	uint32_t i, first, num;
+
+	if (cache->size < sizeof(*hdr) ||
+	    be32toh(hdr->magic) != ACM_ROUTE_CACHE_MAGIC ||
+	    be32toh(hdr->version) != ACM_ROUTE_CACHE_VERSION ||
+	    acm_route_cache_size(hdr) != cache->size)
+		return false;
+
+	cache->num_ports = be32toh(hdr->num_ports);
+	cache->num_lids = be32toh(hdr->num_lids);
+	cache->num_routes = be32toh(hdr->num_routes);
+	cache->ports = (const struct acm_route_cache_port *) (hdr + 1);
+	cache->lids = (const struct acm_route_cache_lid *)
+		      (cache->ports + cache->num_ports);
+	cache->guids = cache->lids + cache->num_lids;
+	cache->routes = (const struct acm_route_cache_route *)
+			(cache->guids + cache->num_lids);
+
+	for (i = 0; i < cache->num_ports; i++) {
+		first = be32toh(cache->ports[i].first_route);
+		num = be32toh(cache->ports[i].num_routes);
+		if (first > cache->num_routes || num > cache->num_routes - first)
+			return false;
+	}
+	return true;
+}
+
+static struct acmp_route_cache *acmp_map_route_cache(int fd, struct stat *st)
+{
+	struct acmp_route_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->size = st->st_size;
+	cache->base = mmap(NULL, cache->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (cache->base == MAP_FAILED) {
+		acm_log(0, "ERROR - unable to map %s\n", route_data_file);
+		goto err1;
+	}
+	if (!acmp_route_cache_valid(cache)) {
+		acm_log(0, "ERROR - %s is not a valid route cache\n",
+			route_data_file);
+		goto err2;
+	}
+
+	cache->dev = st->st_dev;
+	cache->ino = st->st_ino;
+	cache->mtime = st->st_mtim;
+	atomic_init(&cache->refcnt);
+	atomic_set(&cache->refcnt, 1);
+	acm_log(1, "mapped %s, %u ports, %u routes\n", route_data_file,
+		cache->num_ports, cache->num_routes);
+	return cache;
+
+err2:
+	munmap(cache->base, cache->size);
+err1:
+	free(cache);
+	return NULL;
+}
+
+/* Maps the route cache file again if it was replaced */
+static void acmp_update_route_cache(void)
+{
+	struct acmp_route_cache *cache = route_cache;
+	struct stat st;
+	int fd;
+
+	fd = open(route_data_file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (!cache)
+			acm_log(0, "ERROR - couldn't open %s\n", route_data_file);
+		return;
+	}
+
+	if (fstat(fd, &st) ||
+	    (cache && cache->dev == st.st_dev && cache->ino == st.st_ino &&
+	     cache->mtime.tv_sec == st.st_mtim.tv_sec &&
+	     cache->mtime.tv_nsec == st.st_mtim.tv_nsec))
+		goto out;
+
+	cache = acmp_map_route_cache(fd, &st);
+	if (cache) {
+		if (route_cache)
+			acmp_put_route_cache(route_cache);
+		route_cache = cache;
+	}
+out:
+	close(fd);
+}
+
+static struct acmp_route_cache *acmp_get_route_cache(void)
+{
+	struct acmp_route_cache *cache;
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&route_cache_lock);
+	if (now != route_cache_checked) {
+		route_cache_checked = now;
+		acmp_update_route_cache();
+	}
+	cache = route_cache;
+	if (cache)
+		(void) atomic_inc(&cache->refcnt);
+	pthread_mutex_unlock(&route_cache_lock);
+	return cache;
+}
+
+static int acmp_cmp_route_cache_guid(const void *key, const void *entry)
+{
+	uint64_t x = be64toh(*(const __be64 *) key);
+	uint64_t y = be64toh(((const struct acm_route_cache_lid *) entry)->guid);
+
+	return (x > y) - (x < y);
+}
+
+static int acmp_cmp_route_cache_lid(const void *key, const void *entry)
+{
+	return (int) be16toh(*(const __be16 *) key) -
+	       (int) be16toh(((const struct acm_route_cache_lid *) entry)->lid);
+}
+
+static int acmp_cmp_route_cache_dlid(const void *key, const void *entry)
+{
+	return (int) be16toh(*(const __be16 *) key) -
+	       (int) be16toh(((const struct acm_route_cache_route *) entry)->dlid);
+}
+
+/* Looks up the path to a LID or GID dest of ep in the route cache */
+static bool acmp_route_cache_path(struct acmp_ep *ep, uint8_t addr_type,
+				  const uint8_t *addr,
+				  struct ibv_path_record *path)
+{
+	const struct acm_route_cache_port *port;
+	const struct acm_route_cache_lid *lid;
+	const struct acm_route_cache_route *route;
+	struct acmp_route_cache *cache;
+	union ibv_gid sgid, dgid;
+	__be16 dlid;
+	bool found = false;
+
+	if (addr_type != ACM_ADDRESS_LID && addr_type != ACM_ADDRESS_GID)
+		return false;
+
+	cache = acmp_get_route_cache();
+	if (!cache)
+		return false;
+
+	acm_get_gid((struct acm_port *)ep->port->port, 0, &sgid);
+	port = bsearch(&sgid.global.interface_id, cache->ports,
+		       cache->num_ports, sizeof(*port),
+		       acmp_cmp_route_cache_guid);
+	if (!port || be16toh(port->lid) != ep->port->lid)
+		goto out;
+
+	if (addr_type == ACM_ADDRESS_LID) {
+		memcpy(&dlid, addr, sizeof(dlid));
+		lid = bsearch(&dlid, cache->lids, cache->num_lids,
+			      sizeof(*lid), acmp_cmp_route_cache_lid);
+	} else {
+		memcpy(&dgid, addr, sizeof(dgid));
+		if (dgid.global.subnet_prefix != sgid.global.subnet_prefix)
+			goto out;
+		lid = bsearch(&dgid.global.interface_id, cache->guids,
+			      cache->num_lids, sizeof(*lid),
+			      acmp_cmp_route_cache_guid);
+	}
+	if (!lid)
+		goto out;
+
+	route = bsearch(&lid->lid, &cache->routes[be32toh(port->first_route)],
+			be32toh(port->num_routes), sizeof(*route),
+			acmp_cmp_route_cache_dlid);
+	if (!route)
+		goto out;
+
+	dgid.global.subnet_prefix = sgid.global.subnet_prefix;
+	dgid.global.interface_id = lid->guid;
+	path->sgid = sgid;
+	path->slid = htobe16(ep->port->lid);
+	path->dgid = dgid;
+	path->dlid = route->dlid;
+	path->reversible_numpath = IBV_PATH_RECORD_REVERSIBLE;
+	path->pkey = htobe16(ep->pkey);
+	path->mtu = route->mtu;
+	path->rate = route->rate;
+	path->qosclass_sl = htobe16((uint16_t) route->sl & 0xF);
+	path->packetlifetime = be16toh(route->dlid) == ep->port->lid ?
+			       0 : ep->port->packet_lifetime;
+	found = true;
+out:
+	acmp_put_route_cache(cache);
+	return found;
+}
+
+/* Fills a new dest from the route cache, as the OpenSM file preload would */
+static void acmp_route_cache_fill(struct acmp_ep *ep, struct acmp_dest *dest)
+{
+	if (!acmp_route_cache_path(ep, dest->node.addr_type,
+				   dest->node.address, &dest->path))
+		return;
+
+	if (be16toh(dest->path.dlid) == ep->port->lid) {
+		dest->addr_timeout = (uint64_t)~0ULL;
+		dest->route_timeout = (uint64_t)~0ULL;
+	} else {
+		dest->addr_timeout = time_stamp_min() + (unsigned) addr_timeout;
+		dest->route_timeout = time_stamp_min() + (unsigned) route_timeout;
+	}
+	dest->remote_qpn = 1;
+	dest->state = ACMP_READY;
+	acm_log(1, "added cached dest %s\n", acmp_dest_name(1, dest));
 }
 
 static struct acmp_dest *
 acmp_acquire_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 {
-	struct acmp_dest *dest;
+	struct acmp_dest *dest, *new_dest;
 	int64_t rec_expr_minutes;
 
 	acm_format_name(2, log_data, sizeof log_data,
 			addr_type, addr, ACM_MAX_ADDRESS);
 	acm_log(2, "%s\n", log_data);
-	pthread_mutex_lock(&ep->lock);
 	dest = acmp_get_dest(ep, addr_type, addr);
 	if (dest && dest->state == ACMP_READY &&
 	    dest->addr_timeout != (uint64_t)~0ULL) {
@@ -390,6 +661,7 @@ acmp_acquire_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 		if (rec_expr_minutes <= 0) {
 			acm_log(2, "Record expired\n");
 			acmp_remove_dest(ep, dest);
+			acmp_put_dest(dest);
 			dest = NULL;
 		} else {
 			acm_log(2, "Record valid for the next %" PRId64 " minute(s)\n",
@@ -397,14 +669,22 @@ acmp_acquire_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 		}
 	}
 	if (!dest) {
-		dest = acmp_alloc_dest(addr_type, addr);
-		if (dest) {
-			dest->ep = ep;
-			tsearch(dest, &ep->dest_map[addr_type - 1], acmp_compare_dest);
-			(void) atomic_inc(&dest->refcnt);
-		}
+		new_dest = acmp_alloc_dest(addr_type, addr);
+		if (!new_dest)
+			return NULL;
+
+		new_dest->ep = ep;
+		if (route_preload == ACMP_ROUTE_PRELOAD_ROUTE_CACHE)
+			acmp_route_cache_fill(ep, new_dest);
+		(void) atomic_inc(&new_dest->refcnt);
+		/* Another thread may have added the dest first */
+		dest = container_of(acmp_dest_map_insert(&ep->dest_map,
+							 &new_dest->node,
+							 acmp_get_dest_node),
+				    struct acmp_dest, node);
+		if (dest != new_dest)
+			free(new_dest);
 	}
-	pthread_mutex_unlock(&ep->lock);
 	return dest;
 }
 
@@ -459,7 +739,7 @@ acmp_alloc_send(struct acmp_ep *ep, struct acmp_dest *dest, size_t size)
 		msg->wr.wr.ud.ah = dest->ah;
 	}
 
-	acm_log(2, "get dest %s\n", dest->name);
+	acm_log(2, "get dest %s\n", acmp_dest_name(2, dest));
 	(void) atomic_inc(&dest->refcnt);
 	msg->dest = dest;
 
@@ -618,7 +898,7 @@ static int acmp_mc_index(struct acmp_ep *ep, union ibv_gid *gid)
 	int i;
 
 	for (i = 0; i < ep->mc_cnt; i++) {
-		if (!memcmp(&ep->mc_dest[i].address, gid, sizeof(*gid)))
+		if (!memcmp(&ep->mc_dest[i].node.address, gid, sizeof(*gid)))
 			return i;
 	}
 	return -1;
@@ -800,7 +1080,7 @@ static uint8_t acmp_resolve_path_sa(struct acmp_ep *ep, struct acmp_dest *dest,
 	uint8_t ret;
 	struct acm_sa_mad *sa_mad;
 
-	acm_log(2, "%s\n", dest->name);
+	acm_log(2, "%s\n", acmp_dest_name(2, dest));
 
 	sa_mad = acm_alloc_sa_mad(ep->endpoint, dest, handler);
 	if (!sa_mad) {
@@ -837,7 +1117,7 @@ acmp_record_acm_addr(struct acmp_ep *ep, struct acmp_dest *dest, struct ibv_wc *
 {
 	int index;
 
-	acm_log(2, "%s\n", dest->name);
+	acm_log(2, "%s\n", acmp_dest_name(2, dest));
 	index = acmp_best_mc_index(ep, rec);
 	if (index < 0) {
 		acm_log(0, "ERROR - no shared multicast groups\n");
@@ -866,7 +1146,7 @@ static void
 acmp_record_path_addr(struct acmp_ep *ep, struct acmp_dest *dest,
 	struct ibv_path_record *path)
 {
-	acm_log(2, "%s\n", dest->name);
+	acm_log(2, "%s\n", acmp_dest_name(2, dest));
 	dest->path.pkey = htobe16(ep->pkey);
 	dest->path.dgid = path->dgid;
 	if (path->slid) {
@@ -908,7 +1188,7 @@ acmp_send_addr_resp(struct acmp_ep *ep, struct acmp_dest *dest)
 	struct acmp_send_msg *msg;
 	struct acm_mad *mad;
 
-	acm_log(2, "%s\n", dest->name);
+	acm_log(2, "%s\n", acmp_dest_name(2, dest));
 	msg = acmp_alloc_send(ep, dest, sizeof (*mad));
 	if (!msg) {
 		acm_log(0, "ERROR - failed to allocate message\n");
@@ -1000,7 +1280,7 @@ acmp_dest_sa_resp(struct acm_sa_mad *mad)
 	} else {
 		status = ACM_STATUS_ETIMEDOUT;
 	}
-	acm_log(2, "%s status=0x%x\n", dest->name, status);
+	acm_log(2, "%s status=0x%x\n", acmp_dest_name(2, dest), status);
 
 	pthread_mutex_lock(&dest->lock);
 	if (dest->state != ACMP_QUERY_ROUTE) {
@@ -1710,13 +1990,13 @@ acmp_send_resolve(struct acmp_ep *ep, struct acmp_dest *dest,
 	rec->src_type = (uint8_t) saddr->type;
 	rec->src_length = ACM_MAX_ADDRESS;
 	memcpy(rec->src, saddr->info.addr, ACM_MAX_ADDRESS);
-	rec->dest_type = dest->addr_type;
+	rec->dest_type = dest->node.addr_type;
 	rec->dest_length = ACM_MAX_ADDRESS;
-	memcpy(rec->dest, dest->address, ACM_MAX_ADDRESS);
+	memcpy(rec->dest, dest->node.address, ACM_MAX_ADDRESS);
 
 	rec->gid_cnt = (uint8_t) ep->mc_cnt;
 	for (i = 0; i < ep->mc_cnt; i++)
-		memcpy(&rec->gid[i], ep->mc_dest[i].address, 16);
+		memcpy(&rec->gid[i], ep->mc_dest[i].node.address, 16);
 
 	acm_increment_counter(ACM_CNTR_ADDR_QUERY);
 	atomic_inc(&ep->counters[ACM_CNTR_ADDR_QUERY]);
@@ -1745,11 +2025,11 @@ static int acmp_dest_timeout(struct acmp_dest *dest)
 	uint64_t timestamp = time_stamp_min();
 
 	if (timestamp > dest->addr_timeout) {
-		acm_log(2, "%s address timed out\n", dest->name);
+		acm_log(2, "%s address timed out\n", acmp_dest_name(2, dest));
 		dest->state = ACMP_INIT;
 		return 1;
 	} else if (timestamp > dest->route_timeout) {
-		acm_log(2, "%s route timed out\n", dest->name);
+		acm_log(2, "%s route timed out\n", acmp_dest_name(2, dest));
 		dest->state = ACMP_ADDR_RESOLVED;
 		return 1;
 	}
@@ -1802,14 +2082,14 @@ acmp_acquire_sgid(struct acm_ep_addr_data *saddr,
 	if (!ib_any_gid(&dest->path.sgid))
 		return;
 
-	if (dest->addr_type != ACM_ADDRESS_IP6 &&
-	    dest->addr_type != ACM_ADDRESS_IP)
+	if (dest->node.addr_type != ACM_ADDRESS_IP6 &&
+	    dest->node.addr_type != ACM_ADDRESS_IP)
 		return;
 
 	if (getifaddrs(&addrs))
 		return;
 
-	d_family = (dest->addr_type == ACM_ADDRESS_IP) ? AF_INET : AF_INET6;
+	d_family = (dest->node.addr_type == ACM_ADDRESS_IP) ? AF_INET : AF_INET6;
 
 	for (iap = addrs; iap != NULL; iap = iap->ifa_next) {
 		ret = acmp_check_addr_match(iap, saddr, d_family);
@@ -2026,6 +2306,8 @@ static enum acmp_route_preload acmp_convert_route_preload(char *param)
 		return ACMP_ROUTE_PRELOAD_NONE;
 	else if (!strcasecmp("opensm_full_v1", param))
 		return ACMP_ROUTE_PRELOAD_OSM_FULL_V1;
+	else if (!strcasecmp("route_cache", param))
+		return ACMP_ROUTE_PRELOAD_ROUTE_CACHE;
 
 	return route_preload;
 }
@@ -2252,8 +2534,9 @@ static int acmp_parse_osm_fullv1_paths(FILE *f, __be64 *lid2guid, struct acmp_ep
 			}
 			dest->remote_qpn = 1;
 			dest->state = ACMP_READY;
+			acm_log(1, "added cached dest %s\n",
+				acmp_dest_name(1, dest));
 			acmp_put_dest(dest);
-			acm_log(1, "added cached dest %s\n", dest->name);
 		}
 	}
 	return ret;
@@ -2337,6 +2620,10 @@ static void acmp_parse_hosts_file(struct acmp_ep *ep)
 			dest->path = gid_dest->path;
 			dest->state = ACMP_READY;
 			acmp_put_dest(gid_dest);
+		} else if (route_preload == ACMP_ROUTE_PRELOAD_ROUTE_CACHE &&
+			   acmp_route_cache_path(ep, ACM_ADDRESS_GID, name,
+						 &dest->path)) {
+			dest->state = ACMP_READY;
 		} else {
 			memcpy(&dest->path.dgid, &ib_addr, 16);
 			//ibv_query_gid(ep->port->dev->verbs, ep->port->port_num,
@@ -2370,6 +2657,15 @@ static void acmp_ep_preload(struct acmp_ep *ep)
 		if (acmp_parse_osm_fullv1(ep))
 			acm_log(0, "ERROR - failed to preload EP\n");
 		break;
+	case ACMP_ROUTE_PRELOAD_ROUTE_CACHE:
+		/* Only map the cache, dests are filled when they are created */
+		pthread_mutex_lock(&route_cache_lock);
+		route_cache_checked = time(NULL);
+		acmp_update_route_cache();
+		if (!route_cache)
+			acm_log(0, "ERROR - failed to preload EP\n");
+		pthread_mutex_unlock(&route_cache_lock);
+		break;
 	default:
 		break;
 	}
@@ -2449,7 +2745,7 @@ static int __acmp_add_addr(const struct acm_address *addr, struct acmp_ep *ep,
 	dest->state = ACMP_READY;
 	acmp_put_dest(dest);
 	*addr_context = addr_ctx;
-	acm_log(1, "added loopback dest %s\n", dest->name);
+	acm_log(1, "added loopback dest %s\n", acmp_dest_name(1, dest));
 
 	return 0;
 }
@@ -2498,9 +2794,8 @@ static void acmp_remove_addr(void *addr_context)
 				dest = acmp_get_dest(ep, address->type, address->addr.info.addr);
 				if (dest) {
 					acm_log(2, "Found a dest addr, deleting it\n");
-					pthread_mutex_lock(&ep->lock);
 					acmp_remove_dest(ep, dest);
-					pthread_mutex_unlock(&ep->lock);
+					acmp_put_dest(dest);
 				}
 				pthread_mutex_lock(&port->lock);
 			}
@@ -2602,6 +2897,11 @@ acmp_alloc_ep(struct acmp_port *port, struct acm_endpoint *endpoint)
 		free(ep);
 		return NULL;
 	}
+	if (acmp_dest_map_init(&ep->dest_map)) {
+		pthread_rwlock_destroy(&ep->rwlock);
+		free(ep);
+		return NULL;
+	}
 	ep->addr_info = NULL;
 	ep->nmbr_ep_addrs = 0;
 
@@ -2712,6 +3012,7 @@ err2:
 err1:
 	ibv_destroy_cq(ep->cq);
 err0:
+	acmp_dest_map_cleanup(&ep->dest_map);
 	free(ep);
 	return -1;
 }
@@ -2736,6 +3037,7 @@ static void acmp_port_up(struct acmp_port *port)
 	port->rate = acm_get_rate(attr.active_width, attr.active_speed);
 	if (attr.subnet_timeout >= 8)
 		port->subnet_timeout = 1 << (attr.subnet_timeout - 8);
+	port->packet_lifetime = attr.subnet_timeout;
 
 	port->lid = attr.lid;
 	port->lid_mask = 0xffff - ((1 << attr.lmc) - 1);
@@ -0,0 +1,279 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+
+/*
+ * Measures the lookup rate of the acmp destination cache.  The LIDs and GIDs
+ * of an 'opensm full v1' path file, or of a synthetic subnet, are loaded as
+ * the route preload would, then looked up from several threads at once.
+ * The sharded map is compared with a binary tree under a single mutex, as
+ * the cache was previously kept.
+ */
+
+#include <config.h>
+
+#include <endian.h>
+#include <getopt.h>
+#include <search.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ccan/container_of.h>
+#include <infiniband/verbs.h>
+#include "acm_mad.h"
+#include "acmp_dest_map.h"
+
+struct bench_dest {
+	struct acmp_dest_node	node;
+	int			refcnt;
+};
+
+static struct acmp_dest_map map;
+static void *tree[ACM_ADDRESS_RESERVED - 1];
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct acmp_dest_node *keys;
+static int num_keys;
+static unsigned long lookups = 1000000;
+static int max_threads = 8;
+static bool use_map;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_dest(const void *a, const void *b)
+{
+	return memcmp(((const struct acmp_dest_node *) a)->address,
+		      ((const struct acmp_dest_node *) b)->address,
+		      ACM_MAX_ADDRESS);
+}
+
+static void get_dest(struct acmp_dest_node *node)
+{
+	__atomic_add_fetch(&container_of(node, struct bench_dest, node)->refcnt,
+			   1, __ATOMIC_RELAXED);
+}
+
+static int add_key(uint8_t addr_type, const void *addr, size_t len)
+{
+	uint8_t buf[ACM_MAX_ADDRESS] = {};
+	struct acmp_dest_node *new_keys;
+
+	if (!(num_keys & (num_keys - 1))) {
+		new_keys = realloc(keys, (num_keys ? num_keys * 2 : 1) *
+				   sizeof(*keys));
+		if (!new_keys)
+			return -1;
+		keys = new_keys;
+	}
+
+	memcpy(buf, addr, len);
+	acmp_dest_node_init(&keys[num_keys++], addr_type, buf);
+	return 0;
+}
+
+static int add_port(uint16_t lid, uint64_t guid)
+{
+	union ibv_gid gid;
+	__be16 net_lid = htobe16(lid);
+
+	gid.global.subnet_prefix = htobe64(0xfe80000000000000ULL);
+	gid.global.interface_id = htobe64(guid);
+	if (add_key(ACM_ADDRESS_LID, &net_lid, sizeof(net_lid)) ||
+	    add_key(ACM_ADDRESS_GID, &gid, sizeof(gid)))
+		return -1;
+	return 0;
+}
+
+/* Loads the ports of the file, as found in its lid to guid table */
+static int load_file(const char *path)
+{
+	char s[128], *p, *ptr;
+	unsigned long lid;
+	uint64_t guid;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (!ret && fgets(s, sizeof s, f)) {
+		if (strncmp(s, "Switch", 6) && strncmp(s, "Channel", 7) &&
+		    strncmp(s, "Router", 6))
+			continue;
+
+		p = strstr(s, "0x");
+		ptr = strstr(s, "base LID");
+		if (!p || !ptr)
+			continue;
+
+		guid = strtoull(p, NULL, 16);
+		lid = strtoul(ptr + sizeof("base LID"), NULL, 0);
+		if (lid && lid < 0xc000)
+			ret = add_port(lid, guid);
+	}
+
+	fclose(f);
+	return ret;
+}
+
+static int load_synthetic(int ports)
+{
+	int i;
+
+	for (i = 1; i <= ports; i++)
+		if (add_port(i, 0x0002c90300000000ULL + i))
+			return -1;
+	return 0;
+}
+
+static int fill_cache(void)
+{
+	struct bench_dest *dest;
+	int i;
+
+	if (acmp_dest_map_init(&map))
+		return -1;
+
+	for (i = 0; i < num_keys; i++) {
+		dest = calloc(1, sizeof(*dest));
+		if (!dest)
+			return -1;
+		dest->node = keys[i];
+		acmp_dest_map_insert(&map, &dest->node, get_dest);
+		tsearch(&dest->node, &tree[dest->node.addr_type - 1],
+			compare_dest);
+	}
+	return 0;
+}
+
+static void *lookup_thread(void *arg)
+{
+	struct acmp_dest_node *key, *node, **tnode;
+	unsigned long i, found = 0;
+	uint64_t x = (uintptr_t) arg * 0x9e3779b97f4a7c15ULL + 1;
+
+	for (i = 0; i < lookups; i++) {
+		/* xorshift, so each thread looks up its own sequence */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		key = &keys[x % num_keys];
+
+		if (use_map) {
+			node = acmp_dest_map_find(&map, key->addr_type,
+						  key->address, get_dest);
+		} else {
+			pthread_mutex_lock(&tree_lock);
+			tnode = tfind(key, &tree[key->addr_type - 1],
+				      compare_dest);
+			node = tnode ? *tnode : NULL;
+			if (node)
+				get_dest(node);
+			pthread_mutex_unlock(&tree_lock);
+		}
+		found += node != NULL;
+	}
+
+	return (void *) found;
+}
+
+static int run(int threads)
+{
+	pthread_t tid[threads];
+	unsigned long found = 0;
+	uint64_t start, elapsed;
+	void *ret;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&tid[i], NULL, lookup_thread,
+				   (void *) (uintptr_t) (i + 1)))
+			return -1;
+	for (i = 0; i < threads; i++) {
+		pthread_join(tid[i], &ret);
+		found += (unsigned long) ret;
+	}
+	elapsed = now_ns() - start;
+
+	if (found != lookups * threads) {
+		fprintf(stderr, "%lu of %lu lookups failed\n",
+			lookups * threads - found, lookups * threads);
+		return -1;
+	}
+
+	printf("%-6s%9d%16.0f\n", use_map ? "map" : "tree", threads,
+	       found * 1e9 / elapsed);
+	return 0;
+}
+
+static void show_usage(char *program)
+{
+	printf("usage: %s\n", program);
+	printf("   [-f path_file]     - 'opensm full v1' file to load\n");
+	printf("   [-n ports]         - synthetic ports if no file, default: 40000\n");
+	printf("   [-t threads]       - maximum lookup threads, default: 8\n");
+	printf("   [-l lookups]       - lookups per thread, default: 1000000\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *file = NULL;
+	int op, ports = 40000, threads;
+
+	while ((op = getopt(argc, argv, "f:n:t:l:")) != -1) {
+		switch (op) {
+		case 'f':
+			file = optarg;
+			break;
+		case 'n':
+			ports = atoi(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'l':
+			lookups = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			show_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (ports <= 0 || max_threads <= 0 || !lookups) {
+		show_usage(argv[0]);
+		return 1;
+	}
+
+	if (file ? load_file(file) : load_synthetic(ports))
+		return 1;
+	if (!num_keys) {
+		fprintf(stderr, "no ports found\n");
+		return 1;
+	}
+	if (fill_cache()) {
+		fprintf(stderr, "unable to fill the cache\n");
+		return 1;
+	}
+
+	printf("%d destinations\n", num_keys);
+	printf("%-6s%9s%16s\n", "cache", "threads", "lookups/sec");
+	for (use_map = false; ; use_map = true) {
+		for (threads = 1; threads <= max_threads; threads *= 2)
+			if (run(threads))
+				return 1;
+		if (use_map)
+			break;
+	}
+	return 0;
+}
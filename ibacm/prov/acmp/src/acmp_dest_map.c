@@ -0,0 +1,194 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acmp_dest_map.h"
+
+#define ACMP_DEST_MAP_MIN_BUCKETS	16
+
+static uint32_t acmp_dest_hash(uint8_t addr_type, const uint8_t *addr)
+{
+	uint64_t hash = 14695981039346656037ULL, word;
+	int i;
+
+	/* FNV-1a, a word at a time */
+	for (i = 0; i < ACM_MAX_ADDRESS; i += sizeof(word)) {
+		memcpy(&word, addr + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	hash = (hash ^ addr_type) * 1099511628211ULL;
+
+	/*
+	 * The multiplications only carry changes to higher bits, mix them down
+	 * since GIDs differ in the last bytes of a word.
+	 */
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static struct acmp_dest_shard *
+acmp_dest_shard(struct acmp_dest_map *map, uint32_t hash)
+{
+	/* The bucket is selected by the low bits, the shard by the high ones */
+	return &map->shards[hash >> 26];
+}
+
+static bool acmp_dest_match(struct acmp_dest_node *node, uint32_t hash,
+			    uint8_t addr_type, const uint8_t *addr)
+{
+	return node->hash == hash && node->addr_type == addr_type &&
+	       !memcmp(node->address, addr, ACM_MAX_ADDRESS);
+}
+
+static struct acmp_dest_node *
+acmp_dest_shard_find(struct acmp_dest_shard *shard, uint32_t hash,
+		     uint8_t addr_type, const uint8_t *addr)
+{
+	struct acmp_dest_node *node;
+
+	for (node = shard->buckets[hash & shard->mask]; node; node = node->next)
+		if (acmp_dest_match(node, hash, addr_type, addr))
+			return node;
+	return NULL;
+}
+
+/* Doubles the buckets of a shard, a failure leaves longer chains */
+static void acmp_dest_shard_grow(struct acmp_dest_shard *shard)
+{
+	struct acmp_dest_node **buckets, *node, *next;
+	uint32_t i, mask = shard->mask * 2 + 1;
+
+	buckets = calloc(mask + 1, sizeof(*buckets));
+	if (!buckets)
+		return;
+
+	for (i = 0; i <= shard->mask; i++) {
+		for (node = shard->buckets[i]; node; node = next) {
+			next = node->next;
+			node->next = buckets[node->hash & mask];
+			buckets[node->hash & mask] = node;
+		}
+	}
+
+	free(shard->buckets);
+	shard->buckets = buckets;
+	shard->mask = mask;
+}
+
+int acmp_dest_map_init(struct acmp_dest_map *map)
+{
+	struct acmp_dest_shard *shard;
+	int i;
+
+	for (i = 0; i < ACMP_DEST_MAP_SHARDS; i++) {
+		shard = &map->shards[i];
+		shard->buckets = calloc(ACMP_DEST_MAP_MIN_BUCKETS,
+					sizeof(*shard->buckets));
+		if (!shard->buckets)
+			goto err;
+		shard->mask = ACMP_DEST_MAP_MIN_BUCKETS - 1;
+		shard->count = 0;
+		pthread_rwlock_init(&shard->lock, NULL);
+	}
+	return 0;
+
+err:
+	while (i--) {
+		pthread_rwlock_destroy(&map->shards[i].lock);
+		free(map->shards[i].buckets);
+	}
+	return ENOMEM;
+}
+
+/* The nodes still in the map are not released */
+void acmp_dest_map_cleanup(struct acmp_dest_map *map)
+{
+	int i;
+
+	for (i = 0; i < ACMP_DEST_MAP_SHARDS; i++) {
+		pthread_rwlock_destroy(&map->shards[i].lock);
+		free(map->shards[i].buckets);
+		map->shards[i].buckets = NULL;
+	}
+}
+
+void acmp_dest_node_init(struct acmp_dest_node *node, uint8_t addr_type,
+			 const uint8_t *addr)
+{
+	node->next = NULL;
+	node->addr_type = addr_type;
+	memcpy(node->address, addr, ACM_MAX_ADDRESS);
+	node->hash = acmp_dest_hash(addr_type, node->address);
+}
+
+struct acmp_dest_node *acmp_dest_map_find(struct acmp_dest_map *map,
+					  uint8_t addr_type,
+					  const uint8_t *addr,
+					  acmp_dest_get_t get)
+{
+	uint32_t hash = acmp_dest_hash(addr_type, addr);
+	struct acmp_dest_shard *shard = acmp_dest_shard(map, hash);
+	struct acmp_dest_node *node;
+
+	pthread_rwlock_rdlock(&shard->lock);
+	node = acmp_dest_shard_find(shard, hash, addr_type, addr);
+	if (node)
+		get(node);
+	pthread_rwlock_unlock(&shard->lock);
+	return node;
+}
+
+/*
+ * Inserts node, unless a node with the same key is already in the map, in
+ * which case a reference is taken on that node and it is returned instead.
+ */
+struct acmp_dest_node *acmp_dest_map_insert(struct acmp_dest_map *map,
+					    struct acmp_dest_node *node,
+					    acmp_dest_get_t get)
+{
+	struct acmp_dest_shard *shard = acmp_dest_shard(map, node->hash);
+	struct acmp_dest_node *found;
+
+	pthread_rwlock_wrlock(&shard->lock);
+	found = acmp_dest_shard_find(shard, node->hash, node->addr_type,
+				     node->address);
+	if (found) {
+		get(found);
+		node = found;
+	} else {
+		node->next = shard->buckets[node->hash & shard->mask];
+		shard->buckets[node->hash & shard->mask] = node;
+		if (++shard->count > shard->mask)
+			acmp_dest_shard_grow(shard);
+	}
+	pthread_rwlock_unlock(&shard->lock);
+	return node;
+}
+
+/* Returns false if node was not in the map, e.g. already removed */
+bool acmp_dest_map_remove(struct acmp_dest_map *map,
+			  struct acmp_dest_node *node)
+{
+	struct acmp_dest_shard *shard = acmp_dest_shard(map, node->hash);
+	struct acmp_dest_node **prev;
+	bool found = false;
+
+	pthread_rwlock_wrlock(&shard->lock);
+	for (prev = &shard->buckets[node->hash & shard->mask]; *prev;
+	     prev = &(*prev)->next) {
+		if (*prev == node) {
+			*prev = node->next;
+			shard->count--;
+			found = true;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&shard->lock);
+	return found;
+}
@@ -0,0 +1,53 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef ACMP_DEST_MAP_H
+#define ACMP_DEST_MAP_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <infiniband/acm.h>
+
+/*
+ * Hash table of the destinations of an endpoint, keyed by address type and
+ * address.  The table is split in shards, each with its own lock, so
+ * lookups only contend when they hit the same shard while it is updated.
+ */
+#define ACMP_DEST_MAP_SHARDS	64
+
+/* Embedded in a destination, holds its key */
+struct acmp_dest_node {
+	struct acmp_dest_node	*next;
+	uint32_t		hash;
+	uint8_t			addr_type;
+	uint8_t			address[ACM_MAX_ADDRESS];
+};
+
+struct acmp_dest_shard {
+	pthread_rwlock_t	lock;
+	struct acmp_dest_node	**buckets;
+	uint32_t		mask;
+	uint32_t		count;
+};
+
+struct acmp_dest_map {
+	struct acmp_dest_shard	shards[ACMP_DEST_MAP_SHARDS];
+};
+
+/* Called on a found node while its shard is locked, to take a reference */
+typedef void (*acmp_dest_get_t)(struct acmp_dest_node *node);
+
+int acmp_dest_map_init(struct acmp_dest_map *map);
+void acmp_dest_map_cleanup(struct acmp_dest_map *map);
+void acmp_dest_node_init(struct acmp_dest_node *node, uint8_t addr_type,
+			 const uint8_t *addr);
+struct acmp_dest_node *acmp_dest_map_find(struct acmp_dest_map *map,
+					  uint8_t addr_type,
+					  const uint8_t *addr,
+					  acmp_dest_get_t get);
+struct acmp_dest_node *acmp_dest_map_insert(struct acmp_dest_map *map,
+					    struct acmp_dest_node *node,
+					    acmp_dest_get_t get);
+bool acmp_dest_map_remove(struct acmp_dest_map *map,
+			  struct acmp_dest_node *node);
+
+#endif /* ACMP_DEST_MAP_H */
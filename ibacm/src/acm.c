@@ -53,6 +53,7 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
 #include <net/if_arp.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -71,6 +72,23 @@
 #define ACM_PROV_NAME_SIZE 64
 #define NL_CLIENT_INDEX 0
 
+/*
+ * Clients are allocated in blocks which never move, so that a client id
+ * handed to a provider stays valid while more clients are added.
+ */
+#define ACM_CLIENT_BLOCK	1024
+#define ACM_MAX_CLIENT_BLOCKS	1024
+#define ACM_MAX_EVENTS		64
+
+/* The type of an epoll event is kept in the upper half of its data */
+enum acm_poll_type {
+	ACM_POLL_LISTEN,
+	ACM_POLL_IPMON,
+	ACM_POLL_NL,
+	ACM_POLL_DEVICE,
+	ACM_POLL_CLIENT,
+};
+
 struct acmc_subnet {
 	struct list_node       entry;
 	__be64                 subnet_prefix;
@@ -184,7 +202,19 @@ static LIST_HEAD(dev_list);
 
 static int listen_socket;
 static int ip_mon_socket;
-static struct acmc_client client_array[FD_SETSIZE - 1];
+static struct acmc_client *client_blocks[ACM_MAX_CLIENT_BLOCKS];
+static int num_clients;
+static int next_client;
+static int server_epfd = -1;
+static int client_epfd = -1;
+static pthread_t *server_threads;
+/*
+ * Held for read while a client request is processed, and for write while
+ * devices and addresses are updated, when requests are processed by the
+ * server threads.  Writers are preferred, so updates aren't starved.
+ */
+static pthread_rwlock_t server_lock =
+	PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
 
 static FILE *flog;
 static pthread_mutex_t log_lock;
@@ -223,6 +253,7 @@ static short server_port = 6125;
 static int server_mode = IBACM_SERVER_MODE_DEFAULT;
 static int acme_plus_kernel_only = IBACM_ACME_PLUS_KERNEL_ONLY_DEFAULT;
 static int support_ips_in_addr_cfg = 0;
+static int server_thread_cnt = 0;
 static char prov_lib_path[256] = IBACM_LIB_PATH;
 
 void acm_write(int level, const char *format, ...)
@@ -496,9 +527,14 @@ __be64 acm_path_comp_mask(struct ibv_path_record *path)
 	return comp_mask;
 }
 
+static struct acmc_client *acm_get_client(uint64_t id)
+{
+	return &client_blocks[id / ACM_CLIENT_BLOCK][id % ACM_CLIENT_BLOCK];
+}
+
 int acm_resolve_response(uint64_t id, struct acm_msg *msg)
 {
-	struct acmc_client *client = &client_array[id];
+	struct acmc_client *client = acm_get_client(id);
 	int ret;
 
 	acm_log(2, "client %d, status 0x%x\n", client->index, msg->hdr.status);
@@ -545,7 +581,7 @@ acmc_resolve_response(uint64_t id, struct acm_msg *req_msg, uint8_t status)
 
 int acm_query_response(uint64_t id, struct acm_msg *msg)
 {
-	struct acmc_client *client = &client_array[id];
+	struct acmc_client *client = acm_get_client(id);
 	int ret;
 
 	acm_log(2, "status 0x%x\n", msg->hdr.status);
@@ -576,16 +612,52 @@ static int acmc_query_response(uint64_t id, struct acm_msg *msg, uint8_t status)
 	return acm_query_response(id, msg);
 }
 
+static int acm_alloc_client_block(void)
+{
+	struct acmc_client *block;
+	int i;
+
+	if (num_clients == ACM_CLIENT_BLOCK * ACM_MAX_CLIENT_BLOCKS)
+		return ENOSPC;
+
+	block = calloc(ACM_CLIENT_BLOCK, sizeof(*block));
+	if (!block)
+		return ENOMEM;
+
+	for (i = 0; i < ACM_CLIENT_BLOCK; i++) {
+		pthread_mutex_init(&block[i].lock, NULL);
+		block[i].index = num_clients + i;
+		block[i].sock = -1;
+		atomic_init(&block[i].refcnt);
+	}
+
+	client_blocks[num_clients / ACM_CLIENT_BLOCK] = block;
+	num_clients += ACM_CLIENT_BLOCK;
+	return 0;
+}
+
+static int acm_poll_add(int epfd, int fd, enum acm_poll_type type,
+			uint32_t value, uint32_t events)
+{
+	struct epoll_event event = {
+		.events = events,
+		.data.u64 = (uint64_t) type << 32 | value,
+	};
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event)) {
+		acm_log(0, "ERROR - unable to poll fd %d\n", fd);
+		return errno;
+	}
+	return 0;
+}
+
 static void acm_init_server(void)
 {
 	FILE *f;
-	int i;
 
-	for (i = 0; i < FD_SETSIZE - 1; i++) {
-		pthread_mutex_init(&client_array[i].lock, NULL);
-		client_array[i].index = i;
-		client_array[i].sock = -1;
-		atomic_init(&client_array[i].refcnt);
+	if (acm_alloc_client_block()) {
+		acm_log(0, "ERROR - unable to allocate clients\n");
+		exit(1);
 	}
 
 	if (server_mode != IBACM_SERVER_MODE_UNIX) {
@@ -713,12 +785,12 @@ static int acm_listen_systemd(void)
 			/* ListenNetlink for RDMA_NL_GROUP_LS multicast
 			 * messages from the kernel
 			 */
-			if (client_array[NL_CLIENT_INDEX].sock != -1) {
+			if (acm_get_client(NL_CLIENT_INDEX)->sock != -1) {
 				fprintf(stderr,
 					"sd_listen_fds returned more than one netlink socket\n");
 				return -1;
 			}
-			client_array[NL_CLIENT_INDEX].sock = fd;
+			acm_get_client(NL_CLIENT_INDEX)->sock = fd;
 
 			/* systemd sets NONBLOCK on the netlink socket, while
 			 * we want blocking send to the kernel.
@@ -750,6 +822,7 @@ static int acm_listen_systemd(void)
 static void acm_disconnect_client(struct acmc_client *client)
 {
 	pthread_mutex_lock(&client->lock);
+	epoll_ctl(client_epfd, EPOLL_CTL_DEL, client->sock, NULL);
 	shutdown(client->sock, SHUT_RDWR);
 	close(client->sock);
 	client->sock = -1;
@@ -759,8 +832,9 @@ static void acm_disconnect_client(struct acmc_client *client)
 
 static void acm_svr_accept(void)
 {
+	struct acmc_client *client = NULL;
 	int s;
-	int i;
+	int i, n;
 
 	acm_log(2, "\n");
 	s = accept(listen_socket, NULL, NULL);
@@ -769,22 +843,37 @@ static void acm_svr_accept(void)
 		return;
 	}
 
-	for (i = 0; i < FD_SETSIZE - 1; i++) {
+	/* Continue the search for a free client where the last one ended */
+	for (n = 0; n < num_clients; n++) {
+		i = next_client;
+		next_client = (next_client + 1) % num_clients;
 		if (i == NL_CLIENT_INDEX)
 			continue;
-		if (!atomic_get(&client_array[i].refcnt))
+		if (!atomic_get(&acm_get_client(i)->refcnt)) {
+			client = acm_get_client(i);
 			break;
+		}
 	}
 
-	if (i == FD_SETSIZE - 1) {
-		acm_log(0, "ERROR - all connections busy - rejecting\n");
-		close(s);
-		return;
+	if (!client) {
+		i = num_clients;
+		if (acm_alloc_client_block()) {
+			acm_log(0, "ERROR - all connections busy - rejecting\n");
+			close(s);
+			return;
+		}
+		client = acm_get_client(i);
+		next_client = i + 1;
 	}
 
-	client_array[i].sock = s;
-	atomic_set(&client_array[i].refcnt, 1);
-	acm_log(2, "assigned client %d\n", i);
+	client->sock = s;
+	atomic_set(&client->refcnt, 1);
+	if (acm_poll_add(client_epfd, s, ACM_POLL_CLIENT, client->index,
+			 EPOLLIN | (server_thread_cnt ? EPOLLONESHOT : 0))) {
+		acm_disconnect_client(client);
+		return;
+	}
+	acm_log(2, "assigned client %d\n", client->index);
 }
 
 static int
@@ -1287,7 +1376,7 @@ static int acm_msg_length(struct acm_msg *msg)
 		msg->hdr.length : be16toh(msg->hdr.length);
 }
 
-static void acm_svr_receive(struct acmc_client *client)
+static int acm_svr_receive(struct acmc_client *client)
 {
 	struct acm_msg *msg = malloc(sizeof(*msg));
 	int ret;
@@ -1331,6 +1420,7 @@ out:
 	free(msg);
 	if (ret)
 		acm_disconnect_client(client);
+	return ret;
 }
 
 static int acm_nl_to_addr_data(struct acm_ep_addr_data *ad,
@@ -1874,20 +1964,114 @@ static int acm_init_nl(void)
 	}
 
 	/* init nl client structure */
-	client_array[NL_CLIENT_INDEX].sock = nl_rcv_socket;
+	acm_get_client(NL_CLIENT_INDEX)->sock = nl_rcv_socket;
 	return 0;
 }
 
+/*
+ * Server threads process client requests, while the main thread accepts
+ * clients and handles device and address changes.  A client is polled with
+ * EPOLLONESHOT, so only one thread reads its requests at a time.
+ */
+static void *acm_server_thread(void *context)
+{
+	struct epoll_event event;
+	struct acmc_client *client;
+	int ret;
+
+	acm_log(1, "started\n");
+	while (1) {
+		ret = epoll_wait(client_epfd, &event, 1, -1);
+		if (ret != 1)
+			continue;
+
+		client = acm_get_client((uint32_t) event.data.u64);
+		acm_log(2, "receiving from client %d\n", client->index);
+		pthread_rwlock_rdlock(&server_lock);
+		ret = acm_svr_receive(client);
+		pthread_rwlock_unlock(&server_lock);
+		if (ret)
+			continue;
+
+		event.events = EPOLLIN | EPOLLONESHOT;
+		pthread_mutex_lock(&client->lock);
+		if (client->sock != -1 &&
+		    epoll_ctl(client_epfd, EPOLL_CTL_MOD, client->sock, &event))
+			acm_log(0, "ERROR - unable to poll client %d\n",
+				client->index);
+		pthread_mutex_unlock(&client->lock);
+	}
+
+	return NULL;
+}
+
+static int acm_start_server_threads(void)
+{
+	int i;
+
+	client_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (client_epfd == -1)
+		return errno;
+
+	server_threads = calloc(server_thread_cnt, sizeof(*server_threads));
+	if (!server_threads)
+		return ENOMEM;
+
+	for (i = 0; i < server_thread_cnt; i++) {
+		if (pthread_create(&server_threads[i], NULL,
+				   acm_server_thread, NULL))
+			return EAGAIN;
+	}
+	return 0;
+}
+
+static void acm_server_event(struct epoll_event *event)
+{
+	struct acmc_device *dev;
+	uint32_t value = (uint32_t) event->data.u64;
+
+	switch (event->data.u64 >> 32) {
+	case ACM_POLL_LISTEN:
+		acm_svr_accept();
+		break;
+	case ACM_POLL_IPMON:
+		pthread_rwlock_wrlock(&server_lock);
+		acm_ipnl_handler();
+		pthread_rwlock_unlock(&server_lock);
+		break;
+	case ACM_POLL_NL:
+		acm_log(2, "receiving from client %d\n", NL_CLIENT_INDEX);
+		acm_nl_receive(acm_get_client(NL_CLIENT_INDEX));
+		break;
+	case ACM_POLL_DEVICE:
+		list_for_each(&dev_list, dev, entry) {
+			if (dev->device.verbs->async_fd != value)
+				continue;
+			acm_log(2, "handling event from %s\n",
+				dev->device.verbs->device->name);
+			pthread_rwlock_wrlock(&server_lock);
+			acm_event_handler(dev);
+			pthread_rwlock_unlock(&server_lock);
+			break;
+		}
+		break;
+	case ACM_POLL_CLIENT:
+		acm_log(2, "receiving from client %d\n", value);
+		acm_svr_receive(acm_get_client(value));
+		break;
+	}
+}
+
 static void acm_server(bool systemd)
 {
-	fd_set readfds;
-	int i, n, ret;
+	struct epoll_event events[ACM_MAX_EVENTS];
 	struct acmc_device *dev;
+	int i, n, ret;
 
 	acm_log(0, "started\n");
 	acm_init_server();
 
-	client_array[NL_CLIENT_INDEX].sock = -1;
+	acm_get_client(NL_CLIENT_INDEX)->sock = -1;
 	listen_socket = -1;
 	if (systemd) {
 		ret = acm_listen_systemd();
@@ -1905,64 +2089,52 @@ static void acm_server(bool systemd)
 		}
 	}
 
-	if (client_array[NL_CLIENT_INDEX].sock == -1) {
+	if (acm_get_client(NL_CLIENT_INDEX)->sock == -1) {
 		ret = acm_init_nl();
 		if (ret)
 			acm_log(1, "Warn - Netlink init failed\n");
 	}
 
+	server_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (server_epfd == -1) {
+		acm_log(0, "ERROR - unable to create epoll fd\n");
+		return;
+	}
+	client_epfd = server_epfd;
+
+	if (acm_poll_add(server_epfd, listen_socket, ACM_POLL_LISTEN, 0,
+			 EPOLLIN))
+		return;
+	if (ip_mon_socket != -1)
+		acm_poll_add(server_epfd, ip_mon_socket, ACM_POLL_IPMON, 0,
+			     EPOLLIN);
+	if (acm_get_client(NL_CLIENT_INDEX)->sock != -1)
+		acm_poll_add(server_epfd, acm_get_client(NL_CLIENT_INDEX)->sock,
+			     ACM_POLL_NL, 0, EPOLLIN);
+	list_for_each(&dev_list, dev, entry) {
+		acm_poll_add(server_epfd, dev->device.verbs->async_fd,
+			     ACM_POLL_DEVICE, dev->device.verbs->async_fd,
+			     EPOLLIN);
+	}
+
+	if (server_thread_cnt && acm_start_server_threads()) {
+		acm_log(0, "ERROR - unable to start server threads\n");
+		return;
+	}
+
 	if (systemd)
 		sd_notify(0, "READY=1");
 
 	while (1) {
-		n = (int) listen_socket;
-		FD_ZERO(&readfds);
-		FD_SET(listen_socket, &readfds);
-		n = max(n, (int) ip_mon_socket);
-		FD_SET(ip_mon_socket, &readfds);
-
-		for (i = 0; i < FD_SETSIZE - 1; i++) {
-			if (client_array[i].sock != -1) {
-				FD_SET(client_array[i].sock, &readfds);
-				n = max(n, (int) client_array[i].sock);
-			}
-		}
-
-		list_for_each(&dev_list, dev, entry) {
-			FD_SET(dev->device.verbs->async_fd, &readfds);
-			n = max(n, (int) dev->device.verbs->async_fd);
-		}
-
-		ret = select(n + 1, &readfds, NULL, NULL, NULL);
-		if (ret == -1) {
-			acm_log(0, "ERROR - server select error\n");
+		n = epoll_wait(server_epfd, events, ACM_MAX_EVENTS, -1);
+		if (n == -1) {
+			if (errno != EINTR)
+				acm_log(0, "ERROR - server epoll error\n");
 			continue;
 		}
 
-		if (FD_ISSET(listen_socket, &readfds))
-			acm_svr_accept();
-
-		if (FD_ISSET(ip_mon_socket, &readfds))
-			acm_ipnl_handler();
-
-		for (i = 0; i < FD_SETSIZE - 1; i++) {
-			if (client_array[i].sock != -1 &&
-				FD_ISSET(client_array[i].sock, &readfds)) {
-				acm_log(2, "receiving from client %d\n", i);
-				if (i == NL_CLIENT_INDEX)
-					acm_nl_receive(&client_array[i]);
-				else
-					acm_svr_receive(&client_array[i]);
-			}
-		}
-
-		list_for_each(&dev_list, dev, entry) {
-			if (FD_ISSET(dev->device.verbs->async_fd, &readfds)) {
-				acm_log(2, "handling event from %s\n",
-					dev->device.verbs->device->name);
-				acm_event_handler(dev);
-			}
-		}
+		for (i = 0; i < n; i++)
+			acm_server_event(&events[i]);
 	}
 }
 
@@ -3220,6 +3392,8 @@ static void acm_set_options(void)
 			sa.retries = atoi(value);
 		else if (!strcasecmp("sa_depth", opt))
 			sa.depth = atoi(value);
+		else if (!strcasecmp("server_threads", opt))
+			server_thread_cnt = max(atoi(value), 0);
 	}
 
 	fclose(f);
@@ -3239,6 +3413,7 @@ static void acm_log_options(void)
 	acm_log(0, "lock file %s\n", lock_file);
 	acm_log(0, "server_port %d\n", server_port);
 	acm_log(0, "server_mode %s\n", server_mode_names[server_mode]);
+	acm_log(0, "server_threads %d\n", server_thread_cnt);
 	acm_log(0, "acme_plus_kernel_only %s\n",
 		acme_plus_kernel_only ? "yes" : "no");
 	acm_log(0, "timeout %d ms\n", sa.timeout);
@@ -3390,8 +3565,8 @@ int main(int argc, char **argv)
 	acm_server(systemd);
 
 	acm_log(0, "shutting down\n");
-	if (client_array[NL_CLIENT_INDEX].sock != -1)
-		close(client_array[NL_CLIENT_INDEX].sock);
+	if (acm_get_client(NL_CLIENT_INDEX)->sock != -1)
+		close(acm_get_client(NL_CLIENT_INDEX)->sock);
 	acm_close_providers();
 	acm_stop_sa_handler();
 	umad_done();
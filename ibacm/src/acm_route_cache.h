@@ -0,0 +1,69 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef ACM_ROUTE_CACHE_H
+#define ACM_ROUTE_CACHE_H
+
+#include <endian.h>
+#include <stdint.h>
+#include <linux/types.h>
+
+/*
+ * Binary route cache, converted from an OpenSM 'full v1' path record dump
+ * by ib_acme -R, and mapped by the acmp provider.  All fields are in
+ * network byte order.  The file is laid out as the header, followed by the
+ * ports, lids, guids and routes tables:
+ *
+ * ports  - source ports of the dump, sorted by GUID, each with the range of
+ *          the routes table holding its routes
+ * lids   - GUID and base LID of every port of the subnet, sorted by LID
+ * guids  - the same entries as lids, sorted by GUID
+ * routes - routes of each source port, sorted by destination LID
+ */
+#define ACM_ROUTE_CACHE_MAGIC	0x41434d52	/* "ACMR" */
+#define ACM_ROUTE_CACHE_VERSION	1
+#define ACM_ROUTE_CACHE_FILE	"ibacm_route.cache"
+
+struct acm_route_cache_hdr {
+	__be32		magic;
+	__be32		version;
+	__be32		num_ports;
+	__be32		num_lids;	/* entries of both lids and guids */
+	__be32		num_routes;
+	__be32		reserved;
+};
+
+struct acm_route_cache_port {
+	__be64		guid;
+	__be16		lid;
+	__be16		reserved;
+	__be32		first_route;
+	__be32		num_routes;
+	__be32		reserved2;
+};
+
+struct acm_route_cache_lid {
+	__be64		guid;
+	__be16		lid;
+	__be16		reserved[3];
+};
+
+struct acm_route_cache_route {
+	__be16		dlid;
+	uint8_t		sl;
+	uint8_t		mtu;
+	uint8_t		rate;
+	uint8_t		reserved[3];
+};
+
+static inline uint64_t
+acm_route_cache_size(const struct acm_route_cache_hdr *hdr)
+{
+	return sizeof(*hdr) +
+	       (uint64_t) be32toh(hdr->num_ports) *
+		       sizeof(struct acm_route_cache_port) +
+	       (uint64_t) be32toh(hdr->num_lids) * 2 *
+		       sizeof(struct acm_route_cache_lid) +
+	       (uint64_t) be32toh(hdr->num_routes) *
+		       sizeof(struct acm_route_cache_route);
+}
+
+#endif /* ACM_ROUTE_CACHE_H */
@@ -37,12 +37,14 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <inttypes.h>
+#include <stdbool.h>
 
 #include <osd.h>
 #include <infiniband/verbs.h>
 #include <infiniband/acm.h>
 #include "libacm.h"
 #include "acm_util.h"
+#include "acm_route_cache.h"
 
 static const char *dest_dir = ACM_CONF_DIR;
 static const char *addr_file = ACM_ADDR_FILE;
@@ -108,6 +110,8 @@ static void show_usage(char *program)
 	printf("                      (default is %s)\n", ACM_ADDR_FILE);
 	printf("   -O [opt_file]    - generate local ibacm_opts.cfg options file\n");
 	printf("                      (default is %s)\n", ACM_OPTS_FILE);
+	printf("   -R route_file    - convert an OpenSM 'full v1' path records dump to\n");
+	printf("                      the binary route cache %s\n", ACM_ROUTE_CACHE_FILE);
 	printf("   -D dest_dir      - specify destination directory for output files\n");
 	printf("                      (default is %s)\n", ACM_CONF_DIR);
 	printf("   -V               - enable verbose output\n");
@@ -220,6 +224,12 @@ static void gen_opts_temp(FILE *f)
 #else
 	fprintf(f, "server_mode unix\n");
 #endif
+	fprintf(f, "\n");
+	fprintf(f, "# server_threads:\n");
+	fprintf(f, "# Number of threads processing client requests.  If 0, requests are\n");
+	fprintf(f, "# processed by the thread accepting clients.\n");
+	fprintf(f, "\n");
+	fprintf(f, "server_threads 0\n");
 	fprintf(f, "\n");
 	fprintf(f, "# acme_plus_kernel_only:\n");
 	fprintf(f, "# If set to 'true', 'yes' or a non-zero number\n");
@@ -308,6 +318,9 @@ static void gen_opts_temp(FILE *f)
 	fprintf(f, "# Supported preload values are:\n");
 	fprintf(f, "# none - The routing cache is not pre-built (default)\n");
 	fprintf(f, "# opensm_full_v1 - OpenSM 'full' path records dump file format (version 1)\n");
+	fprintf(f, "# route_cache - binary route cache, converted from an 'opensm_full_v1' file\n");
+	fprintf(f, "#   with ib_acme -R.  The cache is mapped and dests are filled from it on\n");
+	fprintf(f, "#   demand, it is reloaded when the file is replaced.\n");
 	fprintf(f, "\n");
 	fprintf(f, "route_preload none\n");
 	fprintf(f, "\n");
@@ -317,6 +330,8 @@ static void gen_opts_temp(FILE *f)
 	fprintf(f, "# indicates that routing data should be read from a file.\n");
 	fprintf(f, "# Default is %s/ibacm_route.data\n", ACM_CONF_DIR);
 	fprintf(f, "# route_data_file %s/ibacm_route.data\n", ACM_CONF_DIR);
+	fprintf(f, "# With route_cache, set it to %s/%s\n", ACM_CONF_DIR,
+		ACM_ROUTE_CACHE_FILE);
 	fprintf(f, "\n");
 	fprintf(f, "# addr_preload:\n");
 	fprintf(f, "# Specifies if the ACM address cache should be preloaded, or built on demand.\n");
@@ -529,6 +544,287 @@ out1:
 	return ret;
 }
 
+struct route_port {
+	uint64_t	guid;
+	uint16_t	lid;
+	uint32_t	first_route;
+	uint32_t	num_routes;
+};
+
+static struct route_port *route_ports;
+static struct acm_route_cache_route *routes;
+static uint32_t num_route_ports, num_routes;
+
+/* Grows array to the next power of two when cnt reaches one */
+static int grow_array(void **array, uint32_t cnt, size_t size)
+{
+	void *p;
+
+	if (cnt & (cnt - 1))
+		return 0;
+
+	p = realloc(*array, (cnt ? (size_t) cnt * 2 : 1) * size);
+	if (!p)
+		return -1;
+	*array = p;
+	return 0;
+}
+
+/* Parses the 'Channel Adapter 0x..., base LID n, ...' port lines */
+static int parse_route_port(const char *s, struct route_port *port)
+{
+	const char *p;
+
+	if (strncmp(s, "Switch", 6) && strncmp(s, "Channel", 7) &&
+	    strncmp(s, "Router", 6))
+		return 0;
+
+	p = strstr(s, "0x");
+	if (!p)
+		return 0;
+	port->guid = strtoull(p, NULL, 16);
+
+	p = strstr(p, "base LID");
+	if (!p)
+		return 0;
+	port->lid = (uint16_t) strtoul(p + sizeof("base LID"), NULL, 0);
+	port->first_route = num_routes;
+	port->num_routes = 0;
+	return port->lid && port->lid < 0xc000;
+}
+
+static int parse_route_dump(const char *file)
+{
+	struct acm_route_cache_route *route;
+	struct route_port *port = NULL;
+	unsigned int sl, mtu, rate;
+	unsigned long dlid;
+	char s[128], *p;
+	FILE *f;
+	int ret = 0;
+
+	if (!(f = fopen(file, "r"))) {
+		printf("Failed to open route data file %s: %s\n", file,
+		       strerror(errno));
+		return -1;
+	}
+
+	while (!ret && fgets(s, sizeof s, f)) {
+		if (s[0] == '#')
+			continue;
+
+		if (strncmp(s, "0x", 2)) {
+			if (grow_array((void **) &route_ports, num_route_ports,
+				       sizeof(*route_ports))) {
+				ret = -1;
+				break;
+			}
+			port = &route_ports[num_route_ports];
+			if (parse_route_port(s, port))
+				num_route_ports++;
+			else
+				port = NULL;
+			continue;
+		}
+
+		/* 'dlid : sl : mtu : rate', or 'dlid : UNREACHABLE' */
+		dlid = strtoul(s, &p, 0);
+		if (!port || !dlid || dlid >= 0xc000 ||
+		    sscanf(p, " : %u : %u : %u", &sl, &mtu, &rate) != 3)
+			continue;
+
+		if (grow_array((void **) &routes, num_routes, sizeof(*routes))) {
+			ret = -1;
+			break;
+		}
+		route = &routes[num_routes++];
+		memset(route, 0, sizeof(*route));
+		route->dlid = htobe16((uint16_t) dlid);
+		route->sl = (uint8_t) sl;
+		route->mtu = (uint8_t) mtu;
+		route->rate = (uint8_t) rate;
+		port->num_routes++;
+	}
+
+	if (ret)
+		printf("Failed to allocate routes\n");
+	fclose(f);
+	return ret;
+}
+
+static int cmp_route_dlid(const void *a, const void *b)
+{
+	uint16_t x = be16toh(((const struct acm_route_cache_route *) a)->dlid);
+	uint16_t y = be16toh(((const struct acm_route_cache_route *) b)->dlid);
+
+	return (x > y) - (x < y);
+}
+
+static int cmp_port_guid(const void *a, const void *b)
+{
+	uint64_t x = ((const struct route_port *) a)->guid;
+	uint64_t y = ((const struct route_port *) b)->guid;
+
+	return (x > y) - (x < y);
+}
+
+static int cmp_port_lid(const void *a, const void *b)
+{
+	return (int) ((const struct route_port *) a)->lid -
+	       (int) ((const struct route_port *) b)->lid;
+}
+
+static void set_route_lid(struct acm_route_cache_lid *entry,
+			  const struct route_port *port)
+{
+	entry->guid = htobe64(port->guid);
+	entry->lid = htobe16(port->lid);
+}
+
+/* Builds the route cache image, see acm_route_cache.h */
+static void *build_route_cache(size_t *size)
+{
+	struct acm_route_cache_hdr *hdr;
+	struct acm_route_cache_port *ports;
+	struct acm_route_cache_lid *lids, *guids;
+	uint32_t i;
+	void *buf;
+
+	for (i = 0; i < num_route_ports; i++)
+		qsort(&routes[route_ports[i].first_route],
+		      route_ports[i].num_routes, sizeof(*routes),
+		      cmp_route_dlid);
+
+	hdr = &(struct acm_route_cache_hdr) {
+		.num_ports = htobe32(num_route_ports),
+		.num_lids = htobe32(num_route_ports),
+		.num_routes = htobe32(num_routes),
+	};
+	*size = acm_route_cache_size(hdr);
+	buf = calloc(1, *size);
+	if (!buf) {
+		printf("Failed to allocate route cache\n");
+		return NULL;
+	}
+
+	memcpy(buf, hdr, sizeof(*hdr));
+	hdr = buf;
+	hdr->magic = htobe32(ACM_ROUTE_CACHE_MAGIC);
+	hdr->version = htobe32(ACM_ROUTE_CACHE_VERSION);
+	ports = (struct acm_route_cache_port *) (hdr + 1);
+	lids = (struct acm_route_cache_lid *) (ports + num_route_ports);
+	guids = lids + num_route_ports;
+	memcpy(guids + num_route_ports, routes, num_routes * sizeof(*routes));
+
+	qsort(route_ports, num_route_ports, sizeof(*route_ports), cmp_port_lid);
+	for (i = 0; i < num_route_ports; i++) {
+		if (i && route_ports[i].lid == route_ports[i - 1].lid) {
+			printf("Duplicate LID %u in route data\n",
+			       route_ports[i].lid);
+			goto err;
+		}
+		set_route_lid(&lids[i], &route_ports[i]);
+	}
+
+	qsort(route_ports, num_route_ports, sizeof(*route_ports), cmp_port_guid);
+	for (i = 0; i < num_route_ports; i++) {
+		if (i && route_ports[i].guid == route_ports[i - 1].guid) {
+			printf("Duplicate GUID 0x%" PRIx64 " in route data\n",
+			       route_ports[i].guid);
+			goto err;
+		}
+		set_route_lid(&guids[i], &route_ports[i]);
+		ports[i].guid = htobe64(route_ports[i].guid);
+		ports[i].lid = htobe16(route_ports[i].lid);
+		ports[i].first_route = htobe32(route_ports[i].first_route);
+		ports[i].num_routes = htobe32(route_ports[i].num_routes);
+	}
+	return buf;
+
+err:
+	free(buf);
+	return NULL;
+}
+
+/* Returns true if file already holds the image of the given size */
+static bool route_cache_unchanged(const char *file, const void *buf,
+				  size_t size)
+{
+	struct stat st;
+	bool same = false;
+	void *old;
+	FILE *f;
+
+	if (stat(file, &st) || (size_t) st.st_size != size ||
+	    !(f = fopen(file, "r")))
+		return false;
+
+	old = malloc(size);
+	if (old && fread(old, 1, size, f) == size)
+		same = !memcmp(old, buf, size);
+	free(old);
+	fclose(f);
+	return same;
+}
+
+/*
+ * The cache is written to a temporary file and renamed over the previous
+ * one, so ibacm always maps a complete file.  An unchanged cache is left
+ * untouched, so ibacm does not reload it.
+ */
+static int gen_route_cache(const char *dump_file)
+{
+	char tmp_file[sizeof(ACM_ROUTE_CACHE_FILE) + 8];
+	size_t size;
+	void *buf;
+	FILE *f;
+	int ret = -1;
+
+	VPRINT("Generating %s/%s from %s\n", dest_dir, ACM_ROUTE_CACHE_FILE,
+	       dump_file);
+	if (parse_route_dump(dump_file))
+		goto out;
+
+	VPRINT("%u ports, %u routes\n", num_route_ports, num_routes);
+	buf = build_route_cache(&size);
+	if (!buf || open_dir())
+		goto free;
+
+	if (route_cache_unchanged(ACM_ROUTE_CACHE_FILE, buf, size)) {
+		VPRINT("%s is up to date\n", ACM_ROUTE_CACHE_FILE);
+		ret = 0;
+		goto free;
+	}
+
+	snprintf(tmp_file, sizeof tmp_file, "%s.tmp", ACM_ROUTE_CACHE_FILE);
+	if (!(f = fopen(tmp_file, "w"))) {
+		printf("Failed to open route cache file: %s\n", strerror(errno));
+		goto free;
+	}
+
+	if (fwrite(buf, 1, size, f) != size || fflush(f) || fsync(fileno(f))) {
+		printf("Failed to write route cache file: %s\n", strerror(errno));
+		fclose(f);
+		unlink(tmp_file);
+		goto free;
+	}
+	fclose(f);
+
+	if (rename(tmp_file, ACM_ROUTE_CACHE_FILE)) {
+		printf("Failed to replace route cache file: %s\n",
+		       strerror(errno));
+		unlink(tmp_file);
+		goto free;
+	}
+	ret = 0;
+free:
+	free(buf);
+out:
+	free(route_ports);
+	free(routes);
+	return ret;
+}
+
 static void show_path(struct ibv_path_record *path)
 {
 	char gid[sizeof "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff"];
@@ -1043,8 +1339,9 @@ int main(int argc, char **argv)
 	int op, ret = 0;
 	int make_addr = 0;
 	int make_opts = 0;
+	char *route_file = NULL;
 
-	while ((op = getopt(argc, argv, "e::f:s:d:vcA::O::D:P::S:C:V")) != -1) {
+	while ((op = getopt(argc, argv, "e::f:s:d:vcA::O::R:D:P::S:C:V")) != -1) {
 		switch (op) {
 		case 'e':
 			enum_ep = 1;
@@ -1079,6 +1376,9 @@ int main(int argc, char **argv)
 			if (opt_arg(argc, argv))
 				opts_file = opt_arg(argc, argv);
 			break;
+		case 'R':
+			route_file = optarg;
+			break;
 		case 'D':
 			dest_dir = optarg;
 			break;
@@ -1107,7 +1407,7 @@ int main(int argc, char **argv)
 	if ((src_arg && (!dest_arg && perf_query != PERF_QUERY_EP_ADDR)) ||
 	    (perf_query == PERF_QUERY_EP_ADDR && !src_arg) ||
 	    (!src_arg && !dest_arg && !perf_query && !make_addr && !make_opts &&
-	     !enum_ep))
+	     !route_file && !enum_ep))
 		goto show_use;
 
 	if (dest_arg || perf_query || enum_ep)
@@ -1119,7 +1419,10 @@ int main(int argc, char **argv)
 	if (!ret && make_opts)
 		ret = gen_opts();
 
-	if (verbose || !(make_addr || make_opts) || ret)
+	if (!ret && route_file)
+		ret = gen_route_cache(route_file);
+
+	if (verbose || !(make_addr || make_opts || route_file) || ret)
 		printf("return status 0x%x\n", ret);
 	return ret;
 
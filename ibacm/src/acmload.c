@@ -0,0 +1,270 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+
+/*
+ * Load generator for the ibacm service.  Each client is a separate process
+ * with its own connection to ibacm, as every rank of a job would have, and
+ * issues resolve requests back to back.
+ */
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include <osd.h>
+#include <infiniband/acm.h>
+#include "libacm.h"
+
+#if IBACM_SERVER_MODE_DEFAULT == IBACM_SERVER_MODE_UNIX
+static const char *svc_arg = IBACM_IBACME_SERVER_PATH;
+#else
+static const char *svc_arg = "localhost";
+#endif
+static char *src_arg;
+static char **dests;
+static int num_dests;
+static int clients = 16;
+static int requests = 10000;
+static uint32_t flags;
+
+struct client_result {
+	int		errors;
+	int		completed;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int parse_ip(const char *str, struct sockaddr_storage *addr)
+{
+	struct addrinfo hint = {
+		.ai_flags = AI_NUMERICHOST,
+	}, *res;
+
+	if (getaddrinfo(str, NULL, &hint, &res))
+		return -1;
+
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	return 0;
+}
+
+static int resolve(const char *dest, struct sockaddr_storage *src,
+		   bool src_ip)
+{
+	struct sockaddr_storage dst;
+	struct ibv_path_data *paths;
+	int count, ret;
+
+	if (!parse_ip(dest, &dst))
+		ret = ib_acm_resolve_ip(src_ip ? (struct sockaddr *) src : NULL,
+					(struct sockaddr *) &dst, &paths,
+					&count, flags, 0);
+	else
+		ret = ib_acm_resolve_name(src_arg, (char *) dest, &paths,
+					  &count, flags, 0);
+	if (!ret)
+		ib_acm_free_paths(paths);
+	return ret;
+}
+
+/* Waits for the parent to close start_fd, then records one latency per request */
+static int run_client(int id, int start_fd, uint64_t *lat,
+		      struct client_result *result)
+{
+	struct sockaddr_storage src;
+	bool src_ip = src_arg && !parse_ip(src_arg, &src);
+	uint64_t start;
+	char c;
+	int i;
+
+	if (ib_acm_connect((char *) svc_arg)) {
+		fprintf(stderr, "client %d: unable to contact service: %s\n",
+			id, strerror(errno));
+		return 1;
+	}
+
+	if (read(start_fd, &c, 1) < 0)
+		return 1;
+
+	for (i = 0; i < requests; i++) {
+		start = now_ns();
+		if (resolve(dests[(id + i) % num_dests], &src, src_ip)) {
+			result->errors++;
+			continue;
+		}
+		lat[result->completed++] = now_ns() - start;
+	}
+
+	ib_acm_disconnect();
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(uint64_t *lat, size_t n, double p)
+{
+	size_t i = (size_t) (p * (n - 1));
+
+	return lat[i] / 1000.0;
+}
+
+static int run_load(void)
+{
+	struct client_result *results;
+	uint64_t *lat, *all, start, elapsed;
+	size_t lat_size, res_size, n = 0;
+	int pipe_fd[2], i, status, ret = 0, errors = 0;
+	pid_t pid;
+
+	lat_size = (size_t) clients * requests * sizeof(*lat);
+	res_size = clients * sizeof(*results);
+	lat = mmap(NULL, lat_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	results = mmap(NULL, res_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (lat == MAP_FAILED || results == MAP_FAILED || pipe(pipe_fd)) {
+		perror("unable to allocate results");
+		return 1;
+	}
+
+	for (i = 0; i < clients; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			clients = i;
+			ret = 1;
+			break;
+		}
+		if (!pid) {
+			close(pipe_fd[1]);
+			_exit(run_client(i, pipe_fd[0],
+					 &lat[(size_t) i * requests],
+					 &results[i]));
+		}
+	}
+
+	/* Closing the pipe starts all clients at once */
+	close(pipe_fd[0]);
+	start = now_ns();
+	close(pipe_fd[1]);
+
+	for (i = 0; i < clients; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			ret = 1;
+	}
+	elapsed = now_ns() - start;
+
+	all = malloc(lat_size);
+	if (!all) {
+		perror("unable to allocate latencies");
+		return 1;
+	}
+	for (i = 0; i < clients; i++) {
+		memcpy(&all[n], &lat[(size_t) i * requests],
+		       results[i].completed * sizeof(*all));
+		n += results[i].completed;
+		errors += results[i].errors;
+	}
+
+	printf("clients %d, requests %zu, errors %d, %.3f sec\n",
+	       clients, n, errors, elapsed / 1e9);
+	if (n) {
+		qsort(all, n, sizeof(*all), cmp_u64);
+		printf("resolves/sec %.0f\n", n * 1e9 / elapsed);
+		printf("latency usec: p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+		       percentile(all, n, 0.5), percentile(all, n, 0.99),
+		       percentile(all, n, 0.999), all[n - 1] / 1000.0);
+	}
+
+	free(all);
+	munmap(lat, lat_size);
+	munmap(results, res_size);
+	return ret;
+}
+
+static int parse_dests(char *arg)
+{
+	char *tok;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		dests = realloc(dests, (num_dests + 1) * sizeof(*dests));
+		if (!dests)
+			return -1;
+		dests[num_dests++] = tok;
+	}
+	return num_dests ? 0 : -1;
+}
+
+static void show_usage(char *program)
+{
+	printf("usage: %s\n", program);
+	printf("Measure the resolve rate and latency of the ibacm service\n");
+	printf("   -d dest_addr[,...] - destination IP addresses or names\n");
+	printf("   [-s src_addr]      - source address of the paths\n");
+	printf("   [-p clients]       - number of client processes, default: 16\n");
+	printf("   [-n requests]      - requests per client, default: 10000\n");
+	printf("   [-c]               - read ACM cached data only\n");
+	printf("   [-S svc_addr]      - address of ACM service, default: local service\n");
+}
+
+int main(int argc, char **argv)
+{
+	int op;
+
+	while ((op = getopt(argc, argv, "d:s:p:n:cS:")) != -1) {
+		switch (op) {
+		case 'd':
+			if (parse_dests(optarg))
+				goto show_use;
+			break;
+		case 's':
+			src_arg = optarg;
+			break;
+		case 'p':
+			clients = atoi(optarg);
+			break;
+		case 'n':
+			requests = atoi(optarg);
+			break;
+		case 'c':
+			flags |= ACM_FLAGS_NODELAY;
+			break;
+		case 'S':
+			svc_arg = optarg;
+			break;
+		default:
+			goto show_use;
+		}
+	}
+
+	if (!num_dests || clients <= 0 || requests <= 0)
+		goto show_use;
+
+	return run_load();
+
+show_use:
+	show_usage(argv[0]);
+	return 1;
+}
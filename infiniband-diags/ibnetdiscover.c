@@ -1050,6 +1050,9 @@ static int process_opt(void *context, int ch)
 	case 'o':
 		cfg->max_smps = strtoul(optarg, NULL, 0);
 		break;
+	case 6:
+		cfg->max_ports = strtoul(optarg, NULL, 0);
+		break;
 	default:
 		return -1;
 	}
@@ -1086,6 +1089,8 @@ int main(int argc, char **argv)
 		{"outstanding_smps", 'o', 1, NULL,
 		 "specify the number of outstanding SMP's which should be "
 		 "issued during the scan"},
+		{"local_ports", 6, 1, "<num>",
+		 "discover from up to <num> local ports on the subnet"},
 		{}
 	};
 	char usage_args[] = "[topology-file]";
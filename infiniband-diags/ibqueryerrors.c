@@ -46,9 +46,11 @@
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include <util/node_name_map.h>
 #include <infiniband/ibnetdisc.h>
+#include <infiniband/umad.h>
 #include <infiniband/mad.h>
 
 #include "ibdiag_common.h"
@@ -74,6 +76,15 @@ static char *dr_path;
 static uint8_t node_type_to_print;
 static unsigned clear_errors, clear_counts, details;
 
+#define DEF_PIPELINE_DEPTH 64
+static int pipeline_depth;
+static int pipeline_threads;
+static char *pipeline_ports;
+static int num_sweep_threads;
+static int show_timing;
+static double sweep_time;
+static unsigned long sweep_queries;
+
 #define PRINT_SWITCH 0x1
 #define PRINT_CA     0x2
 #define PRINT_ROUTER 0x4
@@ -303,6 +314,15 @@ static int print_summary(void)
 	if (summary.pma_query_failures)
 		printf("##          %d PMA query failures\n", summary.pma_query_failures);
 	report_suppressed();
+	if (show_timing) {
+		printf("## Sweep: %.3f sec", sweep_time);
+		if (pipeline_depth)
+			printf(", %lu PMA queries pipelined (%.0f/sec), %d threads, %d outstanding",
+			       sweep_queries,
+			       sweep_time ? sweep_queries / sweep_time : 0,
+			       num_sweep_threads, pipeline_depth);
+		printf("\n");
+	}
 	return (summary.bad_ports);
 }
 
@@ -360,6 +380,74 @@ Exit:
      return ret;
 }
 
+/*
+ * Pipelined sweep: the PMA queries of the sweep are issued up front, with
+ * many of them outstanding, and their results are then printed in discovery
+ * order by the same code as the serial sweep, which finds them through
+ * pma_query().  Queries which were not prefetched, like the error details,
+ * are still issued when they are printed.
+ */
+struct sweep_node;
+
+struct sweep_query {
+	struct sweep_node *sn;
+	int portnum;
+	unsigned attr_id;
+	int status;
+	uint8_t data[IB_PC_DATA_SZ];
+};
+
+struct sweep_node {
+	ibnd_node_t *node;
+	struct sweep_thread *thread;
+	ib_portid_t portid;	/* of the ClassPortInfo query */
+	__be16 cap_mask;
+	uint32_t cap_mask2;
+	int num_queries;
+	struct sweep_query *queries;
+};
+
+struct sweep_thread {
+	pthread_t thread;
+	char ca[UMAD_CA_NAME_LEN];
+	int ca_port;
+	struct ibmad_ports_pair *ports;
+	struct mad_rpc_async *async;
+	int index;
+	unsigned long queries;
+	int ret;
+};
+
+static struct sweep_node *sweep_nodes;
+static int num_sweep_nodes;
+static struct sweep_node *cur_sweep_node;
+static struct sweep_thread *sweep_threads;
+
+/* Returns the prefetched result of the query, or issues it */
+static uint8_t *pma_query(void *rcvbuf, ib_portid_t *portid, int portnum,
+			  unsigned attr_id)
+{
+	struct sweep_query *q;
+	int i;
+
+	for (i = 0; cur_sweep_node && i < cur_sweep_node->num_queries; i++) {
+		q = &cur_sweep_node->queries[i];
+		if (q->portnum != portnum || q->attr_id != attr_id)
+			continue;
+		if (q->status == EINPROGRESS)
+			break;
+		if (q->status) {
+			errno = q->status;
+			return NULL;
+		}
+		memcpy(rcvbuf, q->data, sizeof(q->data));
+		return rcvbuf;
+	}
+
+	return pma_query_via(rcvbuf, portid, portnum, ibd_timeout, attr_id,
+			     ibmad_port);
+}
+
 static int query_and_dump(char *buf, size_t size, ib_portid_t * portid,
 			  char *node_name, int portnum,
 			  const char *attr_name, uint16_t attr_id,
@@ -371,8 +459,7 @@ static int query_and_dump(char *buf, size_t size, ib_portid_t * portid,
 
 	memset(pc, 0, sizeof(pc));
 
-	if (!pma_query_via(pc, portid, portnum, ibd_timeout, attr_id,
-			   ibmad_port)) {
+	if (!pma_query(pc, portid, portnum, attr_id)) {
 		IBWARN("%s query failed on %s, %s port %d", attr_name,
 		       node_name, portid2str(portid), portnum);
 		summary.pma_query_failures++;
@@ -420,13 +507,11 @@ static int check_threshold(uint8_t *pc, uint8_t *pce, uint32_t cap_mask2,
 	return is_exceeds;
 }
 
-static int print_results(ib_portid_t * portid, char *node_name,
-			 ibnd_node_t * node, uint8_t * pc, int portnum,
-			 int *header_printed, uint8_t *pce, __be16 cap_mask,
-			 uint32_t cap_mask2)
+/* Formats the errors beyond threshold, details are only queried with portid */
+static int check_errors(ib_portid_t *portid, char *node_name, uint8_t *pc,
+			int portnum, uint8_t *pce, uint32_t cap_mask2,
+			char *str, size_t size)
 {
-	char buf[2048];
-	char *str = buf;
 	int i, ext_i, n;
 
 	for (n = 0, i = IB_PC_ERR_SYM_F, ext_i = IB_PC_EXT_ERR_SYM_F;
@@ -440,11 +525,12 @@ static int print_results(ib_portid_t * portid, char *node_name,
 			continue;
 		}
 
-		if (check_threshold(pc, pce, cap_mask2, i, ext_i, &n, str, sizeof(buf))) {
+		if (check_threshold(pc, pce, cap_mask2, i, ext_i, &n, str, size) &&
+		    portid) {
 
 			/* If there are PortXmitDiscards, get details (if supported) */
 			if (i == IB_PC_XMT_DISCARDS_F && details) {
-				n += query_and_dump(str + n, sizeof(buf) - n, portid,
+				n += query_and_dump(str + n, size - n, portid,
 						    node_name, portnum,
 						    "PortXmitDiscardDetails",
 						    IB_GSI_PORT_XMIT_DISCARD_DETAILS,
@@ -452,7 +538,7 @@ static int print_results(ib_portid_t * portid, char *node_name,
 						    IB_PC_RCV_ERR_LAST_F);
 				/* If there are PortRcvErrors, get details (if supported) */
 			} else if (i == IB_PC_ERR_RCV_F && details) {
-				n += query_and_dump(str + n, sizeof(buf) - n, portid,
+				n += query_and_dump(str + n, size - n, portid,
 						    node_name, portnum,
 						    "PortRcvErrorDetails",
 						    IB_GSI_PORT_RCV_ERROR_DETAILS,
@@ -464,8 +550,22 @@ static int print_results(ib_portid_t * portid, char *node_name,
 
 	if (!suppress(IB_PC_XMT_WAIT_F)) {
 		check_threshold(pc, pce, cap_mask2, IB_PC_XMT_WAIT_F,
-				IB_PC_EXT_XMT_WAIT_F, &n, str, sizeof(buf));
+				IB_PC_EXT_XMT_WAIT_F, &n, str, size);
 	}
+	return n;
+}
+
+static int print_results(ib_portid_t * portid, char *node_name,
+			 ibnd_node_t * node, uint8_t * pc, int portnum,
+			 int *header_printed, uint8_t *pce, __be16 cap_mask,
+			 uint32_t cap_mask2)
+{
+	char buf[2048];
+	char *str = buf;
+	int i, n;
+
+	n = check_errors(portid, node_name, pc, portnum, pce, cap_mask2, str,
+			 sizeof(buf));
 
 	/* if we found errors. */
 	if (n != 0) {
@@ -541,8 +641,7 @@ static int query_cap_mask(ib_portid_t * portid, char *node_name, int portnum,
 	portid->sl = lid2sl_table[portid->lid];
 
 	/* PerfMgt ClassPortInfo is a required attribute */
-	if (!pma_query_via(pc, portid, portnum, ibd_timeout, CLASS_PORT_INFO,
-			   ibmad_port)) {
+	if (!pma_query(pc, portid, portnum, CLASS_PORT_INFO)) {
 		IBWARN("classportinfo query failed on %s, %s port %d",
 		       node_name, portid2str(portid), portnum);
 		summary.pma_query_failures++;
@@ -572,8 +671,7 @@ static int print_data_cnts(ib_portid_t * portid, __be16 cap_mask,
 	portid->sl = lid2sl_table[portid->lid];
 
 	if (cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP)) {
-		if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-				   IB_GSI_PORT_COUNTERS_EXT, ibmad_port)) {
+		if (!pma_query(pc, portid, portnum, IB_GSI_PORT_COUNTERS_EXT)) {
 			IBWARN("IB_GSI_PORT_COUNTERS_EXT query failed on %s, %s port %d",
 			       node_name, portid2str(portid), portnum);
 			summary.pma_query_failures++;
@@ -585,8 +683,7 @@ static int print_data_cnts(ib_portid_t * portid, __be16 cap_mask,
 		else
 			end_field = IB_PC_EXT_RCV_PKTS_F;
 	} else {
-		if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-				   IB_GSI_PORT_COUNTERS, ibmad_port)) {
+		if (!pma_query(pc, portid, portnum, IB_GSI_PORT_COUNTERS)) {
 			IBWARN("IB_GSI_PORT_COUNTERS query failed on %s, %s port %d",
 			       node_name, portid2str(portid), portnum);
 			summary.pma_query_failures++;
@@ -642,8 +739,7 @@ static int print_errors(ib_portid_t * portid, __be16 cap_mask, uint32_t cap_mask
 
 	portid->sl = lid2sl_table[portid->lid];
 
-	if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-			   IB_GSI_PORT_COUNTERS, ibmad_port)) {
+	if (!pma_query(pc, portid, portnum, IB_GSI_PORT_COUNTERS)) {
 		IBWARN("IB_GSI_PORT_COUNTERS query failed on %s, %s port %d",
 		       node_name, portid2str(portid), portnum);
 		summary.pma_query_failures++;
@@ -651,8 +747,7 @@ static int print_errors(ib_portid_t * portid, __be16 cap_mask, uint32_t cap_mask
 	}
 
 	if (cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP)) {
-		if (!pma_query_via(pce, portid, portnum, ibd_timeout,
-		    IB_GSI_PORT_COUNTERS_EXT, ibmad_port)) {
+		if (!pma_query(pce, portid, portnum, IB_GSI_PORT_COUNTERS_EXT)) {
 			IBWARN("IB_GSI_PORT_COUNTERS_EXT query failed on %s, %s port %d",
 			       node_name, portid2str(portid), portnum);
 			summary.pma_query_failures++;
@@ -866,6 +961,314 @@ clear:
 	free(node_name);
 }
 
+static void sweep_done(struct mad_rpc_async *async, ib_rpc_t *rpc,
+		       ib_portid_t *dport, void *rcvdata, int status,
+		       void *context);
+
+/* Until it completes, pma_query() issues the query itself */
+static int sweep_submit(struct sweep_node *sn, ib_portid_t *portid,
+			int portnum, unsigned attr_id)
+{
+	struct sweep_query *q = &sn->queries[sn->num_queries++];
+
+	q->sn = sn;
+	q->portnum = portnum;
+	q->attr_id = attr_id;
+	q->status = EINPROGRESS;
+	portid->sl = lid2sl_table[portid->lid];
+	if (pma_query_async_via(sn->thread->async, q->data, portid, portnum,
+				ibd_timeout, attr_id, sweep_done, q))
+		return -1;
+	sn->thread->queries++;
+	return 0;
+}
+
+static void sweep_port_portid(ibnd_node_t *node, int p, ib_portid_t *portid)
+{
+	if (node->type == IB_NODE_SWITCH)
+		ib_portid_set(portid, node->smalid, 0, 0);
+	else
+		ib_portid_set(portid, node->ports[p]->base_lid, 0, 0);
+}
+
+/* Queries the counters print_node() reads, per port unless ports_only is 0 */
+static void sweep_counters(struct sweep_node *sn, int ports_only)
+{
+	ibnd_node_t *node = sn->node;
+	int ext = sn->cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED |
+				  IB_PM_EXT_WIDTH_NOIETF_SUP);
+	ib_portid_t portid;
+	int p, startport = 1;
+
+	if (node->type == IB_NODE_SWITCH && node->smaenhsp0)
+		startport = 0;
+
+	if (!data_counters_only && !ports_only &&
+	    (sn->cap_mask & IB_PM_ALL_PORT_SELECT)) {
+		portid = sn->portid;
+		sweep_submit(sn, &portid, 0xFF, IB_GSI_PORT_COUNTERS);
+		if (ext)
+			sweep_submit(sn, &portid, 0xFF, IB_GSI_PORT_COUNTERS_EXT);
+		return;
+	}
+
+	for (p = startport; p <= node->numports; p++) {
+		if (!node->ports[p])
+			continue;
+		sweep_port_portid(node, p, &portid);
+		if (!data_counters_only)
+			sweep_submit(sn, &portid, p, IB_GSI_PORT_COUNTERS);
+		if (ext)
+			sweep_submit(sn, &portid, p, IB_GSI_PORT_COUNTERS_EXT);
+		else if (data_counters_only)
+			sweep_submit(sn, &portid, p, IB_GSI_PORT_COUNTERS);
+	}
+}
+
+static void sweep_done(struct mad_rpc_async *async, ib_rpc_t *rpc,
+		       ib_portid_t *dport, void *rcvdata, int status,
+		       void *context)
+{
+	struct sweep_query *q = context;
+	struct sweep_node *sn = q->sn;
+	__be32 cap_mask2;
+
+	q->status = status;
+	if (q->attr_id != CLASS_PORT_INFO)
+		return;
+
+	/* As query_cap_mask(), the counters are read even if it failed */
+	if (!status) {
+		memcpy(&sn->cap_mask, q->data + 2, sizeof(sn->cap_mask));
+		memcpy(&cap_mask2, q->data + 4, sizeof(cap_mask2));
+		sn->cap_mask2 = ntohl(cap_mask2) >> 5;
+	}
+	sweep_counters(sn, 0);
+}
+
+/* print_node() reads every port if the counters of all ports have errors */
+static int sweep_needs_ports(struct sweep_node *sn)
+{
+	uint8_t pc[IB_PC_DATA_SZ], *pce = NULL;
+	char buf[2048];
+	uint32_t zero = 0;
+	int i;
+
+	if (data_counters_only || !(sn->cap_mask & IB_PM_ALL_PORT_SELECT))
+		return 0;
+
+	for (i = 0; i < sn->num_queries; i++) {
+		if (sn->queries[i].portnum != 0xFF ||
+		    sn->queries[i].attr_id == CLASS_PORT_INFO)
+			continue;
+		if (sn->queries[i].status)
+			return 0;
+		if (sn->queries[i].attr_id == IB_GSI_PORT_COUNTERS)
+			memcpy(pc, sn->queries[i].data, sizeof(pc));
+		else
+			pce = sn->queries[i].data;
+	}
+
+	if (!(sn->cap_mask & IB_PM_PC_XMIT_WAIT_SUP))
+		mad_encode_field(pc, IB_PC_XMT_WAIT_F, &zero);
+	return check_errors(NULL, NULL, pc, 0xFF, pce, sn->cap_mask2, buf,
+			    sizeof(buf));
+}
+
+static void *sweep_thread(void *arg)
+{
+	struct sweep_thread *t = arg;
+	int mgmt_classes[1] = { IB_PERFORMANCE_CLASS };
+	struct sweep_node *sn;
+	ib_portid_t portid;
+	int i, p = 0;
+
+	t->ports = mad_rpc_open_port2(t->ca[0] ? t->ca : NULL, t->ca_port,
+				      mgmt_classes, 1, 0);
+	if (!t->ports) {
+		IBWARN("Failed to open port %s:%d", t->ca, t->ca_port);
+		goto err;
+	}
+	if (ibd_timeout)
+		mad_rpc_set_timeout(t->ports->gsi.port, ibd_timeout);
+
+	t->async = mad_rpc_async_create(t->ports->gsi.port, pipeline_depth);
+	if (!t->async)
+		goto err;
+
+	for (i = t->index; i < num_sweep_nodes; i += num_sweep_threads) {
+		sn = &sweep_nodes[i];
+		if (sn->node->type == IB_NODE_SWITCH) {
+			ib_portid_set(&portid, sn->node->smalid, 0, 0);
+			p = 0;
+		} else {
+			for (p = 1; p <= sn->node->numports; p++) {
+				if (sn->node->ports[p]) {
+					ib_portid_set(&portid,
+						      sn->node->ports[p]->base_lid,
+						      0, 0);
+					break;
+				}
+			}
+		}
+		sn->portid = portid;
+		if (sweep_submit(sn, &portid, p, CLASS_PORT_INFO))
+			break;
+	}
+	if (mad_rpc_async_wait(t->async))
+		goto err;
+
+	for (i = t->index; i < num_sweep_nodes; i += num_sweep_threads)
+		if (sweep_needs_ports(&sweep_nodes[i]))
+			sweep_counters(&sweep_nodes[i], 1);
+	if (mad_rpc_async_wait(t->async))
+		goto err;
+
+	return NULL;
+err:
+	t->ret = -1;
+	return NULL;
+}
+
+static void add_sweep_node(ibnd_node_t *node, void *user_data)
+{
+	int type = 0;
+
+	switch (node->type) {
+	case IB_NODE_SWITCH:
+		type = PRINT_SWITCH;
+		break;
+	case IB_NODE_CA:
+		type = PRINT_CA;
+		break;
+	case IB_NODE_ROUTER:
+		type = PRINT_ROUTER;
+		break;
+	}
+
+	if (type & node_type_to_print)
+		sweep_nodes[num_sweep_nodes++].node = node;
+}
+
+static void count_node(ibnd_node_t *node, void *user_data)
+{
+	(*(int *)user_data)++;
+}
+
+static int parse_pipeline_ports(void)
+{
+	struct sweep_thread *threads;
+	char *str, *tok, *last = NULL, *p;
+	int i, n = 0;
+
+	num_sweep_threads = pipeline_threads ? pipeline_threads : 1;
+	sweep_threads = calloc(num_sweep_threads, sizeof(*sweep_threads));
+	if (!sweep_threads)
+		return -1;
+
+	if (!pipeline_ports) {
+		for (i = 0; i < num_sweep_threads; i++) {
+			if (ibd_ca)
+				strncpy(sweep_threads[i].ca, ibd_ca,
+					UMAD_CA_NAME_LEN - 1);
+			sweep_threads[i].ca_port = ibd_ca_port;
+		}
+		return 0;
+	}
+
+	str = strdup(pipeline_ports);
+	if (!str)
+		return -1;
+	for (tok = strtok_r(str, ",", &last); tok;
+	     tok = strtok_r(NULL, ",", &last)) {
+		if (!pipeline_threads) {
+			num_sweep_threads = n + 1;
+			threads = realloc(sweep_threads,
+					  num_sweep_threads * sizeof(*threads));
+			if (!threads)
+				goto err;
+			sweep_threads = threads;
+			memset(&sweep_threads[n], 0, sizeof(*sweep_threads));
+		} else if (n >= num_sweep_threads) {
+			break;
+		}
+
+		p = strchr(tok, ':');
+		if (p)
+			*p++ = '\0';
+		strncpy(sweep_threads[n].ca, tok, UMAD_CA_NAME_LEN - 1);
+		sweep_threads[n].ca_port = p ? strtoul(p, NULL, 0) : 0;
+		n++;
+	}
+
+	if (!n)
+		goto err;
+	/* Threads beyond the listed ports reuse them round robin */
+	for (i = n; i < num_sweep_threads; i++)
+		sweep_threads[i] = sweep_threads[i % n];
+	free(str);
+	return 0;
+
+err:
+	free(str);
+	return -1;
+}
+
+static void pipelined_sweep(ibnd_fabric_t *fabric)
+{
+	int i, max_queries, nodes = 0;
+
+	ibnd_iter_nodes(fabric, count_node, &nodes);
+	sweep_nodes = calloc(nodes, sizeof(*sweep_nodes));
+	if (!sweep_nodes || parse_pipeline_ports())
+		IBEXIT("Failed to allocate the sweep");
+	ibnd_iter_nodes(fabric, add_sweep_node, NULL);
+
+	for (i = 0; i < num_sweep_nodes; i++) {
+		/* ClassPortInfo, and up to 2 counters for all ports, twice */
+		max_queries = 1 + 4 * (sweep_nodes[i].node->numports + 2);
+		sweep_nodes[i].queries = calloc(max_queries,
+						sizeof(struct sweep_query));
+		if (!sweep_nodes[i].queries)
+			IBEXIT("Failed to allocate the sweep");
+		sweep_nodes[i].thread = &sweep_threads[i % num_sweep_threads];
+	}
+
+	for (i = 0; i < num_sweep_threads; i++) {
+		sweep_threads[i].index = i;
+		if (num_sweep_threads == 1)
+			sweep_thread(&sweep_threads[i]);
+		else if (pthread_create(&sweep_threads[i].thread, NULL,
+					sweep_thread, &sweep_threads[i]))
+			IBEXIT("Failed to start the sweep threads");
+	}
+	for (i = 0; i < num_sweep_threads; i++) {
+		if (num_sweep_threads > 1)
+			pthread_join(sweep_threads[i].thread, NULL);
+		if (sweep_threads[i].ret)
+			IBWARN("Pipelined sweep failed on %s:%d",
+			       sweep_threads[i].ca, sweep_threads[i].ca_port);
+		sweep_queries += sweep_threads[i].queries;
+	}
+
+	for (i = 0; i < num_sweep_nodes; i++) {
+		cur_sweep_node = &sweep_nodes[i];
+		print_node(sweep_nodes[i].node, NULL);
+	}
+	cur_sweep_node = NULL;
+
+	for (i = 0; i < num_sweep_threads; i++) {
+		if (sweep_threads[i].async)
+			mad_rpc_async_destroy(sweep_threads[i].async);
+		if (sweep_threads[i].ports)
+			mad_rpc_close_port2(sweep_threads[i].ports);
+	}
+	for (i = 0; i < num_sweep_nodes; i++)
+		free(sweep_nodes[i].queries);
+	free(sweep_nodes);
+	free(sweep_threads);
+}
+
 static void add_suppressed(enum MAD_FIELDS field)
 {
 	if (sup_total >= SUP_MAX) {
@@ -936,6 +1339,26 @@ static int process_opt(void *context, int ch)
 	case 10:
 		obtain_sl = 0;
 		break;
+	case 11:
+		pipeline_depth = strtoul(optarg, NULL, 0);
+		if (pipeline_depth <= 0 ||
+		    pipeline_depth > MAD_RPC_ASYNC_MAX_WINDOW)
+			IBEXIT("pipeline must be between 1 and %d",
+			       MAD_RPC_ASYNC_MAX_WINDOW);
+		break;
+	case 12:
+		pipeline_ports = strdup(optarg);
+		if (pipeline_ports == NULL)
+			IBEXIT("out of memory, strdup for pipeline_ports failed");
+		break;
+	case 13:
+		pipeline_threads = strtoul(optarg, NULL, 0);
+		if (pipeline_threads <= 0)
+			IBEXIT("pipeline-threads must be positive");
+		break;
+	case 14:
+		show_timing = 1;
+		break;
 	case 'G':
 	case 'S':
 		port_guid_str = optarg;
@@ -975,6 +1398,7 @@ int main(int argc, char **argv)
 	ibnd_fabric_t *fabric = NULL;
 	ib_gid_t self_gid;
 	int port = 0;
+	struct timespec start, end;
 
 	int mgmt_classes[4] = { IB_SMI_CLASS, IB_SMI_DIRECT_CLASS, IB_SA_CLASS,
 		IB_PERFORMANCE_CLASS
@@ -1014,6 +1438,14 @@ int main(int argc, char **argv)
 		{"outstanding_smps", 'o', 1, NULL,
 		 "specify the number of outstanding SMP's which should be "
 		 "issued during the scan"},
+		{"pipeline", 11, 1, "<outstanding>",
+		 "query the PMAs of the fabric with up to <outstanding> "
+		 "queries in flight per thread"},
+		{"pipeline-ports", 12, 1, "<ca:port,...>",
+		 "local ports to send the pipelined queries from"},
+		{"pipeline-threads", 13, 1, "<threads>",
+		 "threads sending the pipelined queries"},
+		{"timing", 14, 0, NULL, "report the duration of the sweep"},
 		{}
 	};
 	char usage_args[] = "";
@@ -1161,7 +1593,17 @@ int main(int argc, char **argv)
 			if(path_record_query(self_gid,0))
 				goto close_port;
 
-		ibnd_iter_nodes(fabric, print_node, NULL);
+		if (!pipeline_depth && (pipeline_ports || pipeline_threads))
+			pipeline_depth = DEF_PIPELINE_DEPTH;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (pipeline_depth)
+			pipelined_sweep(fabric);
+		else
+			ibnd_iter_nodes(fabric, print_node, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		sweep_time = (end.tv_sec - start.tv_sec) +
+			     (end.tv_nsec - start.tv_nsec) / 1e9;
 	}
 
 	rc = print_summary();
@@ -34,9 +34,14 @@
  *
  */
 
+#include <config.h>
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <netinet/in.h>
 
 #include <infiniband/umad.h>
@@ -734,6 +739,435 @@ static void dump_portsamples_control(ib_portid_t *portid, int port)
 	       port, buf);
 }
 
+/*
+ * Monitor mode: the counters of a set of ports are sampled every interval,
+ * with the queries of a sample in flight together, and the change of each
+ * counter since the previous sample is printed one line per port.
+ */
+static double monitor_interval;
+static unsigned long monitor_count;
+static int monitor_json;
+static int monitor_outstanding = 32;
+
+struct monitor_field {
+	enum MAD_FIELDS field;		/* in PortCounters, or 0 */
+	enum MAD_FIELDS ext_field;	/* in PortCountersExtended, or 0 */
+};
+
+static const struct monitor_field monitor_fields[] = {
+	{IB_PC_ERR_SYM_F, 0},
+	{IB_PC_LINK_RECOVERS_F, 0},
+	{IB_PC_LINK_DOWNED_F, 0},
+	{IB_PC_ERR_RCV_F, 0},
+	{IB_PC_ERR_PHYSRCV_F, 0},
+	{IB_PC_ERR_SWITCH_REL_F, 0},
+	{IB_PC_XMT_DISCARDS_F, 0},
+	{IB_PC_ERR_XMTCONSTR_F, 0},
+	{IB_PC_ERR_RCVCONSTR_F, 0},
+	{IB_PC_ERR_LOCALINTEG_F, 0},
+	{IB_PC_ERR_EXCESS_OVR_F, 0},
+	{IB_PC_VL15_DROPPED_F, 0},
+	{IB_PC_XMT_WAIT_F, 0},
+	{IB_PC_XMT_BYTES_F, IB_PC_EXT_XMT_BYTES_F},
+	{IB_PC_RCV_BYTES_F, IB_PC_EXT_RCV_BYTES_F},
+	{IB_PC_XMT_PKTS_F, IB_PC_EXT_XMT_PKTS_F},
+	{IB_PC_RCV_PKTS_F, IB_PC_EXT_RCV_PKTS_F},
+	{0, IB_PC_EXT_XMT_UPKTS_F},
+	{0, IB_PC_EXT_RCV_UPKTS_F},
+	{0, IB_PC_EXT_XMT_MPKTS_F},
+	{0, IB_PC_EXT_RCV_MPKTS_F},
+};
+
+#define MONITOR_FIELDS (sizeof(monitor_fields) / sizeof(monitor_fields[0]))
+#define MONITOR_FIRST_DATA 13	/* PortXmitData, followed by the rates */
+
+static const char *const monitor_rates[] = {
+	"XmitBytesPerSec", "RcvBytesPerSec", "XmitPktsPerSec", "RcvPktsPerSec"
+};
+
+struct monitor_target {
+	ib_portid_t portid;
+	__be16 cap_mask;
+	int status;
+	uint8_t buf[IB_PC_DATA_SZ];
+};
+
+struct monitor_port {
+	struct monitor_target *target;
+	int port;
+	uint32_t avail;		/* fields the port has */
+	uint32_t wide;		/* fields read as 64 bits */
+	int status;
+	int sampled;
+	struct timespec time, prev_time;
+	uint64_t val[MONITOR_FIELDS];
+	uint8_t pc[IB_PC_DATA_SZ];
+	uint8_t pce[IB_PC_DATA_SZ];
+};
+
+/* Parses "port", "min-max" or "port,port,..." into ports, returns the count */
+static int parse_ports(char *str, int *ports)
+{
+	char *tmpstr;
+	int n = 0;
+
+	if (strchr(str, ',')) {
+		tmpstr = strtok(str, ",");
+		while (tmpstr) {
+			if (n == MAX_PORTS)
+				IBEXIT("too many ports");
+			ports[n++] = strtoul(tmpstr, NULL, 0);
+			tmpstr = strtok(NULL, ",");
+		}
+	} else if ((tmpstr = strchr(str, '-'))) {
+		int pmin, pmax;
+
+		*tmpstr = '\0';
+		tmpstr++;
+
+		pmin = strtoul(str, NULL, 0);
+		pmax = strtoul(tmpstr, NULL, 0);
+
+		if (pmin >= pmax)
+			IBEXIT("max port must be greater than min port in range");
+		if (pmax - pmin >= MAX_PORTS)
+			IBEXIT("too many ports");
+
+		while (pmin <= pmax)
+			ports[n++] = pmin++;
+	} else
+		ports[n++] = strtoul(str, NULL, 0);
+
+	return n;
+}
+
+static void monitor_cpi_done(struct mad_rpc_async *async, ib_rpc_t *rpc,
+			     ib_portid_t *dport, void *rcvdata, int status,
+			     void *context)
+{
+	struct monitor_target *t = context;
+
+	t->status = status;
+	if (!status)
+		memcpy(&t->cap_mask, t->buf + 2, sizeof(t->cap_mask));
+}
+
+static void monitor_done(struct mad_rpc_async *async, ib_rpc_t *rpc,
+			 ib_portid_t *dport, void *rcvdata, int status,
+			 void *context)
+{
+	struct monitor_port *mp = context;
+
+	if (status)
+		mp->status = status;
+	else
+		clock_gettime(CLOCK_MONOTONIC, &mp->time);
+}
+
+static void monitor_wait(struct mad_rpc_async *async)
+{
+	if (mad_rpc_async_wait(async))
+		IBEXIT("perfquery monitor");
+}
+
+/* Selects the counters a port has, from the capabilities of its PMA */
+static void monitor_port_init(struct monitor_port *mp)
+{
+	__be16 cap_mask = mp->target->cap_mask;
+	const struct monitor_field *f;
+	unsigned i;
+
+	for (i = 0; i < MONITOR_FIELDS; i++) {
+		f = &monitor_fields[i];
+		if (f->field == IB_PC_XMT_WAIT_F &&
+		    !(cap_mask & IB_PM_PC_XMIT_WAIT_SUP))
+			continue;
+		if (f->ext_field &&
+		    ((cap_mask & IB_PM_EXT_WIDTH_SUPPORTED) ||
+		     ((cap_mask & IB_PM_EXT_WIDTH_NOIETF_SUP) &&
+		      f->ext_field <= IB_PC_EXT_RCV_PKTS_F))) {
+			mp->avail |= 1 << i;
+			mp->wide |= 1 << i;
+		} else if (f->field)
+			mp->avail |= 1 << i;
+	}
+}
+
+static void monitor_sample(struct mad_rpc_async *async,
+			   struct monitor_port *ports, int num_ports)
+{
+	struct monitor_port *mp;
+	int i;
+
+	for (i = 0; i < num_ports; i++) {
+		mp = &ports[i];
+		mp->status = 0;
+		if (pma_query_async_via(async, mp->pc, &mp->target->portid,
+					mp->port, ibd_timeout,
+					IB_GSI_PORT_COUNTERS, monitor_done, mp))
+			IBEXIT("perfquery monitor");
+		if (mp->wide &&
+		    pma_query_async_via(async, mp->pce, &mp->target->portid,
+					mp->port, ibd_timeout,
+					IB_GSI_PORT_COUNTERS_EXT, monitor_done,
+					mp))
+			IBEXIT("perfquery monitor");
+	}
+	monitor_wait(async);
+}
+
+static void monitor_header(void)
+{
+	unsigned i;
+
+	printf("# time,lid,port,interval");
+	for (i = 0; i < MONITOR_FIELDS; i++)
+		printf(",%s", mad_field_name(monitor_fields[i].field ?
+					     monitor_fields[i].field :
+					     monitor_fields[i].ext_field));
+	for (i = 0; i < 4; i++)
+		printf(",%s", monitor_rates[i]);
+	printf("\n");
+}
+
+static double monitor_secs(struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+/* Prints the changes since the previous sample, and keeps the new one */
+static void monitor_output(struct monitor_port *mp, double now)
+{
+	uint64_t val, delta[MONITOR_FIELDS] = {};
+	const struct monitor_field *f;
+	double interval;
+	const char *sep = "";
+	unsigned i;
+
+	for (i = 0; i < MONITOR_FIELDS; i++) {
+		f = &monitor_fields[i];
+		val = 0;
+		if (!(mp->avail & (1 << i)))
+			continue;
+		if (mp->wide & (1 << i))
+			mad_decode_field(mp->pce, f->ext_field, &val);
+		else
+			mad_decode_field(mp->pc, f->field, &val);
+
+		/*
+		 * 64 bit counters wrap, the unsigned difference is right
+		 * across a wrap.  The others stop at their maximum, so a lower
+		 * value means the counter was reset since the previous sample.
+		 */
+		if ((mp->wide & (1 << i)) || val >= mp->val[i])
+			delta[i] = val - mp->val[i];
+		else
+			delta[i] = val;
+		mp->val[i] = val;
+	}
+
+	interval = monitor_secs(&mp->time) - monitor_secs(&mp->prev_time);
+	mp->prev_time = mp->time;
+	if (!mp->sampled) {
+		mp->sampled = 1;
+		return;
+	}
+
+	if (monitor_json)
+		printf("{\"time\":%.3f,\"lid\":%u,\"port\":%d,\"interval\":%.3f,\"counters\":{",
+		       now, mp->target->portid.lid, mp->port, interval);
+	else
+		printf("%.3f,%u,%d,%.3f", now, mp->target->portid.lid,
+		       mp->port, interval);
+
+	for (i = 0; i < MONITOR_FIELDS; i++) {
+		f = &monitor_fields[i];
+		if (!(mp->avail & (1 << i))) {
+			if (!monitor_json)
+				printf(",");
+		} else if (monitor_json) {
+			printf("%s\"%s\":%" PRIu64, sep,
+			       mad_field_name(f->field ? f->field :
+					      f->ext_field), delta[i]);
+			sep = ",";
+		} else
+			printf(",%" PRIu64, delta[i]);
+	}
+
+	if (monitor_json)
+		printf("},\"rates\":{");
+	for (i = 0; i < 4; i++) {
+		/* PortXmitData and PortRcvData count 4 octet words */
+		double rate = delta[MONITOR_FIRST_DATA + i] * (i < 2 ? 4 : 1) /
+			      (interval > 0 ? interval : 1);
+
+		if (monitor_json)
+			printf("%s\"%s\":%.0f", i ? "," : "", monitor_rates[i],
+			       rate);
+		else
+			printf(",%.0f", rate);
+	}
+	printf(monitor_json ? "}}\n" : "\n");
+}
+
+static int monitor_add_target(struct monitor_target *t, char *str)
+{
+	/* GIDs have colons of their own, their ports follow a '/' */
+	char *ports = strrchr(str, ibd_dest_type == IB_DEST_GID ? '/' : ':');
+
+	if (ports)
+		*ports++ = '\0';
+	if (resolve_portid_str(srcports->gsi.ca_name, ibd_ca_port, &t->portid,
+			       str, ibd_dest_type, ibd_sm_id, srcport) < 0)
+		IBEXIT("can't resolve destination port %s", str);
+	if (!ports)
+		return 0;
+	return parse_ports(ports, info.ports);
+}
+
+/* Adds every port of the node of the target, as -l does */
+static int monitor_all_ports(struct monitor_target *t, int *ports)
+{
+	uint8_t data[IB_SMP_DATA_SIZE] = { 0 };
+	int i, n = 0, num_ports, start_port = 1;
+
+	if (!smp_query_via(data, &t->portid, IB_ATTR_NODE_INFO, 0, 0,
+			   srcports->smi.port))
+		IBEXIT("smp query nodeinfo failed");
+	num_ports = mad_get_field(data, 0, IB_NODE_NPORTS_F);
+	if (mad_get_field(data, 0, IB_NODE_TYPE_F) == IB_NODE_SWITCH) {
+		if (!smp_query_via(data, &t->portid, IB_ATTR_SWITCH_INFO, 0, 0,
+				   srcports->smi.port))
+			IBEXIT("smp query switchinfo failed");
+		if (mad_get_field(data, 0, IB_SW_ENHANCED_PORT0_F))
+			start_port = 0;
+	}
+	for (i = start_port; i <= num_ports; i++)
+		ports[n++] = i;
+	return n;
+}
+
+static void monitor(int argc, char **argv)
+{
+	struct monitor_target *targets;
+	struct monitor_port *ports = NULL, *mp;
+	struct mad_rpc_async *async;
+	struct timespec next, now;
+	int i, j, n, num_targets, num_ports = 0, self_port = 0;
+	unsigned long sample;
+
+	if (info.reset || info.reset_only)
+		IBEXIT("counters can't be reset while monitoring");
+
+	async = mad_rpc_async_create(srcport, monitor_outstanding);
+	if (!async)
+		IBEXIT("perfquery monitor");
+
+	num_targets = argc ? argc : 1;
+	targets = calloc(num_targets, sizeof(*targets));
+	if (!targets)
+		IBEXIT("out of memory");
+
+	for (i = 0; i < num_targets; i++) {
+		if (!argc) {
+			if (resolve_self(srcports->gsi.ca_name, ibd_ca_port,
+					 &targets[i].portid, &self_port,
+					 NULL) < 0)
+				IBEXIT("can't resolve self port");
+			n = 0;
+		} else
+			n = monitor_add_target(&targets[i], argv[i]);
+
+		if (!n && info.loop_ports)
+			n = monitor_all_ports(&targets[i], info.ports);
+		if (!n) {
+			info.ports[0] = argc ? info.port : self_port;
+			if (info.all_ports)
+				info.ports[0] = ALL_PORTS;
+			n = 1;
+		}
+
+		mp = realloc(ports, (num_ports + n) * sizeof(*ports));
+		if (!mp)
+			IBEXIT("out of memory");
+		ports = mp;
+		memset(&ports[num_ports], 0, n * sizeof(*ports));
+		for (j = 0; j < n; j++) {
+			ports[num_ports].target = &targets[i];
+			ports[num_ports++].port = info.ports[j];
+		}
+
+		/* PerfMgt ClassPortInfo is a required attribute */
+		if (pma_query_async_via(async, targets[i].buf,
+					&targets[i].portid, info.ports[0],
+					ibd_timeout, CLASS_PORT_INFO,
+					monitor_cpi_done, &targets[i]))
+			IBEXIT("perfquery monitor");
+	}
+	monitor_wait(async);
+
+	for (i = j = 0; i < num_ports; i++) {
+		mp = &ports[i];
+		if (mp->target->status) {
+			IBWARN("classportinfo query failed on %s: %s",
+			       portid2str(&mp->target->portid),
+			       strerror(mp->target->status));
+			continue;
+		}
+		if (mp->port == ALL_PORTS &&
+		    !(mp->target->cap_mask & IB_PM_ALL_PORT_SELECT)) {
+			IBWARN("AllPortSelect not supported on %s",
+			       portid2str(&mp->target->portid));
+			continue;
+		}
+		ports[j] = *mp;
+		monitor_port_init(&ports[j++]);
+	}
+	num_ports = j;
+	if (!num_ports)
+		IBEXIT("no ports to monitor");
+
+	if (!monitor_json)
+		monitor_header();
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (sample = 0; !monitor_count || sample <= monitor_count; sample++) {
+		monitor_sample(async, ports, num_ports);
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		for (i = 0; i < num_ports; i++) {
+			mp = &ports[i];
+			if (mp->status) {
+				IBWARN("counters query failed on %s port %d: %s",
+				       portid2str(&mp->target->portid),
+				       mp->port, strerror(mp->status));
+				continue;
+			}
+			monitor_output(mp, monitor_secs(&now));
+		}
+		fflush(stdout);
+
+		next.tv_sec += (time_t) monitor_interval;
+		next.tv_nsec += (monitor_interval - (time_t) monitor_interval) *
+				1e9;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		/* Don't try to catch up on samples which took too long */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (monitor_secs(&next) < monitor_secs(&now))
+			next = now;
+		else
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+					NULL);
+	}
+
+	mad_rpc_async_destroy(async);
+	free(ports);
+	free(targets);
+}
+
 static int process_opt(void *context, int ch)
 {
 	switch (ch) {
@@ -807,6 +1241,27 @@ static int process_opt(void *context, int ch)
 	case 'R':
 		info.reset_only++;
 		break;
+	case 13:
+		monitor_interval = strtod(optarg, NULL);
+		if (monitor_interval <= 0)
+			IBEXIT("interval must be positive");
+		break;
+	case 14:
+		monitor_count = strtoul(optarg, NULL, 0);
+		break;
+	case 15:
+		if (!strcmp(optarg, "json"))
+			monitor_json = 1;
+		else if (strcmp(optarg, "csv"))
+			IBEXIT("unknown format %s", optarg);
+		break;
+	case 16:
+		monitor_outstanding = strtoul(optarg, NULL, 0);
+		if (monitor_outstanding <= 0 ||
+		    monitor_outstanding > MAD_RPC_ASYNC_MAX_WINDOW)
+			IBEXIT("outstanding must be between 1 and %d",
+			       MAD_RPC_ASYNC_MAX_WINDOW);
+		break;
 	default:
 		return -1;
 	}
@@ -827,7 +1282,6 @@ int main(int argc, char **argv)
 	uint8_t data[IB_SMP_DATA_SIZE] = { 0 };
 	int start_port = 1;
 	int enhancedport0;
-	char *tmpstr;
 	int i;
 
 	const struct ibdiag_opt opts[] = {
@@ -854,6 +1308,14 @@ int main(int argc, char **argv)
 		{"loop_ports", 'l', 0, NULL, "iterate through each port"},
 		{"reset_after_read", 'r', 0, NULL, "reset counters after read"},
 		{"Reset_only", 'R', 0, NULL, "only reset counters"},
+		{"interval", 13, 1, "<seconds>",
+		 "print the change of the counters every interval"},
+		{"count", 14, 1, "<samples>",
+		 "stop after this many intervals, default: run until killed"},
+		{"format", 15, 1, "<csv|json>",
+		 "output of --interval, default: csv"},
+		{"outstanding", 16, 1, "<queries>",
+		 "queries in flight with --interval, default: 32"},
 		{}
 	};
 	char usage_args[] = " [<lid|guid> [[port(s)] [reset_mask]]]";
@@ -873,6 +1335,7 @@ int main(int argc, char **argv)
 		"-l 32 1-10\t# read performance counters from lid 32, port 1-10, output each port",
 		"-a 32 1,4,8\t# read performance counters from lid 32, port 1, 4, and 8, aggregate output",
 		"-l 32 1,4,8\t# read performance counters from lid 32, port 1, 4, and 8, output each port",
+		"--interval 10 32:1-4 40:1\t# print the counter changes of lid 32 port 1-4 and lid 40 port 1 every 10 seconds",
 		NULL,
 	};
 
@@ -882,37 +1345,12 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc > 1) {
-		if (strchr(argv[1], ',')) {
-			tmpstr = strtok(argv[1], ",");
-			while (tmpstr) {
-				info.ports[info.ports_count++] =
-					strtoul(tmpstr, NULL, 0);
-				tmpstr = strtok(NULL, ",");
-			}
-			info.port = info.ports[0];
-		}
-		else if ((tmpstr = strchr(argv[1], '-'))) {
-			int pmin, pmax;
-
-			*tmpstr = '\0';
-			tmpstr++;
-
-			pmin = strtoul(argv[1], NULL, 0);
-			pmax = strtoul(tmpstr, NULL, 0);
-
-			if (pmin >= pmax)
-				IBEXIT("max port must be greater than min port in range");
-
-			while (pmin <= pmax)
-				info.ports[info.ports_count++] = pmin++;
-
-			info.port = info.ports[0];
-		}
-		else
-			info.port = strtoul(argv[1], NULL, 0);
+	/* With --interval, each argument is a target with its ports */
+	if (argc > 1 && !monitor_interval) {
+		info.ports_count = parse_ports(argv[1], info.ports);
+		info.port = info.ports[0];
 	}
-	if (argc > 2) {
+	if (argc > 2 && !monitor_interval) {
 		ext_mask = strtoull(argv[2], NULL, 0);
 		mask = ext_mask;
 	}
@@ -925,6 +1363,11 @@ int main(int argc, char **argv)
 
 	smp_mkey_set(srcports->smi.port, ibd_mkey);
 
+	if (monitor_interval) {
+		monitor(argc, argv);
+		goto done;
+	}
+
 	if (argc) {
 		if (resolve_portid_str(srcports->gsi.ca_name, ibd_ca_port, &portid, argv[0],
 				       ibd_dest_type, ibd_sm_id, srcport) < 0)
@@ -39,47 +39,72 @@
 
 #include <infiniband/umad.h>
 #include <infiniband/mad.h>
+#include "mad_internal.h"
 
 #undef DEBUG
 #define DEBUG 	if (ibdebug)	IBWARN
 
-uint8_t *pma_query_via(void *rcvbuf, ib_portid_t * dest, int port,
-		       unsigned timeout, unsigned id,
-		       const struct ibmad_port * srcport)
+static int pma_query_init(ib_rpc_v1_t *rpc, void *rcvbuf, ib_portid_t *dest,
+			  int port, unsigned timeout, unsigned id)
 {
-	ib_rpc_v1_t rpc = { 0 };
-	ib_rpc_t *rpcold = (ib_rpc_t *)(void *)&rpc;
 	int lid = dest->lid;
-	void *p_ret;
 
 	DEBUG("lid %u port %d", lid, port);
 
 	if (lid == -1) {
 		IBWARN("only lid routed is supported");
-		return NULL;
+		return -1;
 	}
 
-	rpc.mgtclass = IB_PERFORMANCE_CLASS | IB_MAD_RPC_VERSION1;
-	rpc.method = IB_MAD_METHOD_GET;
-	rpc.attr.id = id;
+	rpc->mgtclass = IB_PERFORMANCE_CLASS | IB_MAD_RPC_VERSION1;
+	rpc->method = IB_MAD_METHOD_GET;
+	rpc->attr.id = id;
 
 	/* Same for attribute IDs */
 	mad_set_field(rcvbuf, 0, IB_PC_PORT_SELECT_F, port);
-	rpc.attr.mod = 0;
-	rpc.timeout = timeout;
-	rpc.datasz = IB_PC_DATA_SZ;
-	rpc.dataoffs = IB_PC_DATA_OFFS;
+	rpc->attr.mod = 0;
+	rpc->timeout = timeout;
+	rpc->datasz = IB_PC_DATA_SZ;
+	rpc->dataoffs = IB_PC_DATA_OFFS;
 
 	if (!dest->qp)
 		dest->qp = 1;
 	if (!dest->qkey)
 		dest->qkey = IB_DEFAULT_QP1_QKEY;
+	return 0;
+}
+
+uint8_t *pma_query_via(void *rcvbuf, ib_portid_t * dest, int port,
+		       unsigned timeout, unsigned id,
+		       const struct ibmad_port * srcport)
+{
+	ib_rpc_v1_t rpc = { 0 };
+	ib_rpc_t *rpcold = (ib_rpc_t *)(void *)&rpc;
+	void *p_ret;
+
+	if (pma_query_init(&rpc, rcvbuf, dest, port, timeout, id))
+		return NULL;
 
 	p_ret = mad_rpc(srcport, rpcold, dest, rcvbuf, rcvbuf);
 	errno = rpc.error;
 	return p_ret;
 }
 
+int pma_query_async_via(struct mad_rpc_async *async, void *rcvbuf,
+			ib_portid_t *dest, int port, unsigned timeout,
+			unsigned id, mad_rpc_async_cb_fn *cb, void *context)
+{
+	ib_rpc_v1_t rpc = { 0 };
+
+	if (pma_query_init(&rpc, rcvbuf, dest, port, timeout, id)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return mad_rpc_async_submit(async, (ib_rpc_t *)(void *)&rpc, dest,
+				    rcvbuf, rcvbuf, cb, context);
+}
+
 uint8_t *performance_reset_via(void *rcvbuf, ib_portid_t * dest,
 			       int port, unsigned mask, unsigned timeout,
 			       unsigned id, const struct ibmad_port * srcport)
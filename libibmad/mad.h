@@ -1513,6 +1513,37 @@ void mad_rpc_set_retries(struct ibmad_port *port, int retries);
 void mad_rpc_set_timeout(struct ibmad_port *port, int timeout);
 int mad_rpc_class_agent(struct ibmad_port *srcport, int cls);
 
+/*
+ * Asynchronous interface: up to window MADs are outstanding at once on
+ * srcport, each with its own timeout and retries.  The callback of a MAD is
+ * called from mad_rpc_async_poll(), or from mad_rpc_async_submit() while it
+ * waits for room in the window, with status 0 and rcvdata filled in, EIO if
+ * the MAD completed with an error status (rpc->rstatus), or ETIMEDOUT.  rpc
+ * and dport are copies, dport being the redirection target if the MAD was
+ * redirected.  Callbacks may submit MADs.
+ *
+ * The TID of submitted MADs is assigned by the engine, RMPP is not
+ * supported, and only one engine may send MADs on srcport at a time.
+ */
+#define MAD_RPC_ASYNC_MAX_WINDOW	4096
+
+struct mad_rpc_async;
+typedef void (mad_rpc_async_cb_fn) (struct mad_rpc_async *async,
+				    ib_rpc_t *rpc, ib_portid_t *dport,
+				    void *rcvdata, int status, void *context);
+
+struct mad_rpc_async *mad_rpc_async_create(const struct ibmad_port *srcport,
+					   int window);
+void mad_rpc_async_destroy(struct mad_rpc_async *async);
+int mad_rpc_async_submit(struct mad_rpc_async *async, ib_rpc_t *rpc,
+			 ib_portid_t *dport, void *payload, void *rcvdata,
+			 mad_rpc_async_cb_fn *cb, void *context);
+/* Returns the number of completed MADs, waits at most timeout_ms if >= 0 */
+int mad_rpc_async_poll(struct mad_rpc_async *async, int timeout_ms);
+/* Waits for all outstanding MADs to complete */
+int mad_rpc_async_wait(struct mad_rpc_async *async);
+int mad_rpc_async_outstanding(struct mad_rpc_async *async);
+
 int mad_get_timeout(const struct ibmad_port *srcport, int override_ms);
 int mad_get_retries(const struct ibmad_port *srcport);
 
@@ -1594,6 +1625,10 @@ uint8_t *smp_set_status_via(void *data, ib_portid_t *portid, unsigned attrid,
 			    const struct ibmad_port *srcport);
 void smp_mkey_set(struct ibmad_port *srcport, uint64_t mkey);
 uint64_t smp_mkey_get(const struct ibmad_port *srcport);
+int smp_query_async_via(struct mad_rpc_async *async, void *rcvbuf,
+			ib_portid_t *portid, unsigned attrid, unsigned mod,
+			unsigned timeout, mad_rpc_async_cb_fn *cb,
+			void *context);
 
 /* cc.c */
 void *cc_query_status_via(void *rcvbuf, ib_portid_t *portid, unsigned attrid,
@@ -1649,6 +1684,9 @@ uint8_t *pma_query_via(void *rcvbuf, ib_portid_t *dest, int port,
 uint8_t *performance_reset_via(void *rcvbuf, ib_portid_t *dest, int port,
 			       unsigned mask, unsigned timeout, unsigned id,
 			       const struct ibmad_port *srcport);
+int pma_query_async_via(struct mad_rpc_async *async, void *rcvbuf,
+			ib_portid_t *dest, int port, unsigned timeout,
+			unsigned id, mad_rpc_async_cb_fn *cb, void *context);
 
 /* bm.c */
 uint8_t *bm_call_via(void *data, ib_portid_t *portid, ib_bm_call_t *call,
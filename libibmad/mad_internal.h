@@ -47,4 +47,6 @@ extern struct ibmad_port *ibmp;
 extern int madrpc_timeout;
 extern int madrpc_retries;
 
+const struct ibmad_port *mad_rpc_async_port(struct mad_rpc_async *async);
+
 #endif /* _MAD_INTERNAL_H_ */
@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include <infiniband/umad.h>
 #include <infiniband/mad.h>
@@ -330,6 +331,331 @@ void *mad_rpc_rmpp(const struct ibmad_port *port, ib_rpc_t * rpc,
 	return data;
 }
 
+/*
+ * Asynchronous RPCs.  The TID of each MAD selects its request slot, in the
+ * low bits, and a sequence number in the bits above tells a reply to the
+ * current request of a slot from a late reply to a previous one.
+ */
+struct mad_rpc_async_req {
+	ib_rpc_cc_t rpc;	/* the largest of the rpc variants */
+	ib_portid_t dport;
+	void *rcvdata;
+	mad_rpc_async_cb_fn *cb;	/* NULL if the slot is free */
+	void *context;
+	uint64_t deadline;
+	int timeout;
+	int retries;
+	int agent;
+	int len;
+	uint8_t *sndbuf;
+};
+
+struct mad_rpc_async {
+	const struct ibmad_port *port;
+	struct mad_rpc_async_req *reqs;
+	uint32_t *free_slots;
+	int num_free;
+	uint32_t mask;
+	uint32_t shift;
+	uint32_t seq;
+	int window;
+	int outstanding;
+	unsigned completed;	/* callbacks called, for mad_rpc_async_poll */
+	uint8_t *sndbufs;
+	uint8_t *rcvbuf;
+};
+
+#define MAD_ASYNC_BUF_SIZE	(umad_size() + IB_MAD_SIZE)
+#define MAD_ASYNC_RCV_LEN	1024
+
+static uint64_t async_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static size_t async_rpc_size(const ib_rpc_t *rpc)
+{
+	if ((rpc->mgtclass & 0xff) == IB_CC_CLASS)
+		return sizeof(ib_rpc_cc_t);
+	if ((rpc->mgtclass & IB_MAD_RPC_VERSION_MASK) == IB_MAD_RPC_VERSION1)
+		return sizeof(ib_rpc_v1_t);
+	return sizeof(ib_rpc_t);
+}
+
+struct mad_rpc_async *mad_rpc_async_create(const struct ibmad_port *srcport,
+					   int window)
+{
+	struct mad_rpc_async *async;
+	uint32_t slots = 1, i;
+
+	if (window <= 0 || window > MAD_RPC_ASYNC_MAX_WINDOW) {
+		IBWARN("invalid window %d", window);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	async = calloc(1, sizeof(*async));
+	if (!async) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	while (slots < (uint32_t) window) {
+		slots <<= 1;
+		async->shift++;
+	}
+	async->mask = slots - 1;
+	async->port = srcport;
+	async->window = window;
+	async->seq = (uint32_t) mad_trid();
+
+	async->reqs = calloc(slots, sizeof(*async->reqs));
+	async->free_slots = calloc(slots, sizeof(*async->free_slots));
+	async->sndbufs = calloc(slots, MAD_ASYNC_BUF_SIZE);
+	async->rcvbuf = calloc(1, umad_size() + MAD_ASYNC_RCV_LEN);
+	if (!async->reqs || !async->free_slots || !async->sndbufs ||
+	    !async->rcvbuf) {
+		mad_rpc_async_destroy(async);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	for (i = 0; i < slots; i++) {
+		async->reqs[i].sndbuf = async->sndbufs + i * MAD_ASYNC_BUF_SIZE;
+		async->free_slots[async->num_free++] = slots - 1 - i;
+	}
+	return async;
+}
+
+void mad_rpc_async_destroy(struct mad_rpc_async *async)
+{
+	free(async->reqs);
+	free(async->free_slots);
+	free(async->sndbufs);
+	free(async->rcvbuf);
+	free(async);
+}
+
+const struct ibmad_port *mad_rpc_async_port(struct mad_rpc_async *async)
+{
+	return async->port;
+}
+
+int mad_rpc_async_outstanding(struct mad_rpc_async *async)
+{
+	return async->outstanding;
+}
+
+static int async_send(struct mad_rpc_async *async,
+		      struct mad_rpc_async_req *req)
+{
+	if (ibdebug > 1) {
+		IBWARN(">>> sending: len %d pktsz %zu", req->len,
+		       umad_size() + req->len);
+		xdump(stderr, "send buf\n", req->sndbuf,
+		      umad_size() + req->len);
+	}
+
+	/*
+	 * The kernel returns the MAD with a timeout status if no reply comes,
+	 * the deadline covers a send lost before that.
+	 */
+	req->deadline = async_now_ms() + 2 * req->timeout;
+	if (umad_send(async->port->port_id, req->agent, req->sndbuf, req->len,
+		      req->timeout, 0) < 0) {
+		IBWARN("send failed; %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Frees the slot of req before calling its callback, which may submit */
+static void async_complete(struct mad_rpc_async *async,
+			   struct mad_rpc_async_req *req, int status)
+{
+	ib_rpc_cc_t rpc = req->rpc;
+	ib_portid_t dport = req->dport;
+	mad_rpc_async_cb_fn *cb = req->cb;
+
+	if ((rpc.mgtclass & IB_MAD_RPC_VERSION_MASK) == IB_MAD_RPC_VERSION1)
+		rpc.error = status == ETIMEDOUT ? ETIMEDOUT : 0;
+
+	req->cb = NULL;
+	async->free_slots[async->num_free++] = req - async->reqs;
+	async->outstanding--;
+	async->completed++;
+
+	cb(async, (ib_rpc_t *)(void *)&rpc, &dport, req->rcvdata, status,
+	   req->context);
+}
+
+static void async_retry(struct mad_rpc_async *async,
+			struct mad_rpc_async_req *req)
+{
+	if (--req->retries > 0) {
+		ERRS("retry tid 0x%x (timeout %d ms)", (uint32_t) req->rpc.trid,
+		     req->timeout);
+		if (!async_send(async, req))
+			return;
+	} else {
+		ERRS("timeout tid 0x%x; dport (%s)", (uint32_t) req->rpc.trid,
+		     portid2str(&req->dport));
+	}
+	async_complete(async, req, ETIMEDOUT);
+}
+
+static void async_process(struct mad_rpc_async *async)
+{
+	struct mad_rpc_async_req *req;
+	uint8_t *mad = umad_get_mad(async->rcvbuf);
+	uint32_t trid, status;
+
+	if (ibdebug > 2)
+		umad_addr_dump(umad_get_mad_addr(async->rcvbuf));
+	if (ibdebug > 1) {
+		IBWARN("rcv buf:");
+		xdump(stderr, "rcv buf\n", mad, IB_MAD_SIZE);
+	}
+
+	trid = (uint32_t) mad_get_field64(mad, 0, IB_MAD_TRID_F);
+	req = &async->reqs[trid & async->mask];
+	if (!req->cb || (uint32_t) req->rpc.trid != trid) {
+		DEBUG("dropping MAD with unknown tid 0x%x", trid);
+		return;
+	}
+
+	status = umad_status(async->rcvbuf);
+	if (status && status != ENOMEM) {
+		async_retry(async, req);
+		return;
+	}
+
+	status = mad_get_field(mad, 0, IB_DRSMP_STATUS_F);
+	if (status == IB_MAD_STS_REDIRECT && !redirect_port(&req->dport, mad)) {
+		/* The payload is still in the send buffer */
+		if (mad_build_pkt(req->sndbuf, (ib_rpc_t *)(void *)&req->rpc,
+				  &req->dport, NULL, NULL) >= 0 &&
+		    !async_send(async, req))
+			return;
+		async_complete(async, req, EIO);
+		return;
+	}
+
+	req->rpc.rstatus = status;
+	if (status) {
+		ERRS("MAD completed with error status 0x%x; dport (%s)",
+		     status, portid2str(&req->dport));
+		async_complete(async, req, EIO);
+		return;
+	}
+
+	if (req->rcvdata)
+		memcpy(req->rcvdata, mad + req->rpc.dataoffs, req->rpc.datasz);
+	async_complete(async, req, 0);
+}
+
+static void async_expire(struct mad_rpc_async *async, uint64_t now)
+{
+	uint32_t i;
+
+	for (i = 0; i <= async->mask; i++)
+		if (async->reqs[i].cb && async->reqs[i].deadline <= now)
+			async_retry(async, &async->reqs[i]);
+}
+
+int mad_rpc_async_poll(struct mad_rpc_async *async, int timeout_ms)
+{
+	uint64_t now, first;
+	unsigned completed = async->completed;
+	int length, ret, wait;
+	uint32_t i;
+
+	if (!async->outstanding)
+		return 0;
+
+	now = async_now_ms();
+	first = UINT64_MAX;
+	for (i = 0; i <= async->mask; i++)
+		if (async->reqs[i].cb && async->reqs[i].deadline < first)
+			first = async->reqs[i].deadline;
+	wait = first > now ? (int) (first - now) : 0;
+	if (timeout_ms >= 0 && timeout_ms < wait)
+		wait = timeout_ms;
+
+	for (;;) {
+		length = MAD_ASYNC_RCV_LEN;
+		ret = umad_recv(async->port->port_id, async->rcvbuf, &length,
+				wait);
+		if (ret < 0) {
+			if (errno == ETIMEDOUT || errno == EAGAIN ||
+			    errno == EWOULDBLOCK)
+				break;
+			IBWARN("recv failed: %s", strerror(errno));
+			return -1;
+		}
+		async_process(async);
+		/* Drain what else is already queued, without waiting */
+		wait = 0;
+	}
+
+	async_expire(async, async_now_ms());
+	/* Includes MADs completed by polls nested in the callbacks */
+	return async->completed - completed;
+}
+
+int mad_rpc_async_wait(struct mad_rpc_async *async)
+{
+	while (async->outstanding)
+		if (mad_rpc_async_poll(async, -1) < 0)
+			return -1;
+	return 0;
+}
+
+int mad_rpc_async_submit(struct mad_rpc_async *async, ib_rpc_t *rpc,
+			 ib_portid_t *dport, void *payload, void *rcvdata,
+			 mad_rpc_async_cb_fn *cb, void *context)
+{
+	const struct ibmad_port *port = async->port;
+	struct mad_rpc_async_req *req;
+	uint32_t slot;
+
+	if (!cb || (rpc->mgtclass & 0xff) >= MAX_CLASS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (async->outstanding >= async->window)
+		if (mad_rpc_async_poll(async, -1) < 0)
+			return -1;
+
+	slot = async->free_slots[--async->num_free];
+	req = &async->reqs[slot];
+	memcpy(&req->rpc, rpc, async_rpc_size(rpc));
+	req->rpc.trid = ((async->seq++ << async->shift) | slot) & 0xffffffff;
+	req->rpc.rstatus = 0;
+	req->dport = *dport;
+	req->rcvdata = rcvdata;
+	req->context = context;
+	req->agent = port->class_agents[rpc->mgtclass & 0xff];
+	req->timeout = mad_get_timeout(port, rpc->timeout);
+	req->retries = mad_get_retries(port);
+
+	memset(req->sndbuf, 0, MAD_ASYNC_BUF_SIZE);
+	req->len = mad_build_pkt(req->sndbuf, (ib_rpc_t *)(void *)&req->rpc,
+				 &req->dport, NULL, payload);
+	if (req->len < 0 || async_send(async, req)) {
+		async->free_slots[async->num_free++] = slot;
+		return -1;
+	}
+
+	req->cb = cb;
+	async->outstanding++;
+	return 0;
+}
+
 void *madrpc(ib_rpc_t * rpc, ib_portid_t * dport, void *payload, void *rcvdata)
 {
 	return mad_rpc(ibmp, rpc, dport, payload, rcvdata);
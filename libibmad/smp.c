@@ -98,32 +98,38 @@ uint8_t *smp_set(void *data, ib_portid_t * portid, unsigned attrid,
 	return smp_set_via(data, portid, attrid, mod, timeout, ibmp);
 }
 
-uint8_t *smp_query_status_via(void *rcvbuf, ib_portid_t * portid,
-			      unsigned attrid, unsigned mod, unsigned timeout,
-			      int *rstatus, const struct ibmad_port * srcport)
+static void smp_query_init(ib_rpc_t *rpc, ib_portid_t *portid,
+			   unsigned attrid, unsigned mod, unsigned timeout,
+			   const struct ibmad_port *srcport)
 {
-	ib_rpc_t rpc = { 0 };
-	uint8_t *res;
-
 	DEBUG("attr 0x%x mod 0x%x route %s", attrid, mod, portid2str(portid));
-	rpc.method = IB_MAD_METHOD_GET;
-	rpc.attr.id = attrid;
-	rpc.attr.mod = mod;
-	rpc.timeout = timeout;
-	rpc.datasz = IB_SMP_DATA_SIZE;
-	rpc.dataoffs = IB_SMP_DATA_OFFS;
-	rpc.mkey = srcport->smp_mkey;
+	rpc->method = IB_MAD_METHOD_GET;
+	rpc->attr.id = attrid;
+	rpc->attr.mod = mod;
+	rpc->timeout = timeout;
+	rpc->datasz = IB_SMP_DATA_SIZE;
+	rpc->dataoffs = IB_SMP_DATA_OFFS;
+	rpc->mkey = srcport->smp_mkey;
 
 	if ((portid->lid <= 0) ||
 	    (portid->drpath.drslid == 0xffff) ||
 	    (portid->drpath.drdlid == 0xffff))
-		rpc.mgtclass = IB_SMI_DIRECT_CLASS;	/* direct SMI */
+		rpc->mgtclass = IB_SMI_DIRECT_CLASS;	/* direct SMI */
 	else
-		rpc.mgtclass = IB_SMI_CLASS;	/* Lid routed SMI */
+		rpc->mgtclass = IB_SMI_CLASS;	/* Lid routed SMI */
 
 	portid->sl = 0;
 	portid->qp = 0;
+}
 
+uint8_t *smp_query_status_via(void *rcvbuf, ib_portid_t * portid,
+			      unsigned attrid, unsigned mod, unsigned timeout,
+			      int *rstatus, const struct ibmad_port * srcport)
+{
+	ib_rpc_t rpc = { 0 };
+	uint8_t *res;
+
+	smp_query_init(&rpc, portid, attrid, mod, timeout, srcport);
 	res = mad_rpc(srcport, &rpc, portid, rcvbuf, rcvbuf);
 	if (rstatus)
 		*rstatus = rpc.rstatus;
@@ -138,6 +144,19 @@ uint8_t *smp_query_via(void *rcvbuf, ib_portid_t * portid, unsigned attrid,
 				    srcport);
 }
 
+int smp_query_async_via(struct mad_rpc_async *async, void *rcvbuf,
+			ib_portid_t *portid, unsigned attrid, unsigned mod,
+			unsigned timeout, mad_rpc_async_cb_fn *cb,
+			void *context)
+{
+	ib_rpc_t rpc = { 0 };
+
+	smp_query_init(&rpc, portid, attrid, mod, timeout,
+		       mad_rpc_async_port(async));
+	return mad_rpc_async_submit(async, &rpc, portid, rcvbuf, rcvbuf, cb,
+				    context);
+}
+
 uint8_t *smp_query(void *rcvbuf, ib_portid_t * portid, unsigned attrid,
 		   unsigned mod, unsigned timeout)
 {
@@ -0,0 +1,108 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+
+#include <stdlib.h>
+#include "internal.h"
+
+#define IBND_HASH_MIN_SIZE 64
+
+static uint32_t ibnd_hash_key(uint64_t key, uint32_t key2)
+{
+	/* GUIDs of a fabric differ in a few low bytes, mix them everywhere */
+	key ^= key2 * 0x9e3779b97f4a7c15ULL;
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+static void ibnd_hash_place(struct ibnd_hash_entry *entries, uint32_t mask,
+			    const struct ibnd_hash_entry *entry)
+{
+	uint32_t i = ibnd_hash_key(entry->key, entry->key2) & mask;
+
+	while (entries[i].item)
+		i = (i + 1) & mask;
+	entries[i] = *entry;
+}
+
+/* Doubles the table, keeping it at most half full */
+static int ibnd_hash_grow(struct ibnd_hash *hash)
+{
+	struct ibnd_hash_entry *entries;
+	uint32_t i, size;
+
+	size = hash->entries ? (hash->mask + 1) * 2 : IBND_HASH_MIN_SIZE;
+	entries = calloc(size, sizeof(*entries));
+	if (!entries)
+		return -1;
+
+	for (i = 0; hash->entries && i <= hash->mask; i++)
+		if (hash->entries[i].item)
+			ibnd_hash_place(entries, size - 1, &hash->entries[i]);
+
+	free(hash->entries);
+	hash->entries = entries;
+	hash->mask = size - 1;
+	return 0;
+}
+
+/*
+ * Returns 0 if item was added, or replaced the item with the same key, 1 if
+ * it is already in the table under that key, and -1 if out of memory.
+ */
+int ibnd_hash_add(struct ibnd_hash *hash, uint64_t key, uint32_t key2,
+		  void *item, enum ibnd_hash_mode mode)
+{
+	struct ibnd_hash_entry entry = { key, key2, item };
+	struct ibnd_hash_entry *e;
+	uint32_t i;
+
+	if ((hash->count + 1) * 2 > (hash->entries ? hash->mask + 1 : 0) &&
+	    ibnd_hash_grow(hash))
+		return -1;
+
+	for (i = ibnd_hash_key(key, key2) & hash->mask;
+	     (e = &hash->entries[i])->item; i = (i + 1) & hash->mask) {
+		if (e->key != key || e->key2 != key2)
+			continue;
+		if (e->item == item)
+			return 1;
+		if (mode == IBND_HASH_KEEP)
+			return 0;
+		if (mode == IBND_HASH_REPLACE) {
+			e->item = item;
+			return 0;
+		}
+	}
+
+	*e = entry;
+	hash->count++;
+	return 0;
+}
+
+/* Returns an item added with the key */
+void *ibnd_hash_find(const struct ibnd_hash *hash, uint64_t key, uint32_t key2)
+{
+	const struct ibnd_hash_entry *e;
+	uint32_t i;
+
+	if (!hash->entries)
+		return NULL;
+
+	for (i = ibnd_hash_key(key, key2) & hash->mask;
+	     (e = &hash->entries[i])->item; i = (i + 1) & hash->mask)
+		if (e->key == key && e->key2 == key2)
+			return e->item;
+	return NULL;
+}
+
+/* The items are not released */
+void ibnd_hash_destroy(struct ibnd_hash *hash)
+{
+	free(hash->entries);
+	hash->entries = NULL;
+	hash->mask = 0;
+	hash->count = 0;
+}
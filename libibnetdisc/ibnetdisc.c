@@ -222,10 +222,22 @@ static int is_mlnx_ext_port_info_supported(ibnd_port_t * port)
 	return 0;
 }
 
+/*
+ * The port a node was reached through, which leads back to a known node.
+ * The other ports of a switch may have been queried, LID routed, by another
+ * engine, so take it from port 0.
+ */
+static uint8_t local_port_num(ibnd_node_t * node, ibnd_port_t * port)
+{
+	if (node->type == IB_NODE_SWITCH && node->ports[0])
+		port = node->ports[0];
+	return (uint8_t) mad_get_field(port->info, 0, IB_PORT_LOCAL_PORT_F);
+}
+
 int mlnx_ext_port_info_err(smp_engine_t * engine, ibnd_smp_t * smp,
 			   uint8_t * mad, void *cb_data)
 {
-	f_internal_t *f_int = ((ibnd_scan_t *) engine->user_data)->f_int;
+	ibnd_scan_t *scan = engine->user_data;
 	ibnd_node_t *node = cb_data;
 	ibnd_port_t *port;
 	uint8_t port_num, local_port;
@@ -238,18 +250,18 @@ int mlnx_ext_port_info_err(smp_engine_t * engine, ibnd_smp_t * smp,
 		return -1;
 	}
 
-	local_port = (uint8_t) mad_get_field(port->info, 0, IB_PORT_LOCAL_PORT_F);
+	local_port = local_port_num(node, port);
 	debug_port(&smp->path, port);
 
 	if (port_num && mad_get_field(port->info, 0, IB_PORT_PHYS_STATE_F)
 	    == IB_PORT_PHYS_STATE_LINKUP
 	    && ((node->type == IB_NODE_SWITCH && port_num != local_port) ||
-		(node == f_int->fabric.from_node && port_num == f_int->fabric.from_portnum))) {
+		(node == scan->from_node && port_num == scan->from_portnum))) {
 		int rc = 0;
 		ib_portid_t path = smp->path;
 
 		if (node->type != IB_NODE_SWITCH &&
-		    node == f_int->fabric.from_node &&
+		    node == scan->from_node &&
 		    path.drpath.cnt > 1)
 			rc = retract_dpath(engine, &path);
 		else {
@@ -272,7 +284,7 @@ int mlnx_ext_port_info_err(smp_engine_t * engine, ibnd_smp_t * smp,
 static int recv_mlnx_ext_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 				   uint8_t * mad, void *cb_data)
 {
-	f_internal_t *f_int = ((ibnd_scan_t *) engine->user_data)->f_int;
+	ibnd_scan_t *scan = engine->user_data;
 	ibnd_node_t *node = cb_data;
 	ibnd_port_t *port;
 	uint8_t *ext_port_info = mad + IB_SMP_DATA_OFFS;
@@ -287,18 +299,18 @@ static int recv_mlnx_ext_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 	}
 
 	memcpy(port->ext_info, ext_port_info, sizeof(port->ext_info));
-	local_port = (uint8_t) mad_get_field(port->info, 0, IB_PORT_LOCAL_PORT_F);
+	local_port = local_port_num(node, port);
 	debug_port(&smp->path, port);
 
 	if (port_num && mad_get_field(port->info, 0, IB_PORT_PHYS_STATE_F)
 	    == IB_PORT_PHYS_STATE_LINKUP
 	    && ((node->type == IB_NODE_SWITCH && port_num != local_port) ||
-		(node == f_int->fabric.from_node && port_num == f_int->fabric.from_portnum))) {
+		(node == scan->from_node && port_num == scan->from_portnum))) {
 		int rc = 0;
 		ib_portid_t path = smp->path;
 
 		if (node->type != IB_NODE_SWITCH &&
-		    node == f_int->fabric.from_node &&
+		    node == scan->from_node &&
 		    path.drpath.cnt > 1)
 			rc = retract_dpath(engine, &path);
 		else {
@@ -340,7 +352,6 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 	uint8_t *info;
 
 	port_num = (uint8_t) mad_get_field(mad, 0, IB_MAD_ATTRMOD_F);
-	local_port = (uint8_t) mad_get_field(port_info, 0, IB_PORT_LOCAL_PORT_F);
 
 	/* this may have been created before */
 	port = node->ports[port_num];
@@ -356,6 +367,7 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 	}
 
 	memcpy(port->info, port_info, sizeof(port->info));
+	local_port = local_port_num(node, port);
 	port->node = node;
 	port->portnum = port_num;
 	port->ext_portnum = 0;
@@ -370,7 +382,7 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 		port->lmc = node->smalmc;
 	}
 
-	int rc1 = add_to_portguid_hash(port, f_int->fabric.portstbl);
+	int rc1 = add_to_portguid_hash(port, f_int);
 	if (rc1)
 		IBND_ERROR("Error Occurred when trying"
 			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
@@ -403,13 +415,13 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 	if (port_num && mad_get_field(port->info, 0, IB_PORT_PHYS_STATE_F)
 	    == IB_PORT_PHYS_STATE_LINKUP
 	    && ((node->type == IB_NODE_SWITCH && port_num != local_port) ||
-		(node == f_int->fabric.from_node && port_num == f_int->fabric.from_portnum))) {
+		(node == scan->from_node && port_num == scan->from_portnum))) {
 
 		int rc = 0;
 		ib_portid_t path = smp->path;
 
 		if (node->type != IB_NODE_SWITCH &&
-		    node == f_int->fabric.from_node &&
+		    node == scan->from_node &&
 		    path.drpath.cnt > 1)
 			rc = retract_dpath(engine, &path);
 		else {
@@ -429,16 +441,49 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 	return 0;
 }
 
+/*
+ * With several engines, the least loaded one queries the ports of a switch
+ * with a LID, LID routed, so the discovery spreads over all of them.
+ */
+static smp_engine_t *sweep_engine(smp_engine_t * engine, ibnd_node_t * node)
+{
+	struct smp_engine_group *group = engine->group;
+	smp_engine_t *best = engine;
+	ibnd_scan_t *scan;
+	int i;
+
+	if (!group || !node->smalid || node->smalid > 0xbfff)
+		return engine;
+
+	for (i = 0; i < group->count; i++) {
+		scan = group->engines[i]->user_data;
+		if (scan->selfportid.lid &&
+		    smp_engine_load(group->engines[i]) < smp_engine_load(best))
+			best = group->engines[i];
+	}
+	return best;
+}
+
 static int recv_port0_info(smp_engine_t * engine, ibnd_smp_t * smp,
 			   uint8_t * mad, void *cb_data)
 {
 	ibnd_node_t *node = cb_data;
+	ib_portid_t lid_path = { 0 };
+	ib_portid_t *path = &smp->path;
+	smp_engine_t *sweeper;
 	int i, status;
 
 	status = recv_port_info(engine, smp, mad, cb_data);
+
+	sweeper = sweep_engine(engine, node);
+	if (sweeper != engine) {
+		lid_path.lid = node->smalid;
+		path = &lid_path;
+	}
+
 	/* Query PortInfo on switch external/physical ports */
 	for (i = 1; i <= node->numports; i++)
-		query_port_info(engine, &smp->path, node, i);
+		query_port_info(sweeper, path, node, i);
 
 	return status;
 }
@@ -477,7 +522,7 @@ static ibnd_node_t *create_node(smp_engine_t * engine, ib_portid_t * path,
 	rc->path_portid = *path;
 	memcpy(rc->info, node_info, sizeof(rc->info));
 
-	int rc1 = add_to_nodeguid_hash(rc, f_int->fabric.nodestbl);
+	int rc1 = add_to_nodeguid_hash(rc, f_int);
 	if (rc1)
 		IBND_ERROR("Error Occurred when trying"
 			   " to insert new node guid 0x%016" PRIx64 " to DB\n",
@@ -530,6 +575,7 @@ static int recv_node_info(smp_engine_t * engine, ibnd_smp_t * smp,
 	int rem_port_num = 0;
 	ibnd_node_t *node;
 	int node_is_new = 0;
+	int port_is_new = 0;
 	uint64_t node_guid = mad_get_field64(node_info, 0, IB_NODE_GUID_F);
 	uint64_t port_guid = mad_get_field64(node_info, 0, IB_NODE_PORT_GUID_F);
 	int port_num = mad_get_field(node_info, 0, IB_NODE_LOCAL_PORT_F);
@@ -560,6 +606,7 @@ static int recv_node_info(smp_engine_t * engine, ibnd_smp_t * smp,
 			return -1;
 		port->node = node;
 		port->portnum = port_num;
+		port_is_new = 1;
 	}
 	port->guid = port_guid;
 
@@ -568,8 +615,8 @@ static int recv_node_info(smp_engine_t * engine, ibnd_smp_t * smp,
 			     node, port);
 
 	if (rem_node == NULL) {	/* this is the start node */
-		f_int->fabric.from_node = node;
-		f_int->fabric.from_portnum = port_num;
+		scan->from_node = node;
+		scan->from_portnum = port_num;
 	} else {
 		/* link ports... */
 		if (!rem_node->ports[rem_port_num]) {
@@ -593,7 +640,8 @@ static int recv_node_info(smp_engine_t * engine, ibnd_smp_t * smp,
 		}
 	}
 
-	if (node->type != IB_NODE_SWITCH)
+	/* with several engines, another one may have reached this port */
+	if (node->type != IB_NODE_SWITCH && (port_is_new || !engine->group))
 		query_port_info(engine, &smp->path, node, port_num);
 
 	return 0;
@@ -609,19 +657,12 @@ static int query_node_info(smp_engine_t * engine, ib_portid_t * portid,
 
 ibnd_node_t *ibnd_find_node_guid(ibnd_fabric_t * fabric, uint64_t guid)
 {
-	int hash = HASHGUID(guid) % HTSZ;
-	ibnd_node_t *node;
-
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
 		return NULL;
 	}
 
-	for (node = fabric->nodestbl[hash]; node; node = node->htnext)
-		if (node->guid == guid)
-			return node;
-
-	return NULL;
+	return ibnd_hash_find(&((f_internal_t *)fabric)->nodes, guid, 0);
 }
 
 ibnd_node_t *ibnd_find_node_dr(ibnd_fabric_t * fabric, char *dr_str)
@@ -630,63 +671,44 @@ ibnd_node_t *ibnd_find_node_dr(ibnd_fabric_t * fabric, char *dr_str)
 	return rc->node;
 }
 
-int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[])
+/* The last node added with a GUID is found, as a GUID should be unique */
+int add_to_nodeguid_hash(ibnd_node_t * node, f_internal_t * f_int)
 {
-	int rc = 0;
-	ibnd_node_t *tblnode;
-	int hash_idx = HASHGUID(node->guid) % HTSZ;
-
-	for (tblnode = hash[hash_idx]; tblnode; tblnode = tblnode->htnext) {
-		if (tblnode == node) {
-			IBND_ERROR("Duplicate Node: Node with guid 0x%016"
-				   PRIx64 " already exists in nodes DB\n",
-				   node->guid);
-			return 1;
-		}
-	}
-	node->htnext = hash[hash_idx];
-	hash[hash_idx] = node;
-	return rc;
+	int rc = ibnd_hash_add(&f_int->nodes, node->guid, 0, node,
+			       IBND_HASH_REPLACE);
+
+	if (rc > 0)
+		IBND_ERROR("Duplicate Node: Node with guid 0x%016"
+			   PRIx64 " already exists in nodes DB\n",
+			   node->guid);
+	return rc ? 1 : 0;
 }
 
-int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[])
+int add_to_portguid_hash(ibnd_port_t * port, f_internal_t * f_int)
 {
-	int rc = 0;
-	ibnd_port_t *tblport;
-	int hash_idx = HASHGUID(port->guid) % HTSZ;
-
-	for (tblport = hash[hash_idx]; tblport; tblport = tblport->htnext) {
-		if (tblport == port) {
-			IBND_ERROR("Duplicate Port: Port with guid 0x%016"
-				   PRIx64 " already exists in ports DB\n",
-				   port->guid);
-			return 1;
-		}
-	}
-	port->htnext = hash[hash_idx];
-	hash[hash_idx] = port;
-	return rc;
-}
+	int rc = ibnd_hash_add(&f_int->ports, port->guid, port->portnum, port,
+			       IBND_HASH_MULTI);
 
-struct lid2guid_item {
-	cl_map_item_t cl_map;
-	ibnd_port_t *port;
-};
+	if (rc > 0) {
+		IBND_ERROR("Duplicate Port: Port with guid 0x%016"
+			   PRIx64 " already exists in ports DB\n",
+			   port->guid);
+		return 1;
+	}
 
-void create_lid2guid(f_internal_t *f_int)
-{
-	cl_qmap_init(&f_int->lid2guid);
+	/* The ports of a switch share their GUID */
+	if (!rc)
+		rc = ibnd_hash_add(&f_int->portguids, port->guid, 0, port,
+				   IBND_HASH_REPLACE);
+	return rc ? 1 : 0;
 }
 
-void destroy_lid2guid(f_internal_t *f_int)
+void destroy_fabric_hashes(f_internal_t *f_int)
 {
-	cl_map_item_t *item;
-
-	for (item = cl_qmap_head(&f_int->lid2guid); item != cl_qmap_end(&f_int->lid2guid);
-	     item = cl_qmap_head(&f_int->lid2guid)) {
-		cl_qmap_remove_item(&f_int->lid2guid, item);
-		free(container_of(item, struct lid2guid_item, cl_map));
-	}
+	ibnd_hash_destroy(&f_int->nodes);
+	ibnd_hash_destroy(&f_int->ports);
+	ibnd_hash_destroy(&f_int->portguids);
+	ibnd_hash_destroy(&f_int->lids);
 }
 
 void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int)
@@ -698,19 +720,9 @@ void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int)
 	if (base_lid > 0 && base_lid <= 0xbfff) {
 		/* We add the port for all lids
 		 * so it is easier to find any "random" lid specified */
-		for (lid = base_lid; lid <= (base_lid + lid_mask); lid++) {
-			struct lid2guid_item *item;
-
-			item = malloc(sizeof(*item));
-			if (item) {
-				item->port = port;
-				if (cl_qmap_insert(&f_int->lid2guid, lid,
-						   &item->cl_map) != &item->cl_map) {
-					/* Port is already in map, release item */
-					free(item);
-				}
-			}
-		}
+		for (lid = base_lid; lid <= (base_lid + lid_mask); lid++)
+			ibnd_hash_add(&f_int->lids, lid, 0, port,
+				      IBND_HASH_KEEP);
 	}
 }
 
@@ -753,11 +765,213 @@ static int set_config(struct ibnd_config *config, struct ibnd_config *cfg)
 
 f_internal_t *allocate_fabric_internal(void)
 {
-	f_internal_t *f = calloc(1, sizeof(*f));
-	if (f)
-		create_lid2guid(f);
+	return calloc(1, sizeof(f_internal_t));
+}
+
+/* A local port the fabric is discovered from */
+struct discover_port {
+	smp_engine_t engine;
+	ibnd_scan_t scan;
+	__be64 port_guid;
+	pthread_t thread;
+	int rc;
+};
+
+static void *discover_thread(void *arg)
+{
+	struct discover_port *dport = arg;
+	struct smp_engine_group *group = dport->engine.group;
+
+	if (group) {
+		pthread_mutex_lock(&group->lock);
+		while (!group->started)
+			pthread_cond_wait(&group->cond, &group->lock);
+		pthread_mutex_unlock(&group->lock);
+	}
+
+	dport->rc = process_mads(&dport->engine);
+	return NULL;
+}
+
+/*
+ * Returns the GUID of the SM the port is managed by, from its SMInfo, or 0
+ * if it can't be queried.
+ */
+static uint64_t port_sm_guid(char *ca_name, int portnum, uint16_t sm_lid,
+			     struct ibnd_config *cfg)
+{
+	int mc[2] = { IB_SMI_CLASS, IB_SMI_DIRECT_CLASS };
+	uint8_t data[IB_SMP_DATA_SIZE] = { 0 };
+	ib_portid_t portid = { 0 };
+	struct ibmad_port *srcport;
+	uint64_t guid = 0;
+
+	srcport = mad_rpc_open_port(ca_name, portnum, mc, 2);
+	if (!srcport)
+		return 0;
+	mad_rpc_set_timeout(srcport, cfg->timeout_ms);
+	mad_rpc_set_retries(srcport, cfg->retries);
+	smp_mkey_set(srcport, cfg->mkey);
+
+	portid.lid = sm_lid;
+	if (smp_query_via(data, &portid, IB_ATTR_SMINFO, 0, 0, srcport))
+		mad_decode_field(data, IB_SMINFO_GUID_F, &guid);
 
-	return (f);
+	mad_rpc_close_port(srcport);
+	return guid;
+}
+
+/*
+ * Opens the other active ports on the subnet of the first port, once per
+ * port GUID, up to max ports in all.  Returns the number of ports.
+ *
+ * Separate fabrics may well use the same default GID prefix and SM LID,
+ * so a port is only used if its SM has the same GUID as that of the first
+ * port.
+ */
+static int add_discover_ports(struct discover_port *dports, int max,
+			      char *ca_name, int portnum,
+			      struct ibnd_config *cfg)
+{
+	struct umad_ca_pair cas[UMAD_MAX_PORTS];
+	umad_port_t self;
+	umad_port_t *port;
+	umad_ca_t ca;
+	uint64_t sm_guid, guid;
+	int n = 1, ncas, i, p, j;
+
+	if (umad_get_port(ca_name, portnum, &self) < 0) {
+		IBND_ERROR("can't get UMAD port (%s:%d)\n", ca_name, portnum);
+		return n;
+	}
+	dports[0].port_guid = self.port_guid;
+
+	sm_guid = port_sm_guid(ca_name, portnum, self.sm_lid, cfg);
+	if (!sm_guid) {
+		IBND_DEBUG("can't query SMInfo from %s:%d, using one port\n",
+			   ca_name, portnum);
+		goto out;
+	}
+
+	ncas = umad_get_smi_gsi_pairs(cas, UMAD_MAX_PORTS);
+	for (i = 0; i < ncas && n < max; i++) {
+		if (!cas[i].smi_name[0] || umad_get_ca(cas[i].smi_name, &ca) < 0)
+			continue;
+
+		for (p = 1; p <= ca.numports && n < max; p++) {
+			port = ca.ports[p];
+			if (!port || port->state != 4 ||	/* ACTIVE */
+			    (strcmp(port->link_layer, "InfiniBand") &&
+			     strcmp(port->link_layer, "IB")) ||
+			    port->gid_prefix != self.gid_prefix ||
+			    port->sm_lid != self.sm_lid)
+				continue;
+			for (j = 0; j < n; j++)
+				if (dports[j].port_guid == port->port_guid)
+					break;
+			if (j < n)
+				continue;
+
+			guid = port_sm_guid(ca.ca_name, p, port->sm_lid, cfg);
+			if (guid != sm_guid) {
+				IBND_DEBUG("%s:%d is managed by SM 0x%016" PRIx64
+					   ", not 0x%016" PRIx64 ", skipping\n",
+					   ca.ca_name, p, guid, sm_guid);
+				continue;
+			}
+
+			dports[n].scan = dports[0].scan;
+			dports[n].scan.selfportid.lid = port->base_lid;
+			dports[n].scan.initial_hops = 0;
+			if (smp_engine_init(&dports[n].engine, ca.ca_name, p,
+					    &dports[n].scan, cfg))
+				continue;
+			dports[n].port_guid = port->port_guid;
+			IBND_DEBUG("also discovering from %s:%d\n",
+				   ca.ca_name, p);
+			n++;
+		}
+		umad_release_ca(&ca);
+	}
+
+out:
+	umad_release_port(&self);
+	return n;
+}
+
+/*
+ * The nodes found from the other ports have paths from those.  Gives every
+ * node a shortest directed route from the node the scan started from,
+ * which must reach all of them.
+ */
+static int set_dr_paths(f_internal_t *f_int, ib_portid_t *from)
+{
+	ibnd_fabric_t *fabric = &f_int->fabric;
+	struct ibnd_hash seen = { 0 };
+	ibnd_node_t **queue, *node, *rem_node;
+	ibnd_port_t *port;
+	unsigned head = 0, tail = 0, count = 0, hops = 0;
+	ib_portid_t path;
+	int i, rc = -1;
+
+	for (node = fabric->nodes; node; node = node->next)
+		count++;
+
+	queue = calloc(count, sizeof(*queue));
+	if (!queue) {
+		IBND_ERROR("OOM: failed to allocate the node queue\n");
+		return -1;
+	}
+
+	node = fabric->from_node;
+	node->path_portid = *from;
+	if (ibnd_hash_add(&seen, node->guid, 0, node, IBND_HASH_KEEP) < 0)
+		goto out;
+	queue[tail++] = node;
+
+	while (head < tail) {
+		node = queue[head++];
+		/* we can't proceed through an HCA with DR */
+		if (node->type != IB_NODE_SWITCH && node != fabric->from_node)
+			continue;
+
+		for (i = 1; i <= node->numports; i++) {
+			port = node->ports[i];
+			if (!port || !port->remoteport ||
+			    (node->type != IB_NODE_SWITCH &&
+			     i != fabric->from_portnum))
+				continue;
+
+			rem_node = port->remoteport->node;
+			if (ibnd_hash_find(&seen, rem_node->guid, 0))
+				continue;
+
+			path = node->path_portid;
+			if (add_port_to_dpath(&path.drpath, i) < 0)
+				continue;
+			if (ibnd_hash_add(&seen, rem_node->guid, 0, rem_node,
+					  IBND_HASH_KEEP) < 0)
+				goto out;
+			rem_node->path_portid = path;
+			if ((unsigned)path.drpath.cnt > hops)
+				hops = path.drpath.cnt;
+			queue[tail++] = rem_node;
+		}
+	}
+
+	if (tail < count) {
+		IBND_ERROR("%u nodes found from the other ports can't be "
+			   "reached from 0x%016" PRIx64 ", are they on another "
+			   "fabric?\n", count - tail, fabric->from_node->guid);
+		goto out;
+	}
+
+	fabric->maxhops_discovered = hops;
+	rc = 0;
+out:
+	ibnd_hash_destroy(&seen);
+	free(queue);
+	return rc;
 }
 
 ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
@@ -767,12 +981,16 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 	struct ibnd_config config = { 0 };
 	f_internal_t *f_int = NULL;
 	ib_portid_t my_portid = { 0 };
-	smp_engine_t engine;
-	ibnd_scan_t scan;
+	struct discover_port *dports;
+	struct smp_engine_group group = { .lock = PTHREAD_MUTEX_INITIALIZER,
+					  .cond = PTHREAD_COND_INITIALIZER };
+	ibnd_scan_t *scan;
 	struct ibmad_port *ibmad_port;
 	struct ibmad_ports_pair *ibmad_ports;
 	int nc = 2;
 	int mc[2] = { IB_SMI_CLASS, IB_SMI_DIRECT_CLASS };
+	int self_portnum = 0;
+	int ndports = 1, i;
 
 	/* If not specified start from "my" port */
 	if (!from)
@@ -789,10 +1007,19 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 		return NULL;
 	}
 
-	memset(&scan.selfportid, 0, sizeof(scan.selfportid));
-	scan.f_int = f_int;
-	scan.cfg = &config;
-	scan.initial_hops = from->drpath.cnt;
+	dports = calloc(config.max_ports ? config.max_ports : 1,
+			sizeof(*dports));
+	group.engines = calloc(config.max_ports ? config.max_ports : 1,
+			       sizeof(*group.engines));
+	if (!dports || !group.engines) {
+		IBND_ERROR("OOM: failed to calloc the discovery ports\n");
+		goto error_int;
+	}
+
+	scan = &dports[0].scan;
+	scan->f_int = f_int;
+	scan->cfg = &config;
+	scan->initial_hops = from->drpath.cnt;
 
 	ibmad_ports = mad_rpc_open_port2(ca_name, ca_port, mc, nc, 1);
 	if (!ibmad_ports) {
@@ -808,8 +1035,8 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 	mad_rpc_set_retries(ibmad_port, cfg->retries);
 	smp_mkey_set(ibmad_port, cfg->mkey);
 
-	if (ib_resolve_self_via(&scan.selfportid,
-				NULL, NULL, ibmad_port) < 0) {
+	if (ib_resolve_self_via(&scan->selfportid,
+				&self_portnum, NULL, ibmad_port) < 0) {
 		IBND_ERROR("Failed to resolve self\n");
 		mad_rpc_close_port2(ibmad_ports);
 		goto error_int;
@@ -822,28 +1049,98 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 
 	mad_rpc_close_port2(ibmad_ports);
 
-	if (smp_engine_init(&engine, fixed_ca_name, ca_port, &scan, &config)) {
+	if (smp_engine_init(&dports[0].engine, fixed_ca_name, ca_port, scan,
+			    &config)) {
 		goto error_int;
 	}
 
+	/*
+	 * The other ports start from themselves, so a scan of part of the
+	 * fabric only uses this one.
+	 */
+	if (config.max_ports > 1 && !from->lid && !from->drpath.cnt &&
+	    !config.max_hops)
+		ndports = add_discover_ports(dports, config.max_ports,
+					     fixed_ca_name, self_portnum,
+					     &config);
+
 	IBND_DEBUG("from %s\n", portid2str(from));
 
-	if (!query_node_info(&engine, from, NULL))
-		if (process_mads(&engine) != 0)
+	if (ndports > 1) {
+		for (i = 0; i < ndports; i++) {
+			group.engines[i] = &dports[i].engine;
+			dports[i].engine.group = &group;
+		}
+		group.count = ndports;
+	}
+
+	/*
+	 * The threads wait until every engine has its first SMP on the wire.
+	 * Ports whose thread can't be created are dropped before then, since
+	 * the other engines would wait for their replies.
+	 */
+	for (i = 1; i < ndports; i++) {
+		if (pthread_create(&dports[i].thread, NULL, discover_thread,
+				   &dports[i])) {
+			IBND_ERROR("can't create a discovery thread, using %d "
+				   "ports\n", i);
+			break;
+		}
+	}
+	if (i < ndports) {
+		while (ndports > i)
+			smp_engine_destroy(&dports[--ndports].engine);
+		group.count = ndports;
+		if (ndports == 1)
+			dports[0].engine.group = NULL;
+	}
+
+	for (i = 0; i < ndports; i++)
+		query_node_info(&dports[i].engine, i ? &my_portid : from,
+				NULL);
+
+	pthread_mutex_lock(&group.lock);
+	group.started = 1;
+	pthread_cond_broadcast(&group.cond);
+	pthread_mutex_unlock(&group.lock);
+
+	discover_thread(&dports[0]);
+	for (i = 1; i < ndports; i++)
+		pthread_join(dports[i].thread, NULL);
+
+	if (group.error)
+		goto error;
+	for (i = 0; i < ndports; i++) {
+		if (dports[i].rc)
 			goto error;
+		f_int->fabric.total_mads_used += dports[i].engine.total_smps;
+	}
 
-	f_int->fabric.total_mads_used = engine.total_smps;
-	f_int->fabric.maxhops_discovered += scan.initial_hops;
+	f_int->fabric.from_node = scan->from_node;
+	f_int->fabric.from_portnum = scan->from_portnum;
+	if (ndports == 1)
+		f_int->fabric.maxhops_discovered += scan->initial_hops;
+	else if (!scan->from_node || set_dr_paths(f_int, from))
+		goto error;
 
 	if (group_nodes(&f_int->fabric))
 		goto error;
 
-	smp_engine_destroy(&engine);
+	for (i = 0; i < ndports; i++)
+		smp_engine_destroy(&dports[i].engine);
+	free(group.engines);
+	free(dports);
 	return (ibnd_fabric_t *)f_int;
 error:
-	smp_engine_destroy(&engine);
+	for (i = 0; i < ndports; i++)
+		smp_engine_destroy(&dports[i].engine);
+	free(group.engines);
+	free(dports);
 	ibnd_destroy_fabric(&f_int->fabric);
+	return NULL;
 error_int:
+	free(group.engines);
+	free(dports);
 	free(f_int);
 	return NULL;
 }
@@ -881,7 +1178,7 @@ void ibnd_destroy_fabric(ibnd_fabric_t * fabric)
 		destroy_node(node);
 		node = next;
 	}
-	destroy_lid2guid((f_internal_t *)fabric);
+	destroy_fabric_hashes((f_internal_t *)fabric);
 	free(fabric);
 }
 
@@ -944,31 +1241,17 @@ ibnd_port_t *ibnd_find_port_lid(ibnd_fabric_t * fabric,
 {
 	f_internal_t *f = (f_internal_t *)fabric;
 
-	cl_map_item_t *p_item = cl_qmap_get(&f->lid2guid, lid);
-
-	if (p_item == &f->lid2guid.nil)
-		return NULL;
-
-	return container_of(p_item,
-			    struct lid2guid_item, cl_map)
-		->port;
+	return ibnd_hash_find(&f->lids, lid, 0);
 }
 
 ibnd_port_t *ibnd_find_port_guid(ibnd_fabric_t * fabric, uint64_t guid)
 {
-	int hash = HASHGUID(guid) % HTSZ;
-	ibnd_port_t *port;
-
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
 		return NULL;
 	}
 
-	for (port = fabric->portstbl[hash]; port; port = port->htnext)
-		if (port->guid == guid)
-			return port;
-
-	return NULL;
+	return ibnd_hash_find(&((f_internal_t *)fabric)->portguids, guid, 0);
 }
 
 ibnd_port_t *ibnd_find_port_dr(ibnd_fabric_t * fabric, char *dr_str)
@@ -1014,8 +1297,8 @@ ibnd_port_t *ibnd_find_port_dr(ibnd_fabric_t * fabric, char *dr_str)
 void ibnd_iter_ports(ibnd_fabric_t * fabric, ibnd_iter_port_func_t func,
 			void *user_data)
 {
-	int i = 0;
-	ibnd_port_t *cur = NULL;
+	f_internal_t *f = (f_internal_t *)fabric;
+	uint32_t i;
 
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
@@ -1027,9 +1310,8 @@ void ibnd_iter_ports(ibnd_fabric_t * fabric, ibnd_iter_port_func_t func,
 		return;
 	}
 
-	for (i = 0; i<HTSZ; i++)
-		for (cur = fabric->portstbl[i]; cur; cur = cur->htnext)
-			func(cur, user_data);
+	ibnd_hash_for_each(&f->ports, i)
+		func(f->ports.entries[i].item, user_data);
 }
 
 int ibnd_get_agg_linkspeedext_field(void *cap_info, void *info,
@@ -94,7 +94,7 @@ typedef struct ibnd_node {
 
 	/* internal use only */
 	unsigned char ch_found;
-	struct ibnd_node *htnext;	/* hash table list */
+	struct ibnd_node *htnext;	/* unused */
 	struct ibnd_node *type_next;	/* next based on type */
 } ibnd_node_t;
 
@@ -115,7 +115,7 @@ typedef struct ibnd_port {
 	uint8_t ext_info[IB_SMP_DATA_SIZE];
 
 	/* internal use only */
-	struct ibnd_port *htnext;
+	struct ibnd_port *htnext;	/* unused */
 } ibnd_port_t;
 
 /** =========================================================================
@@ -151,7 +151,9 @@ typedef struct ibnd_config {
 	unsigned retries;
 	uint32_t flags;
 	uint64_t mkey;
-	uint8_t pad[44];
+	/* local ports of the subnet to discover from, each on its own thread */
+	unsigned max_ports;
+	uint8_t pad[40];
 } ibnd_config_t;
 
 /** =========================================================================
@@ -174,8 +176,8 @@ typedef struct ibnd_fabric {
 	unsigned total_mads_used;
 
 	/* internal use only */
-	ibnd_node_t *nodestbl[HTSZ];
-	ibnd_port_t *portstbl[HTSZ];
+	ibnd_node_t *nodestbl[HTSZ];	/* unused, kept for the ABI */
+	ibnd_port_t *portstbl[HTSZ];	/* unused, kept for the ABI */
 	ibnd_node_t *switches;
 	ibnd_node_t *ch_adapters;
 	ibnd_node_t *routers;
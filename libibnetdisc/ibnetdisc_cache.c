@@ -108,7 +108,6 @@ typedef struct ibnd_node_cache {
 	uint8_t ports_stored_count;
 	ibnd_port_cache_key_t *port_cache_keys;
 	struct ibnd_node_cache *next;
-	struct ibnd_node_cache *htnext;
 	int node_stored_to_fabric;
 } ibnd_node_cache_t;
 
@@ -118,7 +117,6 @@ typedef struct ibnd_port_cache {
 	uint8_t remoteport_flag;
 	ibnd_port_cache_key_t remoteport_cache_key;
 	struct ibnd_port_cache *next;
-	struct ibnd_port_cache *htnext;
 	int port_stored_to_fabric;
 } ibnd_port_cache_t;
 
@@ -127,8 +125,8 @@ typedef struct ibnd_fabric_cache {
 	uint64_t from_node_guid;
 	ibnd_node_cache_t *nodes_cache;
 	ibnd_port_cache_t *ports_cache;
-	ibnd_node_cache_t *nodescachetbl[HTSZ];
-	ibnd_port_cache_t *portscachetbl[HTSZ];
+	struct ibnd_hash nodes_hash;	/* by GUID */
+	struct ibnd_hash ports_hash;	/* by GUID and port number */
 } ibnd_fabric_cache_t;
 
 #define IBND_FABRIC_CACHE_BUFLEN  4096
@@ -289,19 +287,23 @@ static void _destroy_ibnd_fabric_cache(ibnd_fabric_cache_t * fabric_cache)
 		port_cache = port_cache_next;
 	}
 
+	ibnd_hash_destroy(&fabric_cache->nodes_hash);
+	ibnd_hash_destroy(&fabric_cache->ports_hash);
 	free(fabric_cache);
 }
 
-static void store_node_cache(ibnd_node_cache_t * node_cache,
-			     ibnd_fabric_cache_t * fabric_cache)
+static int store_node_cache(ibnd_node_cache_t * node_cache,
+			    ibnd_fabric_cache_t * fabric_cache)
 {
-	int hash_indx = HASHGUID(node_cache->node->guid) % HTSZ;
+	if (ibnd_hash_add(&fabric_cache->nodes_hash, node_cache->node->guid,
+			  0, node_cache, IBND_HASH_REPLACE) < 0) {
+		IBND_DEBUG("OOM: nodes_hash\n");
+		return -1;
+	}
 
 	node_cache->next = fabric_cache->nodes_cache;
 	fabric_cache->nodes_cache = node_cache;
-
-	node_cache->htnext = fabric_cache->nodescachetbl[hash_indx];
-	fabric_cache->nodescachetbl[hash_indx] = node_cache;
+	return 0;
 }
 
 static int _load_node(int fd, ibnd_fabric_cache_t * fabric_cache)
@@ -384,7 +386,8 @@ static int _load_node(int fd, ibnd_fabric_cache_t * fabric_cache)
 		}
 	}
 
-	store_node_cache(node_cache, fabric_cache);
+	if (store_node_cache(node_cache, fabric_cache) < 0)
+		goto cleanup;
 
 	return 0;
 
@@ -393,16 +396,19 @@ cleanup:
 	return -1;
 }
 
-static void store_port_cache(ibnd_port_cache_t * port_cache,
-			     ibnd_fabric_cache_t * fabric_cache)
+static int store_port_cache(ibnd_port_cache_t * port_cache,
+			    ibnd_fabric_cache_t * fabric_cache)
 {
-	int hash_indx = HASHGUID(port_cache->port->guid) % HTSZ;
+	if (ibnd_hash_add(&fabric_cache->ports_hash, port_cache->port->guid,
+			  port_cache->port->portnum, port_cache,
+			  IBND_HASH_REPLACE) < 0) {
+		IBND_DEBUG("OOM: ports_hash\n");
+		return -1;
+	}
 
 	port_cache->next = fabric_cache->ports_cache;
 	fabric_cache->ports_cache = port_cache;
-
-	port_cache->htnext = fabric_cache->portscachetbl[hash_indx];
-	fabric_cache->portscachetbl[hash_indx] = port_cache;
+	return 0;
 }
 
 static int _load_port(int fd, ibnd_fabric_cache_t * fabric_cache)
@@ -449,7 +455,8 @@ static int _load_port(int fd, ibnd_fabric_cache_t * fabric_cache)
 	    _unmarshall8(buf + offset,
 			 &port_cache->remoteport_cache_key.portnum);
 
-	store_port_cache(port_cache, fabric_cache);
+	if (store_port_cache(port_cache, fabric_cache) < 0)
+		goto cleanup;
 
 	return 0;
 
@@ -462,32 +469,14 @@ cleanup:
 static ibnd_port_cache_t *_find_port(ibnd_fabric_cache_t * fabric_cache,
 				     ibnd_port_cache_key_t * port_cache_key)
 {
-	int hash_indx = HASHGUID(port_cache_key->guid) % HTSZ;
-	ibnd_port_cache_t *port_cache;
-
-	for (port_cache = fabric_cache->portscachetbl[hash_indx];
-	     port_cache; port_cache = port_cache->htnext) {
-		if (port_cache->port->guid == port_cache_key->guid
-		    && port_cache->port->portnum == port_cache_key->portnum)
-			return port_cache;
-	}
-
-	return NULL;
+	return ibnd_hash_find(&fabric_cache->ports_hash, port_cache_key->guid,
+			      port_cache_key->portnum);
 }
 
 static ibnd_node_cache_t *_find_node(ibnd_fabric_cache_t * fabric_cache,
 				     uint64_t guid)
 {
-	int hash_indx = HASHGUID(guid) % HTSZ;
-	ibnd_node_cache_t *node_cache;
-
-	for (node_cache = fabric_cache->nodescachetbl[hash_indx];
-	     node_cache; node_cache = node_cache->htnext) {
-		if (node_cache->node->guid == guid)
-			return node_cache;
-	}
-
-	return NULL;
+	return ibnd_hash_find(&fabric_cache->nodes_hash, guid, 0);
 }
 
 static int _fill_port(ibnd_fabric_cache_t * fabric_cache, ibnd_node_t * node,
@@ -511,8 +500,7 @@ static int _fill_port(ibnd_fabric_cache_t * fabric_cache, ibnd_node_t * node,
 	/* achu: needed if user wishes to re-cache a loaded fabric.
 	 * Otherwise, mostly unnecessary to do this.
 	 */
-	int rc = add_to_portguid_hash(port_cache->port,
-				      fabric_cache->f_int->fabric.portstbl);
+	int rc = add_to_portguid_hash(port_cache->port, fabric_cache->f_int);
 	if (rc) {
 		IBND_DEBUG("Error Occurred when trying"
 			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
@@ -541,9 +529,7 @@ static int _rebuild_nodes(ibnd_fabric_cache_t * fabric_cache)
 		fabric_cache->f_int->fabric.nodes = node;
 
 		int rc = add_to_nodeguid_hash(node_cache->node,
-					      fabric_cache->
-					      f_int->
-					      fabric.nodestbl);
+					      fabric_cache->f_int);
 		if (rc) {
 			IBND_DEBUG("Error Occurred when trying"
 				   " to insert new node guid 0x%016" PRIx64 " to DB\n",
@@ -882,11 +868,10 @@ int ibnd_cache_fabric(ibnd_fabric_t * fabric, const char *file,
 	ibnd_node_t *node = NULL;
 	ibnd_node_t *node_next = NULL;
 	unsigned int node_count = 0;
-	ibnd_port_t *port = NULL;
-	ibnd_port_t *port_next = NULL;
+	f_internal_t *f_int = (f_internal_t *)fabric;
 	unsigned int port_count = 0;
 	int fd;
-	int i;
+	uint32_t i;
 
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
@@ -933,17 +918,11 @@ int ibnd_cache_fabric(ibnd_fabric_t * fabric, const char *file,
 		node = node_next;
 	}
 
-	for (i = 0; i < HTSZ; i++) {
-		port = fabric->portstbl[i];
-		while (port) {
-			port_next = port->htnext;
-
-			if (_cache_port(fd, port) < 0)
-				goto cleanup;
+	ibnd_hash_for_each(&f_int->ports, i) {
+		if (_cache_port(fd, f_int->ports.entries[i].item) < 0)
+			goto cleanup;
 
-			port_count++;
-			port = port_next;
-		}
+		port_count++;
 	}
 
 	if (_cache_header_counts(fd, node_count, port_count) < 0)
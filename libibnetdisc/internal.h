@@ -38,6 +38,7 @@
 #ifndef _INTERNAL_H_
 #define _INTERNAL_H_
 
+#include <pthread.h>
 #include <infiniband/ibnetdisc.h>
 #include <util/cl_qmap.h>
 
@@ -48,8 +49,40 @@
 #define	IBND_ERROR(fmt, ...) \
 		fprintf(stderr, "%s:%u; " fmt, __FILE__, __LINE__, ## __VA_ARGS__)
 
-/* HASH table defines */
-#define HASHGUID(guid) ((uint32_t)(((uint32_t)(guid) * 101) ^ ((uint32_t)((guid) >> 32) * 103)))
+/*
+ * Open addressing hash table, with linear probing, of items keyed by a GUID
+ * or LID and a port number.  The keys are stored in the table, so a lookup
+ * reads a single run of entries and only the item it returns.  Items are
+ * never removed.
+ */
+struct ibnd_hash_entry {
+	uint64_t key;
+	uint32_t key2;
+	void *item;
+};
+
+struct ibnd_hash {
+	struct ibnd_hash_entry *entries;
+	uint32_t mask;
+	uint32_t count;
+};
+
+/* What adding an item does when another item has the same key */
+enum ibnd_hash_mode {
+	IBND_HASH_MULTI,	/* add it as well */
+	IBND_HASH_REPLACE,	/* replace the other item */
+	IBND_HASH_KEEP,		/* keep the other item */
+};
+
+int ibnd_hash_add(struct ibnd_hash *hash, uint64_t key, uint32_t key2,
+		  void *item, enum ibnd_hash_mode mode);
+void *ibnd_hash_find(const struct ibnd_hash *hash, uint64_t key,
+		     uint32_t key2);
+void ibnd_hash_destroy(struct ibnd_hash *hash);
+
+#define ibnd_hash_for_each(hash, i) \
+	for ((i) = 0; (hash)->entries && (i) <= (hash)->mask; (i)++) \
+		if ((hash)->entries[i].item)
 
 #define MAXHOPS         63
 
@@ -59,11 +92,13 @@
 
 typedef struct f_internal {
 	ibnd_fabric_t fabric;
-	cl_qmap_t lid2guid;
+	struct ibnd_hash nodes;		/* by GUID */
+	struct ibnd_hash ports;		/* by GUID and port number */
+	struct ibnd_hash portguids;	/* by GUID, the last port added */
+	struct ibnd_hash lids;		/* by every LID of the port */
 } f_internal_t;
 f_internal_t *allocate_fabric_internal(void);
-void create_lid2guid(f_internal_t *f_int);
-void destroy_lid2guid(f_internal_t *f_int);
+void destroy_fabric_hashes(f_internal_t *f_int);
 void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int);
 
 typedef struct ibnd_scan {
@@ -71,6 +106,8 @@ typedef struct ibnd_scan {
 	f_internal_t *f_int;
 	struct ibnd_config *cfg;
 	unsigned initial_hops;
+	ibnd_node_t *from_node;	/* the node this scan started from */
+	int from_portnum;
 } ibnd_scan_t;
 
 typedef struct ibnd_smp ibnd_smp_t;
@@ -86,6 +123,16 @@ struct ibnd_smp {
 	ib_rpc_t rpc;
 };
 
+/* Engines on several local ports, discovering one fabric together */
+struct smp_engine_group {
+	pthread_mutex_t lock;	/* held while processing replies */
+	pthread_cond_t cond;	/* signalled after each reply */
+	smp_engine_t **engines;
+	int count;
+	int started;		/* the first SMPs of all engines are issued */
+	int error;
+};
+
 struct smp_engine {
 	int umad_fd;
 	int smi_agent;
@@ -96,6 +143,8 @@ struct smp_engine {
 	cl_qmap_t smps_on_wire;
 	struct ibnd_config *cfg;
 	unsigned total_smps;
+	unsigned queued;
+	struct smp_engine_group *group;
 };
 
 int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
@@ -103,11 +152,12 @@ int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
 int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	      unsigned attrid, unsigned mod, smp_comp_cb_t cb, void *cb_data);
 int process_mads(smp_engine_t * engine);
+unsigned smp_engine_load(smp_engine_t * engine);
 void smp_engine_destroy(smp_engine_t * engine);
 
-int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[]);
+int add_to_nodeguid_hash(ibnd_node_t * node, f_internal_t * f_int);
 
-int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[]);
+int add_to_portguid_hash(ibnd_port_t * port, f_internal_t * f_int);
 
 void add_to_type_list(ibnd_node_t * node, f_internal_t * fabric);
 
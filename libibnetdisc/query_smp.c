@@ -40,6 +40,7 @@
 static void queue_smp(smp_engine_t * engine, ibnd_smp_t * smp)
 {
 	smp->qnext = NULL;
+	engine->queued++;
 	if (!engine->smp_queue_head) {
 		engine->smp_queue_head = smp;
 		engine->smp_queue_tail = smp;
@@ -55,6 +56,7 @@ static ibnd_smp_t *get_smp(smp_engine_t * engine)
 	ibnd_smp_t *tail = engine->smp_queue_tail;
 	ibnd_smp_t *rc = head;
 	if (head) {
+		engine->queued--;
 		if (tail == head)
 			engine->smp_queue_tail = NULL;
 		engine->smp_queue_head = head->qnext;
@@ -150,24 +152,13 @@ int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	return process_smp_queue(engine);
 }
 
-static int process_one_recv(smp_engine_t * engine)
+static int process_recv(smp_engine_t * engine, uint8_t * umad)
 {
 	int rc = 0;
 	int status = 0;
 	ibnd_smp_t *smp;
 	uint8_t *mad;
 	uint32_t trid;
-	uint8_t umad[sizeof(struct ib_user_mad) + IB_MAD_SIZE];
-	int length = umad_size() + IB_MAD_SIZE;
-
-	memset(umad, 0, sizeof(umad));
-
-	/* wait for the next message */
-	if ((rc = umad_recv(engine->umad_fd, umad, &length,
-			    -1)) < 0) {
-		IBND_ERROR("umad_recv failed: %d\n", rc);
-		return -1;
-	}
 
 	mad = umad_get_mad(umad);
 	trid = (uint32_t) mad_get_field64(mad, 0, IB_MAD_TRID_F);
@@ -204,6 +195,31 @@ error:
 	return rc;
 }
 
+static int process_one_recv(smp_engine_t * engine)
+{
+	int rc = 0;
+	uint8_t umad[sizeof(struct ib_user_mad) + IB_MAD_SIZE];
+	int length = umad_size() + IB_MAD_SIZE;
+
+	memset(umad, 0, sizeof(umad));
+
+	/* wait for the next message */
+	if ((rc = umad_recv(engine->umad_fd, umad, &length,
+			    -1)) < 0) {
+		IBND_ERROR("umad_recv failed: %d\n", rc);
+		return -1;
+	}
+
+	if (!engine->group)
+		return process_recv(engine, umad);
+
+	pthread_mutex_lock(&engine->group->lock);
+	rc = process_recv(engine, umad);
+	pthread_cond_broadcast(&engine->group->cond);
+	pthread_mutex_unlock(&engine->group->lock);
+	return rc;
+}
+
 int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
 		    void *user_data, ibnd_config_t *cfg)
 {
@@ -269,9 +285,54 @@ void smp_engine_destroy(smp_engine_t * engine)
 	umad_close_port(engine->umad_fd);
 }
 
+/* Replies awaited and SMPs queued, to spread the work of a group */
+unsigned smp_engine_load(smp_engine_t * engine)
+{
+	return cl_qmap_count(&engine->smps_on_wire) + engine->queued;
+}
+
+static int group_busy(struct smp_engine_group *group)
+{
+	int i;
+
+	for (i = 0; i < group->count; i++)
+		if (!cl_is_qmap_empty(&group->engines[i]->smps_on_wire))
+			return 1;
+	return 0;
+}
+
+/* Other engines hand SMPs to this one until all of them are done */
+static int process_group_mads(smp_engine_t * engine)
+{
+	struct smp_engine_group *group = engine->group;
+	int rc = 0;
+
+	pthread_mutex_lock(&group->lock);
+	while (!group->error) {
+		if (!cl_is_qmap_empty(&engine->smps_on_wire)) {
+			pthread_mutex_unlock(&group->lock);
+			rc = process_one_recv(engine);
+			pthread_mutex_lock(&group->lock);
+			if (rc) {
+				group->error = rc;
+				pthread_cond_broadcast(&group->cond);
+			}
+		} else if (group_busy(group))
+			pthread_cond_wait(&group->cond, &group->lock);
+		else
+			break;
+	}
+	pthread_mutex_unlock(&group->lock);
+	return rc;
+}
+
 int process_mads(smp_engine_t * engine)
 {
 	int rc;
+
+	if (engine->group)
+		return process_group_mads(engine);
+
 	while (!cl_is_qmap_empty(&engine->smps_on_wire))
 		if ((rc = process_one_recv(engine)) != 0)
 			return rc;
@@ -0,0 +1,302 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+
+/*
+ * Measures the lookups of libibnetdisc on a large synthetic fabric.  A cache
+ * file of switches, each with a CA on half of its ports, is written in the
+ * ibnd_cache_fabric() format, then loaded, and every node, port and LID of
+ * it is looked up.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include <infiniband/ibnetdisc.h>
+
+#define CACHE_MAGIC	0x8FE7832B
+#define CACHE_VERSION	1
+
+#define SWITCH_GUID(s)		(0x0002c90300000000ULL + ((uint64_t)(s) << 8))
+#define CA_GUID(s, p)		(0x0008f10400000000ULL + ((uint64_t)(s) << 8) + (p))
+
+static int switches = 2000;
+static int ports = 48;
+
+/* LIDs are reused once the unicast range is exhausted */
+static uint16_t switch_lid(int s)
+{
+	return 1 + s % 0xbfff;
+}
+
+static uint16_t ca_lid(int s, int p)
+{
+	return 1 + (switches + s * (ports / 2) + p - 1) % 0xbfff;
+}
+
+static uint8_t *put8(uint8_t *p, uint8_t v)
+{
+	*p++ = v;
+	return p;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+	p = put8(p, v);
+	return put8(p, v >> 8);
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p = put16(p, v);
+	return put16(p, v >> 16);
+}
+
+static uint8_t *put64(uint8_t *p, uint64_t v)
+{
+	p = put32(p, v);
+	return put32(p, v >> 32);
+}
+
+static uint8_t *put_zero(uint8_t *p, size_t len)
+{
+	memset(p, 0, len);
+	return p + len;
+}
+
+static int write_buf(FILE *f, uint8_t *buf, uint8_t *end)
+{
+	return fwrite(buf, end - buf, 1, f) == 1 ? 0 : -1;
+}
+
+static int write_node(FILE *f, uint64_t guid, int type, int numports,
+		      uint16_t lid, uint64_t port_guid, int first_port)
+{
+	uint8_t buf[4096], *p = buf;
+	int i;
+
+	p = put16(p, type == IB_NODE_SWITCH ? lid : 0);
+	p = put8(p, 0);
+	p = put8(p, 0);
+	p = put_zero(p, IB_SMP_DATA_SIZE);
+	p = put64(p, guid);
+	p = put8(p, type);
+	p = put8(p, numports);
+	p = put_zero(p, IB_SMP_DATA_SIZE);
+	memset(p, 0, IB_SMP_DATA_SIZE);
+	snprintf((char *)p, IB_SMP_DATA_SIZE, "%s %" PRIx64,
+		 type == IB_NODE_SWITCH ? "switch" : "ca", guid);
+	p += IB_SMP_DATA_SIZE;
+	p = put8(p, numports + 1 - first_port);
+	for (i = first_port; i <= numports; i++) {
+		p = put64(p, port_guid + (type == IB_NODE_SWITCH ? 0 : i - 1));
+		p = put8(p, i);
+	}
+	return write_buf(f, buf, p);
+}
+
+static int write_port(FILE *f, uint64_t guid, int portnum, uint16_t lid,
+		      uint64_t node_guid, uint64_t rem_guid, int rem_portnum)
+{
+	uint8_t buf[128], *p = buf;
+
+	p = put64(p, guid);
+	p = put8(p, portnum);
+	p = put8(p, 0);
+	p = put16(p, lid);
+	p = put8(p, 0);
+	p = put_zero(p, IB_SMP_DATA_SIZE);
+	p = put64(p, node_guid);
+	p = put8(p, rem_guid != 0);
+	p = put64(p, rem_guid);
+	p = put8(p, rem_portnum);
+	return write_buf(f, buf, p);
+}
+
+/* Switch ports 1 to ports/2 link to a CA, the others are down */
+static int write_fabric(const char *file)
+{
+	uint8_t buf[64], *p = buf;
+	int s, i, cas = ports / 2;
+	uint64_t guid;
+	FILE *f;
+
+	f = fopen(file, "w");
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+
+	p = put32(p, CACHE_MAGIC);
+	p = put32(p, CACHE_VERSION);
+	p = put32(p, switches * (1 + cas));
+	p = put32(p, switches * (ports + 1 + cas));
+	p = put64(p, SWITCH_GUID(0));
+	p = put32(p, 3);
+	if (write_buf(f, buf, p))
+		goto err;
+
+	for (s = 0; s < switches; s++) {
+		guid = SWITCH_GUID(s);
+		if (write_node(f, guid, IB_NODE_SWITCH, ports, switch_lid(s),
+			       guid, 0))
+			goto err;
+		for (i = 1; i <= cas; i++)
+			if (write_node(f, CA_GUID(s, i) | 1ULL << 32,
+				       IB_NODE_CA, 1, 0, CA_GUID(s, i), 1))
+				goto err;
+	}
+
+	for (s = 0; s < switches; s++) {
+		guid = SWITCH_GUID(s);
+		for (i = 0; i <= ports; i++)
+			if (write_port(f, guid, i, switch_lid(s), guid,
+				       i && i <= cas ? CA_GUID(s, i) : 0, 1))
+				goto err;
+		for (i = 1; i <= cas; i++)
+			if (write_port(f, CA_GUID(s, i), 1,
+				       ca_lid(s, i),
+				       CA_GUID(s, i) | 1ULL << 32, guid, i))
+				goto err;
+	}
+
+	if (fclose(f))
+		return -1;
+	return 0;
+
+err:
+	fclose(f);
+	return -1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, unsigned long n, double start)
+{
+	double t = now() - start;
+
+	printf("%-18s%10lu%12.3f%14.0f\n", what, n, t, n / t);
+}
+
+static void count_port(ibnd_port_t *port, void *user_data)
+{
+	(*(unsigned long *)user_data)++;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-s switches] [-p ports] [-f cache_file]\n"
+		"   -s switches in the fabric, default: 2000\n"
+		"   -p ports per switch, half of them with a CA, default: 48\n"
+		"   -f cache file to write and keep, default: a temporary file\n",
+		argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char tmpl[] = "/tmp/ibnd_hash_bench.XXXXXX";
+	const char *file = NULL;
+	ibnd_fabric_t *fabric;
+	unsigned long n, found;
+	int s, i, fd, ch;
+	double start;
+
+	while ((ch = getopt(argc, argv, "s:p:f:")) != -1) {
+		switch (ch) {
+		case 's':
+			switches = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			ports = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (switches <= 0 || ports < 2 || ports > 254)
+		usage(argv[0]);
+
+	if (!file) {
+		fd = mkstemp(tmpl);
+		if (fd < 0) {
+			perror("mkstemp");
+			return 1;
+		}
+		close(fd);
+		file = tmpl;
+	}
+
+	if (write_fabric(file)) {
+		fprintf(stderr, "failed to write %s\n", file);
+		goto err;
+	}
+
+	printf("%-18s%10s%12s%14s\n", "", "count", "sec", "per sec");
+	start = now();
+	fabric = ibnd_load_fabric(file, 0);
+	if (!fabric) {
+		fprintf(stderr, "failed to load %s\n", file);
+		goto err;
+	}
+	report("load", switches * (ports + 1 + ports / 2), start);
+
+	n = found = 0;
+	start = now();
+	for (s = 0; s < switches; s++) {
+		found += ibnd_find_node_guid(fabric, SWITCH_GUID(s)) != NULL;
+		for (i = 1; i <= ports / 2; i++, n++)
+			found += ibnd_find_node_guid(fabric, CA_GUID(s, i) |
+							     1ULL << 32) != NULL;
+	}
+	report("node guid", n + switches, start);
+
+	start = now();
+	for (s = 0; s < switches; s++) {
+		found += ibnd_find_port_guid(fabric, SWITCH_GUID(s)) != NULL;
+		for (i = 1; i <= ports / 2; i++)
+			found += ibnd_find_port_guid(fabric, CA_GUID(s, i)) !=
+				 NULL;
+	}
+	report("port guid", n + switches, start);
+
+	start = now();
+	for (i = 1; i < 0xc000; i++)
+		ibnd_find_port_lid(fabric, i);
+	report("port lid", 0xbfff, start);
+
+	n = 0;
+	start = now();
+	ibnd_iter_ports(fabric, count_port, &n);
+	report("iterate ports", n, start);
+
+	ibnd_destroy_fabric(fabric);
+	if (file == tmpl)
+		unlink(file);
+
+	if (found != 2 * (unsigned long)switches * (1 + ports / 2)) {
+		fprintf(stderr, "%lu lookups failed\n",
+			2 * (unsigned long)switches * (1 + ports / 2) - found);
+		return 1;
+	}
+	return 0;
+
+err:
+	if (file == tmpl)
+		unlink(file);
+	return 1;
+}
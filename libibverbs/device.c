@@ -251,6 +251,7 @@ int verbs_init_context(struct verbs_context *context_ex,
 	}
 
 	context_ex->priv->driver_id = driver_id;
+	pthread_mutex_init(&context_ex->priv->gid_cache_lock, NULL);
 	verbs_set_ops(context_ex, &verbs_dummy_ops);
 	context_ex->priv->use_ioctl_write = has_ioctl_write(context);
 
@@ -323,11 +324,13 @@ static void set_lib_ops(struct verbs_context *vctx)
 struct ibv_context *verbs_open_device(struct ibv_device *device, void *private_data)
 {
 	struct verbs_device *verbs_device = verbs_get_device(device);
+	bool has_cdev = verbs_device->sysfs &&
+			!(verbs_device->sysfs->flags & VSYSFS_USERSPACE);
 	int cmd_fd = -1;
 	struct verbs_context *context_ex;
 	int ret;
 
-	if (verbs_device->sysfs) {
+	if (has_cdev) {
 		/*
 		 * We'll only be doing writes, but we need O_RDWR in case the
 		 * provider needs to mmap() the file.
@@ -347,7 +350,7 @@ struct ibv_context *verbs_open_device(struct ibv_device *device, void *private_d
 		return NULL;
 
 	set_lib_ops(context_ex);
-	if (verbs_device->sysfs) {
+	if (has_cdev) {
 		if (context_ex->context.async_fd == -1) {
 			ret = ibv_cmd_alloc_async_fd(&context_ex->context);
 			if (ret) {
@@ -431,6 +434,8 @@ out:
 
 void verbs_uninit_context(struct verbs_context *context_ex)
 {
+	ibverbs_gid_cache_invalidate(&context_ex->context);
+	pthread_mutex_destroy(&context_ex->priv->gid_cache_lock);
 	free(context_ex->priv);
 	if (context_ex->context.cmd_fd != -1)
 		close(context_ex->context.cmd_fd);
@@ -485,6 +490,11 @@ LATEST_SYMVER_FUNC(ibv_get_async_event, 1_1, "IBVERBS_1.1",
 	case IBV_EVENT_WQ_FATAL:
 		event->element.wq = (void *) (uintptr_t) ev.element;
 		break;
+
+	case IBV_EVENT_GID_CHANGE:
+		ibverbs_gid_cache_invalidate(context);
+		event->element.port_num = ev.element;
+		break;
 	default:
 		event->element.port_num = ev.element;
 		break;
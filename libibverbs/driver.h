@@ -143,6 +143,7 @@ enum ibv_mr_type {
 	IBV_MR_TYPE_NULL_MR,
 	IBV_MR_TYPE_IMPORTED_MR,
 	IBV_MR_TYPE_DMABUF_MR,
+	IBV_MR_TYPE_CACHED_MR,
 };
 
 struct verbs_mr {
@@ -243,6 +244,8 @@ struct verbs_match_ent {
 enum {
 	VSYSFS_READ_MODALIAS = 1 << 0,
 	VSYSFS_READ_NODE_GUID = 1 << 1,
+	/* Emulated in userspace, there is no kernel device or uverbs cdev */
+	VSYSFS_USERSPACE = 1 << 2,
 };
 
 /* An rdma device detected in sysfs */
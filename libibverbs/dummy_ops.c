@@ -639,7 +639,11 @@ void verbs_set_ops(struct verbs_context *vctx,
 	SET_OP(vctx, create_counters);
 	SET_PRIV_OP(ctx, async_event);
 	SET_PRIV_OP(ctx, attach_mcast);
-	SET_OP(ctx, bind_mw);
+	/* Cached MR handles are rejected before reaching the provider */
+	if (ops->bind_mw) {
+		priv->ops.bind_mw = ops->bind_mw;
+		ctx->bind_mw = ibverbs_bind_mw;
+	}
 	SET_OP(vctx, close_xrcd);
 	SET_PRIV_OP(ctx, cq_event);
 	SET_PRIV_OP(ctx, create_ah);
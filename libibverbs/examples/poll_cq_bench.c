@@ -0,0 +1,354 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <infiniband/verbs.h>
+
+static char *ib_devname;
+static int ib_port = 1;
+static int gidx = -1;
+static unsigned int iters = 1000000;
+static unsigned int depth = 512;
+static unsigned int batch = 16;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct ibv_context *open_device(void)
+{
+	struct ibv_device **dev_list;
+	struct ibv_context *context = NULL;
+	int i;
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("Failed to get IB devices list");
+		return NULL;
+	}
+
+	for (i = 0; dev_list[i]; ++i) {
+		if (!ib_devname ||
+		    !strcmp(ibv_get_device_name(dev_list[i]), ib_devname))
+			break;
+	}
+
+	if (!dev_list[i]) {
+		fprintf(stderr, "IB device %s not found\n",
+			ib_devname ? ib_devname : "");
+		goto out;
+	}
+
+	context = ibv_open_device(dev_list[i]);
+	if (!context)
+		fprintf(stderr, "Couldn't get context for %s\n",
+			ibv_get_device_name(dev_list[i]));
+out:
+	ibv_free_device_list(dev_list);
+	return context;
+}
+
+/* Connect an RC QP to itself so that every write completes locally */
+static int connect_self(struct ibv_qp *qp)
+{
+	struct ibv_port_attr port_attr;
+	struct ibv_qp_attr attr = {
+		.qp_state = IBV_QPS_INIT,
+		.port_num = ib_port,
+		.qp_access_flags = IBV_ACCESS_REMOTE_WRITE,
+	};
+
+	if (ibv_query_port(qp->context, ib_port, &port_attr)) {
+		fprintf(stderr, "Couldn't query port %d\n", ib_port);
+		return 1;
+	}
+
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT |
+			  IBV_QP_ACCESS_FLAGS)) {
+		fprintf(stderr, "Failed to modify QP to INIT\n");
+		return 1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.qp_state = IBV_QPS_RTR;
+	attr.path_mtu = IBV_MTU_1024;
+	attr.dest_qp_num = qp->qp_num;
+	attr.max_dest_rd_atomic = 1;
+	attr.min_rnr_timer = 12;
+	attr.ah_attr.dlid = port_attr.lid;
+	attr.ah_attr.port_num = ib_port;
+	if (gidx >= 0) {
+		if (ibv_query_gid(qp->context, ib_port, gidx,
+				  &attr.ah_attr.grh.dgid)) {
+			fprintf(stderr, "Couldn't read GID %d\n", gidx);
+			return 1;
+		}
+		attr.ah_attr.is_global = 1;
+		attr.ah_attr.grh.hop_limit = 1;
+		attr.ah_attr.grh.sgid_index = gidx;
+	}
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
+			  IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+			  IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER)) {
+		fprintf(stderr, "Failed to modify QP to RTR\n");
+		return 1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.qp_state = IBV_QPS_RTS;
+	attr.timeout = 14;
+	attr.retry_cnt = 7;
+	attr.rnr_retry = 7;
+	attr.max_rd_atomic = 1;
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
+			  IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN |
+			  IBV_QP_MAX_QP_RD_ATOMIC)) {
+		fprintf(stderr, "Failed to modify QP to RTS\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static struct ibv_cq *create_cq(struct ibv_context *context,
+				bool single_threaded)
+{
+	struct ibv_cq_init_attr_ex attr = {
+		.cqe = depth,
+		.wc_flags = IBV_WC_STANDARD_FLAGS,
+		.comp_mask = IBV_CQ_INIT_ATTR_MASK_FLAGS,
+		.flags = IBV_CREATE_CQ_ATTR_SINGLE_THREADED,
+	};
+	struct ibv_cq_ex *cq_ex;
+
+	if (!single_threaded)
+		return ibv_create_cq(context, depth, NULL, NULL, 0);
+
+	cq_ex = ibv_create_cq_ex(context, &attr);
+	return cq_ex ? ibv_cq_ex_to_cq(cq_ex) : NULL;
+}
+
+static int run_bench(struct ibv_context *context, struct ibv_pd *pd,
+		     struct ibv_mr *mr, const char *mode, bool single_threaded)
+{
+	uint64_t start, poll_ns = 0, total_ns;
+	unsigned int posted = 0, completed = 0, polls = 0;
+	struct ibv_wc *wc;
+	struct ibv_cq *cq;
+	struct ibv_qp *qp;
+	int ne, i, ret = 1;
+	struct ibv_sge sge = {
+		.addr = (uintptr_t)mr->addr,
+		.length = 8,
+		.lkey = mr->lkey,
+	};
+	struct ibv_send_wr wr = {
+		.sg_list = &sge,
+		.num_sge = 1,
+		.opcode = IBV_WR_RDMA_WRITE,
+		.send_flags = IBV_SEND_SIGNALED,
+		.wr.rdma.remote_addr = (uintptr_t)mr->addr + 8,
+		.wr.rdma.rkey = mr->rkey,
+	}, *bad_wr;
+	struct ibv_qp_init_attr init_attr = {
+		.cap = {
+			.max_send_wr = depth,
+			.max_recv_wr = 1,
+			.max_send_sge = 1,
+			.max_recv_sge = 1,
+		},
+		.qp_type = IBV_QPT_RC,
+	};
+
+	wc = calloc(batch, sizeof(*wc));
+	if (!wc) {
+		fprintf(stderr, "Couldn't allocate completions\n");
+		return 1;
+	}
+
+	cq = create_cq(context, single_threaded);
+	if (!cq) {
+		if (single_threaded && errno == EOPNOTSUPP) {
+			printf("%-10s%40s\n", mode, "not supported");
+			ret = 0;
+		} else {
+			fprintf(stderr, "Couldn't create CQ\n");
+		}
+		goto free;
+	}
+
+	init_attr.send_cq = cq;
+	init_attr.recv_cq = cq;
+	qp = ibv_create_qp(pd, &init_attr);
+	if (!qp) {
+		fprintf(stderr, "Couldn't create QP\n");
+		goto destroy_cq;
+	}
+
+	if (connect_self(qp))
+		goto destroy_qp;
+
+	total_ns = now_ns();
+	while (completed < iters) {
+		while (posted < iters && posted - completed < depth) {
+			wr.wr_id = posted;
+			if (ibv_post_send(qp, &wr, &bad_wr)) {
+				fprintf(stderr, "Couldn't post send\n");
+				goto destroy_qp;
+			}
+			posted++;
+		}
+
+		start = now_ns();
+		ne = ibv_poll_cq(cq, batch, wc);
+		poll_ns += now_ns() - start;
+		if (ne < 0) {
+			fprintf(stderr, "Failed to poll CQ\n");
+			goto destroy_qp;
+		}
+		polls++;
+
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				fprintf(stderr, "Completion failed with %s\n",
+					ibv_wc_status_str(wc[i].status));
+				goto destroy_qp;
+			}
+		}
+		completed += ne;
+	}
+	total_ns = now_ns() - total_ns;
+
+	printf("%-10s%8u%10u%14.0f%12.1f%12.2f\n", mode, batch, iters,
+	       iters * 1e9 / total_ns, (double)poll_ns / iters,
+	       (double)completed / polls);
+	ret = 0;
+
+destroy_qp:
+	ibv_destroy_qp(qp);
+destroy_cq:
+	ibv_destroy_cq(cq);
+free:
+	free(wc);
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s            measure completion polling rate\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -d, --ib-dev=<dev>     use IB device <dev> (default first device found)\n");
+	printf("  -i, --ib-port=<port>   use port <port> of IB device (default 1)\n");
+	printf("  -g, --gid-idx=<gid>    local port gid index, required for RoCE\n");
+	printf("  -n, --iters=<iters>    number of completions (default 1000000)\n");
+	printf("  -r, --depth=<depth>    number of outstanding writes (default 512)\n");
+	printf("  -b, --batch=<count>    completions polled per call (default 16)\n");
+	printf("  -h, --help             print a help text and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct ibv_context *context;
+	struct ibv_pd *pd;
+	struct ibv_mr *mr;
+	char buf[16];
+	int ret = 1;
+
+	while (1) {
+		int c;
+		static struct option long_options[] = {
+			{ .name = "ib-dev",  .has_arg = 1, .val = 'd' },
+			{ .name = "ib-port", .has_arg = 1, .val = 'i' },
+			{ .name = "gid-idx", .has_arg = 1, .val = 'g' },
+			{ .name = "iters",   .has_arg = 1, .val = 'n' },
+			{ .name = "depth",   .has_arg = 1, .val = 'r' },
+			{ .name = "batch",   .has_arg = 1, .val = 'b' },
+			{ .name = "help",    .has_arg = 0, .val = 'h' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "d:i:g:n:r:b:h", long_options,
+				NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'd':
+			ib_devname = optarg;
+			break;
+		case 'i':
+			ib_port = strtol(optarg, NULL, 0);
+			break;
+		case 'g':
+			gidx = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!iters || !depth || !batch || ib_port < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	context = open_device();
+	if (!context)
+		return 1;
+
+	pd = ibv_alloc_pd(context);
+	if (!pd) {
+		fprintf(stderr, "Couldn't allocate PD\n");
+		goto close;
+	}
+
+	mr = ibv_reg_mr(pd, buf, sizeof(buf),
+			IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+	if (!mr) {
+		fprintf(stderr, "Couldn't register MR\n");
+		goto dealloc;
+	}
+
+	printf("%-10s%8s%10s%14s%12s%12s\n", "mode", "batch", "iters",
+	       "wc/sec", "nsec/wc", "wc/poll");
+	ret = run_bench(context, pd, mr, "locked", false);
+	if (!ret)
+		ret = run_bench(context, pd, mr, "lockless", true);
+
+	ibv_dereg_mr(mr);
+dealloc:
+	ibv_dealloc_pd(pd);
+close:
+	ibv_close_device(context);
+	return ret;
+}
@@ -0,0 +1,201 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <util/compiler.h>
+#include <infiniband/verbs.h>
+
+static char *ib_devname;
+static size_t size = 64 * 1024;
+static unsigned int iters = 10000;
+static unsigned int nbufs = 16;
+static size_t cache_size = 1024 * 1024 * 1024;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct ibv_context *open_device(void)
+{
+	struct ibv_device **dev_list;
+	struct ibv_context *context = NULL;
+	int i;
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("Failed to get IB devices list");
+		return NULL;
+	}
+
+	for (i = 0; dev_list[i]; ++i) {
+		if (!ib_devname ||
+		    !strcmp(ibv_get_device_name(dev_list[i]), ib_devname))
+			break;
+	}
+
+	if (!dev_list[i]) {
+		fprintf(stderr, "IB device %s not found\n",
+			ib_devname ? ib_devname : "");
+		goto out;
+	}
+
+	context = ibv_open_device(dev_list[i]);
+	if (!context)
+		fprintf(stderr, "Couldn't get context for %s\n",
+			ibv_get_device_name(dev_list[i]));
+out:
+	ibv_free_device_list(dev_list);
+	return context;
+}
+
+static int run_bench(const char *mode, size_t cache)
+{
+	uint64_t start, reg_ns = 0, dereg_ns = 0;
+	struct ibv_context *context;
+	struct ibv_pd *pd;
+	struct ibv_mr *mr;
+	char *buf;
+	unsigned int i;
+	int ret = 1;
+
+	ret = ibv_enable_mr_cache(cache);
+	if (ret) {
+		fprintf(stderr, "Couldn't set the registration cache size: %s\n",
+			strerror(ret));
+		return 1;
+	}
+	ret = 1;
+
+	context = open_device();
+	if (!context)
+		return 1;
+
+	pd = ibv_alloc_pd(context);
+	if (!pd) {
+		fprintf(stderr, "Couldn't allocate PD\n");
+		goto close;
+	}
+
+	buf = aligned_alloc(sysconf(_SC_PAGESIZE), size * nbufs);
+	if (!buf) {
+		fprintf(stderr, "Couldn't allocate work buffer\n");
+		goto dealloc;
+	}
+	memset(buf, 0, size * nbufs);
+
+	for (i = 0; i < iters; i++) {
+		start = now_ns();
+		mr = ibv_reg_mr(pd, buf + (i % nbufs) * size, size,
+				IBV_ACCESS_LOCAL_WRITE |
+				IBV_ACCESS_REMOTE_WRITE |
+				IBV_ACCESS_REMOTE_READ);
+		reg_ns += now_ns() - start;
+		if (!mr) {
+			perror("ibv_reg_mr");
+			goto free;
+		}
+
+		start = now_ns();
+		if (ibv_dereg_mr(mr)) {
+			perror("ibv_dereg_mr");
+			goto free;
+		}
+		dereg_ns += now_ns() - start;
+	}
+
+	printf("%-10s%12zu%10u%10u%14.3f%14.3f\n", mode, size, nbufs, iters,
+	       reg_ns / 1000. / iters, dereg_ns / 1000. / iters);
+	ret = 0;
+free:
+	/* Cached registrations must be dropped before the memory is freed */
+	ibv_invalidate_mr_cache(buf, size * nbufs);
+	free(buf);
+dealloc:
+	ibv_dealloc_pd(pd);
+close:
+	ibv_close_device(context);
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s            measure memory registration cost\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -d, --ib-dev=<dev>     use IB device <dev> (default first device found)\n");
+	printf("  -s, --size=<size>      size of each registration (default 65536)\n");
+	printf("  -n, --iters=<iters>    number of registrations (default 10000)\n");
+	printf("  -b, --buffers=<count>  number of distinct buffers registered in turn (default 16)\n");
+	printf("  -c, --cache=<bytes>    registration cache size (default 1073741824)\n");
+	printf("  -h, --help             print a help text and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	while (1) {
+		int c;
+		static struct option long_options[] = {
+			{ .name = "ib-dev",  .has_arg = 1, .val = 'd' },
+			{ .name = "size",    .has_arg = 1, .val = 's' },
+			{ .name = "iters",   .has_arg = 1, .val = 'n' },
+			{ .name = "buffers", .has_arg = 1, .val = 'b' },
+			{ .name = "cache",   .has_arg = 1, .val = 'c' },
+			{ .name = "help",    .has_arg = 0, .val = 'h' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "d:s:n:b:c:h", long_options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'd':
+			ib_devname = optarg;
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			nbufs = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cache_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!size || !iters || !nbufs) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	printf("%-10s%12s%10s%10s%14s%14s\n", "mode", "bytes", "buffers",
+	       "iters", "usec/reg", "usec/dereg");
+	ret = run_bench("uncached", 0);
+	if (!ret)
+		ret = run_bench("cached", cache_size);
+	return ret;
+}
@@ -0,0 +1,210 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+
+#include <config.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ccan/minmax.h>
+#include <util/util.h>
+
+#include "ibverbs.h"
+
+/*
+ * Per context snapshot of the GID tables of all ports, loaded with a single
+ * ibv_query_gid_table() call and hashed by (port, gid, type).  The snapshot
+ * is dropped when an IBV_EVENT_GID_CHANGE is read from the context.  Since
+ * the application may never read async events, every hit is checked against
+ * the kernel with one GID query, and a stale snapshot is reloaded.
+ */
+
+#define GID_CACHE_MIN_ENTRIES	64
+#define GID_CACHE_MAX_ENTRIES	(1 << 16)
+
+struct verbs_gid_cache {
+	size_t num_entries;
+	/* Open addressing, each slot holds an entries index + 1, 0 is empty */
+	uint32_t *slots;
+	uint32_t mask;
+	struct ibv_gid_entry entries[];
+};
+
+static enum ibv_gid_type_sysfs sysfs_gid_type(uint32_t gid_type)
+{
+	if (gid_type == IBV_GID_TYPE_IB || gid_type == IBV_GID_TYPE_ROCE_V1)
+		return IBV_GID_TYPE_SYSFS_IB_ROCE_V1;
+	return IBV_GID_TYPE_SYSFS_ROCE_V2;
+}
+
+static uint32_t gid_hash(uint32_t port_num, const union ibv_gid *gid,
+			 enum ibv_gid_type_sysfs gid_type)
+{
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+
+	/* FNV-1a */
+	for (i = 0; i < sizeof(gid->raw); i++)
+		hash = (hash ^ gid->raw[i]) * 16777619u;
+	hash = (hash ^ port_num) * 16777619u;
+	hash = (hash ^ gid_type) * 16777619u;
+	return hash;
+}
+
+static bool gid_entry_match(const struct ibv_gid_entry *entry,
+			    uint32_t port_num, const union ibv_gid *gid,
+			    enum ibv_gid_type_sysfs gid_type)
+{
+	return entry->port_num == port_num &&
+	       sysfs_gid_type(entry->gid_type) == gid_type &&
+	       !memcmp(&entry->gid, gid, sizeof(*gid));
+}
+
+static void gid_cache_free(struct verbs_gid_cache *cache)
+{
+	if (!cache)
+		return;
+	free(cache->slots);
+	free(cache);
+}
+
+static struct verbs_gid_cache *gid_cache_load(struct ibv_context *context)
+{
+	struct verbs_gid_cache *cache;
+	size_t max_entries = GID_CACHE_MIN_ENTRIES;
+	uint32_t i, slot, nslots;
+	ssize_t ret;
+
+	while (true) {
+		cache = calloc(1, sizeof(*cache) +
+				  max_entries * sizeof(cache->entries[0]));
+		if (!cache)
+			return NULL;
+
+		ret = _ibv_query_gid_table(context, cache->entries, max_entries,
+					   0, sizeof(cache->entries[0]));
+		if (ret >= 0)
+			break;
+
+		free(cache);
+		/* The kernel reports a too small buffer as EINVAL */
+		if (ret != -EINVAL || max_entries >= GID_CACHE_MAX_ENTRIES)
+			return NULL;
+		max_entries *= 2;
+	}
+	cache->num_entries = ret;
+
+	nslots = roundup_pow_of_two(max(cache->num_entries * 2,
+					(size_t)GID_CACHE_MIN_ENTRIES));
+	cache->slots = calloc(nslots, sizeof(*cache->slots));
+	if (!cache->slots) {
+		free(cache);
+		return NULL;
+	}
+	cache->mask = nslots - 1;
+
+	for (i = 0; i < cache->num_entries; i++) {
+		struct ibv_gid_entry *entry = &cache->entries[i];
+
+		slot = gid_hash(entry->port_num, &entry->gid,
+				sysfs_gid_type(entry->gid_type)) & cache->mask;
+		while (cache->slots[slot])
+			slot = (slot + 1) & cache->mask;
+		cache->slots[slot] = i + 1;
+	}
+
+	return cache;
+}
+
+static struct ibv_gid_entry *gid_cache_lookup(struct verbs_gid_cache *cache,
+					      uint32_t port_num,
+					      const union ibv_gid *gid,
+					      enum ibv_gid_type_sysfs gid_type)
+{
+	struct ibv_gid_entry *entry, *found = NULL;
+	uint32_t slot;
+
+	/* The same GID may appear twice in a table, return the lowest index */
+	slot = gid_hash(port_num, gid, gid_type) & cache->mask;
+	for (; cache->slots[slot]; slot = (slot + 1) & cache->mask) {
+		entry = &cache->entries[cache->slots[slot] - 1];
+		if (!gid_entry_match(entry, port_num, gid, gid_type))
+			continue;
+		if (!found || entry->gid_index < found->gid_index)
+			found = entry;
+	}
+	return found;
+}
+
+static bool gid_cache_entry_valid(struct ibv_context *context,
+				  const struct ibv_gid_entry *cached)
+{
+	struct ibv_gid_entry entry = {};
+
+	if (__ibv_query_gid_ex(context, cached->port_num, cached->gid_index,
+			       &entry, 0, sizeof(entry),
+			       VERBS_QUERY_GID_ATTR_GID |
+			       VERBS_QUERY_GID_ATTR_TYPE))
+		return false;
+
+	return sysfs_gid_type(entry.gid_type) ==
+		       sysfs_gid_type(cached->gid_type) &&
+	       !memcmp(&entry.gid, &cached->gid, sizeof(entry.gid));
+}
+
+/*
+ * Return the index of @gid of @gid_type in the table of @port_num, -ENOENT if
+ * it isn't there, or another negative errno if the table can't be read as a
+ * whole, in which case the caller should fall back to per index queries.
+ */
+int ibverbs_gid_cache_find(struct ibv_context *context, uint32_t port_num,
+			   const union ibv_gid *gid,
+			   enum ibv_gid_type_sysfs gid_type)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct ibv_gid_entry *entry;
+	bool reloaded = false;
+	int ret;
+
+	pthread_mutex_lock(&priv->gid_cache_lock);
+	while (true) {
+		if (!priv->gid_cache) {
+			priv->gid_cache = gid_cache_load(context);
+			if (!priv->gid_cache) {
+				ret = -EOPNOTSUPP;
+				break;
+			}
+			reloaded = true;
+		}
+
+		entry = gid_cache_lookup(priv->gid_cache, port_num, gid,
+					 gid_type);
+		if (entry && gid_cache_entry_valid(context, entry)) {
+			ret = entry->gid_index;
+			break;
+		}
+
+		if (reloaded) {
+			ret = -ENOENT;
+			break;
+		}
+
+		/* Missed on a snapshot that may be stale, reload it once */
+		gid_cache_free(priv->gid_cache);
+		priv->gid_cache = NULL;
+	}
+	pthread_mutex_unlock(&priv->gid_cache_lock);
+
+	return ret;
+}
+
+void ibverbs_gid_cache_invalidate(struct ibv_context *context)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+
+	pthread_mutex_lock(&priv->gid_cache_lock);
+	gid_cache_free(priv->gid_cache);
+	priv->gid_cache = NULL;
+	pthread_mutex_unlock(&priv->gid_cache_lock);
+}
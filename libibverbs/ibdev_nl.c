@@ -32,8 +32,11 @@
 #include <util/rdma_nl.h>
 
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/sysmacros.h>
 
 #include <ccan/list.h>
@@ -187,8 +190,11 @@ err:
 	return NLE_PARSE_ERR;
 }
 
-/* Fetch the list of IB devices and uverbs from netlink */
-int find_sysfs_devs_nl(struct list_head *tmp_sysfs_dev_list)
+/*
+ * Fetch the list of IB devices and uverbs from netlink, @skipped is set if
+ * a device was left out because its uverbs device can't be used.
+ */
+int find_sysfs_devs_nl(struct list_head *tmp_sysfs_dev_list, bool *skipped)
 {
 	struct verbs_sysfs_dev *dev, *dev_tmp;
 	struct nl_sock *nl;
@@ -205,6 +211,7 @@ int find_sysfs_devs_nl(struct list_head *tmp_sysfs_dev_list)
 		    try_access_device(dev)) {
 			list_del(&dev->entry);
 			free(dev);
+			*skipped = true;
 		}
 	}
 
@@ -249,9 +256,236 @@ bool get_copy_on_fork(void)
 	if (!nl)
 		return false;
 
-	if (rdmanl_get_copy_on_fork(nl, get_copy_on_fork_cb, &cof))
+	if (rdmanl_get_sys(nl, get_copy_on_fork_cb, &cof))
 		cof = false;
 
 	nl_socket_free(nl);
 	return cof;
 }
+
+static int get_monitor_mode_cb(struct nl_msg *msg, void *data)
+{
+	struct nlattr *tb[RDMA_NLDEV_ATTR_MAX];
+	int ret;
+
+	ret = nlmsg_parse(nlmsg_hdr(msg), 0, tb, RDMA_NLDEV_ATTR_MAX - 1,
+			  rdmanl_policy);
+	if (ret < 0)
+		return ret;
+
+	/* Only kernels sending monitor events report the attribute */
+	if (tb[RDMA_NLDEV_SYS_ATTR_MONITOR_MODE])
+		*(uint8_t *)data =
+			nla_get_u8(tb[RDMA_NLDEV_SYS_ATTR_MONITOR_MODE]);
+	return NL_OK;
+}
+
+/* A netlink socket subscribed to the RDMA device monitor events */
+static struct nl_sock *monitor_socket_alloc(void)
+{
+	uint8_t monitor_mode = 0;
+	struct nl_sock *nl;
+	int ret;
+
+	nl = rdmanl_socket_alloc();
+	if (!nl) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	if (rdmanl_get_sys(nl, get_monitor_mode_cb, &monitor_mode) ||
+	    !monitor_mode) {
+		errno = EOPNOTSUPP;
+		goto err;
+	}
+
+	if (nl_socket_add_membership(nl, RDMA_NL_GROUP_NOTIFY)) {
+		if (!errno)
+			errno = EPERM;
+		goto err;
+	}
+
+	return nl;
+
+err:
+	ret = errno;
+	nl_socket_free(nl);
+	errno = ret;
+	return NULL;
+}
+
+/*
+ * Tracks changes to the set of devices for the cached device list, only
+ * used under the device list lock.  The socket is reopened after fork() so
+ * the child does not consume the events of its parent.  A failure to open
+ * it is remembered until then, rather than retried by every call.
+ */
+static struct nl_sock *list_monitor;
+static pid_t list_monitor_pid;
+static int list_monitor_error;
+
+/*
+ * Return 0 if no device was added, removed or renamed since the previous
+ * call, 1 if the device list must be read again, or a negative errno if
+ * device changes can't be tracked.
+ */
+int ibverbs_device_list_changed(void)
+{
+	char buf[4096];
+	bool changed = false;
+	ssize_t len;
+	int ret;
+
+	if (list_monitor_pid != getpid()) {
+		if (list_monitor) {
+			nl_socket_free(list_monitor);
+			list_monitor = NULL;
+		}
+		list_monitor_error = 0;
+	}
+
+	if (list_monitor_error)
+		return -list_monitor_error;
+
+	if (!list_monitor) {
+		list_monitor_pid = getpid();
+		list_monitor = monitor_socket_alloc();
+		if (!list_monitor) {
+			list_monitor_error = errno ? errno : EOPNOTSUPP;
+			return -list_monitor_error;
+		}
+		return 1;
+	}
+
+	/* Any event, or an overrun that lost some, invalidates the list */
+	while (true) {
+		len = recv(nl_socket_get_fd(list_monitor), buf, sizeof(buf),
+			   MSG_DONTWAIT);
+		if (len >= 0) {
+			changed = true;
+			continue;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+		if (errno == EINTR)
+			continue;
+		if (errno == ENOBUFS) {
+			changed = true;
+			continue;
+		}
+
+		/* nl_socket_free() may change errno */
+		ret = errno;
+		nl_socket_free(list_monitor);
+		list_monitor = NULL;
+		return -ret;
+	}
+
+	return changed;
+}
+
+struct verbs_device_monitor {
+	struct ibv_device_monitor monitor;
+	struct nl_sock *nl;
+	/* Messages of the last datagram not returned yet */
+	size_t len;
+	size_t offset;
+	uint32_t buf[1024];
+};
+
+struct ibv_device_monitor *ibv_create_device_monitor(void)
+{
+	struct verbs_device_monitor *mon;
+
+	mon = calloc(1, sizeof(*mon));
+	if (!mon) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	mon->nl = monitor_socket_alloc();
+	if (!mon->nl) {
+		free(mon);
+		return NULL;
+	}
+	mon->monitor.fd = nl_socket_get_fd(mon->nl);
+
+	return &mon->monitor;
+}
+
+/* Fill @event from a monitor message, false if it isn't a device event */
+static bool parse_device_event(struct nlmsghdr *nlh,
+			       struct ibv_device_event *event)
+{
+	struct nlattr *tb[RDMA_NLDEV_ATTR_MAX];
+
+	if (nlh->nlmsg_type !=
+	    RDMA_NL_GET_TYPE(RDMA_NL_NLDEV, RDMA_NLDEV_CMD_MONITOR))
+		return false;
+
+	if (nlmsg_parse(nlh, 0, tb, RDMA_NLDEV_ATTR_MAX - 1, rdmanl_policy) ||
+	    !tb[RDMA_NLDEV_ATTR_EVENT_TYPE] || !tb[RDMA_NLDEV_ATTR_DEV_INDEX])
+		return false;
+
+	/* Netdev association changes don't change the device list */
+	switch (nla_get_u8(tb[RDMA_NLDEV_ATTR_EVENT_TYPE])) {
+	case RDMA_REGISTER_EVENT:
+		event->event_type = IBV_DEVICE_EVENT_ADD;
+		break;
+	case RDMA_UNREGISTER_EVENT:
+		event->event_type = IBV_DEVICE_EVENT_REMOVE;
+		break;
+	case RDMA_RENAME_EVENT:
+		event->event_type = IBV_DEVICE_EVENT_RENAME;
+		break;
+	default:
+		return false;
+	}
+
+	event->index = nla_get_u32(tb[RDMA_NLDEV_ATTR_DEV_INDEX]);
+	event->name[0] = 0;
+	if (tb[RDMA_NLDEV_ATTR_DEV_NAME] &&
+	    !check_snprintf(event->name, sizeof(event->name), "%s",
+			    nla_get_string(tb[RDMA_NLDEV_ATTR_DEV_NAME])))
+		event->name[0] = 0;
+	return true;
+}
+
+int ibv_get_device_event(struct ibv_device_monitor *monitor,
+			 struct ibv_device_event *event)
+{
+	struct verbs_device_monitor *mon =
+		container_of(monitor, struct verbs_device_monitor, monitor);
+	struct nlmsghdr *nlh;
+	ssize_t len;
+
+	while (true) {
+		if (mon->offset >= mon->len) {
+			mon->offset = mon->len = 0;
+			len = recv(monitor->fd, mon->buf, sizeof(mon->buf), 0);
+			if (len < 0)
+				return -1;
+			mon->len = len;
+			continue;
+		}
+
+		nlh = (struct nlmsghdr *)((uint8_t *)mon->buf + mon->offset);
+		if (!NLMSG_OK(nlh, mon->len - mon->offset)) {
+			mon->offset = mon->len;
+			continue;
+		}
+		mon->offset += NLMSG_ALIGN(nlh->nlmsg_len);
+
+		if (parse_device_event(nlh, event))
+			return 0;
+	}
+}
+
+void ibv_destroy_device_monitor(struct ibv_device_monitor *monitor)
+{
+	struct verbs_device_monitor *mon =
+		container_of(monitor, struct verbs_device_monitor, monitor);
+
+	nl_socket_free(mon->nl);
+	free(mon);
+}
@@ -75,6 +75,8 @@ struct verbs_ex_private {
 	bool use_ioctl_write;
 	struct verbs_context_ops ops;
 	bool imported;
+	pthread_mutex_t gid_cache_lock;
+	struct verbs_gid_cache *gid_cache;
 };
 
 static inline struct verbs_ex_private *get_priv(struct ibv_context *ctx)
@@ -89,8 +91,24 @@ static inline const struct verbs_context_ops *get_ops(struct ibv_context *ctx)
 
 enum ibv_node_type decode_knode_type(unsigned int knode_type);
 
-int find_sysfs_devs_nl(struct list_head *tmp_sysfs_dev_list);
+int find_sysfs_devs_nl(struct list_head *tmp_sysfs_dev_list, bool *skipped);
+int ibverbs_device_list_changed(void);
 
 int try_access_device(const struct verbs_sysfs_dev *sysfs_dev);
 
+struct ibv_mr *ibverbs_reg_mr(struct ibv_pd *pd, void *addr, size_t length,
+			      uint64_t iova, unsigned int access);
+bool ibverbs_mr_cache_enabled(void);
+struct ibv_mr *ibverbs_mr_cache_get(struct ibv_pd *pd, void *addr,
+				    size_t length, unsigned int access);
+int ibverbs_mr_cache_put(struct ibv_mr *mr);
+void ibverbs_mr_cache_flush_pd(struct ibv_pd *pd);
+int ibverbs_bind_mw(struct ibv_qp *qp, struct ibv_mw *mw,
+		    struct ibv_mw_bind *mw_bind);
+
+int ibverbs_gid_cache_find(struct ibv_context *context, uint32_t port_num,
+			   const union ibv_gid *gid,
+			   enum ibv_gid_type_sysfs gid_type);
+void ibverbs_gid_cache_invalidate(struct ibv_context *context);
+
 #endif /* IB_VERBS_H */
@@ -237,6 +237,41 @@ static int find_sysfs_devs(struct list_head *tmp_sysfs_dev_list)
 	return ret;
 }
 
+/*
+ * RDMAV_LOOPBACK_DEVICES=<n> adds n devices named loopbackX that are
+ * emulated entirely in userspace by the loopback provider.
+ */
+static unsigned int num_loopback_devs(void)
+{
+	const char *env = getenv("RDMAV_LOOPBACK_DEVICES");
+
+	return env ? strtoul(env, NULL, 0) : 0;
+}
+
+static int find_loopback_devs(struct list_head *tmp_sysfs_dev_list)
+{
+	unsigned int num = num_loopback_devs();
+	struct verbs_sysfs_dev *sysfs_dev;
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		sysfs_dev = calloc(1, sizeof(*sysfs_dev));
+		if (!sysfs_dev)
+			return ENOMEM;
+
+		sysfs_dev->ibdev_idx = -1;
+		sysfs_dev->flags = VSYSFS_USERSPACE;
+		sysfs_dev->node_type = IBV_NODE_CA;
+		sysfs_dev->num_ports = 1;
+		snprintf(sysfs_dev->sysfs_name, sizeof(sysfs_dev->sysfs_name),
+			 "loopback%u", i);
+		snprintf(sysfs_dev->ibdev_name, sizeof(sysfs_dev->ibdev_name),
+			 "loopback%u", i);
+		list_add_tail(tmp_sysfs_dev_list, &sysfs_dev->entry);
+	}
+	return 0;
+}
+
 void verbs_register_driver(const struct verbs_device_ops *ops)
 {
 	struct ibv_driver *driver;
@@ -554,22 +589,44 @@ int ibverbs_get_device_list(struct list_head *device_list)
 	struct verbs_sysfs_dev *sysfs_dev, *next_dev;
 	struct verbs_device *vdev, *tmp;
 	static int drivers_loaded;
+	/* device_list is reused until the kernel reports a device change */
+	static bool list_current;
+	static unsigned int list_num_devices;
 	unsigned int num_devices = 0;
+	bool skipped = false;
+	int changed;
 	int ret;
 
-	ret = find_sysfs_devs_nl(&sysfs_list);
+	changed = ibverbs_device_list_changed();
+	if (list_current && !changed)
+		return list_num_devices;
+	list_current = false;
+
+	ret = find_sysfs_devs_nl(&sysfs_list, &skipped);
 	if (ret) {
+		/* Changes seen through sysfs aren't tracked */
+		skipped = true;
 		ret = find_sysfs_devs(&sysfs_list);
-		if (ret)
-			return -ret;
 	}
 
-	if (!list_empty(&sysfs_list)) {
+	if (!ret && !list_empty(&sysfs_list))
 		ret = check_abi_version();
-		if (ret)
-			return -ret;
+
+	if (ret) {
+		/* Loopback devices still work without the kernel */
+		if (!num_loopback_devs())
+			goto err_free;
+		list_for_each_safe(&sysfs_list, sysfs_dev, next_dev, entry) {
+			list_del(&sysfs_dev->entry);
+			free(sysfs_dev);
+		}
+		skipped = true;
 	}
 
+	ret = find_loopback_devs(&sysfs_list);
+	if (ret)
+		goto err_free;
+
 	/* Remove entries from the sysfs_list that are already preset in the
 	 * device_list, and remove entries from the device_list that are not
 	 * present in the sysfs_list.
@@ -615,9 +672,27 @@ out:
 				sysfs_dev->ibdev_name);
 		}
 		free(sysfs_dev);
+		skipped = true;
+	}
+
+	/*
+	 * Devices that were left out may become usable without a device
+	 * event (e.g. once udev creates their uverbs node), so only a
+	 * complete list is cached.
+	 */
+	if (changed >= 0 && !skipped) {
+		list_current = true;
+		list_num_devices = num_devices;
 	}
 
 	return num_devices;
+
+err_free:
+	list_for_each_safe(&sysfs_list, sysfs_dev, next_dev, entry) {
+		list_del(&sysfs_dev->entry);
+		free(sysfs_dev);
+	}
+	return -ret;
 }
 
 static void verbs_set_log_level(void)
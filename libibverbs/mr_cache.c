@@ -0,0 +1,388 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+
+#include <config.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <ccan/list.h>
+#include <ccan/minmax.h>
+#include <util/util.h>
+
+#include "ibverbs.h"
+
+/*
+ * Optional cache of memory registrations, enabled by the application calling
+ * ibv_enable_mr_cache() with the number of bytes of registered memory the
+ * cache may hold.  Registrations are made over whole pages and kept in an
+ * interval tree, so that later ibv_reg_mr() calls on the same pd, with the
+ * same access flags, for any range covered by a cached registration reuse
+ * it.  The caller gets a handle carrying the lkey/rkey of the underlying
+ * registration, which ibv_dereg_mr() releases.  Unused registrations are
+ * kept on an LRU list and deregistered when the cache exceeds its budget.
+ *
+ * A cached registration pins the pages it covered when it was created.  The
+ * application that enables the cache takes over its invalidation, and must
+ * call ibv_invalidate_mr_cache() before unmapping or remapping memory that
+ * may be cached.  This is why the cache is never enabled behind the back of
+ * an application, e.g. from the environment.
+ */
+
+struct mr_cache_entry {
+	/* Interval tree, a treap ordered by start and augmented by max_end */
+	struct mr_cache_entry *left;
+	struct mr_cache_entry *right;
+	uint32_t prio;
+	uintptr_t start;
+	uintptr_t end;
+	uintptr_t max_end;
+
+	struct list_node lru;
+	struct ibv_mr *mr;
+	struct ibv_pd *pd;
+	unsigned int access;
+	unsigned int refcnt;
+	bool invalid;
+};
+
+struct mr_cache_handle {
+	struct verbs_mr vmr;
+	struct mr_cache_entry *entry;
+};
+
+static pthread_once_t mr_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t mr_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mr_cache_entry *mr_cache_root;
+static LIST_HEAD(mr_cache_lru);
+static _Atomic(size_t) mr_cache_max;
+static size_t mr_cache_bytes;
+static uintptr_t mr_cache_page_size;
+static uint32_t mr_cache_seed = 1;
+
+static void mr_cache_init(void)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if (page_size > 0)
+		mr_cache_page_size = page_size;
+}
+
+bool ibverbs_mr_cache_enabled(void)
+{
+	/* Pairs with ibv_enable_mr_cache(), which set mr_cache_page_size */
+	return atomic_load_explicit(&mr_cache_max, memory_order_acquire) != 0;
+}
+
+static uint32_t mr_cache_rand(void)
+{
+	/* xorshift32, only used to balance the treap */
+	mr_cache_seed ^= mr_cache_seed << 13;
+	mr_cache_seed ^= mr_cache_seed >> 17;
+	mr_cache_seed ^= mr_cache_seed << 5;
+	return mr_cache_seed;
+}
+
+static uintptr_t node_max_end(struct mr_cache_entry *node)
+{
+	return node ? node->max_end : 0;
+}
+
+static void node_update(struct mr_cache_entry *node)
+{
+	uintptr_t child_max = max(node_max_end(node->left),
+				  node_max_end(node->right));
+
+	node->max_end = max(node->end, child_max);
+}
+
+static bool node_before(struct mr_cache_entry *a, struct mr_cache_entry *b)
+{
+	return a->start < b->start || (a->start == b->start && a < b);
+}
+
+static struct mr_cache_entry *tree_insert(struct mr_cache_entry *root,
+					  struct mr_cache_entry *node)
+{
+	struct mr_cache_entry *child;
+
+	if (!root)
+		return node;
+
+	if (node_before(node, root)) {
+		root->left = tree_insert(root->left, node);
+		if (root->left->prio > root->prio) {
+			child = root->left;
+			root->left = child->right;
+			child->right = root;
+			node_update(root);
+			root = child;
+		}
+	} else {
+		root->right = tree_insert(root->right, node);
+		if (root->right->prio > root->prio) {
+			child = root->right;
+			root->right = child->left;
+			child->left = root;
+			node_update(root);
+			root = child;
+		}
+	}
+	node_update(root);
+	return root;
+}
+
+/* Every node in @left is ordered before every node in @right */
+static struct mr_cache_entry *tree_merge(struct mr_cache_entry *left,
+					 struct mr_cache_entry *right)
+{
+	if (!left)
+		return right;
+	if (!right)
+		return left;
+
+	if (left->prio > right->prio) {
+		left->right = tree_merge(left->right, right);
+		node_update(left);
+		return left;
+	}
+
+	right->left = tree_merge(left, right->left);
+	node_update(right);
+	return right;
+}
+
+static struct mr_cache_entry *tree_remove(struct mr_cache_entry *root,
+					  struct mr_cache_entry *node)
+{
+	if (root == node)
+		return tree_merge(node->left, node->right);
+
+	if (node_before(node, root))
+		root->left = tree_remove(root->left, node);
+	else
+		root->right = tree_remove(root->right, node);
+	node_update(root);
+	return root;
+}
+
+/* Find a registration of @pd with @access covering [start, end) */
+static struct mr_cache_entry *tree_find(struct mr_cache_entry *node,
+					struct ibv_pd *pd, unsigned int access,
+					uintptr_t start, uintptr_t end)
+{
+	struct mr_cache_entry *found;
+
+	if (!node || node->max_end < end)
+		return NULL;
+
+	found = tree_find(node->left, pd, access, start, end);
+	if (found)
+		return found;
+
+	if (node->start > start)
+		return NULL;
+
+	if (node->end >= end && node->pd == pd && node->access == access)
+		return node;
+
+	return tree_find(node->right, pd, access, start, end);
+}
+
+/* Find any registration overlapping [start, end) */
+static struct mr_cache_entry *tree_find_overlap(struct mr_cache_entry *node,
+						uintptr_t start, uintptr_t end)
+{
+	struct mr_cache_entry *found;
+
+	if (!node || node->max_end <= start)
+		return NULL;
+
+	found = tree_find_overlap(node->left, start, end);
+	if (found)
+		return found;
+
+	if (node->start >= end)
+		return NULL;
+
+	if (node->end > start)
+		return node;
+
+	return tree_find_overlap(node->right, start, end);
+}
+
+static void mr_cache_free_entry(struct mr_cache_entry *entry)
+{
+	mr_cache_bytes -= entry->end - entry->start;
+	ibv_dereg_mr(entry->mr);
+	free(entry);
+}
+
+static void mr_cache_evict(void)
+{
+	struct mr_cache_entry *entry;
+
+	while (mr_cache_bytes > mr_cache_max) {
+		entry = list_pop(&mr_cache_lru, struct mr_cache_entry, lru);
+		if (!entry)
+			break;
+
+		mr_cache_root = tree_remove(mr_cache_root, entry);
+		mr_cache_free_entry(entry);
+	}
+}
+
+static struct mr_cache_entry *mr_cache_add(struct ibv_pd *pd, uintptr_t start,
+					   uintptr_t end, unsigned int access)
+{
+	struct mr_cache_entry *entry;
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	entry->mr = ibverbs_reg_mr(pd, (void *)start, end - start, start,
+				   access);
+	if (!entry->mr) {
+		free(entry);
+		return NULL;
+	}
+
+	entry->pd = pd;
+	entry->access = access;
+	entry->start = start;
+	entry->end = end;
+	entry->max_end = end;
+	entry->prio = mr_cache_rand();
+	mr_cache_root = tree_insert(mr_cache_root, entry);
+	mr_cache_bytes += end - start;
+	return entry;
+}
+
+struct ibv_mr *ibverbs_mr_cache_get(struct ibv_pd *pd, void *addr,
+				    size_t length, unsigned int access)
+{
+	struct mr_cache_handle *handle;
+	struct mr_cache_entry *entry;
+	uintptr_t start, end;
+
+	start = align_down((uintptr_t)addr, mr_cache_page_size);
+	end = align((uintptr_t)addr + length, mr_cache_page_size);
+
+	/* Too big to ever fit, don't flush the cache for it */
+	if (!length || end - start > atomic_load(&mr_cache_max))
+		return ibverbs_reg_mr(pd, addr, length, (uintptr_t)addr,
+				      access);
+
+	handle = calloc(1, sizeof(*handle));
+	if (!handle) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&mr_cache_mutex);
+	entry = tree_find(mr_cache_root, pd, access, start, end);
+	if (entry) {
+		if (!entry->refcnt++)
+			list_del(&entry->lru);
+	} else {
+		entry = mr_cache_add(pd, start, end, access);
+		if (!entry)
+			goto err;
+		entry->refcnt = 1;
+		mr_cache_evict();
+	}
+	pthread_mutex_unlock(&mr_cache_mutex);
+
+	handle->entry = entry;
+	handle->vmr.mr_type = IBV_MR_TYPE_CACHED_MR;
+	handle->vmr.access = access;
+	handle->vmr.ibv_mr.context = pd->context;
+	handle->vmr.ibv_mr.pd = pd;
+	handle->vmr.ibv_mr.addr = addr;
+	handle->vmr.ibv_mr.length = length;
+	handle->vmr.ibv_mr.handle = entry->mr->handle;
+	handle->vmr.ibv_mr.lkey = entry->mr->lkey;
+	handle->vmr.ibv_mr.rkey = entry->mr->rkey;
+	return &handle->vmr.ibv_mr;
+
+err:
+	pthread_mutex_unlock(&mr_cache_mutex);
+	free(handle);
+	return NULL;
+}
+
+int ibverbs_mr_cache_put(struct ibv_mr *mr)
+{
+	struct mr_cache_handle *handle =
+		container_of(verbs_get_mr(mr), struct mr_cache_handle, vmr);
+	struct mr_cache_entry *entry = handle->entry;
+
+	pthread_mutex_lock(&mr_cache_mutex);
+	if (!--entry->refcnt) {
+		if (entry->invalid) {
+			mr_cache_free_entry(entry);
+		} else {
+			list_add_tail(&mr_cache_lru, &entry->lru);
+			mr_cache_evict();
+		}
+	}
+	pthread_mutex_unlock(&mr_cache_mutex);
+
+	free(handle);
+	return 0;
+}
+
+/* Release the unused registrations of a pd that is being deallocated */
+void ibverbs_mr_cache_flush_pd(struct ibv_pd *pd)
+{
+	struct mr_cache_entry *entry, *tmp;
+
+	pthread_mutex_lock(&mr_cache_mutex);
+	list_for_each_safe(&mr_cache_lru, entry, tmp, lru) {
+		if (entry->pd != pd)
+			continue;
+
+		list_del(&entry->lru);
+		mr_cache_root = tree_remove(mr_cache_root, entry);
+		mr_cache_free_entry(entry);
+	}
+	pthread_mutex_unlock(&mr_cache_mutex);
+}
+
+void ibv_invalidate_mr_cache(void *addr, size_t length)
+{
+	struct mr_cache_entry *entry;
+	uintptr_t start = (uintptr_t)addr;
+
+	pthread_mutex_lock(&mr_cache_mutex);
+	while ((entry = tree_find_overlap(mr_cache_root, start,
+					  start + length))) {
+		mr_cache_root = tree_remove(mr_cache_root, entry);
+		if (entry->refcnt) {
+			/* Released by the last ibv_dereg_mr() of the range */
+			entry->invalid = true;
+		} else {
+			list_del(&entry->lru);
+			mr_cache_free_entry(entry);
+		}
+	}
+	pthread_mutex_unlock(&mr_cache_mutex);
+}
+
+int ibv_enable_mr_cache(size_t max_bytes)
+{
+	pthread_once(&mr_cache_once, mr_cache_init);
+	if (!mr_cache_page_size)
+		return EOPNOTSUPP;
+
+	pthread_mutex_lock(&mr_cache_mutex);
+	atomic_store(&mr_cache_max, max_bytes);
+	mr_cache_evict();
+	pthread_mutex_unlock(&mr_cache_mutex);
+	return 0;
+}
@@ -52,6 +52,10 @@
 #include "ibverbs.h"
 #include <net/if.h>
 #include <net/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <time.h>
 #include "neigh.h"
 
 #undef ibv_query_port
@@ -304,11 +308,12 @@ LATEST_SYMVER_FUNC(ibv_dealloc_pd, 1_1, "IBVERBS_1.1",
 		   int,
 		   struct ibv_pd *pd)
 {
+	ibverbs_mr_cache_flush_pd(pd);
 	return get_ops(pd->context)->dealloc_pd(pd);
 }
 
-struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length,
-				uint64_t iova, unsigned int access)
+struct ibv_mr *ibverbs_reg_mr(struct ibv_pd *pd, void *addr, size_t length,
+			      uint64_t iova, unsigned int access)
 {
 	struct verbs_device *device = verbs_get_device(pd->context->device);
 	bool odp_mr = access & IBV_ACCESS_ON_DEMAND;
@@ -334,6 +339,16 @@ struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length,
 	return mr;
 }
 
+struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length,
+				uint64_t iova, unsigned int access)
+{
+	if (!(access & IBV_ACCESS_ON_DEMAND) && iova == (uintptr_t)addr &&
+	    ibverbs_mr_cache_enabled())
+		return ibverbs_mr_cache_get(pd, addr, length, access);
+
+	return ibverbs_reg_mr(pd, addr, length, iova, access);
+}
+
 #undef ibv_reg_mr
 LATEST_SYMVER_FUNC(ibv_reg_mr, 1_1, "IBVERBS_1.1",
 		   struct ibv_mr *,
@@ -488,6 +503,9 @@ LATEST_SYMVER_FUNC(ibv_dereg_mr, 1_1, "IBVERBS_1.1",
 	enum ibv_mr_type type	= verbs_get_mr(mr)->mr_type;
 	int access = verbs_get_mr(mr)->access;
 
+	if (type == IBV_MR_TYPE_CACHED_MR)
+		return ibverbs_mr_cache_put(mr);
+
 	ret = get_ops(mr->context)->dereg_mr(verbs_get_mr(mr));
 	if (!ret && type == IBV_MR_TYPE_MR && !(access & IBV_ACCESS_ON_DEMAND))
 		ibv_dofork_range(addr, length);
@@ -495,6 +513,23 @@ LATEST_SYMVER_FUNC(ibv_dereg_mr, 1_1, "IBVERBS_1.1",
 	return ret;
 }
 
+/*
+ * Installed as the context's bind_mw op.  A cached MR handle is not laid
+ * out as the provider's MR, so it must not reach the provider.
+ */
+int ibverbs_bind_mw(struct ibv_qp *qp, struct ibv_mw *mw,
+		    struct ibv_mw_bind *mw_bind)
+{
+	struct ibv_mr *mr = mw_bind->bind_info.mr;
+
+	if (mr && verbs_get_mr(mr)->mr_type == IBV_MR_TYPE_CACHED_MR) {
+		errno = EINVAL;
+		return errno;
+	}
+
+	return get_ops(qp->context)->bind_mw(qp, mw, mw_bind);
+}
+
 struct ibv_comp_channel *ibv_create_comp_channel(struct ibv_context *context)
 {
 	struct ibv_create_comp_channel req;
@@ -785,6 +820,12 @@ static int ibv_find_gid_index(struct ibv_context *context, uint8_t port_num,
 	union ibv_gid sgid;
 	int i = 0, ret;
 
+	ret = ibverbs_gid_cache_find(context, port_num, gid, gid_type);
+	if (ret >= 0)
+		return ret;
+	if (ret == -ENOENT)
+		return -1;
+
 	do {
 		ret = ibv_query_gid(context, port_num, i, &sgid);
 		if (!ret) {
@@ -1028,43 +1069,34 @@ static inline int create_peer_from_gid(int family, void *raw_gid,
 }
 
 #define NEIGH_GET_DEFAULT_TIMEOUT_MS 3000
-int ibv_resolve_eth_l2_from_gid(struct ibv_context *context,
-				struct ibv_ah_attr *attr,
-				uint8_t eth_mac[ETHERNET_LL_SIZE],
-				uint16_t *vid)
+static int l2_resolve(union ibv_gid *sgid, union ibv_gid *dgid,
+		      uint8_t eth_mac[ETHERNET_LL_SIZE], uint16_t *vid)
 {
 	int dst_family;
 	int src_family;
 	int oif;
 	struct get_neigh_handler neigh_handler;
-	union ibv_gid sgid;
 	int ether_len;
 	struct peer_address src;
 	struct peer_address dst;
 	int ret = -EINVAL;
 	int err;
 
-	err = ibv_query_gid(context, attr->port_num,
-			    attr->grh.sgid_index, &sgid);
-
-	if (err)
-		return err;
-
 	err = neigh_init_resources(&neigh_handler,
 				   NEIGH_GET_DEFAULT_TIMEOUT_MS);
 
 	if (err)
 		return err;
 
-	dst_family = ipv6_addr_v4mapped((struct in6_addr *)attr->grh.dgid.raw) ?
+	dst_family = ipv6_addr_v4mapped((struct in6_addr *)dgid->raw) ?
 			AF_INET : AF_INET6;
-	src_family = ipv6_addr_v4mapped((struct in6_addr *)sgid.raw) ?
+	src_family = ipv6_addr_v4mapped((struct in6_addr *)sgid->raw) ?
 			AF_INET : AF_INET6;
 
-	if (create_peer_from_gid(dst_family, attr->grh.dgid.raw, &dst))
+	if (create_peer_from_gid(dst_family, dgid->raw, &dst))
 		goto free_resources;
 
-	if (create_peer_from_gid(src_family, &sgid.raw, &src))
+	if (create_peer_from_gid(src_family, sgid->raw, &src))
 		goto free_resources;
 
 	if (neigh_set_dst(&neigh_handler, dst_family, dst.address,
@@ -1112,6 +1144,371 @@ free_resources:
 	return ret;
 }
 
+/*
+ * Resolved L2 addresses are cached process wide, keyed by the source and
+ * destination GIDs.  The cache is kept coherent by a netlink socket
+ * subscribed to neighbour, route, address and link changes, which is
+ * drained before every lookup.  Neighbour updates for a cached destination
+ * drop that entry unless the MAC is unchanged; any other change, or a lost
+ * notification, drops the whole cache.  Concurrent lookups of a destination
+ * being resolved wait for that resolution instead of starting their own,
+ * and ibv_prefetch_eth_l2_from_gid() hands resolutions to a small pool of
+ * threads so they proceed in parallel.
+ */
+#define L2_CACHE_HASH_SIZE	256
+#define L2_CACHE_MAX_ENTRIES	16384
+#define L2_RESOLVE_THREADS	8
+#define L2_RESOLVE_IDLE_SEC	1
+#define L2_NUD_VALID		(NUD_PERMANENT | NUD_NOARP | NUD_REACHABLE | \
+				 NUD_PROBE | NUD_STALE | NUD_DELAY)
+
+enum l2_entry_state {
+	L2_ENTRY_RESOLVING,
+	L2_ENTRY_VALID,
+	L2_ENTRY_FAILED,
+};
+
+struct l2_entry {
+	struct list_node hash_entry;
+	struct list_node queue_entry;
+	union ibv_gid sgid;
+	union ibv_gid dgid;
+	enum l2_entry_state state;
+	bool stale;
+	unsigned int waiters;
+	int ret;
+	uint8_t mac[ETHERNET_LL_SIZE];
+	uint16_t vid;
+};
+
+static pthread_once_t l2_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t l2_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t l2_cache_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t l2_queue_cond = PTHREAD_COND_INITIALIZER;
+static struct list_head l2_cache_hash[L2_CACHE_HASH_SIZE];
+static LIST_HEAD(l2_queue);
+static unsigned int l2_cache_cnt;
+static unsigned int l2_threads, l2_idle_threads;
+static int l2_cache_nl_fd = -1;
+
+static void l2_cache_init(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK | RTMGRP_NEIGH |
+			     RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE |
+			     RTMGRP_IPV6_IFADDR | RTMGRP_IPV6_ROUTE,
+	};
+	int i, fd;
+
+	for (i = 0; i < L2_CACHE_HASH_SIZE; i++)
+		list_head_init(&l2_cache_hash[i]);
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    NETLINK_ROUTE);
+	if (fd < 0)
+		return;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return;
+	}
+	l2_cache_nl_fd = fd;
+}
+
+static struct list_head *l2_cache_bucket(const union ibv_gid *sgid,
+					 const union ibv_gid *dgid)
+{
+	uint32_t hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < sizeof(sgid->raw); i++)
+		hash = (hash ^ sgid->raw[i] ^ (dgid->raw[i] << 8)) * 16777619U;
+
+	return &l2_cache_hash[hash % L2_CACHE_HASH_SIZE];
+}
+
+static bool l2_entry_unused(struct l2_entry *entry)
+{
+	return entry->state != L2_ENTRY_RESOLVING && !entry->waiters;
+}
+
+static void l2_cache_drop(struct l2_entry *entry)
+{
+	if (!l2_entry_unused(entry)) {
+		/* Whoever resolves or waits on it still needs it */
+		entry->stale = true;
+		return;
+	}
+
+	list_del(&entry->hash_entry);
+	l2_cache_cnt--;
+	free(entry);
+}
+
+static void l2_cache_flush(void)
+{
+	struct l2_entry *entry, *tmp;
+	int i;
+
+	for (i = 0; i < L2_CACHE_HASH_SIZE; i++)
+		list_for_each_safe(&l2_cache_hash[i], entry, tmp, hash_entry)
+			l2_cache_drop(entry);
+}
+
+static bool l2_entry_has_dst(struct l2_entry *entry, const void *dst,
+			     size_t len)
+{
+	if (ipv6_addr_v4mapped((struct in6_addr *)entry->dgid.raw))
+		return len == 4 && !memcmp(entry->dgid.raw + 12, dst, 4);
+
+	return len == 16 && !memcmp(entry->dgid.raw, dst, 16);
+}
+
+static void l2_cache_neigh_event(struct nlmsghdr *hdr)
+{
+	struct ndmsg *ndm = NLMSG_DATA(hdr);
+	struct rtattr *rta = (struct rtattr *)((char *)ndm +
+					       NLMSG_ALIGN(sizeof(*ndm)));
+	int len = hdr->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+	void *dst = NULL, *lladdr = NULL;
+	size_t dst_len = 0, lladdr_len = 0;
+	struct l2_entry *entry, *tmp;
+	int i;
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == NDA_DST) {
+			dst = RTA_DATA(rta);
+			dst_len = RTA_PAYLOAD(rta);
+		} else if (rta->rta_type == NDA_LLADDR) {
+			lladdr = RTA_DATA(rta);
+			lladdr_len = RTA_PAYLOAD(rta);
+		}
+	}
+	if (!dst)
+		return;
+
+	for (i = 0; i < L2_CACHE_HASH_SIZE; i++) {
+		list_for_each_safe(&l2_cache_hash[i], entry, tmp, hash_entry) {
+			if (!l2_entry_has_dst(entry, dst, dst_len))
+				continue;
+
+			/* Neighbour state refreshes keep the same MAC */
+			if (hdr->nlmsg_type == RTM_NEWNEIGH &&
+			    entry->state == L2_ENTRY_VALID &&
+			    (ndm->ndm_state & L2_NUD_VALID) &&
+			    lladdr_len == ETHERNET_LL_SIZE &&
+			    !memcmp(entry->mac, lladdr, ETHERNET_LL_SIZE))
+				continue;
+
+			l2_cache_drop(entry);
+		}
+	}
+}
+
+static void l2_cache_process_events(void)
+{
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *hdr;
+	ssize_t len;
+
+	while (true) {
+		len = recv(l2_cache_nl_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0) {
+			/* Notifications were lost, nothing can be trusted */
+			if (errno == ENOBUFS)
+				l2_cache_flush();
+			if (errno == ENOBUFS || errno == EINTR)
+				continue;
+			return;
+		}
+
+		for (hdr = (struct nlmsghdr *)buf; NLMSG_OK(hdr, len);
+		     hdr = NLMSG_NEXT(hdr, len)) {
+			switch (hdr->nlmsg_type) {
+			case RTM_NEWNEIGH:
+			case RTM_DELNEIGH:
+				l2_cache_neigh_event(hdr);
+				break;
+			case NLMSG_NOOP:
+			case NLMSG_DONE:
+				break;
+			default:
+				l2_cache_flush();
+				break;
+			}
+		}
+	}
+}
+
+static void l2_entry_complete(struct l2_entry *entry, int ret,
+			      uint8_t *mac, uint16_t vid)
+{
+	entry->ret = ret;
+	entry->state = ret ? L2_ENTRY_FAILED : L2_ENTRY_VALID;
+	if (!ret) {
+		memcpy(entry->mac, mac, ETHERNET_LL_SIZE);
+		entry->vid = vid;
+	}
+	pthread_cond_broadcast(&l2_cache_cond);
+}
+
+static void *l2_resolve_thread(void *arg)
+{
+	uint8_t mac[ETHERNET_LL_SIZE];
+	struct l2_entry *entry;
+	struct timespec ts;
+	uint16_t vid;
+	int ret;
+
+	pthread_mutex_lock(&l2_cache_mutex);
+	while (true) {
+		entry = list_pop(&l2_queue, struct l2_entry, queue_entry);
+		if (!entry) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += L2_RESOLVE_IDLE_SEC;
+			l2_idle_threads++;
+			ret = pthread_cond_timedwait(&l2_queue_cond,
+						     &l2_cache_mutex, &ts);
+			l2_idle_threads--;
+			if (ret == ETIMEDOUT && list_empty(&l2_queue))
+				break;
+			continue;
+		}
+
+		pthread_mutex_unlock(&l2_cache_mutex);
+		ret = l2_resolve(&entry->sgid, &entry->dgid, mac, &vid);
+		pthread_mutex_lock(&l2_cache_mutex);
+		l2_entry_complete(entry, ret, mac, vid);
+	}
+	l2_threads--;
+	pthread_mutex_unlock(&l2_cache_mutex);
+	return NULL;
+}
+
+/* Called with the cache lock held, returns false if no thread can run it */
+static bool l2_queue_entry(struct l2_entry *entry)
+{
+	pthread_t thread;
+
+	if (!l2_idle_threads && l2_threads < L2_RESOLVE_THREADS) {
+		if (!pthread_create(&thread, NULL, l2_resolve_thread, NULL)) {
+			pthread_detach(thread);
+			l2_threads++;
+		}
+	}
+	if (!l2_threads)
+		return false;
+
+	list_add_tail(&l2_queue, &entry->queue_entry);
+	pthread_cond_signal(&l2_queue_cond);
+	return true;
+}
+
+static int l2_cache_resolve(union ibv_gid *sgid, union ibv_gid *dgid,
+			    uint8_t eth_mac[ETHERNET_LL_SIZE], uint16_t *vid,
+			    bool wait)
+{
+	uint8_t mac[ETHERNET_LL_SIZE];
+	struct l2_entry *entry;
+	struct list_head *bucket;
+	uint16_t ret_vid;
+	int ret;
+
+	pthread_once(&l2_cache_once, l2_cache_init);
+	if (l2_cache_nl_fd < 0)
+		return wait ? l2_resolve(sgid, dgid, eth_mac, vid) : 0;
+
+	pthread_mutex_lock(&l2_cache_mutex);
+	l2_cache_process_events();
+
+	bucket = l2_cache_bucket(sgid, dgid);
+	list_for_each(bucket, entry, hash_entry) {
+		if (!memcmp(&entry->sgid, sgid, sizeof(*sgid)) &&
+		    !memcmp(&entry->dgid, dgid, sizeof(*dgid)))
+			goto found;
+	}
+
+	if (l2_cache_cnt >= L2_CACHE_MAX_ENTRIES)
+		l2_cache_flush();
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		pthread_mutex_unlock(&l2_cache_mutex);
+		return wait ? l2_resolve(sgid, dgid, eth_mac, vid) : 0;
+	}
+	entry->sgid = *sgid;
+	entry->dgid = *dgid;
+	entry->state = L2_ENTRY_FAILED;
+	entry->stale = true;
+	list_add(bucket, &entry->hash_entry);
+	l2_cache_cnt++;
+
+found:
+	if (entry->state != L2_ENTRY_RESOLVING &&
+	    (entry->stale || entry->state == L2_ENTRY_FAILED)) {
+		entry->state = L2_ENTRY_RESOLVING;
+		entry->stale = false;
+		if (wait || !l2_queue_entry(entry)) {
+			pthread_mutex_unlock(&l2_cache_mutex);
+			ret = l2_resolve(sgid, dgid, mac, &ret_vid);
+			pthread_mutex_lock(&l2_cache_mutex);
+			l2_entry_complete(entry, ret, mac, ret_vid);
+		}
+	}
+
+	if (!wait) {
+		pthread_mutex_unlock(&l2_cache_mutex);
+		return 0;
+	}
+
+	entry->waiters++;
+	while (entry->state == L2_ENTRY_RESOLVING)
+		pthread_cond_wait(&l2_cache_cond, &l2_cache_mutex);
+	entry->waiters--;
+
+	ret = entry->ret;
+	if (!ret) {
+		memcpy(eth_mac, entry->mac, ETHERNET_LL_SIZE);
+		if (vid)
+			*vid = entry->vid;
+	}
+	pthread_mutex_unlock(&l2_cache_mutex);
+	return ret;
+}
+
+int ibv_resolve_eth_l2_from_gid(struct ibv_context *context,
+				struct ibv_ah_attr *attr,
+				uint8_t eth_mac[ETHERNET_LL_SIZE],
+				uint16_t *vid)
+{
+	union ibv_gid sgid;
+	int err;
+
+	err = ibv_query_gid(context, attr->port_num,
+			    attr->grh.sgid_index, &sgid);
+
+	if (err)
+		return err;
+
+	return l2_cache_resolve(&sgid, &attr->grh.dgid, eth_mac, vid, true);
+}
+
+int ibv_prefetch_eth_l2_from_gid(struct ibv_context *context,
+				 struct ibv_ah_attr *attr)
+{
+	union ibv_gid sgid;
+	int err;
+
+	err = ibv_query_gid(context, attr->port_num,
+			    attr->grh.sgid_index, &sgid);
+
+	if (err)
+		return err;
+
+	return l2_cache_resolve(&sgid, &attr->grh.dgid, NULL, NULL, false);
+}
+
 int ibv_set_ece(struct ibv_qp *qp, struct ibv_ece *ece)
 {
 	if (!ece->vendor_id) {
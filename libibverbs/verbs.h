@@ -2275,6 +2275,7 @@ extern const struct verbs_device_ops verbs_provider_hfi1verbs;
 extern const struct verbs_device_ops verbs_provider_hns;
 extern const struct verbs_device_ops verbs_provider_ipathverbs;
 extern const struct verbs_device_ops verbs_provider_irdma;
+extern const struct verbs_device_ops verbs_provider_loopback;
 extern const struct verbs_device_ops verbs_provider_mana;
 extern const struct verbs_device_ops verbs_provider_mlx4;
 extern const struct verbs_device_ops verbs_provider_mlx5;
@@ -2326,6 +2327,41 @@ int ibv_get_device_index(struct ibv_device *device);
  */
 __be64 ibv_get_device_guid(struct ibv_device *device);
 
+enum ibv_device_event_type {
+	IBV_DEVICE_EVENT_ADD,
+	IBV_DEVICE_EVENT_REMOVE,
+	IBV_DEVICE_EVENT_RENAME,
+};
+
+struct ibv_device_event {
+	enum ibv_device_event_type event_type;
+	/* Kernel device index, as returned by ibv_get_device_index() */
+	int			index;
+	/* Device name, the new name for IBV_DEVICE_EVENT_RENAME */
+	char			name[IBV_SYSFS_NAME_MAX];
+};
+
+struct ibv_device_monitor {
+	int			fd;
+};
+
+/**
+ * ibv_create_device_monitor - Subscribe to RDMA device hotplug events
+ */
+struct ibv_device_monitor *ibv_create_device_monitor(void);
+
+/**
+ * ibv_get_device_event - Get the next device event, blocking unless the
+ * monitor fd was made non-blocking
+ */
+int ibv_get_device_event(struct ibv_device_monitor *monitor,
+			 struct ibv_device_event *event);
+
+/**
+ * ibv_destroy_device_monitor - Stop receiving device events
+ */
+void ibv_destroy_device_monitor(struct ibv_device_monitor *monitor);
+
 /**
  * ibv_open_device - Initialize device for use
  */
@@ -3476,6 +3512,20 @@ int ibv_fork_init(void);
  */
 enum ibv_fork_status ibv_is_fork_initialized(void);
 
+/**
+ * ibv_enable_mr_cache - Cache up to @max_bytes of memory registrations, or
+ * stop caching them if @max_bytes is 0.  The caller becomes responsible for
+ * calling ibv_invalidate_mr_cache() before memory is unmapped or remapped.
+ */
+int ibv_enable_mr_cache(size_t max_bytes);
+
+/**
+ * ibv_invalidate_mr_cache - Drop cached memory registrations overlapping
+ * a range that is about to be unmapped or remapped.  Only needed when the
+ * registration cache is enabled through ibv_enable_mr_cache().
+ */
+void ibv_invalidate_mr_cache(void *addr, size_t length);
+
 /**
  * ibv_node_type_str - Return string describing node_type enum value
  */
@@ -3496,6 +3546,14 @@ int ibv_resolve_eth_l2_from_gid(struct ibv_context *context,
 				uint8_t eth_mac[ETHERNET_LL_SIZE],
 				uint16_t *vid);
 
+/**
+ * ibv_prefetch_eth_l2_from_gid - Start resolving the L2 address of the
+ * destination in @attr in the background, so a later AH creation for it
+ * does not block on neighbour resolution.
+ */
+int ibv_prefetch_eth_l2_from_gid(struct ibv_context *context,
+				 struct ibv_ah_attr *attr);
+
 static inline int ibv_is_qpt_supported(uint32_t caps, enum ibv_qp_type qpt)
 {
 	return !!(caps & (1 << qpt));
@@ -32,8 +32,12 @@
 
 #include <config.h>
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -46,10 +50,39 @@
 #include <infiniband/ib.h>
 #include <infiniband/sa.h>
 
+/*
+ * Requests are spread over a pool of connections to ibacm, each carrying
+ * one request at a time.  ibacm reads a request with a single recv() and
+ * drops the client if it doesn't get exactly one message, so requests can't
+ * be pipelined on the same stream socket.
+ */
+#define ACM_MAX_CONNS		16
+
+struct acm_conn {
+	int			sock;
+	struct acm_conn		*next;
+};
+
 static pthread_mutex_t acm_lock = PTHREAD_MUTEX_INITIALIZER;
-static int sock = -1;
+static pthread_cond_t acm_cond = PTHREAD_COND_INITIALIZER;
+static struct acm_conn *idle_conns;
+static int num_conns;
+static uint64_t acm_tid;
 static uint16_t server_port;
 
+/* Successful responses are reused for a short time, 0 disables caching */
+#define ACM_CACHE_SIZE		256
+#define ACM_CACHE_TIMEOUT_MS	1000
+
+struct acm_cache_entry {
+	uint64_t		expires;
+	struct acm_msg		req;
+	struct acm_msg		resp;
+};
+
+static struct acm_cache_entry *acm_cache;
+static uint64_t acm_cache_timeout = ACM_CACHE_TIMEOUT_MS;
+
 static int ucma_set_server_port(void)
 {
 	FILE *f;
@@ -64,41 +97,29 @@ static int ucma_set_server_port(void)
 	return server_port;
 }
 
-void ucma_ib_init(void)
+static int ucma_acm_connect(void)
 {
 	union {
 		struct sockaddr any;
 		struct sockaddr_in inet;
 		struct sockaddr_un unx;
 	} addr;
-	static int init;
-	int ret;
+	int sock, ret;
 
-	if (init)
-		return;
-
-	pthread_mutex_lock(&acm_lock);
-	if (init)
-		goto unlock;
-
-	if (ucma_set_server_port()) {
+	if (server_port) {
 		sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
 		if (sock < 0)
-			goto out;
+			return -1;
 
 		memset(&addr, 0, sizeof(addr));
 		addr.any.sa_family = AF_INET;
 		addr.inet.sin_addr.s_addr = htobe32(INADDR_LOOPBACK);
 		addr.inet.sin_port = htobe16(server_port);
 		ret = connect(sock, &addr.any, sizeof(addr.inet));
-		if (ret) {
-			close(sock);
-			sock = -1;
-		}
 	} else {
 		sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 		if (sock < 0)
-			goto out;
+			return -1;
 
 		memset(&addr, 0, sizeof(addr));
 		addr.any.sa_family = AF_UNIX;
@@ -106,12 +127,58 @@ void ucma_ib_init(void)
 			     sizeof(addr.unx.sun_path));
 		strcpy(addr.unx.sun_path, IBACM_SERVER_PATH);
 		ret = connect(sock, &addr.any, sizeof(addr.unx));
-		if (ret) {
-			close(sock);
-			sock = -1;
-		}
 	}
-out:
+
+	if (ret) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static struct acm_conn *ucma_acm_alloc_conn(void)
+{
+	struct acm_conn *conn;
+
+	conn = malloc(sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	conn->sock = ucma_acm_connect();
+	if (conn->sock < 0) {
+		free(conn);
+		return NULL;
+	}
+	return conn;
+}
+
+void ucma_ib_init(void)
+{
+	static int init;
+	struct acm_conn *conn;
+	char *env;
+
+	if (init)
+		return;
+
+	pthread_mutex_lock(&acm_lock);
+	if (init)
+		goto unlock;
+
+	ucma_set_server_port();
+	conn = ucma_acm_alloc_conn();
+	if (conn) {
+		conn->next = NULL;
+		idle_conns = conn;
+		num_conns = 1;
+	}
+
+	env = getenv("RDMACM_ACM_CACHE_TIMEOUT");
+	if (env)
+		acm_cache_timeout = strtoull(env, NULL, 0);
+	if (acm_cache_timeout)
+		acm_cache = calloc(ACM_CACHE_SIZE, sizeof(*acm_cache));
+
 	init = 1;
 unlock:
 	pthread_mutex_unlock(&acm_lock);
@@ -119,10 +186,162 @@ unlock:
 
 void ucma_ib_cleanup(void)
 {
-	if (sock >= 0) {
-		shutdown(sock, SHUT_RDWR);
-		close(sock);
+	struct acm_conn *conn;
+
+	while ((conn = idle_conns)) {
+		idle_conns = conn->next;
+		shutdown(conn->sock, SHUT_RDWR);
+		close(conn->sock);
+		free(conn);
+	}
+	free(acm_cache);
+	acm_cache = NULL;
+}
+
+/*
+ * Get a connection without a request in flight, opening a new one if all
+ * are busy.  If wait is false, NULL is returned rather than waiting for a
+ * busy connection.  NULL is also returned if ibacm can't be reached.
+ */
+static struct acm_conn *ucma_acm_get_conn(bool wait)
+{
+	struct acm_conn *conn = NULL;
+
+	pthread_mutex_lock(&acm_lock);
+	while (!idle_conns && num_conns) {
+		if (num_conns < ACM_MAX_CONNS) {
+			num_conns++;
+			pthread_mutex_unlock(&acm_lock);
+
+			conn = ucma_acm_alloc_conn();
+			if (conn)
+				return conn;
+
+			pthread_mutex_lock(&acm_lock);
+			num_conns--;
+			/* Wait for a busy connection instead */
+			if (!num_conns)
+				break;
+		}
+		if (!wait)
+			break;
+		pthread_cond_wait(&acm_cond, &acm_lock);
+	}
+
+	if (idle_conns) {
+		conn = idle_conns;
+		idle_conns = conn->next;
+	}
+	pthread_mutex_unlock(&acm_lock);
+	return conn;
+}
+
+/* A connection that failed is closed rather than reused */
+static void ucma_acm_put_conn(struct acm_conn *conn, bool failed)
+{
+	pthread_mutex_lock(&acm_lock);
+	if (failed) {
+		num_conns--;
+	} else {
+		conn->next = idle_conns;
+		idle_conns = conn;
 	}
+	pthread_cond_signal(&acm_cond);
+	pthread_mutex_unlock(&acm_lock);
+
+	if (failed) {
+		close(conn->sock);
+		free(conn);
+	}
+}
+
+static int ucma_acm_send(struct acm_conn *conn, struct acm_msg *msg)
+{
+	int ret;
+
+	pthread_mutex_lock(&acm_lock);
+	msg->hdr.tid = ++acm_tid;
+	pthread_mutex_unlock(&acm_lock);
+
+	ret = send(conn->sock, (char *) msg, msg->hdr.length, 0);
+	return ret == msg->hdr.length ? 0 : -1;
+}
+
+/* Read the response to the request in flight on conn into msg */
+static int ucma_acm_recv(struct acm_conn *conn, struct acm_msg *msg)
+{
+	uint64_t tid = msg->hdr.tid;
+	int ret;
+
+	ret = recv(conn->sock, (char *) msg, sizeof(*msg), 0);
+	if (ret < ACM_MSG_HDR_LENGTH || ret != msg->hdr.length ||
+	    msg->hdr.tid != tid)
+		return -1;
+	return 0;
+}
+
+static uint64_t ucma_acm_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static struct acm_cache_entry *ucma_acm_cache_slot(struct acm_msg *req)
+{
+	uint8_t *data = req->data;
+	uint32_t hash = 2166136261u;
+	int i;
+
+	/* FNV-1a over the request, which does not include the tid */
+	for (i = 0; i < req->hdr.length - ACM_MSG_HDR_LENGTH; i++)
+		hash = (hash ^ data[i]) * 16777619u;
+	hash = (hash ^ req->hdr.length) * 16777619u;
+	return &acm_cache[hash % ACM_CACHE_SIZE];
+}
+
+static bool ucma_acm_cache_match(struct acm_cache_entry *entry,
+				 struct acm_msg *req)
+{
+	return entry->req.hdr.length == req->hdr.length &&
+	       !memcmp(entry->req.data, req->data,
+		       req->hdr.length - ACM_MSG_HDR_LENGTH);
+}
+
+/* Replace the request in msg by a cached response, if there is one */
+static bool ucma_acm_cache_lookup(struct acm_msg *msg)
+{
+	struct acm_cache_entry *entry;
+	bool found = false;
+
+	if (!acm_cache)
+		return false;
+
+	pthread_mutex_lock(&acm_lock);
+	entry = ucma_acm_cache_slot(msg);
+	if (entry->expires > ucma_acm_now_ms() &&
+	    ucma_acm_cache_match(entry, msg)) {
+		memcpy(msg, &entry->resp, entry->resp.hdr.length);
+		found = true;
+	}
+	pthread_mutex_unlock(&acm_lock);
+	return found;
+}
+
+static void ucma_acm_cache_insert(struct acm_msg *req, struct acm_msg *resp)
+{
+	struct acm_cache_entry *entry;
+
+	if (!acm_cache || resp->hdr.status)
+		return;
+
+	pthread_mutex_lock(&acm_lock);
+	entry = ucma_acm_cache_slot(req);
+	memcpy(&entry->req, req, req->hdr.length);
+	memcpy(&entry->resp, resp, resp->hdr.length);
+	entry->expires = ucma_acm_now_ms() + acm_cache_timeout;
+	pthread_mutex_unlock(&acm_lock);
 }
 
 static int ucma_ib_set_addr(struct rdma_addrinfo *ib_rai,
@@ -319,42 +538,36 @@ static int ucma_ib_addr(struct sockaddr *addr, socklen_t len)
 	return len && addr && (addr->sa_family == AF_IB);
 }
 
-void ucma_ib_resolve(struct rdma_addrinfo **rai,
-		     const struct rdma_addrinfo *hints)
+static void ucma_ib_format_req(struct acm_msg *msg, struct rdma_addrinfo *rai,
+			       const struct rdma_addrinfo *hints)
 {
-	struct acm_msg msg;
 	struct acm_ep_addr_data *data;
-	int ret;
-
-	ucma_ib_init();
-	if (sock < 0)
-		return;
 
-	memset(&msg, 0, sizeof msg);
-	msg.hdr.version = ACM_VERSION;
-	msg.hdr.opcode = ACM_OP_RESOLVE;
-	msg.hdr.length = ACM_MSG_HDR_LENGTH;
+	memset(msg, 0, sizeof(*msg));
+	msg->hdr.version = ACM_VERSION;
+	msg->hdr.opcode = ACM_OP_RESOLVE;
+	msg->hdr.length = ACM_MSG_HDR_LENGTH;
 
-	data = &msg.resolve_data[0];
-	if (ucma_inet_addr((*rai)->ai_src_addr, (*rai)->ai_src_len)) {
+	data = &msg->resolve_data[0];
+	if (ucma_inet_addr(rai->ai_src_addr, rai->ai_src_len)) {
 		data->flags = ACM_EP_FLAG_SOURCE;
-		ucma_set_ep_addr(data, (*rai)->ai_src_addr);
+		ucma_set_ep_addr(data, rai->ai_src_addr);
 		data++;
-		msg.hdr.length += ACM_MSG_EP_LENGTH;
+		msg->hdr.length += ACM_MSG_EP_LENGTH;
 	}
 
-	if (ucma_inet_addr((*rai)->ai_dst_addr, (*rai)->ai_dst_len)) {
+	if (ucma_inet_addr(rai->ai_dst_addr, rai->ai_dst_len)) {
 		data->flags = ACM_EP_FLAG_DEST;
 		if (hints->ai_flags & (RAI_NUMERICHOST | RAI_NOROUTE))
 			data->flags |= ACM_FLAGS_NODELAY;
-		ucma_set_ep_addr(data, (*rai)->ai_dst_addr);
+		ucma_set_ep_addr(data, rai->ai_dst_addr);
 		data++;
-		msg.hdr.length += ACM_MSG_EP_LENGTH;
+		msg->hdr.length += ACM_MSG_EP_LENGTH;
 	}
 
 	if (hints->ai_route_len ||
-	    ucma_ib_addr((*rai)->ai_src_addr, (*rai)->ai_src_len) ||
-	    ucma_ib_addr((*rai)->ai_dst_addr, (*rai)->ai_dst_len)) {
+	    ucma_ib_addr(rai->ai_src_addr, rai->ai_src_len) ||
+	    ucma_ib_addr(rai->ai_dst_addr, rai->ai_dst_len)) {
 		struct ibv_path_record *path;
 
 		if (hints->ai_route_len == sizeof(struct ibv_path_record))
@@ -367,33 +580,136 @@ void ucma_ib_resolve(struct rdma_addrinfo **rai,
 		if (path)
 			memcpy(&data->info.path, path, sizeof(*path));
 
-		if (ucma_ib_addr((*rai)->ai_src_addr, (*rai)->ai_src_len)) {
+		if (ucma_ib_addr(rai->ai_src_addr, rai->ai_src_len)) {
 			memcpy(&data->info.path.sgid,
-			       &((struct sockaddr_ib *) (*rai)->ai_src_addr)->sib_addr, 16);
+			       &((struct sockaddr_ib *) rai->ai_src_addr)->sib_addr, 16);
 		}
-		if (ucma_ib_addr((*rai)->ai_dst_addr, (*rai)->ai_dst_len)) {
+		if (ucma_ib_addr(rai->ai_dst_addr, rai->ai_dst_len)) {
 			memcpy(&data->info.path.dgid,
-			       &((struct sockaddr_ib *) (*rai)->ai_dst_addr)->sib_addr, 16);
+			       &((struct sockaddr_ib *) rai->ai_dst_addr)->sib_addr, 16);
 		}
 		data->type = ACM_EP_INFO_PATH;
 		data++;
-		msg.hdr.length += ACM_MSG_EP_LENGTH;
-	}
-
-	pthread_mutex_lock(&acm_lock);
-	ret = send(sock, (char *) &msg, msg.hdr.length, 0);
-	if (ret != msg.hdr.length) {
-		pthread_mutex_unlock(&acm_lock);
-		return;
+		msg->hdr.length += ACM_MSG_EP_LENGTH;
 	}
+}
 
-	ret = recv(sock, (char *) &msg, sizeof msg, 0);
-	pthread_mutex_unlock(&acm_lock);
-	if (ret < ACM_MSG_HDR_LENGTH || ret != msg.hdr.length || msg.hdr.status)
+static void ucma_ib_process_resp(struct rdma_addrinfo **rai,
+				 const struct rdma_addrinfo *hints,
+				 struct acm_msg *msg)
+{
+	if (msg->hdr.status)
 		return;
 
-	ucma_ib_save_resp(*rai, &msg);
+	ucma_ib_save_resp(*rai, msg);
 
 	if (af_ib_support && !(hints->ai_flags & RAI_ROUTEONLY) && (*rai)->ai_route_len)
 		ucma_resolve_af_ib(rai);
 }
+
+void ucma_ib_resolve(struct rdma_addrinfo **rai,
+		     const struct rdma_addrinfo *hints)
+{
+	ucma_ib_resolve_bulk(rai, hints, 1);
+}
+
+struct acm_bulk_req {
+	struct rdma_addrinfo	**rai;
+	struct acm_msg		req;
+	struct acm_msg		resp;
+};
+
+/*
+ * Resolve each of the num addresses in rai, with up to ACM_MAX_CONNS
+ * requests in flight at once.  Addresses that can't be resolved through
+ * ibacm are left unchanged.
+ */
+void ucma_ib_resolve_bulk(struct rdma_addrinfo **rai,
+			  const struct rdma_addrinfo *hints, int num)
+{
+	struct acm_bulk_req *reqs, *inflight[ACM_MAX_CONNS];
+	struct acm_conn *conns[ACM_MAX_CONNS];
+	struct pollfd fds[ACM_MAX_CONNS];
+	struct acm_conn *conn;
+	int next = 0, nfds = 0, i;
+
+	ucma_ib_init();
+	if (!num)
+		return;
+
+	reqs = calloc(num, sizeof(*reqs));
+	if (!reqs)
+		return;
+
+	for (i = 0; i < num; i++) {
+		reqs[i].rai = &rai[i];
+		ucma_ib_format_req(&reqs[i].req, rai[i], hints);
+	}
+
+	while (next < num || nfds) {
+		/* Start as many requests as there are free connections */
+		while (next < num && nfds < ACM_MAX_CONNS) {
+			if (ucma_acm_cache_lookup(&reqs[next].req)) {
+				ucma_ib_process_resp(reqs[next].rai, hints,
+						     &reqs[next].req);
+				next++;
+				continue;
+			}
+
+			conn = ucma_acm_get_conn(!nfds);
+			if (!conn)
+				break;
+
+			reqs[next].resp = reqs[next].req;
+			if (ucma_acm_send(conn, &reqs[next].resp)) {
+				ucma_acm_put_conn(conn, true);
+				next++;
+				continue;
+			}
+
+			conns[nfds] = conn;
+			inflight[nfds] = &reqs[next++];
+			fds[nfds].fd = conn->sock;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+
+		/* ibacm can't be reached */
+		if (!nfds)
+			break;
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < nfds; i++) {
+			struct acm_bulk_req *req = inflight[i];
+			bool failed;
+
+			if (!fds[i].revents)
+				continue;
+
+			failed = ucma_acm_recv(conns[i], &req->resp);
+			ucma_acm_put_conn(conns[i], failed);
+			if (!failed) {
+				ucma_acm_cache_insert(&req->req, &req->resp);
+				ucma_ib_process_resp(req->rai, hints,
+						     &req->resp);
+			}
+
+			nfds--;
+			conns[i] = conns[nfds];
+			inflight[i] = inflight[nfds];
+			fds[i] = fds[nfds];
+			i--;
+		}
+	}
+
+	/* Release the connections of requests left in flight on an error */
+	for (i = 0; i < nfds; i++)
+		ucma_acm_put_conn(conns[i], true);
+	free(reqs);
+}
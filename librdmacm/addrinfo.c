@@ -234,27 +234,17 @@ static int ucma_getaddrinfo(const char *node, const char *service,
 	return ret;
 }
 
-int rdma_getaddrinfo(const char *node, const char *service,
-		     const struct rdma_addrinfo *hints,
-		     struct rdma_addrinfo **res)
+static int ucma_alloc_addrinfo(const char *node, const char *service,
+			       const struct rdma_addrinfo *hints,
+			       struct rdma_addrinfo **res)
 {
 	struct rdma_addrinfo *rai;
-	int ret;
-
-	if (!service && !node && !hints)
-		return ERR(EINVAL);
-
-	ret = ucma_init();
-	if (ret)
-		return ret;
+	int ret = 0;
 
 	rai = calloc(1, sizeof(*rai));
 	if (!rai)
 		return ERR(ENOMEM);
 
-	if (!hints)
-		hints = &nohints;
-
 	if (node || service) {
 		ret = ucma_getaddrinfo(node, service, hints, rai);
 	} else {
@@ -277,9 +267,6 @@ int rdma_getaddrinfo(const char *node, const char *service,
 			goto err;
 	}
 
-	if (!(rai->ai_flags & RAI_PASSIVE))
-		ucma_ib_resolve(&rai, hints);
-
 	*res = rai;
 	return 0;
 
@@ -288,6 +275,87 @@ err:
 	return ret;
 }
 
+int rdma_getaddrinfo(const char *node, const char *service,
+		     const struct rdma_addrinfo *hints,
+		     struct rdma_addrinfo **res)
+{
+	struct rdma_addrinfo *rai;
+	int ret;
+
+	if (!service && !node && !hints)
+		return ERR(EINVAL);
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if (!hints)
+		hints = &nohints;
+
+	ret = ucma_alloc_addrinfo(node, service, hints, &rai);
+	if (ret)
+		return ret;
+
+	if (!(rai->ai_flags & RAI_PASSIVE))
+		ucma_ib_resolve(&rai, hints);
+
+	*res = rai;
+	return 0;
+}
+
+int rdma_getaddrinfo_bulk(const char *const *nodes, const char *service,
+			  const struct rdma_addrinfo *hints,
+			  struct rdma_addrinfo **res, int num)
+{
+	struct rdma_addrinfo **rais;
+	int *index;
+	int i, n = 0, ret;
+
+	if (!nodes || !res || num < 0)
+		return ERR(EINVAL);
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if (!hints)
+		hints = &nohints;
+
+	rais = calloc(num, sizeof(*rais));
+	index = calloc(num, sizeof(*index));
+	if (!rais || !index) {
+		free(rais);
+		free(index);
+		return ERR(ENOMEM);
+	}
+
+	for (i = 0; i < num; i++) {
+		if ((!nodes[i] && !service) ||
+		    ucma_alloc_addrinfo(nodes[i], service, hints, &res[i])) {
+			res[i] = NULL;
+			continue;
+		}
+
+		if (!(res[i]->ai_flags & RAI_PASSIVE)) {
+			rais[n] = res[i];
+			index[n++] = i;
+		}
+	}
+
+	/* Resolve all active addresses at once, which may replace them */
+	ucma_ib_resolve_bulk(rais, hints, n);
+	for (i = 0; i < n; i++)
+		res[index[i]] = rais[i];
+
+	free(rais);
+	free(index);
+
+	for (i = 0, n = 0; i < num; i++)
+		if (res[i])
+			n++;
+	return n;
+}
+
 void rdma_freeaddrinfo(struct rdma_addrinfo *res)
 {
 	struct rdma_addrinfo *rai;
@@ -135,7 +135,32 @@ struct cma_event {
 	uint8_t			private_data[RDMA_MAX_PRIVATE_DATA];
 	struct cma_id_private	*id_priv;
 	struct cma_multicast	*mc;
+	/*
+	 * Channel the event was read from, which recycles it when acked.
+	 * NULL if the event was detached from its channel and is freed when
+	 * acked, or ucma_buf_chan if it is stored in a struct
+	 * rdma_cm_event_buf.
+	 */
+	struct cma_event_channel *chan;
+	struct cma_event	*next;
 };
+static_assert(sizeof(struct cma_event) <= sizeof(struct rdma_cm_event_buf),
+	      "struct rdma_cm_event_buf is too small");
+static_assert(offsetof(struct cma_event, event) == 0,
+	      "struct cma_event must start with the event");
+
+/* Upper bound on the acked events a channel keeps for reuse */
+#define CMA_MAX_FREE_EVENTS 256
+
+struct cma_event_channel {
+	struct rdma_event_channel channel;
+	pthread_mutex_t		lock;
+	struct cma_event	*free_events;
+	int			num_free;
+};
+
+/* Marks events stored in caller provided buffers, which are never freed */
+static struct cma_event_channel ucma_buf_chan;
 
 static LIST_HEAD(cma_dev_list);
 /* sorted based or index or guid, depends on kernel support */
@@ -566,29 +591,85 @@ void rdma_free_devices(struct ibv_context **list)
 
 struct rdma_event_channel *rdma_create_event_channel(void)
 {
-	struct rdma_event_channel *channel;
+	struct cma_event_channel *chan;
 
 	if (ucma_init())
 		return NULL;
 
-	channel = malloc(sizeof(*channel));
-	if (!channel)
+	chan = calloc(1, sizeof(*chan));
+	if (!chan)
 		return NULL;
 
-	channel->fd = open_cdev(dev_name, dev_cdev);
-	if (channel->fd < 0) {
+	chan->channel.fd = open_cdev(dev_name, dev_cdev);
+	if (chan->channel.fd < 0) {
 		goto err;
 	}
-	return channel;
+	pthread_mutex_init(&chan->lock, NULL);
+	return &chan->channel;
 err:
-	free(channel);
+	free(chan);
 	return NULL;
 }
 
 void rdma_destroy_event_channel(struct rdma_event_channel *channel)
 {
+	struct cma_event_channel *chan =
+		container_of(channel, struct cma_event_channel, channel);
+	struct cma_event *evt;
+
+	while ((evt = chan->free_events)) {
+		chan->free_events = evt->next;
+		free(evt);
+	}
+	pthread_mutex_destroy(&chan->lock);
 	close(channel->fd);
-	free(channel);
+	free(chan);
+}
+
+static struct cma_event *ucma_alloc_event(struct rdma_event_channel *channel)
+{
+	struct cma_event_channel *chan =
+		container_of(channel, struct cma_event_channel, channel);
+	struct cma_event *evt;
+
+	pthread_mutex_lock(&chan->lock);
+	evt = chan->free_events;
+	if (evt) {
+		chan->free_events = evt->next;
+		chan->num_free--;
+	}
+	pthread_mutex_unlock(&chan->lock);
+
+	if (!evt) {
+		evt = malloc(sizeof(*evt));
+		if (!evt)
+			return NULL;
+	}
+	evt->chan = chan;
+	return evt;
+}
+
+static void ucma_free_event(struct cma_event *evt)
+{
+	struct cma_event_channel *chan = evt->chan;
+
+	if (chan == &ucma_buf_chan)
+		return;
+	if (!chan) {
+		free(evt);
+		return;
+	}
+
+	pthread_mutex_lock(&chan->lock);
+	if (chan->num_free < CMA_MAX_FREE_EVENTS) {
+		evt->next = chan->free_events;
+		chan->free_events = evt;
+		chan->num_free++;
+		evt = NULL;
+	}
+	pthread_mutex_unlock(&chan->lock);
+
+	free(evt);
 }
 
 static struct cma_device *ucma_get_cma_device(__be64 guid, uint32_t idx)
@@ -1885,6 +1966,11 @@ int rdma_get_request(struct rdma_cm_id *listen, struct rdma_cm_id **id)
 			goto err;
 	}
 
+	/*
+	 * The new id may outlive the listener, and with it the sync channel
+	 * the event was read from, so the event must not return to it.
+	 */
+	container_of(event, struct cma_event, event)->chan = NULL;
 	*id = event->id;
 	(*id)->event = event;
 	return 0;
@@ -2246,7 +2332,7 @@ int rdma_ack_cm_event(struct rdma_cm_event *event)
 		ucma_complete_mc_event(evt->mc);
 	else
 		ucma_complete_event(evt->id_priv);
-	free(evt);
+	ucma_free_event(evt);
 	return 0;
 }
 
@@ -2495,33 +2581,25 @@ int rdma_establish(struct rdma_cm_id *id)
 						   id));
 }
 
-int rdma_get_cm_event(struct rdma_event_channel *channel,
-		      struct rdma_cm_event **event)
+/*
+ * Read the next event into evt.  If the channel is non-blocking and no
+ * event is pending, fails with EAGAIN.
+ */
+static int ucma_get_event(struct rdma_event_channel *channel,
+			  struct cma_event *evt)
 {
 	struct ucma_abi_event_resp resp = {};
 	struct ucma_abi_get_event cmd;
-	struct cma_event *evt;
+	struct cma_event_channel *chan = evt->chan;
 	int ret;
 
-	ret = ucma_init();
-	if (ret)
-		return ret;
-
-	if (!event)
-		return ERR(EINVAL);
-
-	evt = malloc(sizeof(*evt));
-	if (!evt)
-		return ERR(ENOMEM);
-
 retry:
 	memset(evt, 0, sizeof(*evt));
+	evt->chan = chan;
 	CMA_INIT_CMD_RESP(&cmd, sizeof cmd, GET_EVENT, &resp, sizeof resp);
 	ret = write(channel->fd, &cmd, sizeof cmd);
-	if (ret != sizeof cmd) {
-		free(evt);
+	if (ret != sizeof cmd)
 		return (ret >= 0) ? ERR(ENODATA) : -1;
-	}
 
 	VALGRIND_MAKE_MEM_DEFINED(&resp, sizeof resp);
 
@@ -2636,10 +2714,117 @@ retry:
 		break;
 	}
 
+	return 0;
+}
+
+int rdma_get_cm_event(struct rdma_event_channel *channel,
+		      struct rdma_cm_event **event)
+{
+	struct cma_event *evt;
+	int ret;
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if (!event)
+		return ERR(EINVAL);
+
+	evt = ucma_alloc_event(channel);
+	if (!evt)
+		return ERR(ENOMEM);
+
+	ret = ucma_get_event(channel, evt);
+	if (ret) {
+		ucma_free_event(evt);
+		return ret;
+	}
+
 	*event = &evt->event;
 	return 0;
 }
 
+/* Return true if an event can be read from the channel without blocking */
+static bool ucma_event_pending(struct rdma_event_channel *channel)
+{
+	struct pollfd fds = { .fd = channel->fd, .events = POLLIN };
+	int ret;
+
+	do {
+		ret = poll(&fds, 1, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret > 0;
+}
+
+/*
+ * Retrieve up to num_events events, either into events, or into the caller's
+ * bufs.  Only the first event is waited for.  The channel's flags are left
+ * alone, since other threads may use it: on a non-blocking channel, events
+ * are read until the kernel reports EAGAIN, otherwise each further read is
+ * preceded by a check that an event is pending.
+ */
+static int ucma_get_events(struct rdma_event_channel *channel,
+			   struct rdma_cm_event **events,
+			   struct rdma_cm_event_buf *bufs, int num_events)
+{
+	struct cma_event *evt;
+	bool nonblock = false;
+	int flags, ret, i;
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if ((!events && !bufs) || num_events <= 0)
+		return ERR(EINVAL);
+
+	for (i = 0; i < num_events; i++) {
+		if (i == 1) {
+			flags = fcntl(channel->fd, F_GETFL);
+			if (flags < 0)
+				break;
+			nonblock = flags & O_NONBLOCK;
+		}
+		if (i && !nonblock && !ucma_event_pending(channel))
+			break;
+
+		if (bufs) {
+			evt = (struct cma_event *) &bufs[i];
+			evt->chan = &ucma_buf_chan;
+		} else {
+			evt = ucma_alloc_event(channel);
+			if (!evt) {
+				ret = ERR(ENOMEM);
+				break;
+			}
+		}
+
+		ret = ucma_get_event(channel, evt);
+		if (ret) {
+			ucma_free_event(evt);
+			break;
+		}
+		if (events)
+			events[i] = &evt->event;
+	}
+
+	/* Errors after the first event are reported by the next call */
+	return i ? i : ret;
+}
+
+int rdma_get_cm_events(struct rdma_event_channel *channel,
+		       struct rdma_cm_event **events, int num_events)
+{
+	return ucma_get_events(channel, events, NULL, num_events);
+}
+
+int rdma_get_cm_events_buf(struct rdma_event_channel *channel,
+			   struct rdma_cm_event_buf *bufs, int num_events)
+{
+	return ucma_get_events(channel, NULL, bufs, num_events);
+}
+
 const char *rdma_event_str(enum rdma_cm_event_type event)
 {
 	switch (event) {
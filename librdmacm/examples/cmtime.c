@@ -125,7 +125,10 @@ static int node_index;
 static uint64_t times[STEP_CNT][2];
 static int connections;
 static int num_threads = 1;
+static int event_batch = 1;
 static _Atomic(int) disc_events;
+static _Atomic(int) event_calls;
+static _Atomic(int) event_count;
 
 static _Atomic(int) completed[STEP_CNT];
 
@@ -176,6 +179,7 @@ static void show_perf(int iter)
 	else
 		printf("cm_conn        %10d\n", iter);
 	printf("threads        %10d\n", num_threads);
+	printf("event batch    %10d\n", event_batch);
 
 	printf("step             avg/iter  total(us)    us/conn    sum(us)    max(us)    min(us)\n");
 	for (i = 0; i < STEP_CNT; i++) {
@@ -185,6 +189,13 @@ static void show_perf(int iter)
 			step_str[i], diff / iter, diff,
 			sum[i] / iter, sum[i], max[i], min[i]);
 	}
+
+	diff = (uint32_t) (times[STEP_CONNECT][1] - times[STEP_CONNECT][0]);
+	printf("conn/sec       %10.0f\n", diff ? iter * 1000000.0 / diff : 0);
+	if (atomic_load(&event_calls))
+		printf("events/call    %10.2f\n",
+		       (double) atomic_load(&event_count) /
+		       atomic_load(&event_calls));
 }
 
 static void sock_listen(int *listen_sock, int backlog)
@@ -677,17 +688,32 @@ static void destroy_qps(int iter)
 
 static void *process_events(void *arg)
 {
-	struct rdma_cm_event *event;
-	int ret;
+	struct rdma_cm_event **events;
+	int ret, i;
+
+	events = calloc(event_batch, sizeof(*events));
+	if (!events) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
 
 	while (1) {
-		ret = rdma_get_cm_event(channel, &event);
-		if (!ret) {
-			cma_handler(event->id, event);
+		if (event_batch > 1) {
+			ret = rdma_get_cm_events(channel, events, event_batch);
 		} else {
+			ret = rdma_get_cm_event(channel, &events[0]);
+			if (!ret)
+				ret = 1;
+		}
+		if (ret < 0) {
 			perror("rdma_get_cm_event");
 			exit(EXIT_FAILURE);
 		}
+
+		atomic_fetch_add(&event_calls, 1);
+		atomic_fetch_add(&event_count, ret);
+		for (i = 0; i < ret; i++)
+			cma_handler(events[i]->id, events[i]);
 	}
 
 	return NULL;
@@ -722,6 +748,8 @@ static void reset_test(int iter)
 
 	node_index = 0;
 	atomic_store(&disc_events, 0);
+	atomic_store(&event_calls, 0);
+	atomic_store(&event_count, 0);
 	connections = iter;
 
 	memset(times, 0, sizeof times);
@@ -920,7 +948,7 @@ int main(int argc, char **argv)
 
 	hints.ai_port_space = RDMA_PS_TCP;
 	hints.ai_qp_type = IBV_QPT_RC;
-	while ((op = getopt(argc, argv, "s:b:c:m:n:p:q:r:St:")) != -1) {
+	while ((op = getopt(argc, argv, "s:b:B:c:m:n:p:q:r:St:")) != -1) {
 		switch (op) {
 		case 's':
 			dst_addr = optarg;
@@ -928,6 +956,11 @@ int main(int argc, char **argv)
 		case 'b':
 			src_addr = optarg;
 			break;
+		case 'B':
+			event_batch = atoi(optarg);
+			if (event_batch < 1)
+				event_batch = 1;
+			break;
 		case 'c':
 			iter = atoi(optarg);
 			break;
@@ -959,6 +992,7 @@ int main(int argc, char **argv)
 			printf("\t[-S] (run socket baseline test)\n");
 			printf("\t[-s server_address]\n");
 			printf("\t[-b bind_address]\n");
+			printf("\t[-B event_batch]\n");
 			printf("\t[-c connections]\n");
 			printf("\t[-p port_number]\n");
 			printf("\t[-q base_qpn]\n");
@@ -37,6 +37,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <netdb.h>
 #include <fcntl.h>
@@ -82,6 +83,10 @@ static int flags = MSG_DONTWAIT;
 static int poll_timeout = 0;
 static int custom;
 static int use_fork;
+static int show_cpu;
+static int show_hist;
+static int use_progress;
+static int busy_poll = -1;
 static pid_t fork_pid;
 static enum rs_optimization optimization;
 static int size_option;
@@ -95,15 +100,27 @@ static int keepalive;
 static char *dst_addr;
 static char *src_addr;
 static struct timeval start, end;
+static struct rusage start_usage, end_usage;
 static void *buf;
+
+/* Round trip latency histogram, bucketed by power of 2 nanoseconds */
+#define HIST_CNT 64
+static uint64_t hist[HIST_CNT];
+static uint64_t hist_min, hist_max, hist_samples;
 static struct rdma_addrinfo rai_hints;
 static struct addrinfo ai_hints;
 
+static float cpu_usec(struct rusage *usage)
+{
+	return (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000. +
+	       usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+}
+
 static void show_perf(void)
 {
 	char str[32];
-	float usec;
-	long long bytes;
+	float usec, cpu;
+	long long bytes, xfers;
 
 	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
 	bytes = (long long) iterations * transfer_count * transfer_size * 2;
@@ -118,9 +135,72 @@ static void show_perf(void)
 	printf("%-8s", str);
 	size_str(str, sizeof str, bytes);
 	printf("%-8s", str);
-	printf("%8.2fs%10.2f%11.2f\n",
+	printf("%8.2fs%10.2f%11.2f",
 		usec / 1000000., (bytes * 8) / (1000. * usec),
 		(usec / iterations) / (transfer_count * 2));
+
+	/* cpu% xfers/sec/core */
+	if (show_cpu) {
+		cpu = cpu_usec(&end_usage) - cpu_usec(&start_usage);
+		xfers = (long long) iterations * transfer_count * 2;
+		printf("%8.1f%14.0f", cpu * 100. / usec,
+		       cpu ? xfers * 1000000. / cpu : 0.);
+	}
+	printf("\n");
+}
+
+static void hist_reset(void)
+{
+	memset(hist, 0, sizeof hist);
+	hist_min = UINT64_MAX;
+	hist_max = 0;
+	hist_samples = 0;
+}
+
+static void hist_add(uint64_t ns)
+{
+	int i;
+
+	for (i = 0; i < HIST_CNT - 1 && (ns >> i) > 1; i++)
+		;
+	hist[i]++;
+	hist_samples++;
+	if (ns < hist_min)
+		hist_min = ns;
+	if (ns > hist_max)
+		hist_max = ns;
+}
+
+/* Returns the upper bound of the bucket holding the given percentile */
+static float hist_pct(float pct)
+{
+	uint64_t cnt = 0, target;
+	int i;
+
+	target = (uint64_t) (hist_samples * pct / 100.);
+	for (i = 0; i < HIST_CNT - 1; i++) {
+		cnt += hist[i];
+		if (cnt > target)
+			break;
+	}
+	return (2ULL << i) / 1000.;
+}
+
+static void print_hist(void)
+{
+	int i;
+
+	if (!hist_samples)
+		return;
+
+	printf("  round trip usec: min %.2f p50 %.2f p99 %.2f p99.9 %.2f max %.2f\n",
+	       hist_min / 1000., hist_pct(50), hist_pct(99), hist_pct(99.9),
+	       hist_max / 1000.);
+	for (i = 0; i < HIST_CNT; i++) {
+		if (hist[i])
+			printf("  < %12.3f usec %10llu\n", (2ULL << i) / 1000.,
+			       (unsigned long long) hist[i]);
+	}
 }
 
 static void init_latency_test(int size)
@@ -225,14 +305,20 @@ static int sync_test(void)
 
 static int run_test(void)
 {
+	uint64_t iter_start = 0;
 	int ret, i, t;
 
 	ret = sync_test();
 	if (ret)
 		goto out;
 
+	hist_reset();
+	getrusage(RUSAGE_SELF, &start_usage);
 	gettimeofday(&start, NULL);
 	for (i = 0; i < iterations; i++) {
+		if (show_hist)
+			iter_start = gettime_ns();
+
 		for (t = 0; t < transfer_count; t++) {
 			ret = dst_addr ? send_xfer(transfer_size) :
 					 recv_xfer(transfer_size);
@@ -246,9 +332,15 @@ static int run_test(void)
 			if (ret)
 				goto out;
 		}
+
+		if (show_hist)
+			hist_add(gettime_ns() - iter_start);
 	}
 	gettimeofday(&end, NULL);
+	getrusage(RUSAGE_SELF, &end_usage);
 	show_perf();
+	if (show_hist)
+		print_hist();
 	ret = 0;
 
 out:
@@ -298,6 +390,10 @@ static void set_options(int fd)
 	if (flags & MSG_DONTWAIT)
 		rs_fcntl(fd, F_SETFL, O_NONBLOCK);
 
+	if (busy_poll >= 0)
+		rs_setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll,
+			      sizeof busy_poll);
+
 	if (use_rs) {
 		/* Inline size based on experimental data */
 		if (optimization == opt_latency) {
@@ -307,6 +403,10 @@ static void set_options(int fd)
 			val = 0;
 			rs_setsockopt(fd, SOL_RDMA, RDMA_INLINE, &val, sizeof val);
 		}
+
+		if (use_progress)
+			rs_setsockopt(fd, SOL_RDMA, RDMA_PROGRESS, &use_progress,
+				      sizeof use_progress);
 	}
 
 	if (keepalive)
@@ -512,8 +612,11 @@ static int run(void)
 			goto free;
 	}
 
-	printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s\n",
+	printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s",
 	       "name", "bytes", "xfers", "iters", "total", "time", "Gb/sec", "usec/xfer");
+	if (show_cpu)
+		printf("%8s%14s", "cpu%", "xfers/s/core");
+	printf("\n");
 	if (!custom) {
 		optimization = opt_latency;
 		ret = dst_addr ? client_connect() : server_connect();
@@ -574,6 +677,9 @@ static int set_test_opt(const char *arg)
 		case 'a':
 			use_async = 1;
 			break;
+		case 'c':
+			show_cpu = 1;
+			break;
 		case 'b':
 			flags = (flags & ~MSG_DONTWAIT) | MSG_WAITALL;
 			break;
@@ -581,9 +687,15 @@ static int set_test_opt(const char *arg)
 			use_fork = 1;
 			use_rs = 0;
 			break;
+		case 'h':
+			show_hist = 1;
+			break;
 		case 'n':
 			flags |= MSG_DONTWAIT;
 			break;
+		case 'p':
+			use_progress = 1;
+			break;
 		case 'r':
 			use_rgai = 1;
 			break;
@@ -598,6 +710,12 @@ static int set_test_opt(const char *arg)
 			use_rs = 0;
 		} else if (!strncasecmp("async", arg, 5)) {
 			use_async = 1;
+		} else if (!strncasecmp("cpu", arg, 3)) {
+			show_cpu = 1;
+		} else if (!strncasecmp("histogram", arg, 9)) {
+			show_hist = 1;
+		} else if (!strncasecmp("progress", arg, 8)) {
+			use_progress = 1;
 		} else if (!strncasecmp("block", arg, 5)) {
 			flags = (flags & ~MSG_DONTWAIT) | MSG_WAITALL;
 		} else if (!strncasecmp("nonblock", arg, 8)) {
@@ -622,7 +740,7 @@ int main(int argc, char **argv)
 
 	ai_hints.ai_socktype = SOCK_STREAM;
 	rai_hints.ai_port_space = RDMA_PS_TCP;
-	while ((op = getopt(argc, argv, "s:b:f:B:i:I:C:S:p:k:T:")) != -1) {
+	while ((op = getopt(argc, argv, "s:b:f:B:i:I:C:S:p:k:P:T:")) != -1) {
 		switch (op) {
 		case 's':
 			dst_addr = optarg;
@@ -669,6 +787,9 @@ int main(int argc, char **argv)
 		case 'k':
 			keepalive = atoi(optarg);
 			break;
+		case 'P':
+			busy_poll = atoi(optarg);
+			break;
 		case 'T':
 			if (!set_test_opt(optarg))
 				break;
@@ -687,12 +808,16 @@ int main(int argc, char **argv)
 			printf("\t[-S transfer_size or all]\n");
 			printf("\t[-p port_number]\n");
 			printf("\t[-k keepalive_time]\n");
+			printf("\t[-P busy_poll_usec]\n");
 			printf("\t[-T test_option]\n");
 			printf("\t    s|sockets - use standard tcp/ip sockets\n");
 			printf("\t    a|async - asynchronous operation (use poll)\n");
 			printf("\t    b|blocking - use blocking calls\n");
+			printf("\t    c|cpu - report cpu usage and xfers/sec per core\n");
 			printf("\t    f|fork - fork server processing\n");
+			printf("\t    h|histogram - report round trip latency histogram\n");
 			printf("\t    n|nonblocking - use nonblocking calls\n");
+			printf("\t    p|progress - use the rsocket progress thread\n");
 			printf("\t    r|resolve - use rdma cm to resolve address\n");
 			printf("\t    v|verify - verify data\n");
 			exit(1);
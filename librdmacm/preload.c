@@ -38,6 +38,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/sendfile.h>
+#include <sys/epoll.h>
 #include <stdarg.h>
 #include <dlfcn.h>
 #include <netdb.h>
@@ -47,6 +48,7 @@
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -78,6 +80,13 @@ struct socket_calls {
 	ssize_t (*write)(int socket, const void *buf, size_t count);
 	ssize_t (*writev)(int socket, const struct iovec *iov, int iovcnt);
 	int (*poll)(struct pollfd *fds, nfds_t nfds, int timeout);
+	int (*epoll_create)(int size);
+	int (*epoll_create1)(int flags);
+	int (*epoll_ctl)(int epfd, int op, int fd, struct epoll_event *event);
+	int (*epoll_wait)(int epfd, struct epoll_event *events,
+			  int maxevents, int timeout);
+	int (*epoll_pwait)(int epfd, struct epoll_event *events,
+			   int maxevents, int timeout, const sigset_t *sigmask);
 	int (*shutdown)(int socket, int how);
 	int (*close)(int socket);
 	int (*getpeername)(int socket, struct sockaddr *addr, socklen_t *addrlen);
@@ -105,7 +114,8 @@ static int fork_support;
 
 enum fd_type {
 	fd_normal,
-	fd_rsocket
+	fd_rsocket,
+	fd_repoll
 };
 
 enum fd_fork_state {
@@ -134,6 +144,13 @@ struct config_entry {
 static struct config_entry *config;
 static int config_cnt;
 
+/*
+ * Set while calling into librdmacm to create an fd, so that any fds it
+ * creates internally (e.g. epoll sets for datagram rsockets) are not
+ * themselves redirected.
+ */
+static __thread int recursive;
+
 static void free_config(void)
 {
 	while (config_cnt)
@@ -401,6 +418,11 @@ static void init_preload(void)
 	real.write = dlsym(RTLD_NEXT, "write");
 	real.writev = dlsym(RTLD_NEXT, "writev");
 	real.poll = dlsym(RTLD_NEXT, "poll");
+	real.epoll_create = dlsym(RTLD_NEXT, "epoll_create");
+	real.epoll_create1 = dlsym(RTLD_NEXT, "epoll_create1");
+	real.epoll_ctl = dlsym(RTLD_NEXT, "epoll_ctl");
+	real.epoll_wait = dlsym(RTLD_NEXT, "epoll_wait");
+	real.epoll_pwait = dlsym(RTLD_NEXT, "epoll_pwait");
 	real.shutdown = dlsym(RTLD_NEXT, "shutdown");
 	real.close = dlsym(RTLD_NEXT, "close");
 	real.getpeername = dlsym(RTLD_NEXT, "getpeername");
@@ -531,7 +553,6 @@ static void set_rsocket_options(int rsocket)
 
 int socket(int domain, int type, int protocol)
 {
-	static __thread int recursive;
 	int index, ret;
 
 	init_preload();
@@ -921,6 +942,87 @@ use_rpoll:
 	return ret;
 }
 
+/*
+ * All epoll sets created by the application are repoll sets, so that
+ * rsockets and regular fds may be monitored together.
+ */
+int epoll_create1(int flags)
+{
+	int index, ret;
+
+	init_preload();
+	if (recursive)
+		return real.epoll_create1(flags);
+
+	index = fd_open();
+	if (index < 0)
+		return index;
+
+	recursive = 1;
+	ret = repoll_create1(flags);
+	recursive = 0;
+	if (ret < 0) {
+		fd_close(index, &ret);
+		return -1;
+	}
+
+	fd_store(index, ret, fd_repoll, fd_ready);
+	return index;
+}
+
+int epoll_create(int size)
+{
+	init_preload();
+	if (recursive)
+		return real.epoll_create(size);
+	if (size <= 0)
+		return ERR(EINVAL);
+
+	return epoll_create1(0);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	int efd;
+
+	init_preload();
+	return (fd_get(epfd, &efd) == fd_repoll) ?
+		repoll_ctl(efd, op, fd_getd(fd), event) :
+		real.epoll_ctl(efd, op, fd, event);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	int efd;
+
+	init_preload();
+	return (fd_get(epfd, &efd) == fd_repoll) ?
+		repoll_wait(efd, events, maxevents, timeout) :
+		real.epoll_wait(efd, events, maxevents, timeout);
+}
+
+/*
+ * For repoll sets, the signal mask is installed around repoll_wait, so
+ * unlike epoll_pwait, it is not applied atomically with the wait.
+ */
+int epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
+		int timeout, const sigset_t *sigmask)
+{
+	sigset_t oldmask;
+	int efd, ret;
+
+	init_preload();
+	if (fd_get(epfd, &efd) != fd_repoll)
+		return real.epoll_pwait(efd, events, maxevents, timeout, sigmask);
+
+	if (sigmask)
+		pthread_sigmask(SIG_SETMASK, sigmask, &oldmask);
+	ret = repoll_wait(efd, events, maxevents, timeout);
+	if (sigmask)
+		pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+	return ret;
+}
+
 static void select_to_rpoll(struct pollfd *fds, int *nfds,
 			    fd_set *readfds, fd_set *writefds, fd_set *exceptfds)
 {
@@ -1029,7 +1131,7 @@ int close(int socket)
 
 	idm_clear(&idm, socket);
 	real.close(socket);
-	ret = (fdi->type == fd_rsocket) ? rclose(fdi->fd) : real.close(fdi->fd);
+	ret = (fdi->type != fd_normal) ? rclose(fdi->fd) : real.close(fdi->fd);
 	free(fdi);
 	return ret;
 }
@@ -646,6 +646,52 @@ int rdma_join_multicast_ex(struct rdma_cm_id *id,
 int rdma_get_cm_event(struct rdma_event_channel *channel,
 		      struct rdma_cm_event **event);
 
+/**
+ * rdma_get_cm_events - Retrieves several pending communication events.
+ * @channel: Event channel to check for events.
+ * @events: Array receiving up to @num_events events.
+ * @num_events: Maximum number of events to retrieve.
+ * Description:
+ *   Waits for an event like rdma_get_cm_event, then retrieves the events
+ *   that are already pending, up to @num_events.  Returns the number of
+ *   events retrieved, or -1 on error.
+ * Notes:
+ *   Each event must be acknowledged by calling rdma_ack_cm_event.  Acked
+ *   events are kept by the channel and reused by later calls.
+ * See also:
+ *   rdma_get_cm_event, rdma_ack_cm_event
+ */
+int rdma_get_cm_events(struct rdma_event_channel *channel,
+		       struct rdma_cm_event **events, int num_events);
+
+/*
+ * Caller provided storage for an event retrieved by rdma_get_cm_events_buf.
+ * The event's private data is kept in the buffer.
+ */
+struct rdma_cm_event_buf {
+	struct rdma_cm_event event;
+	uint8_t private_data[256];
+	void *reserved[4];
+};
+
+/**
+ * rdma_get_cm_events_buf - Retrieves several pending communication events
+ *   into caller provided storage.
+ * @channel: Event channel to check for events.
+ * @bufs: Array of @num_events buffers receiving the events.
+ * @num_events: Maximum number of events to retrieve.
+ * Description:
+ *   Behaves as rdma_get_cm_events, but stores the events in @bufs rather
+ *   than in memory owned by the library.
+ * Notes:
+ *   Each event must still be acknowledged by calling rdma_ack_cm_event on
+ *   its event field, before the buffer is reused or freed.
+ * See also:
+ *   rdma_get_cm_events, rdma_ack_cm_event
+ */
+int rdma_get_cm_events_buf(struct rdma_event_channel *channel,
+			   struct rdma_cm_event_buf *bufs, int num_events);
+
 /**
  * rdma_ack_cm_event - Free a communication event.
  * @event: Event to be released.
@@ -749,6 +795,22 @@ int rdma_getaddrinfo(const char *node, const char *service,
 		     const struct rdma_addrinfo *hints,
 		     struct rdma_addrinfo **res);
 
+/**
+ * rdma_getaddrinfo_bulk - Resolve several addresses at once.
+ * @nodes: Array of num host names or addresses.
+ * @service: Service name or port, used for every node.
+ * @hints: Hints used for every node, as for rdma_getaddrinfo.
+ * @res: Array of num results, an entry is NULL if its node failed.
+ * @num: Number of nodes.
+ * Description:
+ *   Routes are resolved with several requests in flight to the address
+ *   resolution service.  Returns the number of nodes resolved, or -1 on
+ *   error.  Each non-NULL result must be released by rdma_freeaddrinfo.
+ */
+int rdma_getaddrinfo_bulk(const char *const *nodes, const char *service,
+			  const struct rdma_addrinfo *hints,
+			  struct rdma_addrinfo **res, int num);
+
 void rdma_freeaddrinfo(struct rdma_addrinfo *res);
 
 /**
@@ -68,8 +68,11 @@
 #define RS_QP_CTRL_SIZE 4	/* must be power of 2 */
 #define RS_CONN_RETRIES 6
 #define RS_SGL_SIZE 2
+#define RS_CQ_BATCH_MAX 64
 static struct index_map idm;
+static struct index_map epidm;
 static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t epoll_mut = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t svc_mut = PTHREAD_MUTEX_INITIALIZER;
 
 struct rsocket;
@@ -124,6 +127,15 @@ static struct rs_svc connect_svc = {
 	.run = cm_svc_run
 };
 
+struct rs_scq;
+static int rs_progress_add(struct rsocket *rs);
+static int rs_progress_add_cq(struct rs_scq *scq);
+static void rs_progress_remove_cq(struct rs_scq *scq);
+static pthread_mutex_t progress_mut = PTHREAD_MUTEX_INITIALIZER;
+static dlist_entry progress_list = { &progress_list, &progress_list };
+static dlist_entry progress_cq_list = { &progress_cq_list, &progress_cq_list };
+static bool progress_running;
+
 static uint32_t pollcnt;
 static bool suspendpoll;
 static int pollsignal = -1;
@@ -135,6 +147,12 @@ static uint16_t def_rqsize = 384;
 static uint32_t def_mem = (1 << 17);
 static uint32_t def_wmem = (1 << 17);
 static uint32_t polling_time = 10;
+static uint16_t cq_batch = 16;
+static uint32_t def_zcopy_threshold = 0;
+static uint16_t def_zcopy_cache = 0;
+static uint16_t def_srqsize = 0;
+static uint32_t progress_interval = 100;
+static uint16_t def_progress = 0;
 static int wake_up_interval = 5000;
 
 /*
@@ -209,6 +227,37 @@ struct rs_iomap {
 	struct rs_sge sge;
 };
 
+struct rs_srq {
+	struct rs_srq	  *next;
+	struct ibv_srq	  *srq;
+	uint32_t	  size;
+	_Atomic(int)	  refcnt;
+};
+
+/* A completion taken from a shared CQ, queued for its rsocket */
+struct rs_scq_comp {
+	uint64_t	  wr_id;
+	__be32		  imm_data;
+	uint32_t	  status;
+	uint32_t	  wc_flags;
+	int		  next;
+};
+
+struct rs_scq {
+	struct rs_scq	  *next;
+	struct ibv_cq	  *cq;
+	struct rs_srq	  *srq;
+	uint16_t	  sq_size;
+	int		  conns;
+	_Atomic(int)	  refcnt;
+	fastlock_t	  lock;
+	void		  *qp_map;
+	struct rs_scq_comp *comp;
+	int		  comp_free;
+	int		  comp_free_cnt;
+	dlist_entry	  progress_entry;
+};
+
 struct rs_iomap_mr {
 	uint64_t offset;
 	struct ibv_mr *mr;
@@ -272,6 +321,7 @@ enum rs_state {
 #define RS_OPT_UDP_SVC    (1 << 2)
 #define RS_OPT_KEEPALIVE  (1 << 3)
 #define RS_OPT_CM_SVC	  (1 << 4)
+#define RS_OPT_PROGRESS	  (1 << 5)
 
 union socket_addr {
 	struct sockaddr		sa;
@@ -324,6 +374,7 @@ struct rsocket {
 	fastlock_t	  cq_lock;
 	fastlock_t	  cq_wait_lock;
 	fastlock_t	  map_lock; /* acquire slock first if needed */
+	fastlock_t	  epoll_lock;
 
 	union {
 		/* data stream */
@@ -361,6 +412,23 @@ struct rsocket {
 			int		  sbuf_bytes_avail;
 			struct ibv_mr	  *smr;
 			struct ibv_sge	  ssgl[2];
+
+			uint32_t	  zcopy_threshold;
+			int		  zcopy_cache_size;
+			int		  zcopy_mr_cnt;
+			struct ibv_mr	  **zcopy_mr;
+
+			struct rs_srq	  *srq;
+			struct rs_scq	  *scq;
+			uint32_t	  scq_qpn;
+			int		  scq_fd;
+			int		  scq_head;
+			int		  scq_tail;
+			bool		  scq_armed;
+			/* listening rsockets */
+			uint32_t	  srq_size;
+			struct rs_srq	  *srq_list;
+			struct rs_scq	  *scq_list;
 		};
 		/* datagram */
 		struct {
@@ -377,6 +445,8 @@ struct rsocket {
 
 	int		  opts;
 	int		  fd_flags;
+	uint32_t	  busy_poll;
+	dlist_entry	  progress_entry;
 	uint64_t	  so_opts;
 	uint64_t	  ipv6_opts;
 	void		  *optval;
@@ -406,6 +476,7 @@ struct rsocket {
 	dlist_entry	  iomap_queue;
 	int		  iomap_pending;
 	int		  unack_cqe;
+	dlist_entry	  epoll_items;
 };
 
 #define DS_UDP_TAG 0x55555555
@@ -428,6 +499,47 @@ struct ds_udp_header {
 
 #define ds_next_qp(qp) container_of((qp)->list.next, struct ds_qp, list)
 
+/*
+ * A repoll set is backed by a kernel epoll fd.  Regular fds are added to
+ * the kernel set directly.  For rsockets, we add the fd that signals
+ * progress for the rsocket's current state (e.g. its CQ channel), and
+ * queue the rsocket on the set's ready list whenever it processes
+ * completions or changes state.  repoll_wait only re-checks rsockets on
+ * the ready list, so its cost is independent of the size of the set.
+ *
+ * Lock ordering: epoll_mut -> ep->lock -> rs->cq_lock -> rs->epoll_lock ->
+ * ep->ready_lock
+ */
+struct rs_epoll {
+	int		  epfd;
+	int		  signal;
+	pthread_mutex_t	  lock;
+	fastlock_t	  ready_lock;
+	dlist_entry	  ready_list;
+	dlist_entry	  item_list;
+	struct index_map  items;
+	bool		  sleeping;
+	bool		  signaled;
+};
+
+struct rs_epoll_item {
+	dlist_entry	  ready_entry;
+	dlist_entry	  rs_entry;
+	dlist_entry	  ep_entry;
+	struct rs_epoll	  *ep;
+	struct rsocket	  *rs;	/* NULL for regular fds */
+	int		  fd;
+	int		  kfd;
+	uint32_t	  events;
+	epoll_data_t	  data;
+	bool		  queued;
+	bool		  kevent;
+	bool		  disabled;
+};
+
+#define RS_EPOLL_MAX_KEVENTS 64
+#define RS_EPOLL_SIGNAL -1
+
 static void write_all(int fd, const void *msg, size_t len)
 {
 	// FIXME: if fd is a socket this really needs to handle EINTR and other conditions.
@@ -614,6 +726,44 @@ static void rs_configure(void)
 			def_wmem = RS_SNDLOWAT << 1;
 	}
 
+	if ((f = fopen(RS_CONF_DIR "/cq_batch", "r"))) {
+		failable_fscanf(f, "%hu", &cq_batch);
+		fclose(f);
+
+		if (cq_batch < 1)
+			cq_batch = 1;
+		else if (cq_batch > RS_CQ_BATCH_MAX)
+			cq_batch = RS_CQ_BATCH_MAX;
+	}
+
+	if ((f = fopen(RS_CONF_DIR "/zcopy_threshold", "r"))) {
+		failable_fscanf(f, "%u", &def_zcopy_threshold);
+		fclose(f);
+	}
+
+	if ((f = fopen(RS_CONF_DIR "/zcopy_cache", "r"))) {
+		failable_fscanf(f, "%hu", &def_zcopy_cache);
+		fclose(f);
+	}
+
+	if ((f = fopen(RS_CONF_DIR "/srqsize_default", "r"))) {
+		failable_fscanf(f, "%hu", &def_srqsize);
+		fclose(f);
+	}
+
+	if ((f = fopen(RS_CONF_DIR "/progress_interval", "r"))) {
+		failable_fscanf(f, "%u", &progress_interval);
+		fclose(f);
+
+		if (!progress_interval)
+			progress_interval = 1;
+	}
+
+	if ((f = fopen(RS_CONF_DIR "/progress_default", "r"))) {
+		failable_fscanf(f, "%hu", &def_progress);
+		fclose(f);
+	}
+
 	if ((f = fopen(RS_CONF_DIR "/iomap_size", "r"))) {
 		failable_fscanf(f, "%hu", &def_iomap_size);
 		fclose(f);
@@ -627,6 +777,46 @@ out:
 	pthread_mutex_unlock(&mut);
 }
 
+/* Caller must hold ep->ready_lock */
+static void rs_epoll_queue(struct rs_epoll *ep, struct rs_epoll_item *item)
+{
+	uint64_t c = 1;
+	ssize_t ret;
+
+	if (item->queued || item->disabled)
+		return;
+
+	dlist_insert_tail(&item->ready_entry, &ep->ready_list);
+	item->queued = true;
+	if (ep->sleeping && !ep->signaled) {
+		ret = write(ep->signal, &c, sizeof(c));
+		ep->signaled = (ret == sizeof(c));
+	}
+}
+
+/*
+ * Called whenever the readiness of an rsocket may have changed, such as
+ * after processing completions or a connection state transition.
+ */
+static void rs_epoll_notify(struct rsocket *rs)
+{
+	struct rs_epoll_item *item;
+	dlist_entry *entry;
+
+	if (dlist_empty(&rs->epoll_items))
+		return;
+
+	fastlock_acquire(&rs->epoll_lock);
+	for (entry = rs->epoll_items.next; entry != &rs->epoll_items;
+	     entry = entry->next) {
+		item = container_of(entry, struct rs_epoll_item, rs_entry);
+		fastlock_acquire(&item->ep->ready_lock);
+		rs_epoll_queue(item->ep, item);
+		fastlock_release(&item->ep->ready_lock);
+	}
+	fastlock_release(&rs->epoll_lock);
+}
+
 static int rs_insert(struct rsocket *rs, int index)
 {
 	pthread_mutex_lock(&mut);
@@ -653,9 +843,12 @@ static struct rsocket *rs_alloc(struct rsocket *inherited_rs, int type)
 
 	rs->type = type;
 	rs->index = -1;
+	rs->busy_poll = polling_time;
 	if (type == SOCK_DGRAM) {
 		rs->udp_sock = -1;
 		rs->epfd = -1;
+	} else {
+		rs->scq_fd = -1;
 	}
 
 	if (inherited_rs) {
@@ -667,7 +860,11 @@ static struct rsocket *rs_alloc(struct rsocket *inherited_rs, int type)
 		if (type == SOCK_STREAM) {
 			rs->ctrl_max_seqno = inherited_rs->ctrl_max_seqno;
 			rs->target_iomap_size = inherited_rs->target_iomap_size;
+			rs->zcopy_threshold = inherited_rs->zcopy_threshold;
+			rs->zcopy_cache_size = inherited_rs->zcopy_cache_size;
+			rs->opts = inherited_rs->opts & RS_OPT_PROGRESS;
 		}
+		rs->busy_poll = inherited_rs->busy_poll;
 	} else {
 		rs->sbuf_size = def_wmem;
 		rs->rbuf_size = def_mem;
@@ -677,6 +874,11 @@ static struct rsocket *rs_alloc(struct rsocket *inherited_rs, int type)
 		if (type == SOCK_STREAM) {
 			rs->ctrl_max_seqno = RS_QP_CTRL_SIZE;
 			rs->target_iomap_size = def_iomap_size;
+			rs->zcopy_threshold = def_zcopy_threshold;
+			rs->zcopy_cache_size = def_zcopy_cache;
+			rs->srq_size = def_srqsize;
+			if (def_progress)
+				rs->opts = RS_OPT_PROGRESS;
 		}
 	}
 	fastlock_init(&rs->slock);
@@ -684,8 +886,11 @@ static struct rsocket *rs_alloc(struct rsocket *inherited_rs, int type)
 	fastlock_init(&rs->cq_lock);
 	fastlock_init(&rs->cq_wait_lock);
 	fastlock_init(&rs->map_lock);
+	fastlock_init(&rs->epoll_lock);
 	dlist_init(&rs->iomap_list);
 	dlist_init(&rs->iomap_queue);
+	dlist_init(&rs->epoll_items);
+	dlist_init(&rs->progress_entry);
 	return rs;
 }
 
@@ -697,6 +902,8 @@ static int rs_set_nonblocking(struct rsocket *rs, int arg)
 	if (rs->type == SOCK_STREAM) {
 		if (rs->cm_id->recv_cq_channel)
 			ret = fcntl(rs->cm_id->recv_cq_channel->fd, F_SETFL, arg);
+		else if (rs->scq_fd >= 0)
+			ret = fcntl(rs->scq_fd, F_SETFL, arg);
 
 		if (rs->state == rs_listening)
 			ret = fcntl(rs->accept_queue[0], F_SETFL, arg);
@@ -865,30 +1072,426 @@ err1:
 	return -1;
 }
 
-static inline int rs_post_recv(struct rsocket *rs)
+static int rs_create_scq_fd(struct rsocket *rs)
 {
-	struct ibv_recv_wr wr, *bad;
-	struct ibv_sge sge;
+	rs->scq_fd = eventfd(0, EFD_CLOEXEC);
+	if (rs->scq_fd < 0)
+		return -1;
 
-	wr.next = NULL;
+	if (rs->fd_flags & O_NONBLOCK)
+		return set_fd_nonblock(rs->scq_fd, true);
+	return 0;
+}
+
+static inline void rs_format_recv(struct rsocket *rs, struct ibv_recv_wr *wr,
+				  struct ibv_sge *sge)
+{
 	if (!(rs->opts & RS_OPT_MSG_SEND)) {
-		wr.wr_id = rs_recv_wr_id(0);
-		wr.sg_list = NULL;
-		wr.num_sge = 0;
+		wr->wr_id = rs_recv_wr_id(0);
+		wr->sg_list = NULL;
+		wr->num_sge = 0;
 	} else {
-		wr.wr_id = rs_recv_wr_id(rs->rbuf_msg_index);
-		sge.addr = (uintptr_t) rs->rbuf + rs->rbuf_size +
-			   (rs->rbuf_msg_index * RS_MSG_SIZE);
-		sge.length = RS_MSG_SIZE;
-		sge.lkey = rs->rmr->lkey;
-
-		wr.sg_list = &sge;
-		wr.num_sge = 1;
+		wr->wr_id = rs_recv_wr_id(rs->rbuf_msg_index);
+		sge->addr = (uintptr_t) rs->rbuf + rs->rbuf_size +
+			    (rs->rbuf_msg_index * RS_MSG_SIZE);
+		sge->length = RS_MSG_SIZE;
+		sge->lkey = rs->rmr->lkey;
+
+		wr->sg_list = sge;
+		wr->num_sge = 1;
 		if(++rs->rbuf_msg_index == rs->rq_size)
 			rs->rbuf_msg_index = 0;
 	}
+}
+
+/*
+ * Repost receive buffers as chained work request lists, so that a batch
+ * of completions costs a single call into the provider.
+ */
+static int rs_post_recvs(struct rsocket *rs, int cnt)
+{
+	struct ibv_recv_wr wr[RS_CQ_BATCH_MAX], *bad;
+	struct ibv_sge sge[RS_CQ_BATCH_MAX];
+	int i, n, ret = 0;
+
+	while (!ret && cnt) {
+		n = min(cnt, RS_CQ_BATCH_MAX);
+		for (i = 0; i < n; i++) {
+			rs_format_recv(rs, &wr[i], &sge[i]);
+			wr[i].next = &wr[i + 1];
+		}
+		wr[n - 1].next = NULL;
+
+		if (rs->srq)
+			ret = ibv_post_srq_recv(rs->srq->srq, wr, &bad);
+		else
+			ret = ibv_post_recv(rs->cm_id->qp, wr, &bad);
+		ret = rdma_seterrno(ret);
+		cnt -= n;
+	}
+	return ret;
+}
+
+/*
+ * Stream rsockets never receive data into posted buffers: data is RDMA
+ * written directly into the receive buffer, and receives only carry
+ * immediate data.  This allows connections accepted from the same
+ * listener to share an SRQ, rather than each QP holding rq_size receives.
+ * Each connection still grants its peer rq_size credits, so the SRQ may
+ * be over-subscribed.  In that case the sender sees an RNR NAK and
+ * retries, which our connection parameters allow indefinitely.
+ *
+ * Each connection keeps its own buffers, since a shared receive buffer
+ * would expose one rkey to every peer.  Connections that also use the
+ * progress thread share CQs as well, see rs_get_scq().
+ */
+static void rs_put_srq(struct rs_srq *srq)
+{
+	if (atomic_fetch_sub(&srq->refcnt, 1) != 1)
+		return;
+
+	ibv_destroy_srq(srq->srq);
+	free(srq);
+}
+
+/*
+ * Receives consumed from the SRQ but not yet polled would otherwise be
+ * lost to the pool when the connection goes away.
+ */
+static void rs_reclaim_srq_recvs(struct rsocket *rs)
+{
+	struct ibv_wc wc[RS_CQ_BATCH_MAX];
+	int i, ret, cnt = 0;
+
+	while ((ret = ibv_poll_cq(rs->cm_id->recv_cq, RS_CQ_BATCH_MAX, wc)) > 0) {
+		for (i = 0; i < ret; i++) {
+			if (rs_wr_is_recv(wc[i].wr_id))
+				cnt++;
+		}
+	}
+	if (cnt)
+		rs_post_recvs(rs, cnt);
+}
+
+static int rs_srq_post_recvs(struct rs_srq *srq, int cnt)
+{
+	struct ibv_recv_wr wr[RS_CQ_BATCH_MAX], *bad;
+	int i, n, ret = 0;
+
+	for (i = 0; i < RS_CQ_BATCH_MAX; i++) {
+		wr[i].wr_id = rs_recv_wr_id(0);
+		wr[i].next = &wr[i + 1];
+		wr[i].sg_list = NULL;
+		wr[i].num_sge = 0;
+	}
+	for (; !ret && cnt; cnt -= n) {
+		n = min(cnt, RS_CQ_BATCH_MAX);
+		wr[n - 1].next = NULL;
+		ret = rdma_seterrno(ibv_post_srq_recv(srq->srq, wr, &bad));
+		wr[n - 1].next = &wr[n];
+	}
+	return ret;
+}
+
+/* Called by the listening rsocket to share its SRQ with a new connection */
+static struct rs_srq *rs_get_srq(struct rsocket *rs, struct rdma_cm_id *cm_id)
+{
+	struct ibv_srq_init_attr attr;
+	struct rs_srq *srq;
+
+	for (srq = rs->srq_list; srq; srq = srq->next) {
+		if (srq->srq->context == cm_id->verbs)
+			goto found;
+	}
+
+	srq = calloc(1, sizeof(*srq));
+	if (!srq)
+		return NULL;
+
+	memset(&attr, 0, sizeof attr);
+	attr.attr.max_wr = rs->srq_size;
+	attr.attr.max_sge = 1;
+	srq->srq = ibv_create_srq(cm_id->pd, &attr);
+	if (!srq->srq)
+		goto err1;
+
+	srq->size = rs->srq_size;
+	if (rs_srq_post_recvs(srq, srq->size))
+		goto err2;
+
+	atomic_init(&srq->refcnt, 1);
+	srq->next = rs->srq_list;
+	rs->srq_list = srq;
+found:
+	atomic_fetch_add(&srq->refcnt, 1);
+	return srq;
+
+err2:
+	ibv_destroy_srq(srq->srq);
+err1:
+	free(srq);
+	return NULL;
+}
+
+/*
+ * Connections on a shared receive queue which are serviced by the progress
+ * thread also share CQs, up to RS_SCQ_CONNS connections per CQ, rather than
+ * each creating a CQ and completion channel.  Whichever thread polls a
+ * shared CQ queues the completions it finds on the rsocket that owns the
+ * QP, found by QP number, and each rsocket only processes its own queue.
+ * The CQ is never armed.  Instead, the progress thread polls it on every
+ * pass, and signals an rsocket's eventfd if the rsocket was waiting for
+ * completions.  The eventfd stands in for the completion channel in
+ * blocking calls, rpoll and repoll.
+ *
+ * The CQ is sized for the SRQ plus the send queue of each connection, and
+ * the queued completions are drawn from a pool of the same size, since a
+ * completion is either in the CQ or queued, never both.
+ */
+#define RS_SCQ_CONNS 64
+
+static int rs_scq_compare(const void *a, const void *b)
+{
+	uint32_t qpn_a = *(const uint32_t *) a, qpn_b = *(const uint32_t *) b;
+
+	return qpn_a < qpn_b ? -1 : qpn_a > qpn_b;
+}
+
+static void rs_put_scq(struct rs_scq *scq)
+{
+	if (atomic_fetch_sub(&scq->refcnt, 1) != 1)
+		return;
+
+	rs_progress_remove_cq(scq);
+	ibv_destroy_cq(scq->cq);
+	rs_put_srq(scq->srq);
+	fastlock_destroy(&scq->lock);
+	free(scq->comp);
+	free(scq);
+}
+
+static void rs_scq_signal(struct rsocket *rs)
+{
+	uint64_t val = 1;
+
+	write_all(rs->scq_fd, &val, sizeof(val));
+}
+
+/* Called with scq->lock held */
+static void rs_scq_drain(struct rs_scq *scq)
+{
+	struct ibv_wc wc[RS_CQ_BATCH_MAX];
+	struct rs_scq_comp *comp;
+	struct rsocket *rs;
+	void **node;
+	int i, n, ret, idx, orphans = 0;
+
+	while ((n = min(scq->comp_free_cnt, RS_CQ_BATCH_MAX)) &&
+	       (ret = ibv_poll_cq(scq->cq, n, wc)) > 0) {
+		for (i = 0; i < ret; i++) {
+			node = tfind(&wc[i].qp_num, &scq->qp_map, rs_scq_compare);
+			if (!node) {
+				/* The connection is gone, keep the SRQ full */
+				if (rs_wr_is_recv(wc[i].wr_id))
+					orphans++;
+				continue;
+			}
+
+			rs = container_of(*node, struct rsocket, scq_qpn);
+			idx = scq->comp_free;
+			comp = &scq->comp[idx];
+			scq->comp_free = comp->next;
+			scq->comp_free_cnt--;
+
+			comp->wr_id = wc[i].wr_id;
+			comp->imm_data = wc[i].imm_data;
+			comp->status = wc[i].status;
+			comp->wc_flags = wc[i].wc_flags;
+			comp->next = -1;
+			if (rs->scq_tail >= 0)
+				scq->comp[rs->scq_tail].next = idx;
+			else
+				rs->scq_head = idx;
+			rs->scq_tail = idx;
+
+			if (rs->scq_armed) {
+				rs->scq_armed = false;
+				rs_scq_signal(rs);
+			}
+		}
+	}
+
+	if (orphans)
+		rs_srq_post_recvs(scq->srq, orphans);
+}
+
+static int rs_scq_poll(struct rsocket *rs, struct ibv_wc *wc, int cnt)
+{
+	struct rs_scq *scq = rs->scq;
+	struct rs_scq_comp *comp;
+	int i, n;
+
+	fastlock_acquire(&scq->lock);
+	rs_scq_drain(scq);
+	for (i = 0; i < cnt && rs->scq_head >= 0; i++) {
+		n = rs->scq_head;
+		comp = &scq->comp[n];
+		rs->scq_head = comp->next;
+		if (rs->scq_head < 0)
+			rs->scq_tail = -1;
+
+		wc[i].wr_id = comp->wr_id;
+		wc[i].imm_data = comp->imm_data;
+		wc[i].status = comp->status;
+		wc[i].wc_flags = comp->wc_flags;
+
+		comp->next = scq->comp_free;
+		scq->comp_free = n;
+		scq->comp_free_cnt++;
+	}
+	fastlock_release(&scq->lock);
+	return i;
+}
+
+static void rs_scq_progress(struct rs_scq *scq)
+{
+	fastlock_acquire(&scq->lock);
+	rs_scq_drain(scq);
+	fastlock_release(&scq->lock);
+}
+
+/* Arms the rsocket's eventfd, the caller rechecks for completions after */
+static void rs_scq_req_notify(struct rsocket *rs)
+{
+	fastlock_acquire(&rs->scq->lock);
+	rs->scq_armed = true;
+	fastlock_release(&rs->scq->lock);
+}
+
+static int rs_scq_get_event(struct rsocket *rs)
+{
+	uint64_t val;
+
+	return read(rs->scq_fd, &val, sizeof(val)) == sizeof(val) ? 0 : -1;
+}
+
+/*
+ * Called by the listening rsocket to reserve room in a shared CQ for a new
+ * connection, which must already have its SRQ.
+ */
+static struct rs_scq *rs_get_scq(struct rsocket *rs, struct rsocket *new_rs)
+{
+	struct rs_scq *scq;
+	int i, cqe;
+
+	for (scq = rs->scq_list; scq; scq = scq->next) {
+		if (scq->srq != new_rs->srq || scq->sq_size < new_rs->sq_size)
+			continue;
+
+		fastlock_acquire(&scq->lock);
+		if (scq->conns < RS_SCQ_CONNS) {
+			scq->conns++;
+			fastlock_release(&scq->lock);
+			goto found;
+		}
+		fastlock_release(&scq->lock);
+	}
+
+	scq = calloc(1, sizeof(*scq));
+	if (!scq)
+		return NULL;
+
+	scq->sq_size = new_rs->sq_size;
+	cqe = new_rs->srq->size + RS_SCQ_CONNS * scq->sq_size;
+	scq->comp = calloc(cqe, sizeof(*scq->comp));
+	if (!scq->comp)
+		goto err1;
+
+	for (i = 0; i < cqe; i++)
+		scq->comp[i].next = i + 1;
+	scq->comp[cqe - 1].next = -1;
+	scq->comp_free_cnt = cqe;
+
+	scq->cq = ibv_create_cq(new_rs->cm_id->verbs, cqe, NULL, NULL, 0);
+	if (!scq->cq)
+		goto err2;
+
+	fastlock_init(&scq->lock);
+	atomic_init(&scq->refcnt, 1);
+	dlist_init(&scq->progress_entry);
+	scq->srq = new_rs->srq;
+	atomic_fetch_add(&scq->srq->refcnt, 1);
+	scq->conns = 1;
+	if (rs_progress_add_cq(scq)) {
+		rs_put_scq(scq);
+		return NULL;
+	}
+
+	scq->next = rs->scq_list;
+	rs->scq_list = scq;
+found:
+	atomic_fetch_add(&scq->refcnt, 1);
+	return scq;
+
+err2:
+	free(scq->comp);
+err1:
+	free(scq);
+	return NULL;
+}
+
+/* Called once the rsocket's QP exists, so its completions can be queued */
+static int rs_scq_add_qp(struct rsocket *rs)
+{
+	void *node;
+
+	rs->scq_qpn = rs->cm_id->qp->qp_num;
+	rs->scq_head = rs->scq_tail = -1;
+	fastlock_acquire(&rs->scq->lock);
+	node = tsearch(&rs->scq_qpn, &rs->scq->qp_map, rs_scq_compare);
+	fastlock_release(&rs->scq->lock);
+	return node ? 0 : ERR(ENOMEM);
+}
+
+/*
+ * The QP is destroyed under the CQ lock, so that its number cannot be
+ * reused by another connection until its completions have been drained.
+ * Receives that it took from the SRQ are returned to it.
+ */
+static void rs_scq_destroy_qp(struct rsocket *rs)
+{
+	struct rs_scq *scq = rs->scq;
+	int n, cnt = 0;
+
+	fastlock_acquire(&scq->lock);
+	rs_scq_drain(scq);
+	tdelete(&rs->scq_qpn, &scq->qp_map, rs_scq_compare);
+	for (; rs->scq_head >= 0; rs->scq_head = n) {
+		n = scq->comp[rs->scq_head].next;
+		if (rs_wr_is_recv(scq->comp[rs->scq_head].wr_id))
+			cnt++;
+		scq->comp[rs->scq_head].next = scq->comp_free;
+		scq->comp_free = rs->scq_head;
+		scq->comp_free_cnt++;
+	}
+	rs->scq_tail = -1;
 
-	return rdma_seterrno(ibv_post_recv(rs->cm_id->qp, &wr, &bad));
+	rdma_destroy_qp(rs->cm_id);
+	rs_scq_drain(scq);
+	fastlock_release(&scq->lock);
+
+	if (cnt)
+		rs_srq_post_recvs(scq->srq, cnt);
+}
+
+static void rs_release_scq(struct rsocket *rs)
+{
+	fastlock_acquire(&rs->scq->lock);
+	rs->scq->conns--;
+	fastlock_release(&rs->scq->lock);
+	rs_put_scq(rs->scq);
+	if (rs->scq_fd >= 0)
+		close(rs->scq_fd);
 }
 
 static inline int ds_post_recv(struct rsocket *rs, struct ds_qp *qp, uint32_t offset)
@@ -914,7 +1517,7 @@ static inline int ds_post_recv(struct rsocket *rs, struct ds_qp *qp, uint32_t of
 static int rs_create_ep(struct rsocket *rs)
 {
 	struct ibv_qp_init_attr qp_attr;
-	int i, ret;
+	int ret;
 
 	rs_set_qp_size(rs);
 	if (rs->cm_id->verbs->device->transport_type == IBV_TRANSPORT_IWARP) {
@@ -923,14 +1526,22 @@ static int rs_create_ep(struct rsocket *rs)
 		if (rs->sq_inline < RS_MSG_SIZE)
 			rs->sq_inline = RS_MSG_SIZE;
 	}
-	ret = rs_create_cq(rs, rs->cm_id);
+	if (rs->scq)
+		ret = rs_create_scq_fd(rs);
+	else
+		ret = rs_create_cq(rs, rs->cm_id);
 	if (ret)
 		return ret;
 
 	memset(&qp_attr, 0, sizeof qp_attr);
 	qp_attr.qp_context = rs;
-	qp_attr.send_cq = rs->cm_id->send_cq;
-	qp_attr.recv_cq = rs->cm_id->recv_cq;
+	if (rs->scq) {
+		qp_attr.send_cq = rs->scq->cq;
+		qp_attr.recv_cq = rs->scq->cq;
+	} else {
+		qp_attr.send_cq = rs->cm_id->send_cq;
+		qp_attr.recv_cq = rs->cm_id->recv_cq;
+	}
 	qp_attr.qp_type = IBV_QPT_RC;
 	qp_attr.sq_sig_all = 1;
 	qp_attr.cap.max_send_wr = rs->sq_size;
@@ -938,11 +1549,19 @@ static int rs_create_ep(struct rsocket *rs)
 	qp_attr.cap.max_send_sge = 2;
 	qp_attr.cap.max_recv_sge = 1;
 	qp_attr.cap.max_inline_data = rs->sq_inline;
+	if (rs->srq)
+		qp_attr.srq = rs->srq->srq;
 
 	ret = rdma_create_qp(rs->cm_id, NULL, &qp_attr);
 	if (ret)
 		return ret;
 
+	if (rs->scq) {
+		ret = rs_scq_add_qp(rs);
+		if (ret)
+			return ret;
+	}
+
 	rs->sq_inline = qp_attr.cap.max_inline_data;
 	if ((rs->opts & RS_OPT_MSG_SEND) && (rs->sq_inline < RS_MSG_SIZE))
 		return ERR(ENOTSUP);
@@ -951,12 +1570,7 @@ static int rs_create_ep(struct rsocket *rs)
 	if (ret)
 		return ret;
 
-	for (i = 0; i < rs->rq_size; i++) {
-		ret = rs_post_recv(rs);
-		if (ret)
-			return ret;
-	}
-	return 0;
+	return rs->srq ? 0 : rs_post_recvs(rs, rs->rq_size);
 }
 
 static void rs_release_iomap_mr(struct rs_iomap_mr *iomr)
@@ -1037,6 +1651,7 @@ static void ds_free(struct rsocket *rs)
 		free(rs->sbuf);
 
 	tdestroy(rs->dest_map, free);
+	fastlock_destroy(&rs->epoll_lock);
 	fastlock_destroy(&rs->map_lock);
 	fastlock_destroy(&rs->cq_wait_lock);
 	fastlock_destroy(&rs->cq_lock);
@@ -1073,23 +1688,52 @@ static void rs_free(struct rsocket *rs)
 		free(rs->target_buffer_list);
 	}
 
+	if (rs->zcopy_mr) {
+		while (rs->zcopy_mr_cnt)
+			rdma_dereg_mr(rs->zcopy_mr[--rs->zcopy_mr_cnt]);
+		free(rs->zcopy_mr);
+	}
+
 	if (rs->index >= 0)
 		rs_remove(rs);
 
 	if (rs->cm_id) {
 		rs_free_iomappings(rs);
-		if (rs->cm_id->qp) {
+		if (rs->cm_id->qp && rs->scq) {
+			rs_scq_destroy_qp(rs);
+		} else if (rs->cm_id->qp) {
 			ibv_ack_cq_events(rs->cm_id->recv_cq, rs->unack_cqe);
 			rdma_destroy_qp(rs->cm_id);
+			if (rs->srq)
+				rs_reclaim_srq_recvs(rs);
 		}
 		rdma_destroy_id(rs->cm_id);
 	}
 
+	if (rs->scq)
+		rs_release_scq(rs);
+	while (rs->scq_list) {
+		struct rs_scq *scq = rs->scq_list;
+
+		rs->scq_list = scq->next;
+		rs_put_scq(scq);
+	}
+
+	if (rs->srq)
+		rs_put_srq(rs->srq);
+	while (rs->srq_list) {
+		struct rs_srq *srq = rs->srq_list;
+
+		rs->srq_list = srq->next;
+		rs_put_srq(srq);
+	}
+
 	if (rs->accept_queue[0] > 0 || rs->accept_queue[1] > 0) {
 		close(rs->accept_queue[0]);
 		close(rs->accept_queue[1]);
 	}
 
+	fastlock_destroy(&rs->epoll_lock);
 	fastlock_destroy(&rs->map_lock);
 	fastlock_destroy(&rs->cq_wait_lock);
 	fastlock_destroy(&rs->cq_lock);
@@ -1323,6 +1967,13 @@ static void rs_accept(struct rsocket *rs)
 	if (creq->version != 1)
 		goto err;
 
+	/* iWarp receives carry data, which cannot be taken from a shared queue */
+	if (rs->srq_size &&
+	    cm_id->verbs->device->transport_type != IBV_TRANSPORT_IWARP)
+		new_rs->srq = rs_get_srq(rs, cm_id);
+	if (new_rs->srq && (new_rs->opts & RS_OPT_PROGRESS))
+		new_rs->scq = rs_get_scq(rs, new_rs);
+
 	ret = rs_create_ep(new_rs);
 	if (ret)
 		goto err;
@@ -1333,9 +1984,11 @@ static void rs_accept(struct rsocket *rs)
 	param.private_data = &cresp;
 	param.private_data_len = sizeof cresp;
 	ret = rdma_accept(new_rs->cm_id, &param);
-	if (!ret)
+	if (!ret) {
 		new_rs->state = rs_connect_rdwr;
-	else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		if (new_rs->opts & RS_OPT_PROGRESS)
+			rs_progress_add(new_rs);
+	} else if (errno == EAGAIN || errno == EWOULDBLOCK)
 		new_rs->state = rs_accepting;
 	else
 		goto err;
@@ -1496,7 +2149,10 @@ connected:
 			rs->state = rs_connect_error;
 			rs->err = errno;
 		}
+	} else if ((rs->state & rs_connected) && (rs->opts & RS_OPT_PROGRESS)) {
+		rs_progress_add(rs);
 	}
+	rs_epoll_notify(rs);
 unlock:
 	fastlock_release(&rs->slock);
 	return ret;
@@ -2004,85 +2660,136 @@ static void rs_update_credits(struct rsocket *rs)
 		rs_send_credits(rs);
 }
 
-static int rs_poll_cq(struct rsocket *rs)
+/*
+ * Returns true if the completion disconnected the rsocket, in which case
+ * no further completions should be processed.
+ */
+static bool rs_process_recv(struct rsocket *rs, struct ibv_wc *wc)
 {
-	struct ibv_wc wc;
 	uint32_t msg;
-	int ret, rcnt = 0;
 
-	while ((ret = ibv_poll_cq(rs->cm_id->recv_cq, 1, &wc)) > 0) {
-		if (rs_wr_is_recv(wc.wr_id)) {
-			if (wc.status != IBV_WC_SUCCESS)
-				continue;
-			rcnt++;
+	if (wc->wc_flags & IBV_WC_WITH_IMM) {
+		msg = be32toh(wc->imm_data);
+	} else {
+		msg = ((uint32_t *) (rs->rbuf + rs->rbuf_size))
+			[rs_wr_data(wc->wr_id)];
 
-			if (wc.wc_flags & IBV_WC_WITH_IMM) {
-				msg = be32toh(wc.imm_data);
+	}
+	switch (rs_msg_op(msg)) {
+	case RS_OP_SGL:
+		rs->sseq_comp = (uint16_t) rs_msg_data(msg);
+		break;
+	case RS_OP_IOMAP_SGL:
+		/* The iomap was updated, that's nice to know. */
+		break;
+	case RS_OP_CTRL:
+		if (rs_msg_data(msg) == RS_CTRL_DISCONNECT) {
+			rs->state = rs_disconnected;
+			return true;
+		} else if (rs_msg_data(msg) == RS_CTRL_SHUTDOWN) {
+			if (rs->state & rs_writable) {
+				rs->state &= ~rs_readable;
 			} else {
-				msg = ((uint32_t *) (rs->rbuf + rs->rbuf_size))
-					[rs_wr_data(wc.wr_id)];
-
-			}
-			switch (rs_msg_op(msg)) {
-			case RS_OP_SGL:
-				rs->sseq_comp = (uint16_t) rs_msg_data(msg);
-				break;
-			case RS_OP_IOMAP_SGL:
-				/* The iomap was updated, that's nice to know. */
-				break;
-			case RS_OP_CTRL:
-				if (rs_msg_data(msg) == RS_CTRL_DISCONNECT) {
-					rs->state = rs_disconnected;
-					return 0;
-				} else if (rs_msg_data(msg) == RS_CTRL_SHUTDOWN) {
-					if (rs->state & rs_writable) {
-						rs->state &= ~rs_readable;
-					} else {
-						rs->state = rs_disconnected;
-						return 0;
-					}
-				}
-				break;
-			case RS_OP_WRITE:
-				/* We really shouldn't be here. */
-				break;
-			default:
-				rs->rmsg[rs->rmsg_tail].op = rs_msg_op(msg);
-				rs->rmsg[rs->rmsg_tail].data = rs_msg_data(msg);
-				if (++rs->rmsg_tail == rs->rq_size + 1)
-					rs->rmsg_tail = 0;
-				break;
+				rs->state = rs_disconnected;
+				return true;
 			}
-		} else {
-			switch  (rs_msg_op(rs_wr_data(wc.wr_id))) {
-			case RS_OP_SGL:
-				rs->ctrl_max_seqno++;
-				break;
-			case RS_OP_CTRL:
-				rs->ctrl_max_seqno++;
-				if (rs_msg_data(rs_wr_data(wc.wr_id)) == RS_CTRL_DISCONNECT)
-					rs->state = rs_disconnected;
-				break;
-			case RS_OP_IOMAP_SGL:
-				rs->sqe_avail++;
-				if (!rs_wr_is_msg_send(wc.wr_id))
-					rs->sbuf_bytes_avail += sizeof(struct rs_iomap);
-				break;
-			default:
-				rs->sqe_avail++;
-				rs->sbuf_bytes_avail += rs_msg_data(rs_wr_data(wc.wr_id));
-				break;
+		}
+		break;
+	case RS_OP_WRITE:
+		/* We really shouldn't be here. */
+		break;
+	default:
+		rs->rmsg[rs->rmsg_tail].op = rs_msg_op(msg);
+		rs->rmsg[rs->rmsg_tail].data = rs_msg_data(msg);
+		if (++rs->rmsg_tail == rs->rq_size + 1)
+			rs->rmsg_tail = 0;
+		break;
+	}
+	return false;
+}
+
+static void rs_process_send(struct rsocket *rs, struct ibv_wc *wc)
+{
+	switch  (rs_msg_op(rs_wr_data(wc->wr_id))) {
+	case RS_OP_SGL:
+		rs->ctrl_max_seqno++;
+		break;
+	case RS_OP_CTRL:
+		rs->ctrl_max_seqno++;
+		if (rs_msg_data(rs_wr_data(wc->wr_id)) == RS_CTRL_DISCONNECT)
+			rs->state = rs_disconnected;
+		break;
+	case RS_OP_IOMAP_SGL:
+		rs->sqe_avail++;
+		if (!rs_wr_is_msg_send(wc->wr_id))
+			rs->sbuf_bytes_avail += sizeof(struct rs_iomap);
+		break;
+	default:
+		rs->sqe_avail++;
+		rs->sbuf_bytes_avail += rs_msg_data(rs_wr_data(wc->wr_id));
+		break;
+	}
+	if (wc->status != IBV_WC_SUCCESS && (rs->state & rs_connected)) {
+		rs->state = rs_error;
+		rs->err = EIO;
+	}
+}
+
+static inline int rs_poll_comps(struct rsocket *rs, struct ibv_wc *wc)
+{
+	if (rs->scq)
+		return rs_scq_poll(rs, wc, cq_batch);
+	return ibv_poll_cq(rs->cm_id->recv_cq, cq_batch, wc);
+}
+
+/*
+ * Completions are drained from the CQ cq_batch at a time.  Receive buffers
+ * consumed by the batch are reposted together once the CQ is empty.  If a
+ * disconnect is processed, any remaining completions in the current batch
+ * are still accounted for, but we stop polling the CQ.
+ */
+static int rs_poll_cq(struct rsocket *rs)
+{
+	struct ibv_wc wc[RS_CQ_BATCH_MAX];
+	int i, ret, rcnt = 0, srq_cnt = 0;
+	bool done = false, polled = false;
+
+	while (!done && (ret = rs_poll_comps(rs, wc)) > 0) {
+		polled = true;
+		for (i = 0; i < ret; i++) {
+			if (!rs_wr_is_recv(wc[i].wr_id)) {
+				rs_process_send(rs, &wc[i]);
+				continue;
 			}
-			if (wc.status != IBV_WC_SUCCESS && (rs->state & rs_connected)) {
-				rs->state = rs_error;
-				rs->err = EIO;
+
+			srq_cnt++;
+			if (wc[i].status == IBV_WC_SUCCESS) {
+				rcnt++;
+				if (rs_process_recv(rs, &wc[i]))
+					done = true;
 			}
 		}
 	}
 
+	if (polled)
+		rs_epoll_notify(rs);
+
+	/*
+	 * Receives taken from a shared receive queue belong to the listener's
+	 * pool, so they are returned regardless of our connection state.
+	 */
+	if (rs->srq) {
+		if (srq_cnt)
+			rs_post_recvs(rs, srq_cnt);
+		rcnt = 0;
+	}
+
+	if (done)
+		return 0;
+
 	if (rs->state & rs_connected) {
-		while (!ret && rcnt--)
-			ret = rs_post_recv(rs);
+		if (!ret && rcnt)
+			ret = rs_post_recvs(rs, rcnt);
 
 		if (ret) {
 			rs->state = rs_error;
@@ -2101,9 +2808,12 @@ static int rs_get_cq_event(struct rsocket *rs)
 	if (!rs->cq_armed)
 		return 0;
 
-	ret = ibv_get_cq_event(rs->cm_id->recv_cq_channel, &cq, &context);
+	if (rs->scq)
+		ret = rs_scq_get_event(rs);
+	else
+		ret = ibv_get_cq_event(rs->cm_id->recv_cq_channel, &cq, &context);
 	if (!ret) {
-		if (++rs->unack_cqe >= rs->sq_size + rs->rq_size) {
+		if (!rs->scq && ++rs->unack_cqe >= rs->sq_size + rs->rq_size) {
 			ibv_ack_cq_events(rs->cm_id->recv_cq, rs->unack_cqe);
 			rs->unack_cqe = 0;
 		}
@@ -2145,7 +2855,10 @@ static int rs_process_cq(struct rsocket *rs, int nonblock, int (*test)(struct rs
 		} else if (nonblock) {
 			ret = ERR(EWOULDBLOCK);
 		} else if (!rs->cq_armed) {
-			ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
+			if (rs->scq)
+				rs_scq_req_notify(rs);
+			else
+				ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
 			rs->cq_armed = 1;
 		} else {
 			rs_update_credits(rs);
@@ -2178,12 +2891,153 @@ static int rs_get_comp(struct rsocket *rs, int nonblock, int (*test)(struct rsoc
 			start_time = rs_time_us();
 
 		poll_time = (uint32_t) (rs_time_us() - start_time);
-	} while (poll_time <= polling_time);
+	} while (poll_time <= rs->busy_poll);
 
 	ret = rs_process_cq(rs, 0, test);
 	return ret;
 }
 
+/*
+ * The progress thread periodically drives completion processing and credit
+ * updates for connected rsockets which request it.  This lets the remote
+ * side keep sending while the application is busy elsewhere, without the
+ * application needing to call into the library.  Rsockets are added once
+ * connected and removed when closed.  The thread also drains shared CQs,
+ * which are added when created.  The thread exits once no rsockets or
+ * shared CQs remain.
+ */
+static void rs_progress(struct rsocket *rs)
+{
+	/*
+	 * Completion processing updates both send and receive state.  If
+	 * the application holds either lock, it is making progress itself,
+	 * so skip the rsocket on this pass rather than wait for it.
+	 */
+	if (!fastlock_tryacquire(&rs->slock))
+		return;
+	if (!fastlock_tryacquire(&rs->rlock))
+		goto out;
+
+	fastlock_acquire(&rs->cq_lock);
+	if (rs->state & rs_connected) {
+		rs_update_credits(rs);
+		rs_poll_cq(rs);
+		rs_update_credits(rs);
+	}
+	fastlock_release(&rs->cq_lock);
+	fastlock_release(&rs->rlock);
+out:
+	fastlock_release(&rs->slock);
+}
+
+static void *rs_progress_run(void *arg)
+{
+	struct timespec ts;
+	dlist_entry *entry;
+
+	ts.tv_sec = progress_interval / 1000000;
+	ts.tv_nsec = (progress_interval % 1000000) * 1000;
+
+	pthread_mutex_lock(&progress_mut);
+	while (!dlist_empty(&progress_list) || !dlist_empty(&progress_cq_list)) {
+		for (entry = progress_cq_list.next; entry != &progress_cq_list;
+		     entry = entry->next)
+			rs_scq_progress(container_of(entry, struct rs_scq,
+						     progress_entry));
+
+		for (entry = progress_list.next; entry != &progress_list;
+		     entry = entry->next)
+			rs_progress(container_of(entry, struct rsocket,
+						 progress_entry));
+
+		pthread_mutex_unlock(&progress_mut);
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&progress_mut);
+	}
+	progress_running = false;
+	pthread_mutex_unlock(&progress_mut);
+	return NULL;
+}
+
+/* Called with progress_mut held */
+static int rs_progress_start(void)
+{
+	pthread_t id;
+	int ret;
+
+	if (progress_running)
+		return 0;
+
+	ret = pthread_create(&id, NULL, rs_progress_run, NULL);
+	if (ret)
+		return ERR(ret);
+
+	pthread_detach(id);
+	progress_running = true;
+	return 0;
+}
+
+static int rs_progress_add(struct rsocket *rs)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&progress_mut);
+	if (dlist_empty(&rs->progress_entry)) {
+		ret = rs_progress_start();
+		if (!ret)
+			dlist_insert_tail(&rs->progress_entry, &progress_list);
+	}
+	pthread_mutex_unlock(&progress_mut);
+	return ret;
+}
+
+static int rs_progress_add_cq(struct rs_scq *scq)
+{
+	int ret;
+
+	pthread_mutex_lock(&progress_mut);
+	ret = rs_progress_start();
+	if (!ret)
+		dlist_insert_tail(&scq->progress_entry, &progress_cq_list);
+	pthread_mutex_unlock(&progress_mut);
+	return ret;
+}
+
+static void rs_progress_remove_cq(struct rs_scq *scq)
+{
+	pthread_mutex_lock(&progress_mut);
+	if (!dlist_empty(&scq->progress_entry)) {
+		dlist_remove(&scq->progress_entry);
+		dlist_init(&scq->progress_entry);
+	}
+	pthread_mutex_unlock(&progress_mut);
+}
+
+static void rs_progress_remove(struct rsocket *rs)
+{
+	pthread_mutex_lock(&progress_mut);
+	if (!dlist_empty(&rs->progress_entry)) {
+		dlist_remove(&rs->progress_entry);
+		dlist_init(&rs->progress_entry);
+	}
+	pthread_mutex_unlock(&progress_mut);
+}
+
+static int rs_set_progress(struct rsocket *rs, int on)
+{
+	int ret = 0;
+
+	if (on) {
+		rs->opts |= RS_OPT_PROGRESS;
+		if (rs->state & rs_connected)
+			ret = rs_progress_add(rs);
+	} else {
+		rs->opts &= ~RS_OPT_PROGRESS;
+		rs_progress_remove(rs);
+	}
+	return ret;
+}
+
 static int ds_valid_recv(struct ds_qp *qp, struct ibv_wc *wc)
 {
 	struct ds_header *hdr;
@@ -2194,20 +3048,46 @@ static int ds_valid_recv(struct ds_qp *qp, struct ibv_wc *wc)
 		 (hdr->version == 6 && hdr->length == DS_IPV6_HDR_LEN)));
 }
 
+static void ds_process_wc(struct rsocket *rs, struct ds_qp *qp,
+			  struct ibv_wc *wc)
+{
+	struct ds_smsg *smsg;
+	struct ds_rmsg *rmsg;
+
+	if (rs_wr_is_recv(wc->wr_id)) {
+		if (rs->rqe_avail && wc->status == IBV_WC_SUCCESS &&
+		    ds_valid_recv(qp, wc)) {
+			rs->rqe_avail--;
+			rmsg = &rs->dmsg[rs->rmsg_tail];
+			rmsg->qp = qp;
+			rmsg->offset = rs_wr_data(wc->wr_id);
+			rmsg->length = wc->byte_len - sizeof(struct ibv_grh);
+			if (++rs->rmsg_tail == rs->rq_size + 1)
+				rs->rmsg_tail = 0;
+		} else {
+			ds_post_recv(rs, qp, rs_wr_data(wc->wr_id));
+		}
+	} else {
+		smsg = (struct ds_smsg *) (rs->sbuf + rs_wr_data(wc->wr_id));
+		smsg->next = rs->smsg_free;
+		rs->smsg_free = smsg;
+		rs->sqe_avail++;
+	}
+}
+
 /*
  * Poll all CQs associated with a datagram rsocket.  We need to drop any
  * received messages that we do not have room to store.  To limit drops,
  * we only poll if we have room to store the receive or we need a send
- * buffer.  To ensure fairness, we poll the CQs round robin, remembering
- * where we left off.
+ * buffer, and never retrieve more completions from a CQ than we have
+ * room to store receives.  To ensure fairness, we poll the CQs round
+ * robin, remembering where we left off.
  */
 static void ds_poll_cqs(struct rsocket *rs)
 {
+	struct ibv_wc wc[RS_CQ_BATCH_MAX];
 	struct ds_qp *qp;
-	struct ds_smsg *smsg;
-	struct ds_rmsg *rmsg;
-	struct ibv_wc wc;
-	int ret, cnt;
+	int i, ret, cnt, total = 0;
 
 	if (!(qp = rs->qp_list))
 		return;
@@ -2215,40 +3095,30 @@ static void ds_poll_cqs(struct rsocket *rs)
 	do {
 		cnt = 0;
 		do {
-			ret = ibv_poll_cq(qp->cm_id->recv_cq, 1, &wc);
+			ret = ibv_poll_cq(qp->cm_id->recv_cq,
+					  rs->rqe_avail ?
+					  min(rs->rqe_avail, (int) cq_batch) : 1,
+					  wc);
 			if (ret <= 0) {
 				qp = ds_next_qp(qp);
 				continue;
 			}
 
-			if (rs_wr_is_recv(wc.wr_id)) {
-				if (rs->rqe_avail && wc.status == IBV_WC_SUCCESS &&
-				    ds_valid_recv(qp, &wc)) {
-					rs->rqe_avail--;
-					rmsg = &rs->dmsg[rs->rmsg_tail];
-					rmsg->qp = qp;
-					rmsg->offset = rs_wr_data(wc.wr_id);
-					rmsg->length = wc.byte_len - sizeof(struct ibv_grh);
-					if (++rs->rmsg_tail == rs->rq_size + 1)
-						rs->rmsg_tail = 0;
-				} else {
-					ds_post_recv(rs, qp, rs_wr_data(wc.wr_id));
-				}
-			} else {
-				smsg = (struct ds_smsg *) (rs->sbuf + rs_wr_data(wc.wr_id));
-				smsg->next = rs->smsg_free;
-				rs->smsg_free = smsg;
-				rs->sqe_avail++;
-			}
+			for (i = 0; i < ret; i++)
+				ds_process_wc(rs, qp, &wc[i]);
 
 			qp = ds_next_qp(qp);
+			total += ret;
 			if (!rs->rqe_avail && rs->sqe_avail) {
 				rs->qp_list = qp;
-				return;
+				goto out;
 			}
-			cnt++;
+			cnt += ret;
 		} while (qp != rs->qp_list);
 	} while (cnt);
+out:
+	if (total)
+		rs_epoll_notify(rs);
 }
 
 static void ds_req_notify_cqs(struct rsocket *rs)
@@ -2337,7 +3207,7 @@ static int ds_get_comp(struct rsocket *rs, int nonblock, int (*test)(struct rsoc
 			start_time = rs_time_us();
 
 		poll_time = (uint32_t) (rs_time_us() - start_time);
-	} while (poll_time <= polling_time);
+	} while (poll_time <= rs->busy_poll);
 
 	ret = ds_process_cqs(rs, 0, test);
 	return ret;
@@ -2785,6 +3655,126 @@ static ssize_t dsend(struct rsocket *rs, const void *buf, size_t len, int flags)
 	return ret ? ret : len;
 }
 
+/*
+ * Zero copy transfers register the user's buffer and RDMA write directly
+ * from it into the remote receive buffer, bypassing the send buffer.  The
+ * call does not return until all writes have completed, so the user may
+ * reuse the buffer afterwards.  Registrations may be kept in a small LRU
+ * cache (zcopy_cache_size entries) to avoid registering the same buffer
+ * on every call.  Cached registrations pin the memory they cover, so the
+ * cache should only be enabled by applications which do not unmap and
+ * remap buffers they send from.
+ */
+static struct ibv_mr *rs_get_zcopy_mr(struct rsocket *rs, const void *buf,
+				      size_t len)
+{
+	struct ibv_mr *mr;
+	int i;
+
+	for (i = 0; i < rs->zcopy_mr_cnt; i++) {
+		mr = rs->zcopy_mr[i];
+		if ((uintptr_t) buf >= (uintptr_t) mr->addr &&
+		    (uintptr_t) buf + len <= (uintptr_t) mr->addr + mr->length) {
+			memmove(&rs->zcopy_mr[1], &rs->zcopy_mr[0],
+				i * sizeof(*rs->zcopy_mr));
+			rs->zcopy_mr[0] = mr;
+			return mr;
+		}
+	}
+
+	return rdma_reg_msgs(rs->cm_id, (void *) buf, len);
+}
+
+static void rs_put_zcopy_mr(struct rsocket *rs, struct ibv_mr *mr)
+{
+	if (!rs->zcopy_cache_size) {
+		rdma_dereg_mr(mr);
+		return;
+	}
+
+	if (!rs->zcopy_mr) {
+		rs->zcopy_mr = calloc(rs->zcopy_cache_size, sizeof(*rs->zcopy_mr));
+		if (!rs->zcopy_mr) {
+			rdma_dereg_mr(mr);
+			return;
+		}
+	}
+
+	if (rs->zcopy_mr_cnt && rs->zcopy_mr[0] == mr)
+		return;
+
+	if (rs->zcopy_mr_cnt == rs->zcopy_cache_size)
+		rdma_dereg_mr(rs->zcopy_mr[--rs->zcopy_mr_cnt]);
+
+	memmove(&rs->zcopy_mr[1], &rs->zcopy_mr[0],
+		rs->zcopy_mr_cnt * sizeof(*rs->zcopy_mr));
+	rs->zcopy_mr[0] = mr;
+	rs->zcopy_mr_cnt++;
+}
+
+static int rs_use_zcopy(struct rsocket *rs, size_t len, int flags)
+{
+	return rs->zcopy_threshold && len >= rs->zcopy_threshold &&
+	       !rs_nonblocking(rs, flags);
+}
+
+/* Caller must hold slock */
+static ssize_t rs_send_zcopy(struct rsocket *rs, const void *buf, size_t len)
+{
+	struct ibv_mr *mr;
+	struct ibv_sge sge;
+	size_t left = len;
+	uint32_t xfer_size;
+	int ret = 0, err;
+
+	mr = rs_get_zcopy_mr(rs, buf, len);
+	if (!mr)
+		return -1;
+
+	sge.lkey = mr->lkey;
+	for (; left; left -= xfer_size, buf += xfer_size) {
+		if (!rs_can_send(rs)) {
+			ret = rs_get_comp(rs, 0, rs_conn_can_send);
+			if (ret)
+				break;
+			if (!(rs->state & rs_writable)) {
+				ret = ERR(ECONNRESET);
+				break;
+			}
+		}
+
+		xfer_size = min_t(size_t, left, rs->sbuf_bytes_avail);
+		if (xfer_size > rs->target_sgl[rs->target_sge].length)
+			xfer_size = rs->target_sgl[rs->target_sge].length;
+
+		sge.addr = (uintptr_t) buf;
+		sge.length = xfer_size;
+		ret = rs_write_data(rs, &sge, 1, xfer_size, 0);
+		if (ret)
+			break;
+	}
+
+	/*
+	 * Writes may still be referencing the user's buffer, even on error.
+	 * Wait for them to complete before releasing the registration.
+	 */
+	if (left != len) {
+		do {
+			err = rs_get_comp(rs, 0, rs_conn_all_sends_done);
+		} while (err && errno == EINTR && (rs->state & rs_connected));
+
+		if (!ret && rs->state == rs_error)
+			ret = ERR(rs->err);
+		else if (!ret && err)
+			ret = err;
+	}
+
+	/* The cache may hold mr, so leave it to rs_free if disconnected */
+	rs_put_zcopy_mr(rs, mr);
+
+	return (ret && left == len) ? ret : len - left;
+}
+
 /*
  * We overlap sending the data, by posting a small work request immediately,
  * then increasing the size of the send on each iteration.
@@ -2822,6 +3812,11 @@ ssize_t rsend(int socket, const void *buf, size_t len, int flags)
 		if (ret)
 			goto out;
 	}
+	if (rs_use_zcopy(rs, len, flags)) {
+		ret = rs_send_zcopy(rs, buf, len);
+		fastlock_release(&rs->slock);
+		return ret;
+	}
 	for (; left; left -= xfer_size, buf += xfer_size) {
 		if (!rs_can_send(rs)) {
 			ret = rs_get_comp(rs, rs_nonblocking(rs, flags),
@@ -2933,38 +3928,21 @@ static void rs_copy_iov(void *dst, const struct iovec **iov, size_t *offset, siz
 	}
 }
 
-static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags)
+/* Caller must hold slock */
+static ssize_t rs_sendv_copy(struct rsocket *rs, const struct iovec *iov,
+			     int iovcnt, int flags)
 {
-	struct rsocket *rs;
 	const struct iovec *cur_iov;
 	size_t left, len, offset = 0;
 	uint32_t xfer_size, olen = RS_OLAP_START_SIZE;
 	int i, ret = 0;
 
-	rs = idm_at(&idm, socket);
-	if (!rs)
-		return ERR(EBADF);
-	if (rs->state & rs_opening) {
-		ret = rs_do_connect(rs);
-		if (ret) {
-			if (errno == EINPROGRESS)
-				errno = EAGAIN;
-			return ret;
-		}
-	}
-
 	cur_iov = iov;
 	len = iov[0].iov_len;
 	for (i = 1; i < iovcnt; i++)
 		len += iov[i].iov_len;
 	left = len;
 
-	fastlock_acquire(&rs->slock);
-	if (rs->iomap_pending) {
-		ret = rs_send_iomaps(rs, flags);
-		if (ret)
-			goto out;
-	}
 	for (; left; left -= xfer_size) {
 		if (!rs_can_send(rs)) {
 			ret = rs_get_comp(rs, rs_nonblocking(rs, flags),
@@ -3013,10 +3991,58 @@ static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags
 		if (ret)
 			break;
 	}
+	return (ret && left == len) ? ret : len - left;
+}
+
+static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags)
+{
+	struct rsocket *rs;
+	ssize_t ret = 0, sent = 0;
+	int i;
+
+	rs = idm_at(&idm, socket);
+	if (!rs)
+		return ERR(EBADF);
+	if (rs->state & rs_opening) {
+		ret = rs_do_connect(rs);
+		if (ret) {
+			if (errno == EINPROGRESS)
+				errno = EAGAIN;
+			return ret;
+		}
+	}
+
+	fastlock_acquire(&rs->slock);
+	if (rs->iomap_pending) {
+		ret = rs_send_iomaps(rs, flags);
+		if (ret)
+			goto out;
+	}
+	/* zero copy is disabled, or the send may not block */
+	if (!rs_use_zcopy(rs, SIZE_MAX, flags)) {
+		ret = rs_sendv_copy(rs, iov, iovcnt, flags);
+		goto out;
+	}
+
+	/* Large elements are sent zero copy, the others through sbuf */
+	for (i = 0; i < iovcnt; i++) {
+		if (!iov[i].iov_len)
+			continue;
+		if (rs_use_zcopy(rs, iov[i].iov_len, flags))
+			ret = rs_send_zcopy(rs, iov[i].iov_base, iov[i].iov_len);
+		else
+			ret = rs_sendv_copy(rs, &iov[i], 1, flags);
+		if (ret < 0)
+			break;
+		sent += ret;
+		if ((size_t) ret != iov[i].iov_len)
+			break;
+	}
+	if (sent)
+		ret = sent;
 out:
 	fastlock_release(&rs->slock);
-
-	return (ret && left == len) ? ret : len - left;
+	return ret;
 }
 
 ssize_t rsendmsg(int socket, const struct msghdr *msg, int flags)
@@ -3273,6 +4299,11 @@ static int rs_poll_check(struct pollfd *fds, nfds_t nfds)
 	return cnt;
 }
 
+static int rs_cq_fd(struct rsocket *rs)
+{
+	return rs->scq ? rs->scq_fd : rs->cm_id->recv_cq_channel->fd;
+}
+
 static int rs_poll_arm(struct pollfd *rfds, struct pollfd *fds, nfds_t nfds)
 {
 	struct rsocket *rs;
@@ -3287,7 +4318,7 @@ static int rs_poll_arm(struct pollfd *rfds, struct pollfd *fds, nfds_t nfds)
 
 			if (rs->type == SOCK_STREAM) {
 				if (rs->state >= rs_connected)
-					rfds[i].fd = rs->cm_id->recv_cq_channel->fd;
+					rfds[i].fd = rs_cq_fd(rs);
 				else
 					rfds[i].fd = rs->cm_id->channel->fd;
 			} else {
@@ -3476,6 +4507,492 @@ int rselect(int nfds, fd_set *readfds, fd_set *writefds,
 	return ret;
 }
 
+static int rs_epoll_fd(struct rsocket *rs)
+{
+	if (rs->type == SOCK_DGRAM)
+		return rs->epfd;
+	if (rs->state == rs_listening)
+		return rs->accept_queue[0];
+	if ((rs->state & rs_connected) && rs->cm_id->recv_cq_channel)
+		return rs->cm_id->recv_cq_channel->fd;
+	if ((rs->state & rs_connected) && rs->scq)
+		return rs->scq_fd;
+	return rs->cm_id->channel->fd;
+}
+
+static int rs_epoll_kctl(struct rs_epoll_item *item, int op, int fd)
+{
+	struct epoll_event event;
+
+	event.data.fd = item->fd;
+	if (item->rs)
+		event.events = EPOLLIN | (item->events & EPOLLET);
+	else
+		event.events = item->events;
+
+	return epoll_ctl(item->ep->epfd, op, fd, &event);
+}
+
+/* The rsocket's signaling fd changes as it transitions between states */
+static void rs_epoll_update_kfd(struct rs_epoll_item *item)
+{
+	int kfd;
+
+	kfd = rs_epoll_fd(item->rs);
+	if (kfd == item->kfd)
+		return;
+
+	if (item->kfd >= 0)
+		epoll_ctl(item->ep->epfd, EPOLL_CTL_DEL, item->kfd, NULL);
+	item->kfd = rs_epoll_kctl(item, EPOLL_CTL_ADD, kfd) ? -1 : kfd;
+}
+
+/*
+ * A disabled EPOLLONESHOT item must not leave its signaling fd in the
+ * kernel set, or the level triggered fd would wake every repoll_wait
+ * call.  The fd is added back when the item is re-armed by EPOLL_CTL_MOD.
+ */
+static void rs_epoll_disarm_kfd(struct rs_epoll_item *item)
+{
+	if (item->kfd < 0)
+		return;
+
+	epoll_ctl(item->ep->epfd, EPOLL_CTL_DEL, item->kfd, NULL);
+	item->kfd = -1;
+}
+
+/* Caller must hold epoll_mut and ep->lock */
+static void rs_epoll_free_item(struct rs_epoll_item *item)
+{
+	struct rs_epoll *ep = item->ep;
+
+	if (item->rs) {
+		if (item->kfd >= 0)
+			epoll_ctl(ep->epfd, EPOLL_CTL_DEL, item->kfd, NULL);
+		fastlock_acquire(&item->rs->epoll_lock);
+		dlist_remove(&item->rs_entry);
+		fastlock_release(&item->rs->epoll_lock);
+	} else {
+		epoll_ctl(ep->epfd, EPOLL_CTL_DEL, item->fd, NULL);
+	}
+
+	fastlock_acquire(&ep->ready_lock);
+	if (item->queued)
+		dlist_remove(&item->ready_entry);
+	fastlock_release(&ep->ready_lock);
+
+	dlist_remove(&item->ep_entry);
+	idm_clear(&ep->items, item->fd);
+	free(item);
+}
+
+static void rs_epoll_remove_rs(struct rsocket *rs)
+{
+	struct rs_epoll_item *item;
+	struct rs_epoll *ep;
+
+	if (dlist_empty(&rs->epoll_items))
+		return;
+
+	pthread_mutex_lock(&epoll_mut);
+	while (!dlist_empty(&rs->epoll_items)) {
+		item = container_of(rs->epoll_items.next,
+				    struct rs_epoll_item, rs_entry);
+		ep = item->ep;
+		pthread_mutex_lock(&ep->lock);
+		rs_epoll_free_item(item);
+		pthread_mutex_unlock(&ep->lock);
+	}
+	pthread_mutex_unlock(&epoll_mut);
+}
+
+static void rs_epoll_free(struct rs_epoll *ep)
+{
+	pthread_mutex_lock(&epoll_mut);
+	pthread_mutex_lock(&ep->lock);
+	while (!dlist_empty(&ep->item_list))
+		rs_epoll_free_item(container_of(ep->item_list.next,
+						struct rs_epoll_item, ep_entry));
+	pthread_mutex_unlock(&ep->lock);
+	pthread_mutex_unlock(&epoll_mut);
+
+	close(ep->signal);
+	close(ep->epfd);
+	fastlock_destroy(&ep->ready_lock);
+	pthread_mutex_destroy(&ep->lock);
+	free(ep);
+}
+
+int repoll_create1(int flags)
+{
+	struct rs_epoll *ep;
+	struct epoll_event event;
+	int ret;
+
+	rs_configure();
+	ep = calloc(1, sizeof(*ep));
+	if (!ep)
+		return ERR(ENOMEM);
+
+	pthread_mutex_init(&ep->lock, NULL);
+	fastlock_init(&ep->ready_lock);
+	dlist_init(&ep->ready_list);
+	dlist_init(&ep->item_list);
+
+	ep->epfd = epoll_create1(flags);
+	if (ep->epfd < 0)
+		goto err1;
+
+	ep->signal = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ep->signal < 0)
+		goto err2;
+
+	event.events = EPOLLIN;
+	event.data.fd = RS_EPOLL_SIGNAL;
+	if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, ep->signal, &event))
+		goto err3;
+
+	pthread_mutex_lock(&mut);
+	ret = idm_set(&epidm, ep->epfd, ep);
+	pthread_mutex_unlock(&mut);
+	if (ret < 0)
+		goto err3;
+
+	return ep->epfd;
+
+err3:
+	close(ep->signal);
+err2:
+	close(ep->epfd);
+err1:
+	fastlock_destroy(&ep->ready_lock);
+	pthread_mutex_destroy(&ep->lock);
+	free(ep);
+	return -1;
+}
+
+int repoll_create(int size)
+{
+	if (size <= 0)
+		return ERR(EINVAL);
+
+	return repoll_create1(0);
+}
+
+static int rs_epoll_add(struct rs_epoll *ep, struct rsocket *rs, int fd,
+			struct epoll_event *event)
+{
+	struct rs_epoll_item *item;
+
+	if (idm_lookup(&ep->items, fd))
+		return ERR(EEXIST);
+
+	item = calloc(1, sizeof(*item));
+	if (!item)
+		return ERR(ENOMEM);
+
+	item->ep = ep;
+	item->rs = rs;
+	item->fd = fd;
+	item->kfd = -1;
+	item->events = event->events;
+	item->data = event->data;
+	if (idm_set(&ep->items, fd, item) < 0) {
+		free(item);
+		return -1;
+	}
+
+	if (!rs) {
+		if (rs_epoll_kctl(item, EPOLL_CTL_ADD, fd)) {
+			idm_clear(&ep->items, fd);
+			free(item);
+			return -1;
+		}
+		dlist_insert_tail(&item->ep_entry, &ep->item_list);
+		return 0;
+	}
+
+	/* The first call to repoll_wait determines the initial state */
+	rs_epoll_update_kfd(item);
+	dlist_insert_tail(&item->ep_entry, &ep->item_list);
+	fastlock_acquire(&rs->epoll_lock);
+	dlist_insert_tail(&item->rs_entry, &rs->epoll_items);
+	fastlock_release(&rs->epoll_lock);
+
+	fastlock_acquire(&ep->ready_lock);
+	rs_epoll_queue(ep, item);
+	fastlock_release(&ep->ready_lock);
+	return 0;
+}
+
+static int rs_epoll_mod(struct rs_epoll_item *item, struct epoll_event *event)
+{
+	struct rs_epoll *ep = item->ep;
+
+	item->events = event->events;
+	item->data = event->data;
+	item->disabled = false;
+	if (!item->rs)
+		return rs_epoll_kctl(item, EPOLL_CTL_MOD, item->fd);
+
+	if (item->kfd >= 0)
+		rs_epoll_kctl(item, EPOLL_CTL_MOD, item->kfd);
+	else
+		rs_epoll_update_kfd(item);
+
+	fastlock_acquire(&ep->ready_lock);
+	rs_epoll_queue(ep, item);
+	fastlock_release(&ep->ready_lock);
+	return 0;
+}
+
+int repoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	struct rs_epoll_item *item;
+	struct rs_epoll *ep;
+	struct rsocket *rs;
+	int ret;
+
+	ep = idm_lookup(&epidm, epfd);
+	if (!ep)
+		return ERR(EINVAL);
+	if (fd == epfd)
+		return ERR(EINVAL);
+	if (op != EPOLL_CTL_DEL && !event)
+		return ERR(EFAULT);
+
+	pthread_mutex_lock(&epoll_mut);
+	pthread_mutex_lock(&ep->lock);
+	rs = idm_lookup(&idm, fd);
+	item = idm_lookup(&ep->items, fd);
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		ret = rs_epoll_add(ep, rs, fd, event);
+		break;
+	case EPOLL_CTL_MOD:
+		ret = item ? rs_epoll_mod(item, event) : ERR(ENOENT);
+		break;
+	case EPOLL_CTL_DEL:
+		if (item) {
+			rs_epoll_free_item(item);
+			ret = 0;
+		} else {
+			ret = ERR(ENOENT);
+		}
+		break;
+	default:
+		ret = ERR(EINVAL);
+		break;
+	}
+	pthread_mutex_unlock(&ep->lock);
+	pthread_mutex_unlock(&epoll_mut);
+	return ret;
+}
+
+static uint32_t rs_epoll_check_rs(struct rs_epoll_item *item, bool kevent)
+{
+	struct rsocket *rs = item->rs;
+	uint32_t mask;
+	int revents;
+
+	if (kevent) {
+		fastlock_acquire(&rs->cq_wait_lock);
+		if (rs->type == SOCK_STREAM)
+			rs_get_cq_event(rs);
+		else
+			ds_get_cq_event(rs);
+		fastlock_release(&rs->cq_wait_lock);
+	}
+
+	mask = item->events | EPOLLERR | EPOLLHUP;
+	revents = rs_poll_rs(rs, item->events & (EPOLLIN | EPOLLOUT), 1,
+			     rs_poll_all) & mask;
+	if (!revents) {
+		/* Arm the CQ, then re-check for completions that raced */
+		revents = rs_poll_rs(rs, item->events & (EPOLLIN | EPOLLOUT), 0,
+				     rs_is_cq_armed) & mask;
+	}
+
+	rs_epoll_update_kfd(item);
+	return revents;
+}
+
+/*
+ * Check rsockets on the ready list.  Level triggered rsockets that are
+ * reported are requeued, so that they will be checked again by the next
+ * call.  Caller must hold ep->lock.
+ */
+static int rs_epoll_check(struct rs_epoll *ep, struct epoll_event *events,
+			  int maxevents)
+{
+	struct rs_epoll_item *item;
+	dlist_entry ready, requeue;
+	uint32_t revents;
+	bool kevent;
+	int cnt = 0;
+
+	dlist_init(&requeue);
+	fastlock_acquire(&ep->ready_lock);
+	if (dlist_empty(&ep->ready_list)) {
+		fastlock_release(&ep->ready_lock);
+		return 0;
+	}
+	ready = ep->ready_list;
+	ready.next->prev = &ready;
+	ready.prev->next = &ready;
+	dlist_init(&ep->ready_list);
+
+	while (!dlist_empty(&ready) && cnt < maxevents) {
+		item = container_of(ready.next, struct rs_epoll_item,
+				    ready_entry);
+		dlist_remove(&item->ready_entry);
+		item->queued = false;
+		kevent = item->kevent;
+		item->kevent = false;
+		fastlock_release(&ep->ready_lock);
+
+		revents = rs_epoll_check_rs(item, kevent);
+		if (revents && (item->events & EPOLLONESHOT))
+			rs_epoll_disarm_kfd(item);
+
+		fastlock_acquire(&ep->ready_lock);
+		if (!revents)
+			continue;
+
+		events[cnt].events = revents;
+		events[cnt++].data = item->data;
+		if (item->events & EPOLLONESHOT) {
+			item->disabled = true;
+			if (item->queued) {
+				dlist_remove(&item->ready_entry);
+				item->queued = false;
+			}
+		} else if (!(item->events & EPOLLET) && !item->queued) {
+			dlist_insert_tail(&item->ready_entry, &requeue);
+			item->queued = true;
+		}
+	}
+
+	/* Unprocessed items go back to the front of the list */
+	while (!dlist_empty(&ready)) {
+		item = container_of(ready.prev, struct rs_epoll_item,
+				    ready_entry);
+		dlist_remove(&item->ready_entry);
+		dlist_insert_head(&item->ready_entry, &ep->ready_list);
+	}
+	while (!dlist_empty(&requeue)) {
+		item = container_of(requeue.next, struct rs_epoll_item,
+				    ready_entry);
+		dlist_remove(&item->ready_entry);
+		dlist_insert_tail(&item->ready_entry, &ep->ready_list);
+	}
+	fastlock_release(&ep->ready_lock);
+	return cnt;
+}
+
+/*
+ * Retrieve events from the kernel epoll set.  Events on regular fds are
+ * returned to the user directly.  Events on rsockets queue the rsocket
+ * to be checked.  Caller must hold ep->lock, which is released while
+ * blocked.
+ */
+static int rs_epoll_kwait(struct rs_epoll *ep, struct epoll_event *events,
+			  int maxevents, int timeout)
+{
+	struct epoll_event kev[RS_EPOLL_MAX_KEVENTS];
+	struct rs_epoll_item *item;
+	uint64_t c;
+	int i, ret, cnt = 0;
+
+	if (timeout) {
+		fastlock_acquire(&ep->ready_lock);
+		if (dlist_empty(&ep->ready_list))
+			ep->sleeping = true;
+		else
+			timeout = 0;
+		fastlock_release(&ep->ready_lock);
+	}
+
+	if (timeout)
+		pthread_mutex_unlock(&ep->lock);
+	ret = epoll_wait(ep->epfd, kev, min(maxevents, RS_EPOLL_MAX_KEVENTS),
+			 timeout);
+	if (timeout) {
+		pthread_mutex_lock(&ep->lock);
+		fastlock_acquire(&ep->ready_lock);
+		ep->sleeping = false;
+		if (ep->signaled) {
+			if (read(ep->signal, &c, sizeof(c)) != sizeof(c))
+				c = 0;
+			ep->signaled = false;
+		}
+		fastlock_release(&ep->ready_lock);
+	}
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < ret; i++) {
+		if (kev[i].data.fd == RS_EPOLL_SIGNAL)
+			continue;
+
+		/* The fd may have been removed while we were blocked */
+		item = idm_lookup(&ep->items, kev[i].data.fd);
+		if (!item)
+			continue;
+
+		if (item->rs) {
+			fastlock_acquire(&ep->ready_lock);
+			item->kevent = true;
+			rs_epoll_queue(ep, item);
+			fastlock_release(&ep->ready_lock);
+		} else {
+			events[cnt].events = kev[i].events;
+			events[cnt++].data = item->data;
+		}
+	}
+	return cnt;
+}
+
+int repoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		int timeout)
+{
+	struct rs_epoll *ep;
+	uint64_t start_time;
+	int sleep, ret, cnt;
+
+	ep = idm_lookup(&epidm, epfd);
+	if (!ep)
+		return ERR(EINVAL);
+	if (maxevents <= 0)
+		return ERR(EINVAL);
+
+	start_time = rs_time_us();
+	pthread_mutex_lock(&ep->lock);
+	for (sleep = 0;;) {
+		ret = rs_epoll_kwait(ep, events, maxevents, sleep);
+		if (ret < 0)
+			break;
+
+		cnt = rs_epoll_check(ep, events + ret, maxevents - ret);
+		ret += cnt;
+		if (ret || !timeout)
+			break;
+
+		/* Busy poll for polling_time before blocking, as rpoll does */
+		if ((uint32_t) (rs_time_us() - start_time) <= polling_time) {
+			sleep = 0;
+		} else if (timeout > 0) {
+			sleep = timeout - (int) ((rs_time_us() - start_time) / 1000);
+			if (sleep <= 0)
+				break;
+		} else {
+			sleep = -1;
+		}
+	}
+	pthread_mutex_unlock(&ep->lock);
+	return ret;
+}
+
 /*
  * For graceful disconnect, notify the remote side that we're
  * disconnecting and wait until all outstanding sends complete, provided
@@ -3530,7 +5047,10 @@ out:
 
 	if (rs->state & rs_disconnected) {
 		/* Generate event by flushing receives to unblock rpoll */
-		ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
+		if (rs->scq)
+			rs_scq_signal(rs);
+		else
+			ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
 		ucma_shutdown(rs->cm_id);
 	}
 
@@ -3554,12 +5074,25 @@ static void ds_shutdown(struct rsocket *rs)
 
 int rclose(int socket)
 {
+	struct rs_epoll *ep;
 	struct rsocket *rs;
 
 	rs = idm_lookup(&idm, socket);
-	if (!rs)
-		return EBADF;
+	if (!rs) {
+		ep = idm_lookup(&epidm, socket);
+		if (!ep)
+			return EBADF;
+
+		pthread_mutex_lock(&mut);
+		idm_clear(&epidm, socket);
+		pthread_mutex_unlock(&mut);
+		rs_epoll_free(ep);
+		return 0;
+	}
+	rs_epoll_remove_rs(rs);
 	if (rs->type == SOCK_STREAM) {
+		if (rs->opts & RS_OPT_PROGRESS)
+			rs_progress_remove(rs);
 		if (rs->state & rs_connected)
 			rshutdown(socket, SHUT_RDWR);
 		if (rs->opts & RS_OPT_KEEPALIVE)
@@ -3706,6 +5239,15 @@ int rsetsockopt(int socket, int level, int optname,
 			opt_on = *(int *) optval;
 			ret = 0;
 			break;
+		case SO_BUSY_POLL:
+			if (*(int *) optval < 0) {
+				ret = ERR(EINVAL);
+				break;
+			}
+			rs->busy_poll = *(int *) optval;
+			opts = NULL;	/* value, not a flag */
+			ret = 0;
+			break;
 		default:
 			break;
 		}
@@ -3753,7 +5295,8 @@ int rsetsockopt(int socket, int level, int optname,
 		}
 		break;
 	case SOL_RDMA:
-		if (rs->state >= rs_opening) {
+		if (rs->state >= rs_opening && optname != RDMA_ZCOPY_THRESHOLD &&
+		    optname != RDMA_PROGRESS) {
 			ret = ERR(EINVAL);
 			break;
 		}
@@ -3788,6 +5331,31 @@ int rsetsockopt(int socket, int level, int optname,
 				ret = ERR(ENOMEM);
 			}
 			break;
+		case RDMA_ZCOPY_THRESHOLD:
+			if (rs->type != SOCK_STREAM)
+				break;
+			rs->zcopy_threshold = *(uint32_t *) optval;
+			ret = 0;
+			break;
+		case RDMA_ZCOPY_CACHE:
+			if (rs->type != SOCK_STREAM)
+				break;
+			rs->zcopy_cache_size = min_t(uint32_t, *(uint32_t *) optval,
+						     UINT16_MAX);
+			ret = 0;
+			break;
+		case RDMA_SRQSIZE:
+			if (rs->type != SOCK_STREAM || rs->state == rs_listening)
+				break;
+			rs->srq_size = min_t(uint32_t, *(uint32_t *) optval,
+					     RS_QP_MAX_SIZE);
+			ret = 0;
+			break;
+		case RDMA_PROGRESS:
+			if (rs->type != SOCK_STREAM)
+				break;
+			ret = rs_set_progress(rs, *(int *) optval);
+			break;
 		default:
 			break;
 		}
@@ -3871,6 +5439,10 @@ int rgetsockopt(int socket, int level, int optname,
 			*optlen = sizeof(int);
 			rs->err = 0;
 			break;
+		case SO_BUSY_POLL:
+			*((int *) optval) = rs->busy_poll;
+			*optlen = sizeof(int);
+			break;
 		default:
 			ret = ENOTSUP;
 			break;
@@ -3930,6 +5502,25 @@ int rgetsockopt(int socket, int level, int optname,
 			*((int *) optval) = rs->target_iomap_size;
 			*optlen = sizeof(int);
 			break;
+		case RDMA_ZCOPY_THRESHOLD:
+			*((int *) optval) = rs->type == SOCK_STREAM ?
+					    rs->zcopy_threshold : 0;
+			*optlen = sizeof(int);
+			break;
+		case RDMA_ZCOPY_CACHE:
+			*((int *) optval) = rs->type == SOCK_STREAM ?
+					    rs->zcopy_cache_size : 0;
+			*optlen = sizeof(int);
+			break;
+		case RDMA_SRQSIZE:
+			*((int *) optval) = rs->type == SOCK_STREAM ?
+					    rs->srq_size : 0;
+			*optlen = sizeof(int);
+			break;
+		case RDMA_PROGRESS:
+			*((int *) optval) = !!(rs->opts & RS_OPT_PROGRESS);
+			*optlen = sizeof(int);
+			break;
 		case RDMA_ROUTE:
 			if (rs->optval) {
 				if (*optlen < rs->optlen) {
@@ -0,0 +1,1439 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+
+#include <config.h>
+
+#include <endian.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ccan/minmax.h>
+#include <util/util.h>
+#include <infiniband/driver.h>
+#include <infiniband/verbs.h>
+
+#include "loopback.h"
+
+/*
+ * A verbs device emulated entirely in userspace.  Setting
+ * RDMAV_LOOPBACK_DEVICES=<n> makes libibverbs list n loopbackX devices, each
+ * with a single active IB port whose LID is X + 1.  All devices of a process
+ * share one fabric: work requests are executed synchronously by the posting
+ * thread, copying directly between the registered buffers of the two QPs.
+ * Only QPs of the same process can talk to each other.
+ *
+ * The fabric lock protects the QP and MR tables.  The data path holds it for
+ * read while it touches a peer QP, MR, CQ or SRQ; everything that changes a
+ * QP's attributes or frees an object a peer can reach takes it for write.
+ * Below it the lock order is sq_lock, then rq_lock or an SRQ lock, then a CQ
+ * lock.
+ */
+
+#define LB_FIRST_QPN		2
+#define LB_NODE_GUID_BASE	0x0200000000000000ULL
+/* Returned by lb_execute() when a send has to wait for a receive WQE */
+#define LB_RNR			(-1)
+
+struct lb_table {
+	void **entries;
+	uint32_t size;
+	uint32_t max;
+	uint32_t next;
+};
+
+static struct {
+	pthread_rwlock_t lock;
+	struct lb_table qps;
+	struct lb_table mrs;
+	uint8_t key_gen;
+	/* Number of QPs whose SQ is stalled on a missing receive WQE */
+	atomic_uint num_rnr_wait;
+} fabric = {
+	.lock = PTHREAD_RWLOCK_INITIALIZER,
+	.qps = { .max = LB_MAX_QP },
+	.mrs = { .max = LB_MAX_MR },
+};
+
+/* A scatter gather list resolved to local addresses */
+struct lb_sg {
+	struct {
+		uint8_t *addr;
+		uint32_t length;
+	} seg[LB_MAX_SGE];
+	int num;
+	uint32_t length;
+};
+
+static int table_insert(struct lb_table *table, void *obj, uint32_t *idx)
+{
+	uint32_t i, n, size;
+	void **entries;
+
+	for (i = 0; i < table->size; i++) {
+		n = (table->next + i) % table->size;
+		if (!table->entries[n])
+			goto found;
+	}
+
+	if (table->size == table->max)
+		return ENOMEM;
+
+	size = max(table->size * 2, 64U);
+	size = min(size, table->max);
+	entries = realloc(table->entries, size * sizeof(*entries));
+	if (!entries)
+		return ENOMEM;
+	memset(entries + table->size, 0,
+	       (size - table->size) * sizeof(*entries));
+
+	n = table->size;
+	table->entries = entries;
+	table->size = size;
+found:
+	table->entries[n] = obj;
+	/* Don't hand out a just released QPN or key again right away */
+	table->next = n + 1;
+	*idx = n;
+	return 0;
+}
+
+static struct lb_qp *lb_find_qp(uint32_t qpn)
+{
+	uint32_t idx = qpn - LB_FIRST_QPN;
+
+	if (qpn < LB_FIRST_QPN || idx >= fabric.qps.size)
+		return NULL;
+	return fabric.qps.entries[idx];
+}
+
+static struct lb_mr *lb_find_mr(uint32_t key)
+{
+	uint32_t idx = (key >> 8) - 1;
+	struct lb_mr *mr;
+
+	if (!(key >> 8) || idx >= fabric.mrs.size)
+		return NULL;
+	mr = fabric.mrs.entries[idx];
+	if (!mr || mr->vmr.ibv_mr.lkey != key)
+		return NULL;
+	return mr;
+}
+
+static uint16_t lb_qp_lid(struct lb_qp *qp)
+{
+	return to_lbdev(qp->vqp.qp.context->device)->index + 1;
+}
+
+static enum ibv_qp_state lb_qp_state(struct lb_qp *qp)
+{
+	return atomic_load(&qp->in_error) ? IBV_QPS_ERR : qp->attr.qp_state;
+}
+
+static void lb_port_gid(struct lb_device *dev, union ibv_gid *gid)
+{
+	memset(gid, 0, sizeof(*gid));
+	gid->global.subnet_prefix = htobe64(0xfe80000000000000ULL);
+	gid->global.interface_id = dev->node_guid;
+}
+
+static int lb_query_device(struct ibv_context *context,
+			   const struct ibv_query_device_ex_input *input,
+			   struct ibv_device_attr_ex *attr, size_t attr_size)
+{
+	struct lb_device *dev = to_lbdev(context->device);
+	struct ibv_device_attr *orig = &attr->orig_attr;
+
+	if (input && input->comp_mask)
+		return EINVAL;
+	if (attr_size < sizeof(*orig))
+		return EINVAL;
+
+	memset(attr, 0, attr_size);
+	snprintf(orig->fw_ver, sizeof(orig->fw_ver), "%s", PACKAGE_VERSION);
+	orig->node_guid = dev->node_guid;
+	orig->sys_image_guid = dev->node_guid;
+	orig->max_mr_size = UINT64_MAX;
+	orig->page_size_cap = 0xfffffffffffff000ULL;
+	orig->max_qp = LB_MAX_QP;
+	orig->max_qp_wr = LB_MAX_QP_WR;
+	orig->device_cap_flags = IBV_DEVICE_RC_RNR_NAK_GEN;
+	orig->max_sge = LB_MAX_SGE;
+	orig->max_sge_rd = LB_MAX_SGE;
+	orig->max_cq = LB_MAX_CQ;
+	orig->max_cqe = LB_MAX_CQE;
+	orig->max_mr = LB_MAX_MR;
+	orig->max_pd = LB_MAX_PD;
+	orig->max_qp_rd_atom = LB_MAX_RD_ATOM;
+	orig->max_qp_init_rd_atom = LB_MAX_RD_ATOM;
+	orig->max_res_rd_atom = LB_MAX_RD_ATOM * LB_MAX_QP;
+	orig->atomic_cap = IBV_ATOMIC_HCA;
+	orig->max_ah = LB_MAX_AH;
+	orig->max_srq = LB_MAX_SRQ;
+	orig->max_srq_wr = LB_MAX_QP_WR;
+	orig->max_srq_sge = LB_MAX_SGE;
+	orig->max_pkeys = 1;
+	orig->phys_port_cnt = 1;
+
+	if (attr_size >= offsetofend(struct ibv_device_attr_ex,
+				     phys_port_cnt_ex))
+		attr->phys_port_cnt_ex = 1;
+
+	return 0;
+}
+
+static int lb_query_port(struct ibv_context *context, uint8_t port,
+			 struct ibv_port_attr *attr)
+{
+	struct lb_device *dev = to_lbdev(context->device);
+
+	if (port != 1)
+		return EINVAL;
+
+	memset(attr, 0, sizeof(*attr));
+	attr->state = IBV_PORT_ACTIVE;
+	attr->max_mtu = IBV_MTU_4096;
+	attr->active_mtu = IBV_MTU_4096;
+	attr->gid_tbl_len = 1;
+	attr->max_msg_sz = LB_MAX_MSG_SZ;
+	attr->pkey_tbl_len = 1;
+	attr->lid = dev->index + 1;
+	attr->sm_lid = 1;
+	attr->max_vl_num = 1;
+	attr->active_width = 2;
+	attr->active_speed = 32;
+	attr->phys_state = 5;
+	attr->link_layer = IBV_LINK_LAYER_INFINIBAND;
+
+	return 0;
+}
+
+static struct ibv_pd *lb_alloc_pd(struct ibv_context *context)
+{
+	struct ibv_pd *pd;
+
+	pd = calloc(1, sizeof(*pd));
+	if (!pd) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return pd;
+}
+
+static int lb_dealloc_pd(struct ibv_pd *pd)
+{
+	free(pd);
+	return 0;
+}
+
+static struct ibv_mr *lb_reg_mr(struct ibv_pd *pd, void *addr, size_t length,
+				uint64_t hca_va, int access)
+{
+	struct lb_mr *mr;
+	uint32_t idx, key;
+	int ret;
+
+	mr = calloc(1, sizeof(*mr));
+	if (!mr) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	mr->iova = hca_va;
+	mr->addr = addr;
+	mr->length = length;
+	mr->access = access;
+	mr->vmr.mr_type = IBV_MR_TYPE_MR;
+	mr->vmr.access = access;
+	mr->vmr.ibv_mr.context = pd->context;
+	mr->vmr.ibv_mr.pd = pd;
+
+	pthread_rwlock_wrlock(&fabric.lock);
+	ret = table_insert(&fabric.mrs, mr, &idx);
+	if (!ret) {
+		/* The low byte catches the use of a stale key */
+		key = ((idx + 1) << 8) | fabric.key_gen++;
+		mr->vmr.ibv_mr.handle = key;
+		mr->vmr.ibv_mr.lkey = key;
+		mr->vmr.ibv_mr.rkey = key;
+	}
+	pthread_rwlock_unlock(&fabric.lock);
+
+	if (ret) {
+		free(mr);
+		errno = ret;
+		return NULL;
+	}
+
+	return &mr->vmr.ibv_mr;
+}
+
+static int lb_dereg_mr(struct verbs_mr *vmr)
+{
+	struct lb_mr *mr = to_lbmr(vmr);
+
+	pthread_rwlock_wrlock(&fabric.lock);
+	fabric.mrs.entries[(vmr->ibv_mr.lkey >> 8) - 1] = NULL;
+	pthread_rwlock_unlock(&fabric.lock);
+
+	free(mr);
+	return 0;
+}
+
+/* Return the local address of [iova, iova + length) of an MR, or NULL */
+static uint8_t *lb_mr_addr(struct lb_mr *mr, struct ibv_pd *pd, uint64_t iova,
+			   uint64_t length, unsigned int access)
+{
+	if (!mr || mr->vmr.ibv_mr.pd != pd)
+		return NULL;
+	if ((mr->access & access) != access)
+		return NULL;
+	if (iova < mr->iova || length > mr->length ||
+	    iova - mr->iova > mr->length - length)
+		return NULL;
+	return mr->addr + (iova - mr->iova);
+}
+
+static bool lb_map_sgl(struct lb_sg *sg, struct ibv_pd *pd,
+		       const struct ibv_sge *sge, int num_sge,
+		       unsigned int access)
+{
+	uint8_t *addr;
+	int i;
+
+	sg->num = 0;
+	sg->length = 0;
+	for (i = 0; i < num_sge; i++) {
+		if (!sge[i].length)
+			continue;
+
+		addr = lb_mr_addr(lb_find_mr(sge[i].lkey), pd, sge[i].addr,
+				  sge[i].length, access);
+		if (!addr)
+			return false;
+
+		sg->seg[sg->num].addr = addr;
+		sg->seg[sg->num].length = sge[i].length;
+		sg->num++;
+		sg->length += sge[i].length;
+	}
+	return true;
+}
+
+static void lb_sg_single(struct lb_sg *sg, void *addr, uint32_t length)
+{
+	sg->num = length ? 1 : 0;
+	sg->seg[0].addr = addr;
+	sg->seg[0].length = length;
+	sg->length = length;
+}
+
+/* Copy @length bytes of @src to @dst, starting @offset bytes into @dst */
+static void lb_sg_copy(const struct lb_sg *dst, uint32_t offset,
+		       const struct lb_sg *src, uint32_t length)
+{
+	uint32_t d_off = offset, s_off = 0, n;
+	int d = 0, s = 0;
+
+	while (d < dst->num && d_off >= dst->seg[d].length)
+		d_off -= dst->seg[d++].length;
+
+	while (length) {
+		n = min(dst->seg[d].length - d_off, src->seg[s].length - s_off);
+		n = min(n, length);
+		memcpy(dst->seg[d].addr + d_off, src->seg[s].addr + s_off, n);
+		length -= n;
+
+		d_off += n;
+		if (d_off == dst->seg[d].length) {
+			d++;
+			d_off = 0;
+		}
+		s_off += n;
+		if (s_off == src->seg[s].length) {
+			s++;
+			s_off = 0;
+		}
+	}
+}
+
+static struct ibv_cq *lb_create_cq(struct ibv_context *context, int cqe,
+				   struct ibv_comp_channel *channel,
+				   int comp_vector)
+{
+	struct lb_cq *cq;
+
+	if (cqe <= 0 || cqe > LB_MAX_CQE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Completion events need the kernel, CQs can only be polled */
+	if (channel) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	cq = calloc(1, sizeof(*cq));
+	if (!cq) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	cq->size = roundup_pow_of_two(cqe);
+	cq->wc = calloc(cq->size, sizeof(*cq->wc));
+	if (!cq->wc) {
+		free(cq);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
+	cq->vcq.cq.cqe = cq->size;
+
+	return &cq->vcq.cq;
+}
+
+static int lb_destroy_cq(struct ibv_cq *ibcq)
+{
+	struct lb_cq *cq = to_lbcq(ibcq);
+
+	/* Wait out any peer still completing into this CQ */
+	pthread_rwlock_wrlock(&fabric.lock);
+	pthread_rwlock_unlock(&fabric.lock);
+
+	pthread_spin_destroy(&cq->lock);
+	free(cq->wc);
+	free(cq);
+	return 0;
+}
+
+static void lb_cq_push(struct lb_cq *cq, const struct ibv_wc *wc)
+{
+	pthread_spin_lock(&cq->lock);
+	if (cq->tail - cq->head == cq->size) {
+		if (!cq->overflow)
+			verbs_err(verbs_get_ctx(cq->vcq.cq.context),
+				  "loopback: CQ overrun, completions lost\n");
+		cq->overflow = true;
+	} else {
+		cq->wc[cq->tail++ & (cq->size - 1)] = *wc;
+	}
+	pthread_spin_unlock(&cq->lock);
+}
+
+static int lb_poll_cq(struct ibv_cq *ibcq, int ne, struct ibv_wc *wc)
+{
+	struct lb_cq *cq = to_lbcq(ibcq);
+	int npolled = 0;
+
+	pthread_spin_lock(&cq->lock);
+	while (npolled < ne && cq->head != cq->tail)
+		wc[npolled++] = cq->wc[cq->head++ & (cq->size - 1)];
+	pthread_spin_unlock(&cq->lock);
+
+	return npolled;
+}
+
+static int lb_wq_init(struct lb_wq *wq, uint32_t max_wr, size_t stride)
+{
+	wq->stride = align(stride, sizeof(uint64_t));
+	wq->buf = calloc(max_wr, wq->stride);
+	if (!wq->buf)
+		return ENOMEM;
+	wq->max_wr = max_wr;
+	wq->head = 0;
+	wq->tail = 0;
+	return 0;
+}
+
+static void *lb_wq_get(struct lb_wq *wq, uint32_t idx)
+{
+	return (uint8_t *)wq->buf + (idx % wq->max_wr) * wq->stride;
+}
+
+static int lb_wq_post_recv(struct lb_wq *wq, struct ibv_recv_wr *wr,
+			   struct ibv_recv_wr **bad_wr)
+{
+	struct lb_recv_wqe *wqe;
+	int i;
+
+	for (; wr; wr = wr->next) {
+		if (wr->num_sge < 0 || (uint32_t)wr->num_sge > wq->max_sge) {
+			*bad_wr = wr;
+			return EINVAL;
+		}
+		if (wq->tail - wq->head == wq->max_wr) {
+			*bad_wr = wr;
+			return ENOMEM;
+		}
+
+		wqe = lb_wq_get(wq, wq->tail);
+		wqe->wr_id = wr->wr_id;
+		wqe->num_sge = wr->num_sge;
+		wqe->length = 0;
+		for (i = 0; i < wr->num_sge; i++) {
+			wqe->sge[i] = wr->sg_list[i];
+			wqe->length += wr->sg_list[i].length;
+		}
+		wq->tail++;
+	}
+	return 0;
+}
+
+static void lb_flush_rq_locked(struct lb_qp *qp)
+{
+	struct lb_cq *cq = to_lbcq(qp->vqp.qp.recv_cq);
+	struct ibv_wc wc = {
+		.status = IBV_WC_WR_FLUSH_ERR,
+		.opcode = IBV_WC_RECV,
+		.qp_num = qp->vqp.qp.qp_num,
+	};
+	struct lb_recv_wqe *wqe;
+
+	for (; qp->rq.head != qp->rq.tail; qp->rq.head++) {
+		wqe = lb_wq_get(&qp->rq, qp->rq.head);
+		wc.wr_id = wqe->wr_id;
+		lb_cq_push(cq, &wc);
+	}
+}
+
+/* Move a QP to the error state on a data path error, SQ flushing is lazy */
+static void lb_qp_set_error(struct lb_qp *qp)
+{
+	atomic_store(&qp->in_error, true);
+	if (qp->vqp.qp.srq)
+		return;
+
+	pthread_spin_lock(&qp->rq_lock);
+	lb_flush_rq_locked(qp);
+	pthread_spin_unlock(&qp->rq_lock);
+}
+
+static enum ibv_wc_opcode lb_send_wc_opcode(enum ibv_wr_opcode opcode)
+{
+	switch (opcode) {
+	case IBV_WR_RDMA_WRITE:
+	case IBV_WR_RDMA_WRITE_WITH_IMM:
+		return IBV_WC_RDMA_WRITE;
+	case IBV_WR_RDMA_READ:
+		return IBV_WC_RDMA_READ;
+	case IBV_WR_ATOMIC_CMP_AND_SWP:
+		return IBV_WC_COMP_SWAP;
+	case IBV_WR_ATOMIC_FETCH_AND_ADD:
+		return IBV_WC_FETCH_ADD;
+	default:
+		return IBV_WC_SEND;
+	}
+}
+
+/*
+ * Consume a receive WQE of @dst for a message of @src->length bytes, which
+ * is copied after @grh_len bytes of @grh unless @src is NULL (RDMA write
+ * with immediate).  Returns the status seen by the sender, or LB_RNR if
+ * there is no receive WQE.
+ */
+static int lb_deliver(struct lb_qp *qp, struct lb_qp *dst,
+		      struct lb_send_wqe *wqe, const struct lb_sg *src,
+		      const void *grh, uint32_t grh_len)
+{
+	struct ibv_srq *ibsrq = dst->vqp.qp.srq;
+	struct lb_srq *srq = ibsrq ? to_lbsrq(ibsrq) : NULL;
+	pthread_spinlock_t *lock = srq ? &srq->lock : &dst->rq_lock;
+	struct lb_wq *rq = srq ? &srq->rq : &dst->rq;
+	struct ibv_pd *pd = srq ? ibsrq->pd : dst->vqp.qp.pd;
+	struct ibv_wc wc = {
+		.opcode = IBV_WC_RECV,
+		.qp_num = dst->vqp.qp.qp_num,
+		.src_qp = qp->vqp.qp.qp_num,
+		.slid = lb_qp_lid(qp),
+		.byte_len = wqe->length,
+	};
+	struct lb_recv_wqe *rwqe;
+	struct lb_sg sg;
+	int ret = IBV_WC_SUCCESS;
+
+	pthread_spin_lock(lock);
+	if (rq->head == rq->tail) {
+		pthread_spin_unlock(lock);
+		return LB_RNR;
+	}
+	rwqe = lb_wq_get(rq, rq->head++);
+	wc.wr_id = rwqe->wr_id;
+
+	if (src) {
+		if (!lb_map_sgl(&sg, pd, rwqe->sge, rwqe->num_sge,
+				IBV_ACCESS_LOCAL_WRITE)) {
+			wc.status = IBV_WC_LOC_PROT_ERR;
+			ret = IBV_WC_REM_OP_ERR;
+		} else if (grh_len + src->length > sg.length) {
+			wc.status = IBV_WC_LOC_LEN_ERR;
+			ret = IBV_WC_REM_INV_REQ_ERR;
+		} else {
+			if (grh) {
+				struct lb_sg grh_sg;
+
+				lb_sg_single(&grh_sg, (void *)grh, grh_len);
+				lb_sg_copy(&sg, 0, &grh_sg, grh_len);
+				wc.wc_flags |= IBV_WC_GRH;
+			}
+			lb_sg_copy(&sg, grh_len, src, src->length);
+		}
+	}
+	pthread_spin_unlock(lock);
+
+	if (wqe->opcode == IBV_WR_SEND_WITH_IMM ||
+	    wqe->opcode == IBV_WR_RDMA_WRITE_WITH_IMM) {
+		wc.imm_data = wqe->imm_data;
+		wc.wc_flags |= IBV_WC_WITH_IMM;
+	}
+	if (wqe->opcode == IBV_WR_RDMA_WRITE_WITH_IMM)
+		wc.opcode = IBV_WC_RECV_RDMA_WITH_IMM;
+
+	lb_cq_push(to_lbcq(dst->vqp.qp.recv_cq), &wc);
+	if (wc.status != IBV_WC_SUCCESS)
+		lb_qp_set_error(dst);
+
+	return ret;
+}
+
+static int lb_execute_ud(struct lb_qp *qp, struct lb_send_wqe *wqe,
+			 const struct lb_sg *local)
+{
+	struct lb_qp *dst = lb_find_qp(wqe->remote_qpn);
+	struct ibv_global_route *route = &wqe->ah_attr.grh;
+	struct ibv_grh grh = {};
+	uint32_t qkey;
+	int ret;
+
+	if (local->length > LB_MTU)
+		return IBV_WC_LOC_LEN_ERR;
+
+	qkey = wqe->remote_qkey & 0x80000000 ? qp->attr.qkey :
+					       wqe->remote_qkey;
+
+	/* Datagrams that can't be delivered are silently dropped */
+	if (!dst || dst->vqp.qp.qp_type != IBV_QPT_UD ||
+	    lb_qp_state(dst) < IBV_QPS_RTR || lb_qp_state(dst) == IBV_QPS_ERR ||
+	    lb_qp_lid(dst) != wqe->ah_attr.dlid || dst->attr.qkey != qkey)
+		return IBV_WC_SUCCESS;
+
+	if (wqe->ah_attr.is_global) {
+		grh.version_tclass_flow =
+			htobe32((6 << 28) | (route->traffic_class << 20) |
+				route->flow_label);
+		grh.paylen = htobe16(local->length);
+		grh.next_hdr = 0x1b;
+		grh.hop_limit = route->hop_limit;
+		lb_port_gid(to_lbdev(qp->vqp.qp.context->device), &grh.sgid);
+		grh.dgid = route->dgid;
+	}
+
+	ret = lb_deliver(qp, dst, wqe, local,
+			 wqe->ah_attr.is_global ? &grh : NULL, LB_GRH_SIZE);
+	/* The sender of a datagram never learns about its fate */
+	return ret == IBV_WC_SUCCESS || ret == LB_RNR ? IBV_WC_SUCCESS : ret;
+}
+
+static void lb_atomic(struct lb_send_wqe *wqe, uint8_t *addr, uint8_t *result)
+{
+	_Atomic(uint64_t) *target = (_Atomic(uint64_t) *)addr;
+	uint64_t orig;
+
+	if (wqe->opcode == IBV_WR_ATOMIC_CMP_AND_SWP) {
+		orig = wqe->compare_add;
+		atomic_compare_exchange_strong(target, &orig, wqe->swap);
+	} else {
+		orig = atomic_fetch_add(target, wqe->compare_add);
+	}
+	memcpy(result, &orig, sizeof(orig));
+}
+
+static int lb_execute_rc(struct lb_qp *qp, struct lb_send_wqe *wqe,
+			 const struct lb_sg *local, struct lb_qp **peer)
+{
+	struct lb_qp *dst = lb_find_qp(qp->attr.dest_qp_num);
+	uint64_t length = local->length;
+	unsigned int access = 0;
+	struct lb_sg remote;
+	uint8_t *addr;
+
+	if (!dst || dst->vqp.qp.qp_type != IBV_QPT_RC ||
+	    dst->attr.dest_qp_num != qp->vqp.qp.qp_num ||
+	    lb_qp_state(dst) < IBV_QPS_RTR || lb_qp_state(dst) == IBV_QPS_ERR)
+		return IBV_WC_RETRY_EXC_ERR;
+	*peer = dst;
+
+	switch (wqe->opcode) {
+	case IBV_WR_SEND:
+	case IBV_WR_SEND_WITH_IMM:
+		return lb_deliver(qp, dst, wqe, local, NULL, 0);
+	case IBV_WR_RDMA_WRITE:
+	case IBV_WR_RDMA_WRITE_WITH_IMM:
+		access = IBV_ACCESS_REMOTE_WRITE;
+		break;
+	case IBV_WR_RDMA_READ:
+		access = IBV_ACCESS_REMOTE_READ;
+		break;
+	case IBV_WR_ATOMIC_CMP_AND_SWP:
+	case IBV_WR_ATOMIC_FETCH_AND_ADD:
+		access = IBV_ACCESS_REMOTE_ATOMIC;
+		length = sizeof(uint64_t);
+		if (local->length != length || wqe->remote_addr % length)
+			return IBV_WC_REM_INV_REQ_ERR;
+		break;
+	default:
+		return IBV_WC_REM_INV_REQ_ERR;
+	}
+
+	if (!(dst->attr.qp_access_flags & access))
+		return IBV_WC_REM_ACCESS_ERR;
+	addr = lb_mr_addr(lb_find_mr(wqe->rkey), dst->vqp.qp.pd,
+			  wqe->remote_addr, length, access);
+	if (!addr)
+		return IBV_WC_REM_ACCESS_ERR;
+	lb_sg_single(&remote, addr, length);
+
+	switch (wqe->opcode) {
+	case IBV_WR_RDMA_WRITE:
+		lb_sg_copy(&remote, 0, local, length);
+		return IBV_WC_SUCCESS;
+	case IBV_WR_RDMA_WRITE_WITH_IMM:
+		/* Rewritten if retried after an RNR, which is harmless */
+		lb_sg_copy(&remote, 0, local, length);
+		return lb_deliver(qp, dst, wqe, NULL, NULL, 0);
+	case IBV_WR_RDMA_READ:
+		lb_sg_copy(local, 0, &remote, length);
+		return IBV_WC_SUCCESS;
+	default:
+		lb_atomic(wqe, addr, local->seg[0].addr);
+		return IBV_WC_SUCCESS;
+	}
+}
+
+/* Called with the fabric read lock and the sq_lock held */
+static int lb_execute(struct lb_qp *qp, struct lb_send_wqe *wqe,
+		      struct lb_qp **peer)
+{
+	unsigned int access = 0;
+	struct lb_sg local;
+
+	if (wqe->send_flags & IBV_SEND_INLINE) {
+		lb_sg_single(&local, wqe->sge, wqe->length);
+	} else {
+		if (wqe->opcode == IBV_WR_RDMA_READ ||
+		    wqe->opcode == IBV_WR_ATOMIC_CMP_AND_SWP ||
+		    wqe->opcode == IBV_WR_ATOMIC_FETCH_AND_ADD)
+			access = IBV_ACCESS_LOCAL_WRITE;
+		if (!lb_map_sgl(&local, qp->vqp.qp.pd, wqe->sge, wqe->num_sge,
+				access))
+			return IBV_WC_LOC_PROT_ERR;
+	}
+
+	if (qp->vqp.qp.qp_type == IBV_QPT_UD)
+		return lb_execute_ud(qp, wqe, &local);
+	return lb_execute_rc(qp, wqe, &local, peer);
+}
+
+static void lb_set_rnr_wait(struct lb_qp *qp, bool wait)
+{
+	if (qp->rnr_wait == wait)
+		return;
+	qp->rnr_wait = wait;
+	if (wait)
+		atomic_fetch_add(&fabric.num_rnr_wait, 1);
+	else
+		atomic_fetch_sub(&fabric.num_rnr_wait, 1);
+}
+
+/*
+ * Execute the queued send WQEs in order.  Called with the fabric read lock
+ * and the sq_lock held.  Returns a peer that moved to the error state and
+ * whose SQ needs flushing.
+ */
+static struct lb_qp *lb_progress_sq_locked(struct lb_qp *qp)
+{
+	struct lb_cq *cq = to_lbcq(qp->vqp.qp.send_cq);
+	struct lb_qp *failed = NULL, *peer;
+	struct lb_send_wqe *wqe;
+	struct ibv_wc wc = {
+		.qp_num = qp->vqp.qp.qp_num,
+	};
+	int status;
+
+	while (qp->sq.head != qp->sq.tail) {
+		wqe = lb_wq_get(&qp->sq, qp->sq.head);
+		peer = NULL;
+
+		if (lb_qp_state(qp) == IBV_QPS_ERR)
+			status = IBV_WC_WR_FLUSH_ERR;
+		else
+			status = lb_execute(qp, wqe, &peer);
+
+		if (status == LB_RNR) {
+			lb_set_rnr_wait(qp, true);
+			break;
+		}
+		lb_set_rnr_wait(qp, false);
+		qp->sq.head++;
+
+		if (status != IBV_WC_SUCCESS ||
+		    wqe->send_flags & IBV_SEND_SIGNALED || qp->sq_sig_all) {
+			wc.wr_id = wqe->wr_id;
+			wc.status = status;
+			wc.opcode = lb_send_wc_opcode(wqe->opcode);
+			wc.byte_len = wqe->length;
+			lb_cq_push(cq, &wc);
+		}
+
+		if (status == IBV_WC_SUCCESS || status == IBV_WC_WR_FLUSH_ERR)
+			continue;
+
+		lb_qp_set_error(qp);
+		/* The responder of a failed RC request also goes to error */
+		if (peer && peer != qp &&
+		    (status == IBV_WC_REM_ACCESS_ERR ||
+		     status == IBV_WC_REM_INV_REQ_ERR ||
+		     status == IBV_WC_REM_OP_ERR)) {
+			if (lb_qp_state(peer) != IBV_QPS_ERR)
+				lb_qp_set_error(peer);
+			failed = peer;
+		}
+	}
+
+	return failed;
+}
+
+/* Called with the fabric read lock held */
+static void lb_progress_sq(struct lb_qp *qp)
+{
+	struct lb_qp *failed;
+
+	pthread_spin_lock(&qp->sq_lock);
+	failed = lb_progress_sq_locked(qp);
+	pthread_spin_unlock(&qp->sq_lock);
+
+	if (failed) {
+		pthread_spin_lock(&failed->sq_lock);
+		lb_progress_sq_locked(failed);
+		pthread_spin_unlock(&failed->sq_lock);
+	}
+}
+
+/*
+ * Restart sends that are waiting for the receive WQEs just posted.  Called
+ * with the fabric read lock held.
+ */
+static void lb_kick_rnr(struct lb_qp *responder)
+{
+	struct lb_qp *qp;
+	uint32_t i;
+
+	if (!atomic_load(&fabric.num_rnr_wait))
+		return;
+
+	if (responder) {
+		qp = lb_find_qp(responder->attr.dest_qp_num);
+		if (qp)
+			lb_progress_sq(qp);
+	} else {
+		/* An SRQ can serve any requester */
+		for (i = 0; i < fabric.qps.size; i++) {
+			qp = fabric.qps.entries[i];
+			if (qp && qp->vqp.qp.qp_type == IBV_QPT_RC)
+				lb_progress_sq(qp);
+		}
+	}
+}
+
+static int lb_queue_send(struct lb_qp *qp, struct ibv_send_wr *wr)
+{
+	struct lb_send_wqe *wqe;
+	uint8_t *data;
+	int i;
+
+	if (qp->sq.tail - qp->sq.head == qp->sq.max_wr)
+		return ENOMEM;
+	if (wr->num_sge < 0 || (uint32_t)wr->num_sge > qp->sq.max_sge)
+		return EINVAL;
+
+	switch (wr->opcode) {
+	case IBV_WR_SEND:
+	case IBV_WR_SEND_WITH_IMM:
+		break;
+	case IBV_WR_RDMA_WRITE:
+	case IBV_WR_RDMA_WRITE_WITH_IMM:
+	case IBV_WR_RDMA_READ:
+	case IBV_WR_ATOMIC_CMP_AND_SWP:
+	case IBV_WR_ATOMIC_FETCH_AND_ADD:
+		if (qp->vqp.qp.qp_type == IBV_QPT_RC)
+			break;
+		SWITCH_FALLTHROUGH;
+	default:
+		return EINVAL;
+	}
+
+	wqe = lb_wq_get(&qp->sq, qp->sq.tail);
+	wqe->wr_id = wr->wr_id;
+	wqe->opcode = wr->opcode;
+	wqe->send_flags = wr->send_flags;
+	wqe->imm_data = wr->imm_data;
+	wqe->num_sge = wr->num_sge;
+	wqe->length = 0;
+
+	switch (wr->opcode) {
+	case IBV_WR_RDMA_READ:
+		wqe->send_flags &= ~IBV_SEND_INLINE;
+		SWITCH_FALLTHROUGH;
+	case IBV_WR_RDMA_WRITE:
+	case IBV_WR_RDMA_WRITE_WITH_IMM:
+		wqe->remote_addr = wr->wr.rdma.remote_addr;
+		wqe->rkey = wr->wr.rdma.rkey;
+		break;
+	case IBV_WR_ATOMIC_CMP_AND_SWP:
+	case IBV_WR_ATOMIC_FETCH_AND_ADD:
+		wqe->send_flags &= ~IBV_SEND_INLINE;
+		wqe->remote_addr = wr->wr.atomic.remote_addr;
+		wqe->rkey = wr->wr.atomic.rkey;
+		wqe->compare_add = wr->wr.atomic.compare_add;
+		wqe->swap = wr->wr.atomic.swap;
+		break;
+	default:
+		if (qp->vqp.qp.qp_type != IBV_QPT_UD)
+			break;
+		if (!wr->wr.ud.ah)
+			return EINVAL;
+		wqe->ah_attr = to_lbah(wr->wr.ud.ah)->attr;
+		wqe->remote_qpn = wr->wr.ud.remote_qpn;
+		wqe->remote_qkey = wr->wr.ud.remote_qkey;
+		break;
+	}
+
+	if (!(wqe->send_flags & IBV_SEND_INLINE)) {
+		for (i = 0; i < wr->num_sge; i++) {
+			wqe->sge[i] = wr->sg_list[i];
+			wqe->length += wr->sg_list[i].length;
+		}
+	} else {
+		data = (uint8_t *)wqe->sge;
+		for (i = 0; i < wr->num_sge; i++) {
+			if (wqe->length + wr->sg_list[i].length >
+			    qp->cap.max_inline_data)
+				return EINVAL;
+			memcpy(data + wqe->length,
+			       (void *)(uintptr_t)wr->sg_list[i].addr,
+			       wr->sg_list[i].length);
+			wqe->length += wr->sg_list[i].length;
+		}
+	}
+
+	qp->sq.tail++;
+	return 0;
+}
+
+static int lb_post_send(struct ibv_qp *ibqp, struct ibv_send_wr *wr,
+			struct ibv_send_wr **bad_wr)
+{
+	struct lb_qp *qp = to_lbqp(ibqp), *failed = NULL;
+	enum ibv_qp_state state;
+	int ret = 0;
+
+	pthread_rwlock_rdlock(&fabric.lock);
+	pthread_spin_lock(&qp->sq_lock);
+
+	state = lb_qp_state(qp);
+	if (state != IBV_QPS_RTS && state != IBV_QPS_ERR) {
+		*bad_wr = wr;
+		ret = EINVAL;
+		goto out;
+	}
+
+	for (; wr; wr = wr->next) {
+		ret = lb_queue_send(qp, wr);
+		if (ret) {
+			*bad_wr = wr;
+			break;
+		}
+	}
+
+	failed = lb_progress_sq_locked(qp);
+out:
+	pthread_spin_unlock(&qp->sq_lock);
+	if (failed) {
+		pthread_spin_lock(&failed->sq_lock);
+		lb_progress_sq_locked(failed);
+		pthread_spin_unlock(&failed->sq_lock);
+	}
+	pthread_rwlock_unlock(&fabric.lock);
+
+	return ret;
+}
+
+static int lb_post_recv(struct ibv_qp *ibqp, struct ibv_recv_wr *wr,
+			struct ibv_recv_wr **bad_wr)
+{
+	struct lb_qp *qp = to_lbqp(ibqp);
+	enum ibv_qp_state state;
+	int ret;
+
+	if (ibqp->srq) {
+		*bad_wr = wr;
+		return EINVAL;
+	}
+
+	pthread_rwlock_rdlock(&fabric.lock);
+	state = lb_qp_state(qp);
+	if (state == IBV_QPS_RESET) {
+		*bad_wr = wr;
+		ret = EINVAL;
+		goto out;
+	}
+
+	pthread_spin_lock(&qp->rq_lock);
+	ret = lb_wq_post_recv(&qp->rq, wr, bad_wr);
+	if (state == IBV_QPS_ERR)
+		lb_flush_rq_locked(qp);
+	pthread_spin_unlock(&qp->rq_lock);
+
+	if (ibqp->qp_type == IBV_QPT_RC && state != IBV_QPS_ERR)
+		lb_kick_rnr(qp);
+out:
+	pthread_rwlock_unlock(&fabric.lock);
+	return ret;
+}
+
+static struct ibv_srq *lb_create_srq(struct ibv_pd *pd,
+				     struct ibv_srq_init_attr *attr)
+{
+	struct lb_srq *srq;
+	int ret;
+
+	if (!attr->attr.max_wr || attr->attr.max_wr > LB_MAX_QP_WR ||
+	    attr->attr.max_sge > LB_MAX_SGE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	srq = calloc(1, sizeof(*srq));
+	if (!srq) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	attr->attr.max_sge = max(attr->attr.max_sge, 1U);
+	ret = lb_wq_init(&srq->rq, attr->attr.max_wr,
+			 sizeof(struct lb_recv_wqe) +
+				 attr->attr.max_sge * sizeof(struct ibv_sge));
+	if (ret) {
+		free(srq);
+		errno = ret;
+		return NULL;
+	}
+	srq->rq.max_sge = attr->attr.max_sge;
+	srq->srq_limit = attr->attr.srq_limit;
+	pthread_spin_init(&srq->lock, PTHREAD_PROCESS_PRIVATE);
+
+	return &srq->vsrq.srq;
+}
+
+static int lb_modify_srq(struct ibv_srq *ibsrq, struct ibv_srq_attr *attr,
+			 int attr_mask)
+{
+	struct lb_srq *srq = to_lbsrq(ibsrq);
+
+	if (attr_mask & IBV_SRQ_MAX_WR)
+		return EOPNOTSUPP;
+
+	if (attr_mask & IBV_SRQ_LIMIT) {
+		if (attr->srq_limit > srq->rq.max_wr)
+			return EINVAL;
+		srq->srq_limit = attr->srq_limit;
+	}
+	return 0;
+}
+
+static int lb_query_srq(struct ibv_srq *ibsrq, struct ibv_srq_attr *attr)
+{
+	struct lb_srq *srq = to_lbsrq(ibsrq);
+
+	attr->max_wr = srq->rq.max_wr;
+	attr->max_sge = srq->rq.max_sge;
+	attr->srq_limit = srq->srq_limit;
+	return 0;
+}
+
+static int lb_destroy_srq(struct ibv_srq *ibsrq)
+{
+	struct lb_srq *srq = to_lbsrq(ibsrq);
+
+	/* Wait out any peer still delivering into this SRQ */
+	pthread_rwlock_wrlock(&fabric.lock);
+	pthread_rwlock_unlock(&fabric.lock);
+
+	pthread_spin_destroy(&srq->lock);
+	free(srq->rq.buf);
+	free(srq);
+	return 0;
+}
+
+static int lb_post_srq_recv(struct ibv_srq *ibsrq, struct ibv_recv_wr *wr,
+			    struct ibv_recv_wr **bad_wr)
+{
+	struct lb_srq *srq = to_lbsrq(ibsrq);
+	int ret;
+
+	pthread_rwlock_rdlock(&fabric.lock);
+	pthread_spin_lock(&srq->lock);
+	ret = lb_wq_post_recv(&srq->rq, wr, bad_wr);
+	pthread_spin_unlock(&srq->lock);
+
+	lb_kick_rnr(NULL);
+	pthread_rwlock_unlock(&fabric.lock);
+
+	return ret;
+}
+
+static struct ibv_qp *lb_create_qp(struct ibv_pd *pd,
+				   struct ibv_qp_init_attr *attr)
+{
+	struct ibv_qp_cap *cap = &attr->cap;
+	struct lb_qp *qp;
+	uint32_t idx;
+	int ret;
+
+	if (attr->qp_type != IBV_QPT_RC && attr->qp_type != IBV_QPT_UD) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	if (!attr->send_cq || !attr->recv_cq ||
+	    cap->max_send_wr > LB_MAX_QP_WR ||
+	    cap->max_recv_wr > LB_MAX_QP_WR ||
+	    cap->max_send_sge > LB_MAX_SGE ||
+	    cap->max_recv_sge > LB_MAX_SGE ||
+	    cap->max_inline_data > LB_MAX_INLINE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	qp = calloc(1, sizeof(*qp));
+	if (!qp) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	cap->max_send_wr = max(cap->max_send_wr, 1U);
+	cap->max_recv_wr = max(cap->max_recv_wr, 1U);
+	cap->max_send_sge = max(cap->max_send_sge, 1U);
+	cap->max_recv_sge = max(cap->max_recv_sge, 1U);
+	cap->max_inline_data = max(cap->max_inline_data,
+				   cap->max_send_sge *
+					   (uint32_t)sizeof(struct ibv_sge));
+
+	ret = lb_wq_init(&qp->sq, cap->max_send_wr,
+			 sizeof(struct lb_send_wqe) +
+				 max(cap->max_send_sge *
+					     (uint32_t)sizeof(struct ibv_sge),
+				     cap->max_inline_data));
+	if (ret)
+		goto err_free;
+	qp->sq.max_sge = cap->max_send_sge;
+
+	if (!attr->srq) {
+		ret = lb_wq_init(&qp->rq, cap->max_recv_wr,
+				 sizeof(struct lb_recv_wqe) +
+					 cap->max_recv_sge *
+						 sizeof(struct ibv_sge));
+		if (ret)
+			goto err_sq;
+		qp->rq.max_sge = cap->max_recv_sge;
+	}
+
+	qp->cap = *cap;
+	qp->sq_sig_all = attr->sq_sig_all;
+	qp->attr.qp_state = IBV_QPS_RESET;
+	qp->attr.cap = *cap;
+	pthread_spin_init(&qp->sq_lock, PTHREAD_PROCESS_PRIVATE);
+	pthread_spin_init(&qp->rq_lock, PTHREAD_PROCESS_PRIVATE);
+
+	qp->vqp.qp.context = pd->context;
+	qp->vqp.qp.qp_context = attr->qp_context;
+	qp->vqp.qp.pd = pd;
+	qp->vqp.qp.send_cq = attr->send_cq;
+	qp->vqp.qp.recv_cq = attr->recv_cq;
+	qp->vqp.qp.srq = attr->srq;
+	qp->vqp.qp.qp_type = attr->qp_type;
+	qp->vqp.qp.state = IBV_QPS_RESET;
+	pthread_mutex_init(&qp->vqp.qp.mutex, NULL);
+	pthread_cond_init(&qp->vqp.qp.cond, NULL);
+
+	pthread_rwlock_wrlock(&fabric.lock);
+	ret = table_insert(&fabric.qps, qp, &idx);
+	pthread_rwlock_unlock(&fabric.lock);
+	if (ret)
+		goto err_locks;
+	qp->vqp.qp.qp_num = idx + LB_FIRST_QPN;
+
+	return &qp->vqp.qp;
+
+err_locks:
+	pthread_spin_destroy(&qp->rq_lock);
+	pthread_spin_destroy(&qp->sq_lock);
+	free(qp->rq.buf);
+err_sq:
+	free(qp->sq.buf);
+err_free:
+	free(qp);
+	errno = ret;
+	return NULL;
+}
+
+static int lb_query_qp(struct ibv_qp *ibqp, struct ibv_qp_attr *attr,
+		       int attr_mask, struct ibv_qp_init_attr *init_attr)
+{
+	struct lb_qp *qp = to_lbqp(ibqp);
+
+	pthread_rwlock_rdlock(&fabric.lock);
+	*attr = qp->attr;
+	attr->qp_state = lb_qp_state(qp);
+	attr->cur_qp_state = attr->qp_state;
+	pthread_rwlock_unlock(&fabric.lock);
+
+	memset(init_attr, 0, sizeof(*init_attr));
+	init_attr->qp_context = ibqp->qp_context;
+	init_attr->send_cq = ibqp->send_cq;
+	init_attr->recv_cq = ibqp->recv_cq;
+	init_attr->srq = ibqp->srq;
+	init_attr->cap = qp->cap;
+	init_attr->qp_type = ibqp->qp_type;
+	init_attr->sq_sig_all = qp->sq_sig_all;
+
+	return 0;
+}
+
+/* Called with the fabric write lock held */
+static void lb_reset_qp(struct lb_qp *qp, bool flush)
+{
+	struct lb_cq *cq = to_lbcq(qp->vqp.qp.send_cq);
+	struct ibv_wc wc = {
+		.status = IBV_WC_WR_FLUSH_ERR,
+		.qp_num = qp->vqp.qp.qp_num,
+	};
+	struct lb_send_wqe *wqe;
+
+	pthread_spin_lock(&qp->sq_lock);
+	lb_set_rnr_wait(qp, false);
+	for (; flush && qp->sq.head != qp->sq.tail; qp->sq.head++) {
+		wqe = lb_wq_get(&qp->sq, qp->sq.head);
+		wc.wr_id = wqe->wr_id;
+		wc.opcode = lb_send_wc_opcode(wqe->opcode);
+		lb_cq_push(cq, &wc);
+	}
+	qp->sq.head = qp->sq.tail;
+	pthread_spin_unlock(&qp->sq_lock);
+
+	pthread_spin_lock(&qp->rq_lock);
+	if (flush && !qp->vqp.qp.srq)
+		lb_flush_rq_locked(qp);
+	qp->rq.head = qp->rq.tail;
+	pthread_spin_unlock(&qp->rq_lock);
+}
+
+static int lb_modify_qp(struct ibv_qp *ibqp, struct ibv_qp_attr *attr,
+			int attr_mask)
+{
+	struct lb_qp *qp = to_lbqp(ibqp);
+	int ret = 0;
+
+	pthread_rwlock_wrlock(&fabric.lock);
+	if (attr_mask & IBV_QP_STATE && lb_qp_state(qp) == IBV_QPS_ERR &&
+	    attr->qp_state != IBV_QPS_RESET && attr->qp_state != IBV_QPS_ERR) {
+		ret = EINVAL;
+		goto out;
+	}
+	if (attr_mask & IBV_QP_PORT && attr->port_num != 1) {
+		ret = EINVAL;
+		goto out;
+	}
+
+	if (attr_mask & IBV_QP_PKEY_INDEX)
+		qp->attr.pkey_index = attr->pkey_index;
+	if (attr_mask & IBV_QP_PORT)
+		qp->attr.port_num = attr->port_num;
+	if (attr_mask & IBV_QP_ACCESS_FLAGS)
+		qp->attr.qp_access_flags = attr->qp_access_flags;
+	if (attr_mask & IBV_QP_QKEY)
+		qp->attr.qkey = attr->qkey;
+	if (attr_mask & IBV_QP_AV)
+		qp->attr.ah_attr = attr->ah_attr;
+	if (attr_mask & IBV_QP_PATH_MTU)
+		qp->attr.path_mtu = attr->path_mtu;
+	if (attr_mask & IBV_QP_TIMEOUT)
+		qp->attr.timeout = attr->timeout;
+	if (attr_mask & IBV_QP_RETRY_CNT)
+		qp->attr.retry_cnt = attr->retry_cnt;
+	if (attr_mask & IBV_QP_RNR_RETRY)
+		qp->attr.rnr_retry = attr->rnr_retry;
+	if (attr_mask & IBV_QP_RQ_PSN)
+		qp->attr.rq_psn = attr->rq_psn;
+	if (attr_mask & IBV_QP_MAX_QP_RD_ATOMIC)
+		qp->attr.max_rd_atomic = attr->max_rd_atomic;
+	if (attr_mask & IBV_QP_MIN_RNR_TIMER)
+		qp->attr.min_rnr_timer = attr->min_rnr_timer;
+	if (attr_mask & IBV_QP_SQ_PSN)
+		qp->attr.sq_psn = attr->sq_psn;
+	if (attr_mask & IBV_QP_MAX_DEST_RD_ATOMIC)
+		qp->attr.max_dest_rd_atomic = attr->max_dest_rd_atomic;
+	if (attr_mask & IBV_QP_DEST_QPN)
+		qp->attr.dest_qp_num = attr->dest_qp_num;
+
+	if (attr_mask & IBV_QP_STATE) {
+		qp->attr.qp_state = attr->qp_state;
+		if (attr->qp_state == IBV_QPS_RESET) {
+			lb_reset_qp(qp, false);
+			atomic_store(&qp->in_error, false);
+		} else if (attr->qp_state == IBV_QPS_ERR) {
+			lb_reset_qp(qp, true);
+		}
+	}
+out:
+	pthread_rwlock_unlock(&fabric.lock);
+	return ret;
+}
+
+static int lb_destroy_qp(struct ibv_qp *ibqp)
+{
+	struct lb_qp *qp = to_lbqp(ibqp);
+
+	pthread_rwlock_wrlock(&fabric.lock);
+	fabric.qps.entries[ibqp->qp_num - LB_FIRST_QPN] = NULL;
+	lb_set_rnr_wait(qp, false);
+	pthread_rwlock_unlock(&fabric.lock);
+
+	pthread_spin_destroy(&qp->rq_lock);
+	pthread_spin_destroy(&qp->sq_lock);
+	free(qp->rq.buf);
+	free(qp->sq.buf);
+	free(qp);
+	return 0;
+}
+
+static struct ibv_ah *lb_create_ah(struct ibv_pd *pd, struct ibv_ah_attr *attr)
+{
+	struct lb_ah *ah;
+
+	if (attr->port_num != 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ah = calloc(1, sizeof(*ah));
+	if (!ah) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	ah->attr = *attr;
+
+	return &ah->ibv_ah;
+}
+
+static int lb_destroy_ah(struct ibv_ah *ibah)
+{
+	free(to_lbah(ibah));
+	return 0;
+}
+
+static void lb_free_context(struct ibv_context *ibctx)
+{
+	struct lb_context *context = to_lbctx(ibctx);
+
+	verbs_uninit_context(&context->ibv_ctx);
+	free(context);
+}
+
+static const struct verbs_context_ops lb_ctx_ops = {
+	.alloc_pd = lb_alloc_pd,
+	.create_ah = lb_create_ah,
+	.create_cq = lb_create_cq,
+	.create_qp = lb_create_qp,
+	.create_srq = lb_create_srq,
+	.dealloc_pd = lb_dealloc_pd,
+	.dereg_mr = lb_dereg_mr,
+	.destroy_ah = lb_destroy_ah,
+	.destroy_cq = lb_destroy_cq,
+	.destroy_qp = lb_destroy_qp,
+	.destroy_srq = lb_destroy_srq,
+	.free_context = lb_free_context,
+	.modify_qp = lb_modify_qp,
+	.modify_srq = lb_modify_srq,
+	.poll_cq = lb_poll_cq,
+	.post_recv = lb_post_recv,
+	.post_send = lb_post_send,
+	.post_srq_recv = lb_post_srq_recv,
+	.query_device_ex = lb_query_device,
+	.query_port = lb_query_port,
+	.query_qp = lb_query_qp,
+	.query_srq = lb_query_srq,
+	.reg_mr = lb_reg_mr,
+};
+
+static struct verbs_context *lb_alloc_context(struct ibv_device *ibdev,
+					      int cmd_fd,
+					      void *private_data)
+{
+	struct lb_context *context;
+
+	context = verbs_init_and_alloc_context(ibdev, cmd_fd, context, ibv_ctx,
+					       RDMA_DRIVER_UNKNOWN);
+	if (!context)
+		return NULL;
+
+	verbs_set_ops(&context->ibv_ctx, &lb_ctx_ops);
+
+	return &context->ibv_ctx;
+}
+
+static void lb_uninit_device(struct verbs_device *verbs_device)
+{
+	struct lb_device *dev = to_lbdev(&verbs_device->device);
+
+	free(dev);
+}
+
+static bool lb_match_device(struct verbs_sysfs_dev *sysfs_dev)
+{
+	return sysfs_dev->flags & VSYSFS_USERSPACE;
+}
+
+static struct verbs_device *lb_device_alloc(struct verbs_sysfs_dev *sysfs_dev)
+{
+	struct lb_device *dev;
+	unsigned int index;
+
+	if (sscanf(sysfs_dev->ibdev_name, "loopback%u", &index) != 1)
+		return NULL;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+
+	dev->index = index;
+	dev->node_guid = htobe64(LB_NODE_GUID_BASE | index);
+
+	/* There is no sysfs to read it from */
+	sysfs_dev->node_guid = be64toh(dev->node_guid);
+	sysfs_dev->flags |= VSYSFS_READ_NODE_GUID;
+
+	return &dev->ibv_dev;
+}
+
+static const struct verbs_device_ops lb_dev_ops = {
+	.name = "loopback",
+	.match_device = lb_match_device,
+	.alloc_device = lb_device_alloc,
+	.uninit_device = lb_uninit_device,
+	.alloc_context = lb_alloc_context,
+};
+PROVIDER_DRIVER(loopback, lb_dev_ops);
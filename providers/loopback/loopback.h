@@ -0,0 +1,162 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <infiniband/driver.h>
+
+/*
+ * Device limits.  They are software limits only, chosen to be comfortably
+ * larger than what benchmarks and test suites ask for.
+ */
+enum {
+	LB_MAX_QP		= 1 << 16,
+	LB_MAX_QP_WR		= 1 << 14,
+	LB_MAX_SGE		= 32,
+	LB_MAX_INLINE		= 1024,
+	LB_MAX_CQ		= 1 << 16,
+	LB_MAX_CQE		= 1 << 20,
+	LB_MAX_MR		= 1 << 20,
+	LB_MAX_PD		= 1 << 16,
+	LB_MAX_AH		= 1 << 20,
+	LB_MAX_SRQ		= 1 << 16,
+	LB_MAX_RD_ATOM		= 16,
+	LB_MAX_MSG_SZ		= 1 << 30,
+	LB_MTU			= 4096,
+	LB_GRH_SIZE		= 40,
+};
+
+struct lb_device {
+	struct verbs_device	ibv_dev;
+	unsigned int		index;
+	__be64			node_guid;
+};
+
+struct lb_context {
+	struct verbs_context	ibv_ctx;
+};
+
+struct lb_mr {
+	struct verbs_mr		vmr;
+	/* Translates [iova, iova + length) to addr */
+	uint64_t		iova;
+	uint8_t			*addr;
+	uint64_t		length;
+	unsigned int		access;
+};
+
+struct lb_cq {
+	struct verbs_cq		vcq;
+	pthread_spinlock_t	lock;
+	struct ibv_wc		*wc;
+	uint32_t		size;
+	uint32_t		head;
+	uint32_t		tail;
+	bool			overflow;
+};
+
+struct lb_ah {
+	struct ibv_ah		ibv_ah;
+	struct ibv_ah_attr	attr;
+};
+
+struct lb_send_wqe {
+	uint64_t		wr_id;
+	enum ibv_wr_opcode	opcode;
+	unsigned int		send_flags;
+	__be32			imm_data;
+	uint64_t		remote_addr;
+	uint32_t		rkey;
+	uint64_t		compare_add;
+	uint64_t		swap;
+	struct ibv_ah_attr	ah_attr;
+	uint32_t		remote_qpn;
+	uint32_t		remote_qkey;
+	uint32_t		length;
+	int			num_sge;
+	/* num_sge entries, or the inline data if IBV_SEND_INLINE */
+	struct ibv_sge		sge[];
+};
+
+struct lb_recv_wqe {
+	uint64_t		wr_id;
+	uint32_t		length;
+	int			num_sge;
+	struct ibv_sge		sge[];
+};
+
+struct lb_wq {
+	void			*buf;
+	size_t			stride;
+	uint32_t		max_wr;
+	uint32_t		max_sge;
+	uint32_t		head;
+	uint32_t		tail;
+};
+
+struct lb_srq {
+	struct verbs_srq	vsrq;
+	pthread_spinlock_t	lock;
+	struct lb_wq		rq;
+	uint32_t		srq_limit;
+};
+
+struct lb_qp {
+	struct verbs_qp		vqp;
+	/* Written under the fabric write lock, read under its read lock */
+	struct ibv_qp_attr	attr;
+	struct ibv_qp_cap	cap;
+	bool			sq_sig_all;
+	/* Moved to the error state by the data path */
+	atomic_bool		in_error;
+
+	pthread_spinlock_t	sq_lock;
+	struct lb_wq		sq;
+	/* The head of the SQ waits for a receive WQE on the responder */
+	bool			rnr_wait;
+
+	pthread_spinlock_t	rq_lock;
+	struct lb_wq		rq;
+};
+
+#define to_lbxxx(xxx, type) container_of(ib##xxx, struct lb_##type, ibv_##xxx)
+
+static inline struct lb_device *to_lbdev(struct ibv_device *ibdev)
+{
+	return container_of(ibdev, struct lb_device, ibv_dev.device);
+}
+
+static inline struct lb_context *to_lbctx(struct ibv_context *ibctx)
+{
+	return container_of(ibctx, struct lb_context, ibv_ctx.context);
+}
+
+static inline struct lb_mr *to_lbmr(struct verbs_mr *vmr)
+{
+	return container_of(vmr, struct lb_mr, vmr);
+}
+
+static inline struct lb_cq *to_lbcq(struct ibv_cq *ibcq)
+{
+	return container_of(ibcq, struct lb_cq, vcq.cq);
+}
+
+static inline struct lb_ah *to_lbah(struct ibv_ah *ibah)
+{
+	return to_lbxxx(ah, ah);
+}
+
+static inline struct lb_srq *to_lbsrq(struct ibv_srq *ibsrq)
+{
+	return container_of(ibsrq, struct lb_srq, vsrq.srq);
+}
+
+static inline struct lb_qp *to_lbqp(struct ibv_qp *ibqp)
+{
+	return container_of(ibqp, struct lb_qp, vqp.qp);
+}
+
+#endif /* LOOPBACK_H */
@@ -30,6 +30,7 @@
  * SOFTWARE.
  */
 
+#include <limits.h>
 #include <stdlib.h>
 #include <ccan/minmax.h>
 #include "mlx5dv_dr.h"
@@ -1628,6 +1629,58 @@ struct mlx5dv_dr_rule *mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 	return rule;
 }
 
+int mlx5dv_dr_rule_create_bulk(struct mlx5dv_dr_matcher *matcher,
+			       struct mlx5dv_dr_rule_bulk_attr *attr,
+			       size_t num_rules)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	bool is_root = dr_is_root_table(matcher->tbl);
+	size_t i;
+	int created = 0;
+
+	if (num_rules > INT_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/*
+	 * Root table rules are created by the kernel, for the others the STE
+	 * writes of the whole batch are posted before ringing the doorbell of
+	 * each send ring once.
+	 */
+	if (!is_root)
+		dr_send_ring_batch_begin(dmn);
+
+	for (i = 0; i < num_rules; i++) {
+		struct mlx5dv_dr_rule_bulk_attr *cur = &attr[i];
+
+		atomic_fetch_add(&matcher->refcount, 1);
+
+		if (is_root)
+			cur->rule = dr_rule_create_rule_root(matcher, cur->value,
+							     cur->num_actions,
+							     cur->actions);
+		else
+			cur->rule = dr_rule_create_rule(matcher, cur->value,
+							cur->num_actions,
+							cur->actions);
+
+		if (!cur->rule) {
+			atomic_fetch_sub(&matcher->refcount, 1);
+			cur->status = errno ? errno : EINVAL;
+			continue;
+		}
+
+		cur->status = 0;
+		created++;
+	}
+
+	if (!is_root)
+		dr_send_ring_batch_end(dmn);
+
+	return created;
+}
+
 int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule)
 {
 	struct mlx5dv_dr_matcher *matcher = rule->matcher;
@@ -536,9 +536,10 @@ static void dr_rdma_handle_icm_write_segments(struct dr_qp *dr_qp,
 	}
 }
 
-static void dr_rdma_segments(struct dr_qp *dr_qp, uint64_t remote_addr,
-			     uint32_t rkey, struct dr_data_seg *data_seg,
-			     uint32_t opcode, bool send_now)
+static struct mlx5_wqe_ctrl_seg *
+dr_rdma_segments(struct dr_qp *dr_qp, uint64_t remote_addr,
+		 uint32_t rkey, struct dr_data_seg *data_seg,
+		 uint32_t opcode, bool send_now)
 {
 	struct mlx5_wqe_ctrl_seg *ctrl = NULL;
 	void *qend = dr_qp->sq.qend;
@@ -586,21 +587,42 @@ static void dr_rdma_segments(struct dr_qp *dr_qp, uint64_t remote_addr,
 
 	if (send_now)
 		dr_post_send_db(dr_qp, ctrl);
+
+	return ctrl;
 }
 
-static void dr_post_send(struct dr_qp *dr_qp, struct postsend_info *send_info)
+/*
+ * Post the WQEs of send_info, ringing the doorbell unless it is deferred by
+ * a batch, in which case the control segment of the last WQE is returned.
+ */
+static struct mlx5_wqe_ctrl_seg *dr_post_send(struct dr_qp *dr_qp,
+					      struct postsend_info *send_info,
+					      bool send_now)
 {
 	if (send_info->type == WRITE_ICM) {
 		/* false, because we delay the post_send_db till the coming READ */
 		dr_rdma_segments(dr_qp, send_info->remote_addr, send_info->rkey,
 				 &send_info->write, MLX5_OPCODE_RDMA_WRITE, false);
-		/* true, because we send WRITE + READ together */
-		dr_rdma_segments(dr_qp, send_info->remote_addr, send_info->rkey,
-				 &send_info->read, MLX5_OPCODE_RDMA_READ, true);
-	} else { /* GTA_ARG */
-		dr_rdma_segments(dr_qp, send_info->remote_addr, send_info->rkey,
-				 &send_info->write, MLX5_OPCODE_FLOW_TBL_ACCESS, true);
+		/* send WRITE + READ together */
+		return dr_rdma_segments(dr_qp, send_info->remote_addr,
+					send_info->rkey, &send_info->read,
+					MLX5_OPCODE_RDMA_READ, send_now);
 	}
+
+	/* GTA_ARG */
+	return dr_rdma_segments(dr_qp, send_info->remote_addr, send_info->rkey,
+				&send_info->write, MLX5_OPCODE_FLOW_TBL_ACCESS,
+				send_now);
+}
+
+/* Ring the doorbell for WQEs posted while the doorbell was deferred */
+static void dr_send_ring_flush_db(struct dr_send_ring *send_ring)
+{
+	if (!send_ring->db_pending)
+		return;
+
+	dr_post_send_db(send_ring->qp, &send_ring->db_ctrl);
+	send_ring->db_pending = false;
 }
 
 /*
@@ -658,6 +680,9 @@ static int dr_handle_pending_wc(struct mlx5dv_dr_domain *dmn,
 	int ne;
 
 	if (send_ring->pending_wqe >= send_ring->signal_th) {
+		/* The awaited completions may belong to deferred WQEs */
+		dr_send_ring_flush_db(send_ring);
+
 		/* Queue is full start drain it */
 		if (send_ring->pending_wqe >= send_ring->signal_th * TH_NUMS_TO_DRAIN)
 			is_drain = true;
@@ -753,6 +778,7 @@ static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
 {
 	struct dr_send_ring *send_ring =
 		dmn->send_ring[ring_idx % DR_MAX_SEND_RINGS];
+	struct mlx5_wqe_ctrl_seg *ctrl;
 	int ret;
 
 	pthread_spin_lock(&send_ring->lock);
@@ -761,7 +787,12 @@ static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
 		goto out_unlock;
 
 	dr_fill_data_segs(dmn, send_ring, send_info);
-	dr_post_send(send_ring->qp, send_info);
+	ctrl = dr_post_send(send_ring->qp, send_info, !send_ring->batch_refcount);
+	if (send_ring->batch_refcount) {
+		/* The WQE may be overwritten before the doorbell is rung */
+		memcpy(&send_ring->db_ctrl, ctrl, sizeof(send_ring->db_ctrl));
+		send_ring->db_pending = true;
+	}
 
 out_unlock:
 	pthread_spin_unlock(&send_ring->lock);
@@ -1297,6 +1328,39 @@ free_send_ring:
 	return ret;
 }
 
+/*
+ * Between dr_send_ring_batch_begin() and dr_send_ring_batch_end() the ICM
+ * writes posted on the domain send rings don't ring the doorbell, it is rung
+ * once per ring when the last batch ends, or earlier if a ring must wait for
+ * completions. Batches of several threads may overlap.
+ */
+void dr_send_ring_batch_begin(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_send_ring *send_ring;
+	int i;
+
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
+		send_ring = dmn->send_ring[i];
+		pthread_spin_lock(&send_ring->lock);
+		send_ring->batch_refcount++;
+		pthread_spin_unlock(&send_ring->lock);
+	}
+}
+
+void dr_send_ring_batch_end(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_send_ring *send_ring;
+	int i;
+
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
+		send_ring = dmn->send_ring[i];
+		pthread_spin_lock(&send_ring->lock);
+		if (!--send_ring->batch_refcount)
+			dr_send_ring_flush_db(send_ring);
+		pthread_spin_unlock(&send_ring->lock);
+	}
+}
+
 int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
 {
 	struct dr_send_ring *send_ring = dmn->send_ring[0];
@@ -2037,6 +2037,19 @@ mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 		      size_t num_actions,
 		      struct mlx5dv_dr_action *actions[]);
 
+struct mlx5dv_dr_rule_bulk_attr {
+	struct mlx5dv_flow_match_parameters *value;
+	size_t num_actions;
+	struct mlx5dv_dr_action **actions;
+	/* Set by mlx5dv_dr_rule_create_bulk() */
+	struct mlx5dv_dr_rule *rule;
+	int status;
+};
+
+int mlx5dv_dr_rule_create_bulk(struct mlx5dv_dr_matcher *matcher,
+			       struct mlx5dv_dr_rule_bulk_attr *attr,
+			       size_t num_rules);
+
 int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule);
 
 enum mlx5dv_dr_action_flags {
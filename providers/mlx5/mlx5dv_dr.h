@@ -46,7 +46,12 @@
 #define DR_ACTION_ASO_CROSS_GVMI_STES 2
 /* Use up to 14 send rings. This number provided the best performance */
 #define DR_MAX_SEND_RINGS	14
-#define NUM_OF_LOCKS		DR_MAX_SEND_RINGS
+/*
+ * Rules of fixed size matchers are serialized per hash bucket stripe, and a
+ * stripe always posts to the same send ring to keep its STE writes ordered.
+ * Must fit the uint8_t lock_index.
+ */
+#define NUM_OF_LOCKS		64
 #define WIRE_PORT		0xFFFF
 #define ECPF_PORT		0xFFFE
 #define DR_STE_SVLAN		0x1
@@ -58,6 +63,7 @@
 #define DR_STE_MAX_FLEX_1_ID	7
 #define DR_VPORTS_BUCKETS	256
 #define ACTION_CACHE_LINE_SIZE	64
+#define DR_CACHE_LINE_SIZE	64
 
 #define dr_dbg(dmn, arg...) dr_dbg_ctx((dmn)->ctx, ##arg)
 
@@ -1049,12 +1055,20 @@ enum dr_domain_nic_type {
 	DR_DOMAIN_NIC_TYPE_TX,
 };
 
+/* Padded so that threads working on different stripes don't share lines */
+struct dr_domain_lock_stripe {
+	union {
+		pthread_spinlock_t	lock;
+		uint8_t			pad[DR_CACHE_LINE_SIZE];
+	};
+};
+
 struct dr_domain_rx_tx {
 	uint64_t		drop_icm_addr;
 	uint64_t		default_icm_addr;
 	enum dr_domain_nic_type	type;
 	/* protect rx/tx domain */
-	pthread_spinlock_t	locks[NUM_OF_LOCKS];
+	struct dr_domain_lock_stripe locks[NUM_OF_LOCKS];
 };
 
 struct dr_domain_info {
@@ -1106,7 +1120,8 @@ static inline int dr_domain_nic_lock_init(struct dr_domain_rx_tx *nic_dmn)
 	int i;
 
 	for (i = 0; i < NUM_OF_LOCKS; i++) {
-		ret = pthread_spin_init(&nic_dmn->locks[i], PTHREAD_PROCESS_PRIVATE);
+		ret = pthread_spin_init(&nic_dmn->locks[i].lock,
+					PTHREAD_PROCESS_PRIVATE);
 		if (ret) {
 			errno = ret;
 			goto destroy_locks;
@@ -1116,7 +1131,7 @@ static inline int dr_domain_nic_lock_init(struct dr_domain_rx_tx *nic_dmn)
 
 destroy_locks:
 	while (i--)
-		pthread_spin_destroy(&nic_dmn->locks[i]);
+		pthread_spin_destroy(&nic_dmn->locks[i].lock);
 
 	return ret;
 }
@@ -1126,7 +1141,7 @@ static inline void dr_domain_nic_lock_uninit(struct dr_domain_rx_tx *nic_dmn)
 	int i;
 
 	for (i = 0; i < NUM_OF_LOCKS; i++)
-		pthread_spin_destroy(&nic_dmn->locks[i]);
+		pthread_spin_destroy(&nic_dmn->locks[i].lock);
 }
 
 static inline void dr_domain_nic_lock(struct dr_domain_rx_tx *nic_dmn)
@@ -1134,7 +1149,7 @@ static inline void dr_domain_nic_lock(struct dr_domain_rx_tx *nic_dmn)
 	int i;
 
 	for (i = 0; i < NUM_OF_LOCKS; i++)
-		pthread_spin_lock(&nic_dmn->locks[i]);
+		pthread_spin_lock(&nic_dmn->locks[i].lock);
 }
 
 static inline void dr_domain_nic_unlock(struct dr_domain_rx_tx *nic_dmn)
@@ -1142,7 +1157,7 @@ static inline void dr_domain_nic_unlock(struct dr_domain_rx_tx *nic_dmn)
 	int i;
 
 	for (i = 0; i < NUM_OF_LOCKS; i++)
-		pthread_spin_unlock(&nic_dmn->locks[i]);
+		pthread_spin_unlock(&nic_dmn->locks[i].lock);
 }
 
 static inline void dr_domain_lock(struct mlx5dv_dr_domain *dmn)
@@ -1392,9 +1407,9 @@ dr_rule_lock(struct dr_rule_rx_tx *nic_rule, uint8_t *hw_ste)
 			index = dr_ste_calc_hash_index(hw_ste, nic_matcher->s_htbl);
 			nic_rule->lock_index = index % NUM_OF_LOCKS;
 		}
-		pthread_spin_lock(&nic_dmn->locks[nic_rule->lock_index]);
+		pthread_spin_lock(&nic_dmn->locks[nic_rule->lock_index].lock);
 	} else {
-		pthread_spin_lock(&nic_dmn->locks[0]);
+		pthread_spin_lock(&nic_dmn->locks[0].lock);
 	}
 }
 
@@ -1405,9 +1420,9 @@ dr_rule_unlock(struct dr_rule_rx_tx *nic_rule)
 	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
 
 	if (nic_matcher->fixed_size)
-		pthread_spin_unlock(&nic_dmn->locks[nic_rule->lock_index]);
+		pthread_spin_unlock(&nic_dmn->locks[nic_rule->lock_index].lock);
 	else
-		pthread_spin_unlock(&nic_dmn->locks[0]);
+		pthread_spin_unlock(&nic_dmn->locks[0].lock);
 }
 
 void dr_rule_set_last_member(struct dr_rule_rx_tx *nic_rule,
@@ -1701,11 +1716,17 @@ struct dr_send_ring {
 	uint32_t		buf_size;
 	void			*sync_buff;
 	struct ibv_mr		*sync_mr;
+	/* Doorbell deferred by batched postsends */
+	struct mlx5_wqe_ctrl_seg db_ctrl;
+	uint32_t		batch_refcount;
+	bool			db_pending;
 };
 
 int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn);
 void dr_send_ring_free(struct mlx5dv_dr_domain *dmn);
 int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn);
+void dr_send_ring_batch_begin(struct mlx5dv_dr_domain *dmn);
+void dr_send_ring_batch_end(struct mlx5dv_dr_domain *dmn);
 bool dr_send_allow_fl(struct dr_devx_caps *caps);
 int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
 			 uint8_t *data, uint16_t size, uint16_t offset,
@@ -611,7 +611,8 @@ static inline int set_bind_wr(struct mlx5_qp *qp, enum ibv_mw_type type,
 		return EINVAL;
 
 	if (bind_info->mr &&
-	    (bind_info->mr->addr > (void *)bind_info->addr ||
+	    (verbs_get_mr(bind_info->mr)->mr_type != IBV_MR_TYPE_MR ||
+	     bind_info->mr->addr > (void *)bind_info->addr ||
 	     bind_info->mr->addr + bind_info->mr->length <
 	     (void *)bind_info->addr + bind_info->length ||
 	     !(to_mmr(bind_info->mr)->alloc_flags &  IBV_ACCESS_MW_BIND) ||
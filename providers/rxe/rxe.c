@@ -49,6 +49,7 @@
 #include <pthread.h>
 #include <stddef.h>
 
+#include <ccan/minmax.h>
 #include <infiniband/driver.h>
 #include <infiniband/verbs.h>
 
@@ -235,17 +236,29 @@ static int rxe_dereg_mr(struct verbs_mr *vmr)
 	return 0;
 }
 
+static void cq_lock(struct rxe_cq *cq)
+{
+	if (!cq->single_threaded)
+		pthread_spin_lock(&cq->lock);
+}
+
+static void cq_unlock(struct rxe_cq *cq)
+{
+	if (!cq->single_threaded)
+		pthread_spin_unlock(&cq->lock);
+}
+
 static int cq_start_poll(struct ibv_cq_ex *current,
 			 struct ibv_poll_cq_attr *attr)
 {
 	struct rxe_cq *cq = container_of(current, struct rxe_cq, vcq.cq_ex);
 
-	pthread_spin_lock(&cq->lock);
+	cq_lock(cq);
 
 	cq->cur_index = load_consumer_index(cq->queue);
 
 	if (check_cq_queue_empty(cq)) {
-		pthread_spin_unlock(&cq->lock);
+		cq_unlock(cq);
 		errno = ENOENT;
 		return errno;
 	}
@@ -266,7 +279,7 @@ static int cq_next_poll(struct ibv_cq_ex *current)
 
 	if (next_index == load_producer_index(q)) {
 		store_consumer_index(cq->queue, cq->cur_index);
-		pthread_spin_unlock(&cq->lock);
+		cq_unlock(cq);
 		errno = ENOENT;
 		return errno;
 	}
@@ -285,7 +298,7 @@ static void cq_end_poll(struct ibv_cq_ex *current)
 
 	advance_cq_cur_index(cq);
 	store_consumer_index(cq->queue, cq->cur_index);
-	pthread_spin_unlock(&cq->lock);
+	cq_unlock(cq);
 }
 
 static enum ibv_wc_opcode cq_read_opcode(struct ibv_cq_ex *current)
@@ -448,6 +461,9 @@ static struct ibv_cq_ex *rxe_create_cq_ex(struct ibv_context *context,
 
 	cq->mmap_info = resp.mi;
 	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
+	cq->single_threaded =
+		attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_FLAGS &&
+		attr->flags & IBV_CREATE_CQ_ATTR_SINGLE_THREADED;
 
 	cq->vcq.cq_ex.start_poll	= cq_start_poll;
 	cq->vcq.cq_ex.next_poll		= cq_next_poll;
@@ -504,12 +520,12 @@ static int rxe_resize_cq(struct ibv_cq *ibcq, int cqe)
 	struct urxe_resize_cq_resp resp;
 	int ret;
 
-	pthread_spin_lock(&cq->lock);
+	cq_lock(cq);
 
 	ret = ibv_cmd_resize_cq(ibcq, cqe, &cmd, sizeof(cmd),
 				&resp.ibv_resp, sizeof(resp));
 	if (ret) {
-		pthread_spin_unlock(&cq->lock);
+		cq_unlock(cq);
 		return ret;
 	}
 
@@ -520,7 +536,7 @@ static int rxe_resize_cq(struct ibv_cq *ibcq, int cqe)
 			 ibcq->context->cmd_fd, resp.mi.offset);
 
 	ret = errno;
-	pthread_spin_unlock(&cq->lock);
+	cq_unlock(cq);
 
 	if ((void *)cq->queue == MAP_FAILED) {
 		cq->queue = NULL;
@@ -549,26 +565,52 @@ static int rxe_destroy_cq(struct ibv_cq *ibcq)
 	return 0;
 }
 
+/* Copy num CQEs starting at index, which must not wrap */
+static void copy_cqes(struct ibv_wc *wc, struct rxe_queue_buf *q,
+		      uint32_t index, uint32_t num)
+{
+	uint8_t *src = addr_from_index(q, index);
+	size_t elem_size = 1UL << q->log2_elem_size;
+	uint32_t i;
+
+	if (elem_size == sizeof(*wc)) {
+		memcpy(wc, src, num * sizeof(*wc));
+		return;
+	}
+
+	for (i = 0; i < num; i++, src += elem_size)
+		memcpy(&wc[i], src, sizeof(*wc));
+}
+
 static int rxe_poll_cq(struct ibv_cq *ibcq, int ne, struct ibv_wc *wc)
 {
 	struct rxe_cq *cq = to_rcq(ibcq);
 	struct rxe_queue_buf *q;
-	int npolled;
-	uint8_t *src;
+	uint32_t avail, cons, run;
+	int npolled = 0;
 
-	pthread_spin_lock(&cq->lock);
-	q = cq->queue;
+	if (ne <= 0)
+		return 0;
 
-	for (npolled = 0; npolled < ne; ++npolled, ++wc) {
-		if (queue_empty(q))
-			break;
+	cq_lock(cq);
+	q = cq->queue;
 
-		src = consumer_addr(q);
-		memcpy(wc, src, sizeof(*wc));
-		advance_consumer(q);
+	/*
+	 * Snapshot the producer index once and hand the entries back to the
+	 * kernel with a single consumer index update.
+	 */
+	avail = min_t(uint32_t, queue_count(q), ne);
+	cons = load_consumer_index(q);
+	while (npolled < avail) {
+		run = min(avail - npolled, q->index_mask + 1 - cons);
+		copy_cqes(wc + npolled, q, cons, run);
+		npolled += run;
+		cons = (cons + run) & q->index_mask;
 	}
+	if (npolled)
+		store_consumer_index(q, cons);
 
-	pthread_spin_unlock(&cq->lock);
+	cq_unlock(cq);
 	return npolled;
 }
 
@@ -1169,23 +1211,24 @@ static void wr_start(struct ibv_qp_ex *ibqp)
 	qp->cur_index = load_producer_index(qp->sq.queue);
 }
 
-static int post_send_db(struct ibv_qp *ibqp);
+static int ring_sq_db(struct rxe_qp *qp);
 
 static int wr_complete(struct ibv_qp_ex *ibqp)
 {
-	int ret;
 	struct rxe_qp *qp = container_of(ibqp, struct rxe_qp, vqp.qp_ex);
+	bool posted;
 
 	if (qp->err) {
 		pthread_spin_unlock(&qp->sq.lock);
 		return qp->err;
 	}
 
+	posted = qp->cur_index != load_producer_index(qp->sq.queue);
 	store_producer_index(qp->sq.queue, qp->cur_index);
-	ret = post_send_db(&qp->vqp.qp);
 
 	pthread_spin_unlock(&qp->sq.lock);
-	return ret;
+
+	return posted ? ring_sq_db(qp) : 0;
 }
 
 static void wr_abort(struct ibv_qp_ex *ibqp)
@@ -1647,6 +1690,30 @@ static int post_send_db(struct ibv_qp *ibqp)
 	return 0;
 }
 
+/* Ring the doorbell once new WQEs are visible in the send queue. Threads
+ * posting to the same QP share doorbells: while one is in the syscall the
+ * others only count their request, and it rings again when it returns if
+ * any came in, since the kernel may have looked at the queue before them.
+ */
+static int ring_sq_db(struct rxe_qp *qp)
+{
+	unsigned int requests;
+	int ret = 0;
+	int err;
+
+	if (atomic_fetch_add(&qp->db_requests, 1))
+		return 0;
+
+	do {
+		requests = atomic_load(&qp->db_requests);
+		err = post_send_db(&qp->vqp.qp);
+		if (err)
+			ret = err;
+	} while (atomic_fetch_sub(&qp->db_requests, requests) != requests);
+
+	return ret;
+}
+
 /* this API does not make a distinction between
  * restartable and non-restartable errors
  */
@@ -1658,6 +1725,7 @@ static int rxe_post_send(struct ibv_qp *ibqp,
 	int err;
 	struct rxe_qp *qp = to_rqp(ibqp);
 	struct rxe_wq *sq = &qp->sq;
+	bool posted = false;
 
 	if (!bad_wr)
 		return EINVAL;
@@ -1676,12 +1744,16 @@ static int rxe_post_send(struct ibv_qp *ibqp,
 			break;
 		}
 
+		posted = true;
 		wr_list = wr_list->next;
 	}
 
 	pthread_spin_unlock(&sq->lock);
 
-	err =  post_send_db(ibqp);
+	if (!posted)
+		return rc;
+
+	err = ring_sq_db(qp);
 	return err ? err : rc;
 }
 
@@ -36,6 +36,7 @@
 #ifndef RXE_H
 #define RXE_H
 
+#include <stdatomic.h>
 #include <infiniband/driver.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -57,6 +58,8 @@ struct rxe_cq {
 	struct mminfo		mmap_info;
 	struct rxe_queue_buf	*queue;
 	pthread_spinlock_t	lock;
+	/* IBV_CREATE_CQ_ATTR_SINGLE_THREADED, the lock is not taken */
+	bool			single_threaded;
 
 	/* new API support */
 	struct ib_uverbs_wc	*wc;
@@ -87,6 +90,9 @@ struct rxe_qp {
 	/* new API support */
 	uint32_t		cur_index;
 	int			err;
+
+	/* doorbells requested while one is being rung */
+	_Atomic(unsigned int)	db_requests;
 };
 
 struct rxe_srq {
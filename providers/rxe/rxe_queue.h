@@ -76,6 +76,18 @@ static inline int queue_empty(struct rxe_queue_buf *q)
 	return (prod == cons);
 }
 
+/* Must hold consumer_index lock, returns the number of valid entries */
+static inline __u32 queue_count(struct rxe_queue_buf *q)
+{
+	__u32 prod;
+	__u32 cons;
+
+	prod = atomic_load_explicit(producer(q), memory_order_acquire);
+	cons = atomic_load_explicit(consumer(q), memory_order_relaxed);
+
+	return (prod - cons) & q->index_mask;
+}
+
 /* Must hold producer_index lock (used by SQ, RQ, SRQ only) */
 static inline int queue_full(struct rxe_queue_buf *q)
 {
@@ -132,6 +132,39 @@ static int siw_dereg_mr(struct verbs_mr *base_mr)
 	return 0;
 }
 
+/* Map the CQE array and control object the kernel set up for the CQ */
+static int siw_map_cq(struct ibv_context *ctx, struct siw_cq *cq,
+		      struct siw_uresp_create_cq *resp)
+{
+	int cq_size;
+
+	if (resp->cq_key == SIW_INVAL_UOBJ_KEY) {
+		verbs_err(verbs_get_ctx(ctx),
+			  "libsiw: prepare CQ mapping failed\n");
+		return -1;
+	}
+	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
+	cq->id = resp->cq_id;
+	cq->num_cqe = resp->num_cqe;
+
+	cq_size = resp->num_cqe * sizeof(struct siw_cqe) +
+		  sizeof(struct siw_cq_ctrl);
+
+	cq->queue = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, ctx->cmd_fd, resp->cq_key);
+
+	if (cq->queue == MAP_FAILED) {
+		verbs_err(verbs_get_ctx(ctx), "libsiw: CQ mapping failed: %d",
+			  errno);
+		pthread_spin_destroy(&cq->lock);
+		return -1;
+	}
+	cq->ctrl = (struct siw_cq_ctrl *)&cq->queue[cq->num_cqe];
+	cq->ctrl->flags = SIW_NOTIFY_NOT;
+
+	return 0;
+}
+
 static struct ibv_cq *siw_create_cq(struct ibv_context *ctx, int num_cqe,
 				    struct ibv_comp_channel *channel,
 				    int comp_vector)
@@ -139,47 +172,27 @@ static struct ibv_cq *siw_create_cq(struct ibv_context *ctx, int num_cqe,
 	struct siw_cmd_create_cq cmd = {};
 	struct siw_cmd_create_cq_resp resp = {};
 	struct siw_cq *cq;
-	int cq_size, rv;
+	int rv;
 
 	cq = calloc(1, sizeof(*cq));
 	if (!cq)
 		return NULL;
 
-	rv = ibv_cmd_create_cq(ctx, num_cqe, channel, comp_vector, &cq->base_cq,
-			       &cmd.ibv_cmd, sizeof(cmd), &resp.ibv_resp,
-			       sizeof(resp));
+	rv = ibv_cmd_create_cq(ctx, num_cqe, channel, comp_vector,
+			       &cq->base_cq.cq, &cmd.ibv_cmd, sizeof(cmd),
+			       &resp.ibv_resp, sizeof(resp));
 	if (rv) {
 		verbs_err(verbs_get_ctx(ctx),
 			  "libsiw: CQ creation failed: %d\n", rv);
 		free(cq);
 		return NULL;
 	}
-	if (resp.cq_key == SIW_INVAL_UOBJ_KEY) {
-		verbs_err(verbs_get_ctx(ctx),
-			  "libsiw: prepare CQ mapping failed\n");
+	if (siw_map_cq(ctx, cq, &resp.drv_payload))
 		goto fail;
-	}
-	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
-	cq->id = resp.cq_id;
-	cq->num_cqe = resp.num_cqe;
-
-	cq_size = resp.num_cqe * sizeof(struct siw_cqe) +
-		  sizeof(struct siw_cq_ctrl);
-
-	cq->queue = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
-			 MAP_SHARED, ctx->cmd_fd, resp.cq_key);
 
-	if (cq->queue == MAP_FAILED) {
-		verbs_err(verbs_get_ctx(ctx), "libsiw: CQ mapping failed: %d",
-			  errno);
-		goto fail;
-	}
-	cq->ctrl = (struct siw_cq_ctrl *)&cq->queue[cq->num_cqe];
-	cq->ctrl->flags = SIW_NOTIFY_NOT;
-
-	return &cq->base_cq;
+	return &cq->base_cq.cq;
 fail:
-	ibv_cmd_destroy_cq(&cq->base_cq);
+	ibv_cmd_destroy_cq(&cq->base_cq.cq);
 	free(cq);
 
 	return NULL;
@@ -290,34 +303,48 @@ static int siw_destroy_srq(struct ibv_srq *base_srq)
 	return 0;
 }
 
-static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
-				    struct ibv_qp_init_attr *attr)
+enum {
+	SIW_QP_CREATE_COMP_MASK = IBV_QP_INIT_ATTR_PD |
+				  IBV_QP_INIT_ATTR_SEND_OPS_FLAGS,
+	SIW_QP_SEND_OPS_FLAGS = IBV_QP_EX_WITH_RDMA_WRITE |
+				IBV_QP_EX_WITH_SEND |
+				IBV_QP_EX_WITH_RDMA_READ |
+				IBV_QP_EX_WITH_SEND_WITH_INV,
+};
+
+static void siw_set_qp_send_ops(struct siw_qp *qp, uint64_t flags);
+
+static struct ibv_qp *siw_create_qp_ex(struct ibv_context *base_ctx,
+				       struct ibv_qp_init_attr_ex *attr)
 {
 	struct siw_cmd_create_qp cmd = {};
 	struct siw_cmd_create_qp_resp resp = {};
 	struct siw_qp *qp;
-	struct ibv_context *base_ctx = pd->context;
 	int sq_size, rq_size, rv;
 
-	memset(&cmd, 0, sizeof(cmd));
-	memset(&resp, 0, sizeof(resp));
+	if (attr->comp_mask & ~SIW_QP_CREATE_COMP_MASK ||
+	    (attr->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS &&
+	     attr->send_ops_flags & ~SIW_QP_SEND_OPS_FLAGS)) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
 
 	qp = calloc(1, sizeof(*qp));
 	if (!qp)
 		return NULL;
 
-	rv = ibv_cmd_create_qp(pd, &qp->base_qp, attr, &cmd.ibv_cmd,
-			       sizeof(cmd), &resp.ibv_resp, sizeof(resp));
+	rv = ibv_cmd_create_qp_ex(base_ctx, &qp->base_qp, attr, &cmd.ibv_cmd,
+				  sizeof(cmd), &resp.ibv_resp, sizeof(resp));
 
 	if (rv) {
-		verbs_err(verbs_get_ctx(pd->context),
+		verbs_err(verbs_get_ctx(base_ctx),
 			  "libsiw: QP creation failed\n");
 		free(qp);
 		return NULL;
 	}
 	if (resp.sq_key == SIW_INVAL_UOBJ_KEY ||
 	    resp.rq_key == SIW_INVAL_UOBJ_KEY) {
-		verbs_err(verbs_get_ctx(pd->context),
+		verbs_err(verbs_get_ctx(base_ctx),
 			  "libsiw: prepare QP mapping failed\n");
 		goto fail;
 	}
@@ -344,7 +371,7 @@ static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
 			 MAP_SHARED, base_ctx->cmd_fd, resp.sq_key);
 
 	if (qp->sendq == MAP_FAILED) {
-		verbs_err(verbs_get_ctx(pd->context),
+		verbs_err(verbs_get_ctx(base_ctx),
 			  "libsiw: SQ mapping failed: %d", errno);
 
 		qp->sendq = NULL;
@@ -359,18 +386,23 @@ static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
 				 MAP_SHARED, base_ctx->cmd_fd, resp.rq_key);
 
 		if (qp->recvq == MAP_FAILED) {
-			verbs_err(verbs_get_ctx(pd->context),
+			verbs_err(verbs_get_ctx(base_ctx),
 				  "libsiw: RQ mapping failed: %d\n",
 				  resp.num_rqe);
 			qp->recvq = NULL;
 			goto fail;
 		}
 	}
-	qp->db_req.qp_handle = qp->base_qp.handle;
+	qp->db_req.qp_handle = qp->base_qp.qp.handle;
 
-	return &qp->base_qp;
+	if (attr->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS) {
+		siw_set_qp_send_ops(qp, attr->send_ops_flags);
+		qp->base_qp.comp_mask |= VERBS_QP_EX;
+	}
+
+	return &qp->base_qp.qp;
 fail:
-	ibv_cmd_destroy_qp(&qp->base_qp);
+	ibv_cmd_destroy_qp(&qp->base_qp.qp);
 
 	if (qp->sendq)
 		munmap(qp->sendq, qp->num_sqe * sizeof(struct siw_sqe));
@@ -382,6 +414,23 @@ fail:
 	return NULL;
 }
 
+static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
+				    struct ibv_qp_init_attr *attr)
+{
+	struct ibv_qp_init_attr_ex attr_ex = {};
+	struct ibv_qp *qp;
+
+	memcpy(&attr_ex, attr, sizeof(*attr));
+	attr_ex.comp_mask = IBV_QP_INIT_ATTR_PD;
+	attr_ex.pd = pd;
+
+	qp = siw_create_qp_ex(pd->context, &attr_ex);
+	if (qp)
+		memcpy(attr, &attr_ex, sizeof(*attr));
+
+	return qp;
+}
+
 static int siw_modify_qp(struct ibv_qp *base_qp, struct ibv_qp_attr *attr,
 			 int attr_mask)
 {
@@ -571,6 +620,26 @@ static inline int push_send_wqe(struct ibv_qp *base_qp,
 	return 0;
 }
 
+/*
+ * If last WQE pushed before position where current post started is idle,
+ * we assume SQ is not being actively processed. Only then, the doorbell
+ * call will be issued. This may significantly reduce unnecessary doorbell
+ * calls on a busy SQ. We also always ring the doorbell, if the complete SQ
+ * was re-written during current post.
+ */
+static int siw_sq_db(struct siw_qp *qp, int new_sqe)
+{
+	if (new_sqe < qp->num_sqe) {
+		uint32_t old_idx = (qp->sq_put - 1) % qp->num_sqe;
+		struct siw_sqe *old_sqe = &qp->sendq[old_idx];
+		atomic_ushort *fp = (atomic_ushort *)&old_sqe->flags;
+
+		if (atomic_load(fp) & SIW_WQE_VALID)
+			return 0;
+	}
+	return siw_db(qp);
+}
+
 static int siw_post_send(struct ibv_qp *base_qp, struct ibv_send_wr *wr,
 			 struct ibv_send_wr **bad_wr)
 {
@@ -615,24 +684,7 @@ static int siw_post_send(struct ibv_qp *base_qp, struct ibv_send_wr *wr,
 		wr = wr->next;
 	}
 	if (new_sqe) {
-		/*
-		 * If last WQE pushed before position where current post_send
-		 * started is idle, we assume SQ is not being actively
-		 * processed. Only then, the doorbell call will be issued.
-		 * This may significantly reduce unnecessary doorbell calls
-		 * on a busy SQ. We also always ring the doorbell, if the
-		 * complete SQ was re-written during current post_send.
-		 */
-		if (new_sqe < qp->num_sqe) {
-			uint32_t old_idx = (qp->sq_put - 1) % qp->num_sqe;
-			struct siw_sqe *old_sqe = &qp->sendq[old_idx];
-
-			fp = (atomic_ushort *)&old_sqe->flags;
-			if (!(atomic_load(fp) & SIW_WQE_VALID))
-				rv = siw_db(qp);
-		} else {
-			rv = siw_db(qp);
-		}
+		rv = siw_sq_db(qp, new_sqe);
 		if (rv)
 			*bad_wr = wr;
 
@@ -643,6 +695,240 @@ static int siw_post_send(struct ibv_qp *base_qp, struct ibv_send_wr *wr,
 	return rv;
 }
 
+static struct siw_sqe *siw_wr_next_sqe(struct siw_qp *qp,
+				       enum siw_opcode opcode)
+{
+	struct ibv_qp_ex *qp_ex = &qp->base_qp.qp_ex;
+	struct siw_sqe *sqe = &qp->sendq[qp->wr_put % qp->num_sqe];
+	atomic_ushort *fp = (atomic_ushort *)&sqe->flags;
+	uint16_t flags;
+
+	if (qp->wr_err)
+		return NULL;
+
+	if (atomic_load(fp) & SIW_WQE_VALID ||
+	    qp->wr_put - qp->sq_put >= qp->num_sqe) {
+		verbs_err(verbs_get_ctx(qp->base_qp.qp.context),
+			  "libsiw: QP[%d]: SQ overflow, idx %d\n",
+			  qp->id, qp->wr_put % qp->num_sqe);
+		qp->wr_err = ENOMEM;
+		return NULL;
+	}
+
+	/*
+	 * Made valid by wr_complete(), once all of the WQE is written.
+	 * Inline is set by wr_set_inline_data*() only.
+	 */
+	flags = map_send_flags(qp_ex->wr_flags) &
+		~(SIW_WQE_VALID | SIW_WQE_INLINE);
+	if (qp->sq_sig_all)
+		flags |= SIW_WQE_SIGNALLED;
+
+	sqe->id = qp_ex->wr_id;
+	sqe->num_sge = 0;
+	sqe->opcode = opcode;
+	atomic_store(fp, flags);
+
+	qp->wr_sqe = sqe;
+	qp->wr_put++;
+
+	return sqe;
+}
+
+static void siw_wr_rdma_read(struct ibv_qp_ex *ibqp, uint32_t rkey,
+			     uint64_t remote_addr)
+{
+	struct siw_sqe *sqe = siw_wr_next_sqe(qp_ex2siw(ibqp), SIW_OP_READ);
+
+	if (!sqe)
+		return;
+
+	sqe->rkey = rkey;
+	sqe->raddr = remote_addr;
+}
+
+static void siw_wr_rdma_write(struct ibv_qp_ex *ibqp, uint32_t rkey,
+			      uint64_t remote_addr)
+{
+	struct siw_sqe *sqe = siw_wr_next_sqe(qp_ex2siw(ibqp), SIW_OP_WRITE);
+
+	if (!sqe)
+		return;
+
+	sqe->rkey = rkey;
+	sqe->raddr = remote_addr;
+}
+
+static void siw_wr_send(struct ibv_qp_ex *ibqp)
+{
+	siw_wr_next_sqe(qp_ex2siw(ibqp), SIW_OP_SEND);
+}
+
+static void siw_wr_send_inv(struct ibv_qp_ex *ibqp, uint32_t invalidate_rkey)
+{
+	struct siw_sqe *sqe = siw_wr_next_sqe(qp_ex2siw(ibqp),
+					      SIW_OP_SEND_REMOTE_INV);
+
+	if (!sqe)
+		return;
+
+	sqe->rkey = invalidate_rkey;
+}
+
+static void siw_wr_set_sge(struct ibv_qp_ex *ibqp, uint32_t lkey,
+			   uint64_t addr, uint32_t length)
+{
+	struct siw_qp *qp = qp_ex2siw(ibqp);
+	struct siw_sqe *sqe = qp->wr_sqe;
+
+	if (qp->wr_err)
+		return;
+
+	sqe->num_sge = 1;
+	sqe->sge[0].laddr = addr;
+	sqe->sge[0].length = length;
+	sqe->sge[0].lkey = lkey;
+}
+
+static void siw_wr_set_sge_list(struct ibv_qp_ex *ibqp, size_t num_sge,
+				const struct ibv_sge *sg_list)
+{
+	struct siw_qp *qp = qp_ex2siw(ibqp);
+	struct siw_sqe *sqe = qp->wr_sqe;
+
+	if (qp->wr_err)
+		return;
+
+	if (num_sge > SIW_MAX_SGE) {
+		qp->wr_err = EINVAL;
+		return;
+	}
+	sqe->num_sge = num_sge;
+
+	/* this assumes same layout of siw and base SGE */
+	memcpy(sqe->sge, sg_list, num_sge * sizeof(struct ibv_sge));
+}
+
+static void siw_wr_set_inline_data_list(struct ibv_qp_ex *ibqp,
+					size_t num_buf,
+					const struct ibv_data_buf *buf_list)
+{
+	struct siw_qp *qp = qp_ex2siw(ibqp);
+	struct siw_sqe *sqe = qp->wr_sqe;
+	char *data = (char *)&sqe->sge[1];
+	atomic_ushort *fp;
+	size_t bytes = 0, i;
+
+	if (qp->wr_err)
+		return;
+
+	for (i = 0; i < num_buf; i++) {
+		bytes += buf_list[i].length;
+		if (bytes > SIW_MAX_INLINE) {
+			verbs_err(verbs_get_ctx(ibqp->qp_base.context),
+				  "libsiw: inline data: %zu:%d\n", bytes,
+				  (int)SIW_MAX_INLINE);
+			qp->wr_err = EINVAL;
+			return;
+		}
+		memcpy(data, buf_list[i].addr, buf_list[i].length);
+		data += buf_list[i].length;
+	}
+	sqe->num_sge = 1;
+	sqe->sge[0].length = bytes;
+
+	fp = (atomic_ushort *)&sqe->flags;
+	atomic_store(fp, atomic_load(fp) | SIW_WQE_INLINE);
+}
+
+static void siw_wr_set_inline_data(struct ibv_qp_ex *ibqp, void *addr,
+				   size_t length)
+{
+	struct ibv_data_buf buf = { .addr = addr, .length = length };
+
+	siw_wr_set_inline_data_list(ibqp, 1, &buf);
+}
+
+static void siw_wr_start(struct ibv_qp_ex *ibqp)
+{
+	struct siw_qp *qp = qp_ex2siw(ibqp);
+
+	pthread_spin_lock(&qp->sq_lock);
+
+	qp->wr_put = qp->sq_put;
+	qp->wr_err = 0;
+}
+
+static void siw_wr_discard(struct siw_qp *qp)
+{
+	atomic_ushort *fp;
+
+	for (; qp->wr_put != qp->sq_put; qp->wr_put--) {
+		fp = (atomic_ushort *)
+			&qp->sendq[(qp->wr_put - 1) % qp->num_sqe].flags;
+		atomic_store(fp, 0);
+	}
+}
+
+static int siw_wr_complete(struct ibv_qp_ex *ibqp)
+{
+	struct siw_qp *qp = qp_ex2siw(ibqp);
+	int new_sqe = qp->wr_put - qp->sq_put;
+	atomic_ushort *fp;
+	uint32_t put;
+	int rv = qp->wr_err;
+
+	if (rv) {
+		siw_wr_discard(qp);
+		goto out;
+	}
+
+	/* Pass the WQEs to the kernel in order */
+	for (put = qp->sq_put; put != qp->wr_put; put++) {
+		fp = (atomic_ushort *)&qp->sendq[put % qp->num_sqe].flags;
+		atomic_store(fp, atomic_load(fp) | SIW_WQE_VALID);
+	}
+	if (new_sqe) {
+		rv = siw_sq_db(qp, new_sqe);
+		qp->sq_put = qp->wr_put;
+	}
+out:
+	pthread_spin_unlock(&qp->sq_lock);
+
+	return rv;
+}
+
+static void siw_wr_abort(struct ibv_qp_ex *ibqp)
+{
+	struct siw_qp *qp = qp_ex2siw(ibqp);
+
+	siw_wr_discard(qp);
+	pthread_spin_unlock(&qp->sq_lock);
+}
+
+static void siw_set_qp_send_ops(struct siw_qp *qp, uint64_t flags)
+{
+	struct ibv_qp_ex *qp_ex = &qp->base_qp.qp_ex;
+
+	if (flags & IBV_QP_EX_WITH_RDMA_READ)
+		qp_ex->wr_rdma_read = siw_wr_rdma_read;
+	if (flags & IBV_QP_EX_WITH_RDMA_WRITE)
+		qp_ex->wr_rdma_write = siw_wr_rdma_write;
+	if (flags & IBV_QP_EX_WITH_SEND)
+		qp_ex->wr_send = siw_wr_send;
+	if (flags & IBV_QP_EX_WITH_SEND_WITH_INV)
+		qp_ex->wr_send_inv = siw_wr_send_inv;
+
+	qp_ex->wr_set_sge = siw_wr_set_sge;
+	qp_ex->wr_set_sge_list = siw_wr_set_sge_list;
+	qp_ex->wr_set_inline_data = siw_wr_set_inline_data;
+	qp_ex->wr_set_inline_data_list = siw_wr_set_inline_data_list;
+
+	qp_ex->wr_start = siw_wr_start;
+	qp_ex->wr_complete = siw_wr_complete;
+	qp_ex->wr_abort = siw_wr_abort;
+}
+
 static inline int push_recv_wqe(struct ibv_recv_wr *base_wr,
 				struct siw_rqe *siw_rqe)
 {
@@ -818,11 +1104,201 @@ static int siw_poll_cq(struct ibv_cq *ibcq, int num_entries, struct ibv_wc *wc)
 	return new;
 }
 
+static inline struct siw_cqe *siw_cq_head(struct siw_cq *cq)
+{
+	struct siw_cqe *cqe = &cq->queue[cq->cq_get % cq->num_cqe];
+	atomic_uchar *fp = (atomic_uchar *)&cqe->flags;
+
+	return atomic_load(fp) & SIW_WQE_VALID ? cqe : NULL;
+}
+
+/* Hand the current CQE back to the kernel */
+static inline void siw_cq_release(struct siw_cq *cq)
+{
+	atomic_uchar *fp = (atomic_uchar *)&cq->cur_cqe->flags;
+
+	atomic_store(fp, 0);
+	cq->cq_get++;
+	cq->cur_cqe = NULL;
+}
+
+static inline void siw_cq_load(struct siw_cq *cq, struct siw_cqe *cqe)
+{
+	cq->cur_cqe = cqe;
+	cq->base_cq.cq_ex.wr_id = cqe->id;
+	cq->base_cq.cq_ex.status = map_cqe_status[cqe->status].base;
+}
+
+static int siw_start_poll(struct ibv_cq_ex *ibcq,
+			  struct ibv_poll_cq_attr *attr)
+{
+	struct siw_cq *cq = cq_ex2siw(ibcq);
+	struct siw_cqe *cqe;
+
+	if (attr->comp_mask)
+		return EINVAL;
+
+	pthread_spin_lock(&cq->lock);
+
+	cqe = siw_cq_head(cq);
+	if (!cqe) {
+		pthread_spin_unlock(&cq->lock);
+		return ENOENT;
+	}
+	siw_cq_load(cq, cqe);
+
+	return 0;
+}
+
+static int siw_next_poll(struct ibv_cq_ex *ibcq)
+{
+	struct siw_cq *cq = cq_ex2siw(ibcq);
+	struct siw_cqe *cqe;
+
+	if (cq->cur_cqe)
+		siw_cq_release(cq);
+
+	cqe = siw_cq_head(cq);
+	if (!cqe)
+		return ENOENT;
+
+	siw_cq_load(cq, cqe);
+
+	return 0;
+}
+
+static void siw_end_poll(struct ibv_cq_ex *ibcq)
+{
+	struct siw_cq *cq = cq_ex2siw(ibcq);
+
+	if (cq->cur_cqe)
+		siw_cq_release(cq);
+
+	pthread_spin_unlock(&cq->lock);
+}
+
+static enum ibv_wc_opcode siw_wc_read_opcode(struct ibv_cq_ex *ibcq)
+{
+	return map_cqe_opcode[cq_ex2siw(ibcq)->cur_cqe->opcode].base;
+}
+
+static uint32_t siw_wc_read_vendor_err(struct ibv_cq_ex *ibcq)
+{
+	return 0;
+}
+
+static uint32_t siw_wc_read_byte_len(struct ibv_cq_ex *ibcq)
+{
+	return cq_ex2siw(ibcq)->cur_cqe->bytes;
+}
+
+static __be32 siw_wc_read_imm_data(struct ibv_cq_ex *ibcq)
+{
+	/* No immediate data supported yet */
+	return 0;
+}
+
+static uint32_t siw_wc_read_qp_num(struct ibv_cq_ex *ibcq)
+{
+	return (uint32_t)cq_ex2siw(ibcq)->cur_cqe->qp_id;
+}
+
+static uint32_t siw_wc_read_src_qp(struct ibv_cq_ex *ibcq)
+{
+	return 0;
+}
+
+static unsigned int siw_wc_read_wc_flags(struct ibv_cq_ex *ibcq)
+{
+	return 0;
+}
+
+static uint32_t siw_wc_read_slid(struct ibv_cq_ex *ibcq)
+{
+	return 0;
+}
+
+static uint8_t siw_wc_read_sl(struct ibv_cq_ex *ibcq)
+{
+	return 0;
+}
+
+static uint8_t siw_wc_read_dlid_path_bits(struct ibv_cq_ex *ibcq)
+{
+	return 0;
+}
+
+/* The IB specific fields always read as 0 on iWARP */
+#define SIW_SUPPORTED_WC_FLAGS	IBV_WC_STANDARD_FLAGS
+
+static struct ibv_cq_ex *siw_create_cq_ex(struct ibv_context *ctx,
+					  struct ibv_cq_init_attr_ex *attr)
+{
+	struct siw_cmd_create_cq_ex_resp resp = {};
+	struct ibv_cq_ex *cq_ex;
+	struct siw_cq *cq;
+	int rv;
+
+	if (attr->wc_flags & ~SIW_SUPPORTED_WC_FLAGS) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	cq = calloc(1, sizeof(*cq));
+	if (!cq)
+		return NULL;
+
+	rv = ibv_cmd_create_cq_ex(ctx, attr, &cq->base_cq, NULL, 0,
+				  &resp.ibv_resp, sizeof(resp), 0);
+	if (rv) {
+		verbs_err(verbs_get_ctx(ctx),
+			  "libsiw: CQ creation failed: %d\n", rv);
+		free(cq);
+		errno = rv;
+		return NULL;
+	}
+	if (siw_map_cq(ctx, cq, &resp.drv_payload))
+		goto fail;
+
+	cq_ex = &cq->base_cq.cq_ex;
+	cq_ex->start_poll = siw_start_poll;
+	cq_ex->next_poll = siw_next_poll;
+	cq_ex->end_poll = siw_end_poll;
+	cq_ex->read_opcode = siw_wc_read_opcode;
+	cq_ex->read_vendor_err = siw_wc_read_vendor_err;
+	cq_ex->read_wc_flags = siw_wc_read_wc_flags;
+
+	if (attr->wc_flags & IBV_WC_EX_WITH_BYTE_LEN)
+		cq_ex->read_byte_len = siw_wc_read_byte_len;
+	if (attr->wc_flags & IBV_WC_EX_WITH_IMM)
+		cq_ex->read_imm_data = siw_wc_read_imm_data;
+	if (attr->wc_flags & IBV_WC_EX_WITH_QP_NUM)
+		cq_ex->read_qp_num = siw_wc_read_qp_num;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SRC_QP)
+		cq_ex->read_src_qp = siw_wc_read_src_qp;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SLID)
+		cq_ex->read_slid = siw_wc_read_slid;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SL)
+		cq_ex->read_sl = siw_wc_read_sl;
+	if (attr->wc_flags & IBV_WC_EX_WITH_DLID_PATH_BITS)
+		cq_ex->read_dlid_path_bits = siw_wc_read_dlid_path_bits;
+
+	return cq_ex;
+fail:
+	ibv_cmd_destroy_cq(&cq->base_cq.cq);
+	free(cq);
+	errno = EINVAL;
+
+	return NULL;
+}
+
 static const struct verbs_context_ops siw_context_ops = {
 	.alloc_pd = siw_alloc_pd,
 	.async_event = siw_async_event,
 	.create_cq = siw_create_cq,
+	.create_cq_ex = siw_create_cq_ex,
 	.create_qp = siw_create_qp,
+	.create_qp_ex = siw_create_qp_ex,
 	.create_srq = siw_create_srq,
 	.dealloc_pd = siw_free_pd,
 	.dereg_mr = siw_dereg_mr,
@@ -30,7 +30,7 @@ struct siw_mr {
 };
 
 struct siw_qp {
-	struct ibv_qp base_qp;
+	struct verbs_qp base_qp;
 	struct siw_device *siw_dev;
 
 	uint32_t id;
@@ -50,10 +50,15 @@ struct siw_qp {
 	uint32_t rq_put;
 	struct siw_rqe *recvq;
 	struct siw_srq *srq;
+
+	/* ibv_qp_ex WR building, between wr_start() and wr_complete() */
+	uint32_t wr_put;
+	struct siw_sqe *wr_sqe;
+	int wr_err;
 };
 
 struct siw_cq {
-	struct ibv_cq base_cq;
+	struct verbs_cq base_cq;
 	struct siw_device *siw_dev;
 	uint32_t id;
 
@@ -66,6 +71,9 @@ struct siw_cq {
 	uint32_t cq_get;
 	struct siw_cqe *queue;
 	pthread_spinlock_t lock;
+
+	/* CQE being read through ibv_cq_ex, owned until the next poll */
+	struct siw_cqe *cur_cqe;
 };
 
 struct siw_context {
@@ -80,12 +88,22 @@ static inline struct siw_context *ctx_ibv2siw(struct ibv_context *base)
 
 static inline struct siw_qp *qp_base2siw(struct ibv_qp *base)
 {
-	return container_of(base, struct siw_qp, base_qp);
+	return container_of(base, struct siw_qp, base_qp.qp);
 }
 
 static inline struct siw_cq *cq_base2siw(struct ibv_cq *base)
 {
-	return container_of(base, struct siw_cq, base_cq);
+	return container_of(base, struct siw_cq, base_cq.cq);
+}
+
+static inline struct siw_qp *qp_ex2siw(struct ibv_qp_ex *base)
+{
+	return container_of(base, struct siw_qp, base_qp.qp_ex);
+}
+
+static inline struct siw_cq *cq_ex2siw(struct ibv_cq_ex *base)
+{
+	return container_of(base, struct siw_cq, base_cq.cq_ex);
 }
 
 static inline struct siw_mr *mr_base2siw(struct verbs_mr *base)
@@ -100,7 +118,7 @@ static inline struct siw_srq *srq_base2siw(struct ibv_srq *base)
 
 static inline int siw_db(struct siw_qp *qp)
 {
-	int rv = write(qp->base_qp.context->cmd_fd, &qp->db_req,
+	int rv = write(qp->base_qp.qp.context->cmd_fd, &qp->db_req,
 		       sizeof(qp->db_req));
 
 	return rv == sizeof(qp->db_req) ? 0 : rv;
@@ -236,6 +236,7 @@ Device-specific plug-in ibverbs userspace drivers are included:
 - libhns: HiSilicon Hip08+ SoC
 - libipathverbs: QLogic InfiniPath HCA
 - libirdma: Intel Ethernet Connection RDMA
+- libloopback: Verbs devices emulated in userspace
 - libmana: Microsoft Azure Network Adapter
 - libmlx4: Mellanox ConnectX-3 InfiniBand HCA
 - libmlx5: Mellanox Connect-IB/X-4+ InfiniBand HCA
@@ -706,6 +707,7 @@ done
 %doc %{_docdir}/%{name}-%{version}/libibverbs.md
 %doc %{_docdir}/%{name}-%{version}/rxe.md
 %doc %{_docdir}/%{name}-%{version}/tag_matching.md
+%{_mandir}/man7/loopback*
 %{_mandir}/man7/rxe*
 
 %files -n libibnetdisc%{ibnetdisc_major}
@@ -742,8 +744,10 @@ done
 %files -n ibacm
 %config(noreplace) %{_sysconfdir}/rdma/ibacm_opts.cfg
 %{_bindir}/ib_acme
+%{_bindir}/ib_acmload
 %{_sbindir}/ibacm
 %{_mandir}/man1/ib_acme.*
+%{_mandir}/man1/ib_acmload.*
 %{_mandir}/man7/ibacm.*
 %{_mandir}/man7/ibacm_prov.*
 %{_mandir}/man8/ibacm.*
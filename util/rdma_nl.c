@@ -49,6 +49,8 @@ struct nla_policy rdmanl_policy[RDMA_NLDEV_ATTR_MAX] = {
 	[RDMA_NLDEV_ATTR_DEV_PROTOCOL] = { .type = NLA_NUL_STRING },
 #endif /* NLA_NUL_STRING */
 	[RDMA_NLDEV_SYS_ATTR_COPY_ON_FORK] = { .type = NLA_U8 },
+	[RDMA_NLDEV_ATTR_EVENT_TYPE] = { .type = NLA_U8 },
+	[RDMA_NLDEV_SYS_ATTR_MONITOR_MODE] = { .type = NLA_U8 },
 };
 
 static int rdmanl_saw_err_cb(struct sockaddr_nl *nla, struct nlmsgerr *nlerr,
@@ -77,8 +79,8 @@ struct nl_sock *rdmanl_socket_alloc(void)
 	return nl;
 }
 
-int rdmanl_get_copy_on_fork(struct nl_sock *nl, nl_recvmsg_msg_cb_t cb_func,
-			    void *data)
+int rdmanl_get_sys(struct nl_sock *nl, nl_recvmsg_msg_cb_t cb_func,
+		   void *data)
 {
 	bool failed = false;
 	int ret;